@@ -187,4 +187,6 @@ public:
 	virtual size_t GetLength(THandle handle) override;
 
 	virtual size_t GetLength(const std::string& fileName) override;
+
+	virtual bool GetContentHash(const std::string& fileName, std::string* hashString) override;
 };
\ No newline at end of file
@@ -341,6 +341,19 @@ size_t ResourceCacheDevice::GetLength(const std::string& fileName)
 	return -1;
 }
 
+bool ResourceCacheDevice::GetContentHash(const std::string& fileName, std::string* hashString)
+{
+	auto entry = GetEntryForFileName(fileName);
+
+	if (entry)
+	{
+		*hashString = entry->referenceHash;
+		return true;
+	}
+
+	return false;
+}
+
 void ResourceCacheDevice::SetPathPrefix(const std::string& pathPrefix)
 {
 	m_pathPrefix = pathPrefix;
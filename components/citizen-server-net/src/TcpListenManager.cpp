@@ -26,8 +26,14 @@ namespace fx
 
 	TcpListenManager::TcpListenManager(const boost::property_tree::ptree& pt)
 	{
-		// initialize a TCP stack
-		m_tcpStack = new net::TcpServerManager();
+		// initialize a TCP stack, optionally sharding listeners across multiple threads
+		int listenThreads = pt.get<int>("server.listenThreads", 1);
+
+		m_tcpStack = new net::TcpServerManager("default", listenThreads);
+
+		// connection timeouts, in milliseconds
+		m_tcpStack->SetFirstByteTimeout(pt.get<uint32_t>("server.firstByteTimeout", m_tcpStack->GetFirstByteTimeout()));
+		m_tcpStack->SetIdleTimeout(pt.get<uint32_t>("server.idleTimeout", m_tcpStack->GetIdleTimeout()));
 
 		// for each defined endpoint
 		for (auto& child : pt.get_child("server.endpoints"))
@@ -41,15 +41,7 @@ void ShellService::Initialize(fwRefContainer<net::MultiplexTcpServer> serverHost
 
 	m_serverHost = serverHost;
 
-	m_server = serverHost->CreateServer([] (const std::vector<uint8_t>& data)
-	{
-		if (data.size() < 5)
-		{
-			return net::MultiplexPatternMatchResult::InsufficientData;
-		}
-
-		return ((memcmp(&data[0], "SSH-2", 5) == 0) ? net::MultiplexPatternMatchResult::Match : net::MultiplexPatternMatchResult::NoMatch);
-	});
+	m_server = serverHost->CreateServer(std::vector<std::string>{ "SSH-2" });
 
 	m_server->SetConnectionCallback(std::bind(&ShellService::OnConnected, this, std::placeholders::_1));
 }
@@ -7,6 +7,8 @@
 
 #pragma once
 
+#include "NetBuffer.h"
+
 namespace net
 {
 class
@@ -19,5 +21,12 @@ public:
 	virtual ~DatagramSink() {}
 
 	virtual void WritePacket(const std::vector<uint8_t>& packet) = 0;
+
+	// passes a packet that may be a slice of a larger one - this copies it out, so sinks that can consume slices directly
+	// should override it
+	virtual void WritePacket(const Buffer& packet)
+	{
+		WritePacket(packet.ToVector());
+	}
 };
 }
\ No newline at end of file
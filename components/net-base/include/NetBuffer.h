@@ -8,13 +8,30 @@
 #pragma once
 
 #include <memory>
+#include <vector>
 
 namespace net
 {
-class Buffer
+// a byte buffer with a read/write cursor
+//
+// buffers may be slices - views of a range of another buffer's storage, sharing it rather than copying. copies of a
+// buffer share its storage too, so writes to any of them show in all of them. growing a slice moves it into storage of
+// its own first, unless it's the last one referencing its storage.
+class
+#ifdef COMPILING_NET_BASE
+	DLL_EXPORT
+#endif
+	Buffer
 {
 private:
 	std::shared_ptr<std::vector<uint8_t>> m_bytes;
+
+	// the range of the storage this buffer covers - a length of WholeLength follows the storage's size, as it may grow
+	size_t m_offset;
+	size_t m_length;
+
+	static const size_t WholeLength = SIZE_MAX;
+
 	size_t m_curOff;
 
 	bool m_end;
@@ -22,6 +39,9 @@ private:
 private:
 	void Initialize();
 
+	// gives the buffer storage of its own, holding just its range
+	void Detach();
+
 protected:
 	void EnsureWritableSize(size_t length);
 
@@ -41,6 +61,12 @@ public:
 	Buffer(const std::vector<uint8_t>& origBytes);
 	Buffer(size_t length);
 
+	// adopts an existing allocation, without copying it
+	Buffer(std::vector<uint8_t>&& origBytes);
+
+	// a view of part of shared storage
+	Buffer(const std::shared_ptr<std::vector<uint8_t>>& bytes, size_t offset, size_t length);
+
 	Buffer(const Buffer& other);
 
 	bool IsAtEnd() const;
@@ -65,16 +91,26 @@ public:
 
 	bool ReadTo(Buffer& other, size_t length);
 
+	// a slice of the given range, clamped to this buffer - with its cursor at the start. unlike ReadTo, this shares the
+	// storage instead of copying from it.
+	Buffer Slice(size_t offset, size_t length) const;
+
 	inline void Reset()
 	{
 		m_curOff = 0;
 	}
 
-	inline const uint8_t* GetBuffer() const { return &(*m_bytes)[0]; }
-	inline size_t GetLength() const { return m_bytes->size(); }
+	inline const uint8_t* GetBuffer() const { return m_bytes->data() + m_offset; }
+	inline size_t GetLength() const { return (m_length == WholeLength) ? m_bytes->size() - m_offset : m_length; }
 	inline size_t GetCurOffset() const { return m_curOff; }
 	inline size_t GetRemainingBytes() const { return GetLength() - GetCurOffset(); }
 
-	inline const std::vector<uint8_t>& GetData() const { return *m_bytes; }
+	// whether this covers all of its storage, which GetData can then return as-is
+	inline bool IsWhole() const { return (m_offset == 0 && (m_length == WholeLength || m_length == m_bytes->size())); }
+
+	// the data as a vector - slices get moved into storage of their own for this, so prefer GetBuffer where possible
+	const std::vector<uint8_t>& GetData();
+
+	std::vector<uint8_t> ToVector() const;
 };
 }
\ No newline at end of file
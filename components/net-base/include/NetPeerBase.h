@@ -13,6 +13,8 @@
 #include <SequencedInputDatagramChannel.h>
 #include <SequencedOutputDatagramChannel.h>
 
+#include <unordered_map>
+
 // A network peer management base using a high-level type-framed protocol.
 namespace net
 {
@@ -30,7 +32,7 @@ private:
 
 private:
 	template<typename TContainer, typename TReceiver>
-	void AddTo(const TContainer& container, const TReceiver& receiver)
+	void AddTo(const TContainer& container, const TReceiver& receiver) const
 	{
 		for (auto&& entry : container)
 		{
@@ -40,19 +42,19 @@ private:
 
 public:
 	template<typename TReceiver>
-	void AddProcessors(const TReceiver& receiver)
+	void AddProcessors(const TReceiver& receiver) const
 	{
 		AddTo(m_processors, receiver);
 	}
 
 	template<typename TReceiver>
-	void AddHandlers(const TReceiver& receiver)
+	void AddGenerators(const TReceiver& receiver) const
 	{
-		AddTo(m_handlers, receiver);
+		AddTo(m_generators, receiver);
 	}
 
 	template<typename TReceiver>
-	void AddComponents(const TReceiver& receiver)
+	void AddComponents(const TReceiver& receiver) const
 	{
 		AddTo(m_components, receiver);
 	}
@@ -73,12 +75,14 @@ public:
 		uint32_t nameHash = RegisterType<TProcess>(name, processor);
 
 		m_generators.insert(std::make_pair(nameHash, std::function<void(PeerBase*, Buffer&)>(generator)));
+
+		return nameHash;
 	}
 
 	template<typename TComponent, typename... TArgs>
 	void RegisterComponent(TArgs... args)
 	{
-		m_components.push_back(std::make_pair(Instance<TComponent>::GetName(), new TComponent(Args...)));
+		m_components.push_back(std::make_pair(Instance<TComponent>::GetName(), fwRefContainer<fwRefCountable>(new TComponent(args...))));
 	}
 };
 
@@ -95,6 +99,8 @@ public:
 
 	}
 
+	using DatagramSink::WritePacket;
+
 	virtual void WritePacket(const std::vector<uint8_t>& packet) override
 	{
 		m_function(packet);
@@ -111,26 +117,77 @@ public:
 	}
 };
 
+// a sink taking packets as buffers, so slices get passed through without being copied
+class FunctionBufferDatagramSink : public DatagramSink
+{
+private:
+	std::function<void(const Buffer&)> m_function;
+
+public:
+	FunctionBufferDatagramSink(const std::function<void(const Buffer&)>& function)
+		: m_function(function)
+	{
+
+	}
+
+	virtual void WritePacket(const std::vector<uint8_t>& packet) override
+	{
+		m_function(Buffer(packet));
+	}
+
+	virtual void WritePacket(const Buffer& packet) override
+	{
+		m_function(packet);
+	}
+};
+
+// messages start with the type as a compressed index, which the sending peer assigns in a mapping packet. index 1 is
+// the mapping packet itself, and types without an index get sent as -1 followed by their full hash.
+//
+// as packets may get lost, indices only get used once the remote acknowledged the mapping they're from - until then,
+// types keep getting sent with their hash, and the mapping gets sent again every so often.
 class PeerBase : public fwRefCountable
 {
+private:
+	// a type the remote sends, with its processor resolved when the mapping arrives
+	struct MessageSlot
+	{
+		uint32_t type;
+
+		const NetProcessor* processor;
+	};
+
 private:
 	fwRefContainer<DatagramSink> m_outSink;
 
-	fwRefContainer<FunctionDatagramSink> m_inSink;
+	fwRefContainer<FunctionBufferDatagramSink> m_inSink;
 
 	fwRefContainer<SequencedInputDatagramChannel> m_inputChannel;
 
 	fwRefContainer<SequencedOutputDatagramChannel> m_outputChannel;
 
-	std::map<uint32_t, NetProcessor> m_processors;
+	// by type hash - dispatching messages sent without an index needs a lookup in here
+	std::unordered_map<uint32_t, NetProcessor> m_processors;
 
-	std::map<uint32_t, NetGenerator> m_generators;
+	std::unordered_map<uint32_t, NetGenerator> m_generators;
+
+	// mapping of full to shorthand packet types (local to remote), as acknowledged by the remote
+	std::unordered_map<uint32_t, int> m_localToRemoteMapping;
+
+	// the mapping last sent, which replaces the above once acknowledged
+	std::unordered_map<uint32_t, int> m_pendingMapping;
 
-	// mapping of shorthand to full packet types (local to remote)
-	std::map<uint32_t, int> m_localToRemoteMapping;
+	uint32_t m_mappingId;
 
-	// mapping of shorthand to full packet types (remote to local)
-	std::map<int, uint32_t> m_remoteToLocalMapping;
+	bool m_mappingPending;
+
+	Buffer m_mappingPacket;
+
+	// messages sent with their hash since the mapping got sent last
+	int m_unmappedMessages;
+
+	// the packet types the remote sends, by shorthand - messages get dispatched through this directly
+	std::vector<MessageSlot> m_remoteSlots;
 
 	fwRefContainer<RefInstanceRegistry> m_components;
 
@@ -139,17 +196,32 @@ private:
 private:
 	void RegisterHandlerInternal(const PeerHandler& trait);
 
-	void ProcessEncapsulatedPacket(const std::vector<uint8_t>& buffer);
+	void ProcessEncapsulatedPacket(const Buffer& buffer);
 
 	void ProcessMappingPacket(Buffer& buffer);
 
+	void ProcessMappingAck(Buffer& buffer);
+
 	int ReadCompressedType(Buffer& buffer);
 
+	void WriteCompressedType(Buffer& buffer, int type);
+
+	// points the remote's types at our processors, after either changed
+	void ResolveRemoteSlots();
+
 public:
 	PeerBase(const fwRefContainer<DatagramSink>& outSink);
 
 	void ProcessPacket(const std::vector<uint8_t>& buffer);
 
+	void ProcessPacket(const Buffer& buffer);
+
+	// assigns indices to the packet types we know, and tells the remote about them
+	void SendMappingPacket();
+
+	// sends a message, using the type's index if the remote got told about one
+	void SendNetMessage(uint32_t type, const Buffer& payload);
+
 	template<typename HandlerType>
 	void RegisterHandler()
 	{
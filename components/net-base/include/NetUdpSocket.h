@@ -9,9 +9,30 @@
 
 #include <NetBase.h>
 #include <NetAddress.h>
+#include <NetBuffer.h>
 
 namespace net
 {
+// a datagram for the batched send/receive functions - the data is owned by the caller, e.g. taken from a pool
+struct UdpDatagram
+{
+	uint8_t* data;
+
+	// the size of the buffer `data` points to, when receiving
+	size_t capacity;
+
+	// the size of the datagram itself
+	size_t length;
+
+	PeerAddress address;
+
+	UdpDatagram()
+		: data(nullptr), capacity(0), length(0)
+	{
+
+	}
+};
+
 class
 #ifdef COMPILING_NET_BASE
 	DLL_EXPORT
@@ -43,6 +64,19 @@ public:
 
 	boost::optional<std::vector<uint8_t>> ReceiveFrom(size_t size, PeerAddress* outAddress);
 
+	// receives a datagram of up to `size` bytes into storage from the packet buffer pool
+	bool ReceiveFrom(size_t size, Buffer* outBuffer, PeerAddress* outAddress);
+
 	bool SendTo(const std::vector<uint8_t>& data, const PeerAddress& outAddress);
+
+	// receives up to `count` datagrams into the buffers given, waiting for the first one if the socket is blocking, and
+	// returns how many got received - datagrams larger than their buffer get truncated, like with ReceiveFrom
+	//
+	// this uses recvmmsg where available, so a full batch takes a single syscall.
+	size_t ReceiveBatch(UdpDatagram* datagrams, size_t count);
+
+	// sends datagrams in order, returning how many got sent - fewer than `count` if the send buffer filled up, or a send
+	// failed, in which case the rest can be retried later
+	size_t SendBatch(const UdpDatagram* datagrams, size_t count);
 };
 }
\ No newline at end of file
@@ -0,0 +1,69 @@
+/*
+ * This file is part of the CitizenFX project - http://citizen.re/
+ *
+ * See LICENSE and MENTIONS in the root of the source tree for information
+ * regarding licensing.
+ */
+
+#pragma once
+
+#include "NetBuffer.h"
+
+namespace net
+{
+struct PacketBufferPoolStatistics
+{
+	// buffers handed out, and how many of those got reused rather than allocated
+	uint64_t acquires;
+
+	uint64_t hits;
+
+	// requests larger than the largest size class, which always get allocated (and aren't counted in acquires)
+	uint64_t oversized;
+
+	// buffers handed out and not released yet, and the most there ever were at once
+	uint64_t inUse;
+
+	uint64_t peakInUse;
+
+	// free buffers held by the pools of all threads
+	uint64_t cachedBuffers;
+
+	uint64_t cachedBytes;
+
+	PacketBufferPoolStatistics()
+		: acquires(0), hits(0), oversized(0), inUse(0), peakInUse(0), cachedBuffers(0), cachedBytes(0)
+	{
+
+	}
+
+	inline double GetHitRate() const
+	{
+		return (acquires) ? static_cast<double>(hits) / acquires : 0.0;
+	}
+};
+
+// size-classed pools of packet storage, one per thread
+//
+// storage comes from the calling thread's pool, and goes back to the pool of whichever thread drops the last reference
+// to it - so once the pools are warm, packets get processed without any heap allocations. packets that get handed off to
+// another thread for good end up in that thread's pool, though, so a thread only producing packets never gets any back.
+class
+#ifdef COMPILING_NET_BASE
+	DLL_EXPORT
+#endif
+	PacketBufferPool
+{
+public:
+	// storage of `length` bytes - its contents are left over from its last use
+	static std::shared_ptr<std::vector<uint8_t>> AcquireStorage(size_t length);
+
+	// a buffer of `length` bytes backed by pooled storage
+	static Buffer Acquire(size_t length);
+
+	// a pooled copy of some data
+	static Buffer Acquire(const uint8_t* data, size_t length);
+
+	static PacketBufferPoolStatistics GetStatistics();
+};
+}
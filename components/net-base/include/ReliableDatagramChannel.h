@@ -0,0 +1,317 @@
+/*
+ * This file is part of the CitizenFX project - http://citizen.re/
+ *
+ * See LICENSE and MENTIONS in the root of the source tree for information
+ * regarding licensing.
+ */
+
+#pragma once
+
+#include "DatagramSink.h"
+
+#include <chrono>
+#include <deque>
+#include <map>
+
+namespace net
+{
+struct ReliableChannelStatistics
+{
+	uint64_t packetsSent;
+
+	uint64_t packetsReceived;
+
+	// packets declared lost, by acknowledgements or by the retransmission timeout
+	uint64_t packetsLost;
+
+	// lost packets that got acknowledged after all, having just been reordered
+	uint64_t spuriousLosses;
+
+	// messages sent again after their packet got lost
+	uint64_t retransmissions;
+
+	// retransmission timeouts, after which everything in flight counts as lost
+	uint64_t timeouts;
+
+	uint64_t messagesDelivered;
+
+	// packets not acknowledged, as they carried messages beyond a stream's receive window
+	uint64_t packetsRefused;
+
+	std::chrono::microseconds smoothedRtt;
+
+	std::chrono::microseconds retransmissionTimeout;
+
+	size_t congestionWindow;
+
+	size_t bytesInFlight;
+
+	ReliableChannelStatistics()
+		: packetsSent(0), packetsReceived(0), packetsLost(0), spuriousLosses(0), retransmissions(0), timeouts(0), messagesDelivered(0),
+		  packetsRefused(0), smoothedRtt(0), retransmissionTimeout(0), congestionWindow(0), bytesInFlight(0)
+	{
+
+	}
+};
+
+// a reliable channel carrying messages over an unreliable datagram path, such as a UdpSocket
+//
+// messages get sent on one of 256 streams, each of which is delivered in order - but independently of the others, so a
+// lost packet only holds up the streams it carried messages for. messages held up like that are bounded per stream and
+// in total, and packets with messages beyond those bounds don't get acknowledged. losses get detected from selective acknowledgements,
+// retransmission timeouts follow an RTT estimate (RFC 6298), and the data in flight is bounded by a NewReno congestion
+// window.
+//
+// packets are a 32-bit packet number followed by frames - every packet, retransmissions included, gets a new number,
+// so RTT samples are never ambiguous.
+class
+#ifdef COMPILING_NET_BASE
+	DLL_EXPORT
+#endif
+	ReliableDatagramChannel : public fwRefCountable
+{
+public:
+	typedef std::chrono::steady_clock::time_point TimePoint;
+
+	typedef std::function<TimePoint()> TClock;
+
+private:
+	struct StreamFrame
+	{
+		uint8_t stream;
+
+		uint32_t sequence;
+
+		Buffer data;
+	};
+
+	struct SentPacket
+	{
+		TimePoint sentTime;
+
+		size_t size;
+
+		std::vector<StreamFrame> frames;
+
+		bool ackEliciting;
+
+		// whether it got acknowledged or declared lost, which either way takes it out of flight
+		bool acked;
+
+		bool lost;
+	};
+
+	struct ReceiveStream
+	{
+		uint32_t nextSequence;
+
+		// messages received ahead of a gap, copied out of their packets
+		std::map<uint32_t, Buffer> pending;
+
+		fwRefContainer<DatagramSink> sink;
+
+		ReceiveStream()
+			: nextSequence(0)
+		{
+
+		}
+	};
+
+	struct ReceivedRange
+	{
+		uint32_t first;
+
+		uint32_t last;
+	};
+
+	struct SendStream
+	{
+		uint32_t nextSequence;
+
+		std::deque<StreamFrame> queue;
+
+		SendStream()
+			: nextSequence(0)
+		{
+
+		}
+	};
+
+private:
+	fwRefContainer<DatagramSink> m_sink;
+
+	TClock m_clock;
+
+	size_t m_maxPacketSize;
+
+	// sending
+	uint32_t m_nextPacketNumber;
+
+	// packets sent and not yet resolved, starting at m_firstSentPacket
+	std::deque<SentPacket> m_sentPackets;
+
+	uint32_t m_firstSentPacket;
+
+	std::vector<std::vector<StreamFrame>> m_spareFrameLists;
+
+	std::map<uint8_t, SendStream> m_sendStreams;
+
+	// the stream to take the next message from, for sending streams round-robin
+	uint8_t m_nextSendStream;
+
+	// messages from packets declared lost, which get sent before any new ones
+	std::deque<StreamFrame> m_retransmitQueue;
+
+	// messages in the stream queues, and in packets in flight
+	size_t m_queuedFrames;
+
+	size_t m_framesInFlight;
+
+	bool m_hasLargestAcked;
+
+	uint32_t m_largestAcked;
+
+	// how many packets behind an acknowledged one a packet needs to be to count as lost - this grows whenever a packet
+	// turns out to have been reordered further than that
+	uint32_t m_reorderThreshold;
+
+	// and likewise, extra time a packet gets on top of the RTT before counting as lost
+	std::chrono::microseconds m_reorderDelay;
+
+	TimePoint m_lastAckElicitingTime;
+
+	// when a packet not yet old enough to be declared lost will be
+	TimePoint m_lossTime;
+
+	// RTT estimation
+	std::chrono::microseconds m_smoothedRtt;
+
+	std::chrono::microseconds m_rttVariance;
+
+	std::chrono::microseconds m_latestRtt;
+
+	std::chrono::microseconds m_minRtt;
+
+	bool m_hasRttSample;
+
+	// the number of timeouts in a row, doubling the retransmission timeout each
+	int m_rtoBackoff;
+
+	// congestion control
+	size_t m_congestionWindow;
+
+	size_t m_slowStartThreshold;
+
+	size_t m_bytesInFlight;
+
+	// packets sent before this don't reduce the congestion window again
+	TimePoint m_recoveryStartTime;
+
+	// receiving
+	std::map<uint8_t, ReceiveStream> m_receiveStreams;
+
+	// the size of the messages pending on all streams
+	size_t m_pendingBytes;
+
+	// packet numbers received, highest first - only the most recent ranges get kept
+	std::vector<ReceivedRange> m_receivedRanges;
+
+	TimePoint m_largestReceivedTime;
+
+	// when an acknowledgement needs to go out - TimePoint::max() if none is owed
+	TimePoint m_ackDeadline;
+
+	int m_unackedPackets;
+
+	ReliableChannelStatistics m_statistics;
+
+private:
+	void SendPackets(TimePoint now);
+
+	bool TakeNextFrame(size_t space, StreamFrame* frame);
+
+	// returns the size of the frame written, which is 0 if there was no space for it
+	size_t WriteAckFrame(uint8_t* data, size_t space, TimePoint now);
+
+	// returns false if the frame was malformed
+	bool ProcessAckFrame(const uint8_t* data, size_t length, size_t* offset, TimePoint now);
+
+	// returns false if the frame didn't fit in the stream's receive window - its packet mustn't be acknowledged then,
+	// so the remote sends it again
+	bool ProcessStreamFrame(uint8_t stream, uint32_t sequence, const Buffer& data);
+
+	// returns false if the packet number had been received already
+	bool RecordReceived(uint32_t packetNumber);
+
+	void DetectLosses(TimePoint now);
+
+	// how long after being sent a packet counts as lost, if anything sent after it got acknowledged
+	std::chrono::microseconds GetLossDelay();
+
+	// queues a lost packet's messages for retransmission
+	void OnPacketLost(SentPacket& packet);
+
+	// halves the congestion window, unless a loss of a packet sent after the last reduction already did so
+	void OnCongestionEvent(TimePoint sentTime, TimePoint now);
+
+	void OnTimeout(TimePoint now);
+
+	void UpdateRtt(std::chrono::microseconds sample, std::chrono::microseconds ackDelay);
+
+	// drops resolved packets from the front of the sent packets - lost ones are kept for a while, in case they just got
+	// reordered and are acknowledged after all
+	void PopResolvedPackets(TimePoint now);
+
+	std::chrono::microseconds GetRetransmissionTimeout();
+
+	TimePoint GetTimeoutTime();
+
+public:
+	ReliableDatagramChannel(size_t maxPacketSize = 1200);
+
+	virtual ~ReliableDatagramChannel();
+
+	// where packets for the remote go
+	inline void SetSink(const fwRefContainer<DatagramSink>& sink)
+	{
+		m_sink = sink;
+	}
+
+	// where the messages received on a stream go, in order
+	void SetStreamSink(uint8_t stream, const fwRefContainer<DatagramSink>& sink);
+
+	// steady_clock by default - simulations may want to run on a clock of their own
+	inline void SetClock(const TClock& clock)
+	{
+		m_clock = clock;
+	}
+
+	// packet numbers wrap around, which simulations may want to get to sooner - this has to be called before anything
+	// got sent
+	inline void SetInitialPacketNumber(uint32_t packetNumber)
+	{
+		m_nextPacketNumber = packetNumber;
+		m_firstSentPacket = packetNumber;
+	}
+
+	// queues a message for reliable delivery, returning false if it's larger than GetMaxMessageSize - it gets sent on the
+	// next Update (or ProcessPacket), so messages queued together may share a packet
+	bool Send(uint8_t stream, const Buffer& message);
+
+	size_t GetMaxMessageSize();
+
+	// a packet received from the remote
+	void ProcessPacket(const Buffer& packet);
+
+	// sends queued messages and delayed acknowledgements, and handles lost packets - this needs to get called after
+	// queueing messages, and periodically, ideally as soon as GetNextTimeout passes
+	void Update();
+
+	TimePoint GetNextTimeout();
+
+	// messages queued, or sent but not acknowledged yet
+	size_t GetPendingMessages();
+
+	const ReliableChannelStatistics& GetStatistics();
+};
+}
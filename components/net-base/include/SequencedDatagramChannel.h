@@ -38,7 +38,7 @@ public:
 
 	virtual ~SequencedDatagramChannel();
 
-	inline void Reset()
+	virtual void Reset()
 	{
 		m_sequence = 0;
 	}
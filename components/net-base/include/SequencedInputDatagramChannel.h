@@ -9,17 +9,116 @@
 
 #include "SequencedDatagramChannel.h"
 
+#include <chrono>
+
 namespace net
 {
+struct SequencedInputStatistics
+{
+	// packets passed to the sink, in order
+	uint64_t delivered;
+
+	// packets that arrived after a later one, but still in time to get delivered
+	uint64_t reordered;
+
+	uint64_t duplicates;
+
+	// packets that arrived after the channel had moved past them
+	uint64_t late;
+
+	// sequences skipped without having been received
+	uint64_t lost;
+
+	uint64_t outOfBand;
+
+	SequencedInputStatistics()
+		: delivered(0), reordered(0), duplicates(0), late(0), lost(0), outOfBand(0)
+	{
+
+	}
+};
+
 class
 #ifdef COMPILING_NET_BASE
 	DLL_EXPORT
 #endif
 	SequencedInputDatagramChannel : public SequencedDatagramChannel
 {
+private:
+	struct PendingPacket
+	{
+		uint32_t sequence;
+
+		Buffer payload;
+
+		std::chrono::steady_clock::time_point arrivalTime;
+	};
+
+	// packets received ahead of a gap, sorted by sequence
+	std::vector<PendingPacket> m_pending;
+
+	size_t m_reorderPackets;
+
+	std::chrono::milliseconds m_reorderDelay;
+
+	// the highest sequence received, and a bitmap of which of the 64 sequences up to it got received
+	uint32_t m_highestSequence;
+
+	uint64_t m_receivedMask;
+
+	fwRefContainer<DatagramSink> m_outOfBandSink;
+
+	SequencedInputStatistics m_statistics;
+
+private:
+	// marks a sequence as received, returning false if it had been already
+	bool MarkReceived(uint32_t sequence);
+
+	void Deliver(uint32_t sequence, const Buffer& payload);
+
+	// delivers the pending packets following on the last delivered one
+	void DeliverPending();
+
+	// gives up on the sequences missing before the first pending packet
+	void SkipGap();
+
+public:
+	// the sequence marking out-of-band packets, which aren't part of the sequence
+	static const uint32_t OutOfBandSequence = 0xFFFFFFFF;
+
 public:
 	SequencedInputDatagramChannel();
 
 	void ProcessPacket(const std::vector<uint8_t>& packet);
+
+	// passes the payload on as a slice of the packet
+	void ProcessPacket(const Buffer& packet);
+
+	// buffers packets arriving ahead of a gap - until `maxPackets` are waiting, or one of them has waited for `maxDelay` -
+	// so that slightly reordered packets still get delivered in order. with a window of 0 packets (the default) packets
+	// get delivered right away, skipping any gap.
+	void SetReorderWindow(size_t maxPackets, std::chrono::milliseconds maxDelay);
+
+	// delivers the packets whose wait timed out, skipping the gaps before them - timeouts only get checked as packets
+	// arrive otherwise, so this should get called periodically while packets are pending
+	void ProcessTimeouts();
+
+	inline bool HasPendingPackets()
+	{
+		return !m_pending.empty();
+	}
+
+	// out-of-band packets get passed straight to this sink, or the regular one if none is set
+	inline void SetOutOfBandSink(const fwRefContainer<DatagramSink>& sink)
+	{
+		m_outOfBandSink = sink;
+	}
+
+	inline const SequencedInputStatistics& GetStatistics()
+	{
+		return m_statistics;
+	}
+
+	virtual void Reset() override;
 };
 }
\ No newline at end of file
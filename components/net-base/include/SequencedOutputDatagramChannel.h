@@ -17,9 +17,17 @@ class
 #endif
 	SequencedOutputDatagramChannel : public SequencedDatagramChannel
 {
+private:
+	void WriteData(uint32_t sequence, const uint8_t* data, size_t length);
+
 public:
 	SequencedOutputDatagramChannel();
 
 	void WritePacket(const std::vector<uint8_t>& packet);
+
+	void WritePacket(const Buffer& packet);
+
+	// writes a packet outside of the sequence, which the receiving side passes on as soon as it arrives
+	void WriteOutOfBandPacket(const Buffer& packet);
 };
 }
\ No newline at end of file
@@ -7,6 +7,7 @@
 
 #include "StdInc.h"
 #include "ConcatPipe.h"
+#include "PacketBufferPool.h"
 
 namespace net
 {
@@ -30,13 +31,11 @@ void ConcatInputPipe::PassPacket(Buffer data)
 	// verify length
 	if (data.GetRemainingBytes() >= firstLength)
 	{
-		// create arrays for both first and second
-		Buffer firstData(firstLength);
-		Buffer secondData(data.GetRemainingBytes() - firstLength);
+		// slice both first and second out of the packet, without copying
+		size_t offset = data.GetCurOffset();
 
-		// write data to both arrays
-		data.ReadTo(firstData, firstData.GetLength());
-		data.ReadTo(secondData, secondData.GetLength());
+		Buffer firstData = data.Slice(offset, firstLength);
+		Buffer secondData = data.Slice(offset + firstLength, data.GetRemainingBytes() - firstLength);
 
 		// pass to both pipes
 		m_pipe1->PassPacket(firstData);
@@ -65,7 +64,7 @@ void ConcatOutputPipe::PassPacket(Buffer data)
 	}
 	else
 	{
-		Buffer outPacket(m_savedFirst.GetLength() + data.GetLength() + 2);
+		Buffer outPacket = PacketBufferPool::Acquire(m_savedFirst.GetLength() + data.GetLength() + 2);
 
 		outPacket.Write<uint16_t>(m_savedFirst.GetLength());
 
@@ -21,9 +21,7 @@ Buffer::Buffer(const uint8_t* bytes, size_t length)
 {
 	Initialize();
 
-	m_bytes = std::make_shared<std::vector<uint8_t>>(length);
-
-	memcpy(&(*m_bytes)[0], bytes, m_bytes->size());
+	m_bytes = std::make_shared<std::vector<uint8_t>>(bytes, bytes + length);
 }
 
 Buffer::Buffer(const std::vector<uint8_t>& origBytes)
@@ -40,35 +38,69 @@ Buffer::Buffer(size_t length)
 	m_bytes = std::make_shared<std::vector<uint8_t>>(length);
 }
 
+Buffer::Buffer(std::vector<uint8_t>&& origBytes)
+{
+	Initialize();
+
+	m_bytes = std::make_shared<std::vector<uint8_t>>(std::move(origBytes));
+}
+
+Buffer::Buffer(const std::shared_ptr<std::vector<uint8_t>>& bytes, size_t offset, size_t length)
+{
+	Initialize();
+
+	m_bytes = bytes;
+
+	// clamp the range to the storage
+	m_offset = std::min(offset, bytes->size());
+	m_length = std::min(length, bytes->size() - m_offset);
+}
+
 Buffer::Buffer(const Buffer& other)
 {
 	m_curOff = 0;
 	m_end = false;
 
 	m_bytes = other.GetBytes();
+	m_offset = other.m_offset;
+	m_length = other.m_length;
 }
 
 void Buffer::Initialize()
 {
+	m_offset = 0;
+	m_length = WholeLength;
+
 	m_curOff = 0;
 	m_end = false;
 }
 
+void Buffer::Detach()
+{
+	const uint8_t* start = GetBuffer();
+
+	m_bytes = std::make_shared<std::vector<uint8_t>>(start, start + GetLength());
+	m_offset = 0;
+	m_length = WholeLength;
+}
+
 bool Buffer::Read(void* buffer, size_t length)
 {
-	if ((m_curOff + length) >= m_bytes->size())
+	size_t size = GetLength();
+
+	if ((m_curOff + length) >= size)
 	{
 		m_end = true;
 
 		// and if it really doesn't fit out of our buffer
-		if ((m_curOff + length) > m_bytes->size())
+		if ((m_curOff + length) > size)
 		{
-			memset(buffer, 0xCE, sizeof(length));
+			memset(buffer, 0xCE, length);
 			return false;
 		}
 	}
 
-	memcpy(buffer, &(*m_bytes)[m_curOff], length);
+	memcpy(buffer, GetBuffer() + m_curOff, length);
 	m_curOff += length;
 
 	return true;
@@ -76,42 +108,79 @@ bool Buffer::Read(void* buffer, size_t length)
 
 void Buffer::EnsureWritableSize(size_t length)
 {
-	if ((m_curOff + length) >= m_bytes->size())
+	size_t size = GetLength();
+
+	if ((m_curOff + length) <= size)
 	{
-		m_bytes->resize(m_curOff + length);
+		return;
 	}
+
+	if (m_length != WholeLength)
+	{
+		// growing a slice in place would overwrite whatever follows it, or show in other buffers sharing the storage
+		if (m_offset + m_length != m_bytes->size() || m_bytes.use_count() != 1)
+		{
+			Detach();
+		}
+		else
+		{
+			m_length = WholeLength;
+		}
+	}
+
+	m_bytes->resize(m_offset + m_curOff + length);
 }
 
 void Buffer::Write(const void* buffer, size_t length)
 {
 	EnsureWritableSize(length);
 
-	memcpy(&(*m_bytes)[m_curOff], buffer, length);
+	memcpy(m_bytes->data() + m_offset + m_curOff, buffer, length);
 	m_curOff += length;
 }
 
 bool Buffer::ReadTo(Buffer& other, size_t length)
 {
-	other.EnsureWritableSize(length);
-
-	if ((m_curOff + length) > m_bytes->size())
+	if ((m_curOff + length) > GetLength())
 	{
 		return false;
 	}
 
-	auto bytes = GetBytes();
-	auto otherBytes = other.GetBytes();
-
-	memcpy(&(*otherBytes)[other.GetCurOffset()], &(*bytes)[GetCurOffset()], length);
+	other.Write(GetBuffer() + m_curOff, length);
 
 	m_curOff += length;
-	other.m_curOff += length; // ugly :(
 
 	return true;
 }
 
+Buffer Buffer::Slice(size_t offset, size_t length) const
+{
+	size_t size = GetLength();
+
+	offset = std::min(offset, size);
+
+	return Buffer(m_bytes, m_offset + offset, std::min(length, size - offset));
+}
+
+const std::vector<uint8_t>& Buffer::GetData()
+{
+	if (!IsWhole())
+	{
+		Detach();
+	}
+
+	return *m_bytes;
+}
+
+std::vector<uint8_t> Buffer::ToVector() const
+{
+	const uint8_t* start = GetBuffer();
+
+	return std::vector<uint8_t>(start, start + GetLength());
+}
+
 bool Buffer::IsAtEnd() const
 {
-	return (m_end || m_curOff == m_bytes->size());
+	return (m_end || m_curOff == GetLength());
 }
 }
\ No newline at end of file
@@ -7,25 +7,61 @@
 
 #include "StdInc.h"
 #include "NetPeerBase.h"
+#include "PacketBufferPool.h"
+
+#include <algorithm>
 
 namespace net
 {
+// sent as a message without an index, followed by the id of the mapping it acknowledges
+static const uint32_t g_mappingAckType = HashRageString("msgPeerMappingAck");
+
+// how many messages get sent with their hash before an unacknowledged mapping gets sent again
+static const int g_mappingResendInterval = 32;
+
 PeerBase::PeerBase(const fwRefContainer<DatagramSink>& outSink)
-	: m_outSink(outSink), m_inputChannel(new SequencedInputDatagramChannel()), m_outputChannel(new SequencedOutputDatagramChannel()), m_components(new RefInstanceRegistry())
+	: m_outSink(outSink), m_inputChannel(new SequencedInputDatagramChannel()), m_outputChannel(new SequencedOutputDatagramChannel()),
+	  m_mappingId(0), m_mappingPending(false), m_unmappedMessages(0), m_components(new RefInstanceRegistry())
 {
-	m_inSink = new FunctionDatagramSink([=] (const std::vector<uint8_t>& packet)
+	m_inSink = new FunctionBufferDatagramSink([=] (const Buffer& packet)
 	{
 		return ProcessEncapsulatedPacket(packet);
 	});
 
+	m_inputChannel->SetSink(m_inSink);
 	m_outputChannel->SetSink(outSink);
 }
 
+void PeerBase::RegisterHandlerInternal(const PeerHandler& trait)
+{
+	trait.AddProcessors([&] (uint32_t type, const NetProcessor& processor)
+	{
+		m_processors[type] = processor;
+	});
+
+	trait.AddGenerators([&] (uint32_t type, const NetGenerator& generator)
+	{
+		m_generators[type] = generator;
+	});
+
+	trait.AddComponents([&] (const char* name, const fwRefContainer<fwRefCountable>& component)
+	{
+		m_components->SetInstance(name, component);
+	});
+
+	ResolveRemoteSlots();
+}
+
 void PeerBase::ProcessPacket(const std::vector<uint8_t>& buffer)
 {
 	m_inputChannel->ProcessPacket(buffer);
 }
 
+void PeerBase::ProcessPacket(const Buffer& buffer)
+{
+	m_inputChannel->ProcessPacket(buffer);
+}
+
 int PeerBase::ReadCompressedType(Buffer& buffer)
 {
 	uint8_t lead = buffer.Read<uint8_t>();
@@ -40,28 +76,91 @@ int PeerBase::ReadCompressedType(Buffer& buffer)
 		result = buffer.Read<uint8_t>() << 7;
 		result |= (lead & ~0x80);
 	}
+	else
+	{
+		result = lead;
+	}
 
 	return result;
 }
 
-void PeerBase::ProcessEncapsulatedPacket(const std::vector<uint8_t>& buffer)
+void PeerBase::WriteCompressedType(Buffer& buffer, int type)
+{
+	if (type < 0)
+	{
+		buffer.Write<uint8_t>(0);
+	}
+	else if (type < 0x80)
+	{
+		buffer.Write<uint8_t>(type);
+	}
+	else
+	{
+		buffer.Write<uint8_t>((type & 0x7F) | 0x80);
+		buffer.Write<uint8_t>(type >> 7);
+	}
+}
+
+void PeerBase::ProcessEncapsulatedPacket(const Buffer& buffer)
 {
 	Buffer netBuffer(buffer);
 
-	// if we don't have a list of remote trusted packets, only expect such
-	if (m_remoteToLocalMapping.empty())
+	int type = ReadCompressedType(netBuffer);
+
+	if (type == 1)
+	{
+		ProcessMappingPacket(netBuffer);
+	}
+	else if (type > 1)
 	{
-		int type = ReadCompressedType(netBuffer);
+		// the fast path - a type the remote told us about, dispatched by index
+		if (static_cast<size_t>(type) < m_remoteSlots.size() && m_remoteSlots[type].processor)
+		{
+			(*m_remoteSlots[type].processor)(this, netBuffer);
+		}
+		else if (static_cast<size_t>(type) < m_remoteSlots.size() && m_remoteSlots[type].type != 0)
+		{
+			trace("Peer %s sent mapped type 0x%08x, but we don't know to handle it.\n", GetName().c_str(), m_remoteSlots[type].type);
+		}
+		else
+		{
+			trace("Peer %s sent unmapped type index %d.\n", GetName().c_str(), type);
+		}
+	}
+	else if (type == -1)
+	{
+		uint32_t fullType = netBuffer.Read<uint32_t>();
+
+		if (fullType == g_mappingAckType)
+		{
+			ProcessMappingAck(netBuffer);
+			return;
+		}
+
+		auto it = m_processors.find(fullType);
 
-		if (type == 1)
+		if (it == m_processors.end())
 		{
-			ProcessMappingPacket(netBuffer);
+			trace("Peer %s sent unknown type 0x%08x.\n", GetName().c_str(), fullType);
+			return;
 		}
+
+		it->second(this, netBuffer);
 	}
 }
 
 void PeerBase::ProcessMappingPacket(Buffer& buffer)
 {
+	uint32_t mappingId;
+
+	if (!buffer.Read(&mappingId, sizeof(mappingId)))
+	{
+		return;
+	}
+
+	// the mapping replaces any earlier one as a whole
+	m_remoteSlots.clear();
+
 	// while the packet type isn't -1
 	int type;
 
@@ -71,15 +170,156 @@ void PeerBase::ProcessMappingPacket(Buffer& buffer)
 
 		if (type >= 0)
 		{
-			uint32_t mappedType = buffer.Read<uint32_t>();
+			uint32_t mappedType;
+
+			if (!buffer.Read(&mappedType, sizeof(mappedType)))
+			{
+				break;
+			}
 
 			if (m_processors.find(mappedType) == m_processors.end())
 			{
 				trace("Peer %s knows to send mapped type 0x%08x, but we don't know to handle it...\n", GetName().c_str(), mappedType);
 			}
 
-			m_remoteToLocalMapping[type] = mappedType;
+			if (static_cast<size_t>(type) >= m_remoteSlots.size())
+			{
+				m_remoteSlots.resize(type + 1, MessageSlot{ 0, nullptr });
+			}
+
+			m_remoteSlots[type].type = mappedType;
 		}
-	} while (type >= 0);
+	} while (type >= 0 && !buffer.IsAtEnd());
+
+	ResolveRemoteSlots();
+
+	// let the remote start using the indices - this goes for resent mappings too, in case the ack got lost
+	Buffer ackPacket;
+	WriteCompressedType(ackPacket, -1);
+	ackPacket.Write<uint32_t>(g_mappingAckType);
+	ackPacket.Write<uint32_t>(mappingId);
+
+	m_outputChannel->WritePacket(ackPacket);
+}
+
+void PeerBase::ProcessMappingAck(Buffer& buffer)
+{
+	uint32_t mappingId;
+
+	if (!buffer.Read(&mappingId, sizeof(mappingId)))
+	{
+		return;
+	}
+
+	// acks for older mappings don't say anything about the current one
+	if (!m_mappingPending || mappingId != m_mappingId)
+	{
+		return;
+	}
+
+	m_localToRemoteMapping = std::move(m_pendingMapping);
+	m_pendingMapping.clear();
+
+	m_mappingPending = false;
+	m_mappingPacket = Buffer();
+}
+
+void PeerBase::ResolveRemoteSlots()
+{
+	for (auto& slot : m_remoteSlots)
+	{
+		auto it = m_processors.find(slot.type);
+
+		// pointers to elements of an unordered_map stay valid until they get erased
+		slot.processor = (it != m_processors.end()) ? &it->second : nullptr;
+	}
+}
+
+void PeerBase::SendMappingPacket()
+{
+	// every type we know, in a stable order
+	std::vector<uint32_t> types;
+
+	for (auto& entry : m_processors)
+	{
+		types.push_back(entry.first);
+	}
+
+	for (auto& entry : m_generators)
+	{
+		if (m_processors.find(entry.first) == m_processors.end())
+		{
+			types.push_back(entry.first);
+		}
+	}
+
+	std::sort(types.begin(), types.end());
+
+	// 0 is taken by the end marker, and 1 by the mapping packet itself
+	Buffer mappingPacket;
+	WriteCompressedType(mappingPacket, 1);
+
+	m_mappingId++;
+	mappingPacket.Write<uint32_t>(m_mappingId);
+
+	// the remote drops the indices it knew as soon as the new mapping arrives, so none get used until it acknowledged that
+	m_localToRemoteMapping.clear();
+	m_pendingMapping.clear();
+
+	int nextIndex = 2;
+
+	for (uint32_t type : types)
+	{
+		// the largest index a compressed type can hold
+		if (nextIndex > 0x7FFF)
+		{
+			break;
+		}
+
+		m_pendingMapping[type] = nextIndex;
+
+		WriteCompressedType(mappingPacket, nextIndex);
+		mappingPacket.Write<uint32_t>(type);
+
+		nextIndex++;
+	}
+
+	WriteCompressedType(mappingPacket, -1);
+
+	m_mappingPending = true;
+	m_mappingPacket = mappingPacket;
+	m_unmappedMessages = 0;
+
+	m_outputChannel->WritePacket(mappingPacket);
+}
+
+void PeerBase::SendNetMessage(uint32_t type, const Buffer& payload)
+{
+	// room for the longest header
+	Buffer packet = PacketBufferPool::Acquire(payload.GetLength() + 5);
+
+	auto it = m_localToRemoteMapping.find(type);
+
+	if (it != m_localToRemoteMapping.end())
+	{
+		WriteCompressedType(packet, it->second);
+	}
+	else
+	{
+		WriteCompressedType(packet, -1);
+		packet.Write<uint32_t>(type);
+
+		// the mapping (or its ack) may have been lost
+		if (m_mappingPending && ++m_unmappedMessages >= g_mappingResendInterval)
+		{
+			m_unmappedMessages = 0;
+
+			m_outputChannel->WritePacket(m_mappingPacket);
+		}
+	}
+
+	packet.Write(payload.GetBuffer(), payload.GetLength());
+
+	m_outputChannel->WritePacket(packet.Slice(0, packet.GetCurOffset()));
 }
 }
\ No newline at end of file
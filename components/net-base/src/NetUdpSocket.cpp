@@ -7,9 +7,15 @@
 
 #include "StdInc.h"
 #include "NetUdpSocket.h"
+#include "PacketBufferPool.h"
+
+#include <algorithm>
 
 namespace net
 {
+// the most datagrams passed to a single recvmmsg/sendmmsg call, bounding the stack space the headers take
+static const size_t MaxBatchSize = 64;
+
 UdpSocket::UdpSocket(AddressFamily addressFamily)
 {
 	EnsureNetInitialized();
@@ -127,6 +133,29 @@ boost::optional<std::vector<uint8_t>> UdpSocket::ReceiveFrom(size_t size, PeerAd
 	return retval;
 }
 
+bool UdpSocket::ReceiveFrom(size_t size, Buffer* outBuffer, PeerAddress* outAddress)
+{
+	UdpDatagram datagram;
+
+	auto storage = PacketBufferPool::AcquireStorage(size);
+	datagram.data = storage->data();
+	datagram.capacity = storage->size();
+
+	if (ReceiveBatch(&datagram, 1) == 0)
+	{
+		return false;
+	}
+
+	*outBuffer = Buffer(storage, 0, datagram.length);
+
+	if (outAddress)
+	{
+		*outAddress = datagram.address;
+	}
+
+	return true;
+}
+
 bool UdpSocket::SendTo(const std::vector<uint8_t>& data, const PeerAddress& outAddress)
 {
 	if (!IsValidSocket())
@@ -152,4 +181,229 @@ bool UdpSocket::SendTo(const std::vector<uint8_t>& data, const PeerAddress& outA
 
 	return true;
 }
+
+#ifdef __linux__
+size_t UdpSocket::ReceiveBatch(UdpDatagram* datagrams, size_t count)
+{
+	if (!IsValidSocket())
+	{
+		trace("Failed to receive from socket - socket is not valid.\n");
+
+		return 0;
+	}
+
+	mmsghdr headers[MaxBatchSize];
+	iovec vectors[MaxBatchSize];
+	sockaddr_storage addresses[MaxBatchSize];
+
+	size_t received = 0;
+
+	while (received < count)
+	{
+		size_t batchSize = std::min(count - received, MaxBatchSize);
+
+		for (size_t i = 0; i < batchSize; i++)
+		{
+			UdpDatagram& datagram = datagrams[received + i];
+
+			vectors[i].iov_base = datagram.data;
+			vectors[i].iov_len = datagram.capacity;
+
+			memset(&headers[i].msg_hdr, 0, sizeof(headers[i].msg_hdr));
+			headers[i].msg_hdr.msg_name = &addresses[i];
+			headers[i].msg_hdr.msg_namelen = sizeof(addresses[i]);
+			headers[i].msg_hdr.msg_iov = &vectors[i];
+			headers[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		// only wait for the very first datagram
+		int result = recvmmsg(m_socket, headers, batchSize, (received == 0) ? MSG_WAITFORONE : MSG_DONTWAIT, nullptr);
+
+		if (result <= 0)
+		{
+			int lastError = GetLastNetError();
+
+			if (result < 0 && lastError != EAGAIN)
+			{
+				trace("Failed to receive from socket - error code %d.\n", lastError);
+			}
+
+			break;
+		}
+
+		for (int i = 0; i < result; i++)
+		{
+			UdpDatagram& datagram = datagrams[received + i];
+
+			datagram.length = headers[i].msg_len;
+			datagram.address = PeerAddress(reinterpret_cast<sockaddr*>(&addresses[i]), headers[i].msg_hdr.msg_namelen);
+		}
+
+		received += result;
+
+		// nothing more is pending
+		if (static_cast<size_t>(result) < batchSize)
+		{
+			break;
+		}
+	}
+
+	return received;
+}
+
+size_t UdpSocket::SendBatch(const UdpDatagram* datagrams, size_t count)
+{
+	if (!IsValidSocket())
+	{
+		trace("Failed to send to socket - socket is not valid.\n");
+
+		return 0;
+	}
+
+	mmsghdr headers[MaxBatchSize];
+	iovec vectors[MaxBatchSize];
+
+	size_t sent = 0;
+
+	while (sent < count)
+	{
+		size_t batchSize = std::min(count - sent, MaxBatchSize);
+
+		for (size_t i = 0; i < batchSize; i++)
+		{
+			const UdpDatagram& datagram = datagrams[sent + i];
+
+			vectors[i].iov_base = datagram.data;
+			vectors[i].iov_len = datagram.length;
+
+			memset(&headers[i].msg_hdr, 0, sizeof(headers[i].msg_hdr));
+			headers[i].msg_hdr.msg_name = const_cast<sockaddr*>(datagram.address.GetSocketAddress());
+			headers[i].msg_hdr.msg_namelen = datagram.address.GetSocketAddressLength();
+			headers[i].msg_hdr.msg_iov = &vectors[i];
+			headers[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		int result = sendmmsg(m_socket, headers, batchSize, 0);
+
+		if (result < 0)
+		{
+			int lastError = GetLastNetError();
+
+			if (lastError != EAGAIN)
+			{
+				trace("Failed to send to socket - error code %d.\n", lastError);
+			}
+
+			break;
+		}
+
+		sent += result;
+
+		// the next call would fail on the datagram that stopped this one, so leave it to the caller
+		if (static_cast<size_t>(result) < batchSize)
+		{
+			break;
+		}
+	}
+
+	return sent;
+}
+#else
+size_t UdpSocket::ReceiveBatch(UdpDatagram* datagrams, size_t count)
+{
+	if (!IsValidSocket())
+	{
+		trace("Failed to receive from socket - socket is not valid.\n");
+
+		return 0;
+	}
+
+	size_t received = 0;
+
+	for (; received < count; received++)
+	{
+		int flags = 0;
+
+		// only wait for the very first datagram
+		if (received > 0)
+		{
+#ifdef _WIN32
+			u_long pending = 0;
+
+			if (ioctlsocket(m_socket, FIONREAD, &pending) != 0 || pending == 0)
+			{
+				break;
+			}
+#else
+			flags = MSG_DONTWAIT;
+#endif
+		}
+
+		UdpDatagram& datagram = datagrams[received];
+
+		sockaddr_storage fromAddr = { 0 };
+		socklen_t fromLen = sizeof(fromAddr);
+
+		int len = recvfrom(m_socket, reinterpret_cast<char*>(datagram.data), datagram.capacity, flags, reinterpret_cast<sockaddr*>(&fromAddr), &fromLen);
+
+#ifdef _WIN32
+		// Winsock fails truncated receives, after having filled the buffer
+		if (len < 0 && GetLastNetError() == WSAEMSGSIZE)
+		{
+			len = datagram.capacity;
+		}
+#endif
+
+		if (len < 0)
+		{
+			int lastError = GetLastNetError();
+
+			if (lastError != EAGAIN)
+			{
+				trace("Failed to receive from socket - error code %d.\n", lastError);
+			}
+
+			break;
+		}
+
+		datagram.length = len;
+		datagram.address = PeerAddress(reinterpret_cast<sockaddr*>(&fromAddr), fromLen);
+	}
+
+	return received;
+}
+
+size_t UdpSocket::SendBatch(const UdpDatagram* datagrams, size_t count)
+{
+	if (!IsValidSocket())
+	{
+		trace("Failed to send to socket - socket is not valid.\n");
+
+		return 0;
+	}
+
+	size_t sent = 0;
+
+	for (; sent < count; sent++)
+	{
+		const UdpDatagram& datagram = datagrams[sent];
+
+		int len = sendto(m_socket, reinterpret_cast<const char*>(datagram.data), datagram.length, 0, datagram.address.GetSocketAddress(), datagram.address.GetSocketAddressLength());
+
+		if (len < 0)
+		{
+			int lastError = GetLastNetError();
+
+			if (lastError != EAGAIN)
+			{
+				trace("Failed to send to socket - error code %d.\n", lastError);
+			}
+
+			break;
+		}
+	}
+
+	return sent;
+}
+#endif
 }
\ No newline at end of file
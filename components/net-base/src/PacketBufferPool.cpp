@@ -0,0 +1,335 @@
+/*
+ * This file is part of the CitizenFX project - http://citizen.re/
+ *
+ * See LICENSE and MENTIONS in the root of the source tree for information
+ * regarding licensing.
+ */
+
+#include "StdInc.h"
+#include "PacketBufferPool.h"
+
+#include <atomic>
+#include <mutex>
+#include <set>
+
+namespace net
+{
+typedef std::vector<uint8_t> PacketStorage;
+
+// the capacities storage gets allocated with
+static const size_t g_sizeClasses[] = { 128, 512, 2048, 8192, 65536 };
+
+static const size_t NumSizeClasses = _countof(g_sizeClasses);
+
+// free storage kept per size class and thread - whatever gets released beyond that is freed
+static const size_t MaxCachedStorage = 512;
+
+// the shared_ptr control blocks of pooled storage are all of the same type, so their pool needs just this one size
+static const size_t ControlBlockSize = 64;
+
+static const size_t MaxCachedControlBlocks = NumSizeClasses * MaxCachedStorage;
+
+static std::atomic<uint64_t> g_inUse;
+static std::atomic<uint64_t> g_peakInUse;
+
+class ThreadPacketPool
+{
+public:
+	std::vector<PacketStorage*> freeStorage[NumSizeClasses];
+
+	std::vector<void*> freeControlBlocks;
+
+	// statistics - only ever written by the owning thread, but read by others
+	std::atomic<uint64_t> acquires;
+	std::atomic<uint64_t> hits;
+	std::atomic<uint64_t> oversized;
+	std::atomic<uint64_t> cachedBuffers;
+	std::atomic<uint64_t> cachedBytes;
+
+public:
+	ThreadPacketPool();
+
+	~ThreadPacketPool();
+};
+
+// pools of running threads, and what the pools of exited ones counted
+static std::mutex g_poolsMutex;
+static std::set<ThreadPacketPool*> g_pools;
+static PacketBufferPoolStatistics g_exitedStatistics;
+
+static inline void AddToCounter(std::atomic<uint64_t>& counter, int64_t amount)
+{
+	// counters have a single writer, so this doesn't need an atomic add
+	counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+ThreadPacketPool::ThreadPacketPool()
+	: acquires(0), hits(0), oversized(0), cachedBuffers(0), cachedBytes(0)
+{
+	// so caching never allocates
+	for (auto& storageList : freeStorage)
+	{
+		storageList.reserve(MaxCachedStorage);
+	}
+
+	freeControlBlocks.reserve(MaxCachedControlBlocks);
+
+	std::unique_lock<std::mutex> lock(g_poolsMutex);
+	g_pools.insert(this);
+}
+
+ThreadPacketPool::~ThreadPacketPool()
+{
+	{
+		std::unique_lock<std::mutex> lock(g_poolsMutex);
+		g_pools.erase(this);
+
+		g_exitedStatistics.acquires += acquires;
+		g_exitedStatistics.hits += hits;
+		g_exitedStatistics.oversized += oversized;
+	}
+
+	for (auto& storageList : freeStorage)
+	{
+		for (PacketStorage* storage : storageList)
+		{
+			delete storage;
+		}
+	}
+
+	for (void* block : freeControlBlocks)
+	{
+		::operator delete(block);
+	}
+}
+
+static thread_local ThreadPacketPool* t_pool;
+static thread_local bool t_poolDestroyed;
+
+// destroys the thread's pool once the thread exits - storage released after that gets freed right away
+struct ThreadPacketPoolHolder
+{
+	~ThreadPacketPoolHolder()
+	{
+		delete t_pool;
+
+		t_pool = nullptr;
+		t_poolDestroyed = true;
+	}
+};
+
+static thread_local ThreadPacketPoolHolder t_poolHolder;
+
+static ThreadPacketPool* GetThreadPool()
+{
+	if (!t_pool && !t_poolDestroyed)
+	{
+		// using the holder makes it get destroyed on thread exit
+		static_cast<void>(&t_poolHolder);
+
+		t_pool = new ThreadPacketPool();
+	}
+
+	return t_pool;
+}
+
+template<typename T>
+struct ControlBlockAllocator
+{
+	typedef T value_type;
+
+	ControlBlockAllocator()
+	{
+
+	}
+
+	template<typename TOther>
+	ControlBlockAllocator(const ControlBlockAllocator<TOther>& other)
+	{
+
+	}
+
+	T* allocate(size_t n)
+	{
+		if (n * sizeof(T) > ControlBlockSize)
+		{
+			return static_cast<T*>(::operator new(n * sizeof(T)));
+		}
+
+		ThreadPacketPool* pool = GetThreadPool();
+
+		if (pool && !pool->freeControlBlocks.empty())
+		{
+			void* block = pool->freeControlBlocks.back();
+			pool->freeControlBlocks.pop_back();
+
+			return static_cast<T*>(block);
+		}
+
+		return static_cast<T*>(::operator new(ControlBlockSize));
+	}
+
+	void deallocate(T* block, size_t n)
+	{
+		if (n * sizeof(T) <= ControlBlockSize)
+		{
+			ThreadPacketPool* pool = GetThreadPool();
+
+			if (pool && pool->freeControlBlocks.size() < MaxCachedControlBlocks)
+			{
+				pool->freeControlBlocks.push_back(block);
+				return;
+			}
+		}
+
+		::operator delete(block);
+	}
+};
+
+template<typename T, typename TOther>
+inline bool operator==(const ControlBlockAllocator<T>&, const ControlBlockAllocator<TOther>&)
+{
+	return true;
+}
+
+template<typename T, typename TOther>
+inline bool operator!=(const ControlBlockAllocator<T>&, const ControlBlockAllocator<TOther>&)
+{
+	return false;
+}
+
+static void ReleaseStorage(PacketStorage* storage)
+{
+	g_inUse.fetch_sub(1, std::memory_order_relaxed);
+
+	ThreadPacketPool* pool = GetThreadPool();
+
+	if (pool)
+	{
+		size_t capacity = storage->capacity();
+
+		// the largest class the storage fits, unless it grew well past that
+		for (size_t i = NumSizeClasses; i-- > 0;)
+		{
+			if (capacity >= g_sizeClasses[i])
+			{
+				if (capacity <= g_sizeClasses[i] * 2 && pool->freeStorage[i].size() < MaxCachedStorage)
+				{
+					pool->freeStorage[i].push_back(storage);
+
+					AddToCounter(pool->cachedBuffers, 1);
+					AddToCounter(pool->cachedBytes, capacity);
+
+					return;
+				}
+
+				break;
+			}
+		}
+	}
+
+	delete storage;
+}
+
+struct PacketStorageDeleter
+{
+	void operator()(PacketStorage* storage) const
+	{
+		ReleaseStorage(storage);
+	}
+};
+
+std::shared_ptr<std::vector<uint8_t>> PacketBufferPool::AcquireStorage(size_t length)
+{
+	size_t sizeClass = 0;
+
+	while (sizeClass < NumSizeClasses && g_sizeClasses[sizeClass] < length)
+	{
+		sizeClass++;
+	}
+
+	ThreadPacketPool* pool = GetThreadPool();
+
+	if (sizeClass == NumSizeClasses)
+	{
+		if (pool)
+		{
+			AddToCounter(pool->oversized, 1);
+		}
+
+		return std::make_shared<PacketStorage>(length);
+	}
+
+	PacketStorage* storage;
+
+	if (pool && !pool->freeStorage[sizeClass].empty())
+	{
+		storage = pool->freeStorage[sizeClass].back();
+		pool->freeStorage[sizeClass].pop_back();
+
+		AddToCounter(pool->hits, 1);
+		AddToCounter(pool->cachedBuffers, -1);
+		AddToCounter(pool->cachedBytes, -static_cast<int64_t>(storage->capacity()));
+	}
+	else
+	{
+		storage = new PacketStorage();
+		storage->reserve(g_sizeClasses[sizeClass]);
+	}
+
+	if (pool)
+	{
+		AddToCounter(pool->acquires, 1);
+	}
+
+	storage->resize(length);
+
+	uint64_t inUse = g_inUse.fetch_add(1, std::memory_order_relaxed) + 1;
+	uint64_t peakInUse = g_peakInUse.load(std::memory_order_relaxed);
+
+	while (inUse > peakInUse && !g_peakInUse.compare_exchange_weak(peakInUse, inUse, std::memory_order_relaxed))
+	{
+
+	}
+
+	return std::shared_ptr<PacketStorage>(storage, PacketStorageDeleter(), ControlBlockAllocator<PacketStorage>());
+}
+
+Buffer PacketBufferPool::Acquire(size_t length)
+{
+	return Buffer(AcquireStorage(length), 0, length);
+}
+
+Buffer PacketBufferPool::Acquire(const uint8_t* data, size_t length)
+{
+	auto storage = AcquireStorage(length);
+	memcpy(storage->data(), data, length);
+
+	return Buffer(storage, 0, length);
+}
+
+PacketBufferPoolStatistics PacketBufferPool::GetStatistics()
+{
+	PacketBufferPoolStatistics statistics;
+
+	{
+		std::unique_lock<std::mutex> lock(g_poolsMutex);
+
+		statistics = g_exitedStatistics;
+
+		for (ThreadPacketPool* pool : g_pools)
+		{
+			statistics.acquires += pool->acquires;
+			statistics.hits += pool->hits;
+			statistics.oversized += pool->oversized;
+			statistics.cachedBuffers += pool->cachedBuffers;
+			statistics.cachedBytes += pool->cachedBytes;
+		}
+	}
+
+	statistics.inUse = g_inUse;
+	statistics.peakInUse = g_peakInUse;
+
+	return statistics;
+}
+}
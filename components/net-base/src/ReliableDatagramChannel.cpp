@@ -0,0 +1,837 @@
+/*
+ * This file is part of the CitizenFX project - http://citizen.re/
+ *
+ * See LICENSE and MENTIONS in the root of the source tree for information
+ * regarding licensing.
+ */
+
+#include "StdInc.h"
+#include "ReliableDatagramChannel.h"
+#include "PacketBufferPool.h"
+
+#include <algorithm>
+
+namespace net
+{
+enum : uint8_t
+{
+	FrameTypeAck = 1,
+	FrameTypeStream = 2
+};
+
+// packet number
+static const size_t PacketHeaderSize = 4;
+
+// type, stream, sequence, length
+static const size_t StreamFrameHeaderSize = 8;
+
+// type, delay, count - followed by 8 bytes per range
+static const size_t AckFrameHeaderSize = 4;
+
+static const size_t MaxAckRanges = 32;
+
+// how many packets behind an acknowledged one a packet needs to be to count as lost, initially and at most
+static const uint32_t InitialReorderThreshold = 3;
+static const uint32_t MaxReorderThreshold = 64;
+
+// acknowledgements get sent right away for every second packet, and otherwise within this
+static const std::chrono::microseconds MaxAckDelay = std::chrono::milliseconds(10);
+
+static const std::chrono::microseconds InitialRto = std::chrono::seconds(1);
+static const std::chrono::microseconds MinRto = std::chrono::milliseconds(100);
+static const std::chrono::microseconds MaxRto = std::chrono::seconds(10);
+
+// how far ahead of the next message to deliver a stream accepts messages, and how much may be held up on all streams
+static const uint32_t ReceiveWindow = 4096;
+static const size_t MaxPendingBytes = 4 * 1024 * 1024;
+
+// packet numbers and sequences wrap around, so they get compared by their distance instead - which works as long as
+// the ones compared are less than 2^31 apart
+static inline bool SerialLess(uint32_t a, uint32_t b)
+{
+	return static_cast<int32_t>(a - b) < 0;
+}
+
+template<typename T>
+static inline T ReadValue(const uint8_t* data)
+{
+	T value;
+	memcpy(&value, data, sizeof(T));
+
+	return value;
+}
+
+template<typename T>
+static inline void WriteValue(uint8_t* data, T value)
+{
+	memcpy(data, &value, sizeof(T));
+}
+
+ReliableDatagramChannel::ReliableDatagramChannel(size_t maxPacketSize)
+	: m_clock(&std::chrono::steady_clock::now), m_maxPacketSize(maxPacketSize), m_nextPacketNumber(0), m_firstSentPacket(0),
+	  m_nextSendStream(0), m_queuedFrames(0), m_framesInFlight(0), m_hasLargestAcked(false), m_largestAcked(0),
+	  m_reorderThreshold(InitialReorderThreshold), m_reorderDelay(0), m_lossTime(TimePoint::max()), m_smoothedRtt(0), m_rttVariance(0), m_latestRtt(0),
+	  m_minRtt(0), m_hasRttSample(false), m_rtoBackoff(0), m_congestionWindow(maxPacketSize * 10), m_slowStartThreshold(SIZE_MAX), m_bytesInFlight(0),
+	  m_recoveryStartTime(TimePoint::min()), m_pendingBytes(0), m_ackDeadline(TimePoint::max()), m_unackedPackets(0)
+{
+
+}
+
+ReliableDatagramChannel::~ReliableDatagramChannel()
+{
+
+}
+
+void ReliableDatagramChannel::SetStreamSink(uint8_t stream, const fwRefContainer<DatagramSink>& sink)
+{
+	m_receiveStreams[stream].sink = sink;
+}
+
+size_t ReliableDatagramChannel::GetMaxMessageSize()
+{
+	return m_maxPacketSize - PacketHeaderSize - StreamFrameHeaderSize;
+}
+
+bool ReliableDatagramChannel::Send(uint8_t stream, const Buffer& message)
+{
+	if (message.GetLength() > GetMaxMessageSize())
+	{
+		return false;
+	}
+
+	auto& sendStream = m_sendStreams[stream];
+
+	// copy the message, as the caller's buffer shares its storage with anything they might write to it later
+	StreamFrame frame;
+	frame.stream = stream;
+	frame.sequence = sendStream.nextSequence++;
+	frame.data = PacketBufferPool::Acquire(message.GetBuffer(), message.GetLength());
+
+	sendStream.queue.push_back(std::move(frame));
+	m_queuedFrames++;
+
+	return true;
+}
+
+size_t ReliableDatagramChannel::GetPendingMessages()
+{
+	return m_queuedFrames + m_retransmitQueue.size() + m_framesInFlight;
+}
+
+const ReliableChannelStatistics& ReliableDatagramChannel::GetStatistics()
+{
+	m_statistics.smoothedRtt = m_smoothedRtt;
+	m_statistics.retransmissionTimeout = GetRetransmissionTimeout();
+	m_statistics.congestionWindow = m_congestionWindow;
+	m_statistics.bytesInFlight = m_bytesInFlight;
+
+	return m_statistics;
+}
+
+void ReliableDatagramChannel::Update()
+{
+	auto now = m_clock();
+
+	if (now >= m_lossTime)
+	{
+		DetectLosses(now);
+	}
+	else if (m_bytesInFlight > 0 && now >= GetTimeoutTime())
+	{
+		OnTimeout(now);
+	}
+
+	SendPackets(now);
+	PopResolvedPackets(now);
+}
+
+ReliableDatagramChannel::TimePoint ReliableDatagramChannel::GetNextTimeout()
+{
+	return std::min(m_ackDeadline, GetTimeoutTime());
+}
+
+ReliableDatagramChannel::TimePoint ReliableDatagramChannel::GetTimeoutTime()
+{
+	if (m_lossTime != TimePoint::max())
+	{
+		return m_lossTime;
+	}
+
+	if (m_bytesInFlight == 0)
+	{
+		return TimePoint::max();
+	}
+
+	return m_lastAckElicitingTime + GetRetransmissionTimeout();
+}
+
+std::chrono::microseconds ReliableDatagramChannel::GetRetransmissionTimeout()
+{
+	auto rto = InitialRto;
+
+	if (m_hasRttSample)
+	{
+		rto = m_smoothedRtt + std::max(m_rttVariance * 4, std::chrono::microseconds(1000)) + MaxAckDelay;
+		rto = std::max(rto, MinRto);
+	}
+
+	for (int i = 0; i < m_rtoBackoff && rto < MaxRto; i++)
+	{
+		rto *= 2;
+	}
+
+	return std::min(rto, MaxRto);
+}
+
+void ReliableDatagramChannel::UpdateRtt(std::chrono::microseconds sample, std::chrono::microseconds ackDelay)
+{
+	m_latestRtt = sample;
+
+	if (!m_hasRttSample)
+	{
+		m_minRtt = sample;
+		m_smoothedRtt = sample;
+		m_rttVariance = sample / 2;
+		m_hasRttSample = true;
+
+		return;
+	}
+
+	m_minRtt = std::min(m_minRtt, sample);
+
+	// the time the remote held on to the acknowledgement isn't part of the path's RTT
+	auto adjusted = sample;
+
+	if (adjusted > m_minRtt + ackDelay)
+	{
+		adjusted -= ackDelay;
+	}
+
+	auto deviation = (m_smoothedRtt > adjusted) ? m_smoothedRtt - adjusted : adjusted - m_smoothedRtt;
+
+	m_rttVariance = (m_rttVariance * 3 + deviation) / 4;
+	m_smoothedRtt = (m_smoothedRtt * 7 + adjusted) / 8;
+}
+
+void ReliableDatagramChannel::SendPackets(TimePoint now)
+{
+	if (!m_sink.GetRef())
+	{
+		return;
+	}
+
+	while (true)
+	{
+		bool ackOwed = (m_ackDeadline != TimePoint::max());
+		bool canSendData = (m_queuedFrames > 0 || !m_retransmitQueue.empty()) && m_bytesInFlight < m_congestionWindow;
+
+		if (!canSendData && !(ackOwed && now >= m_ackDeadline))
+		{
+			break;
+		}
+
+		auto storage = PacketBufferPool::AcquireStorage(m_maxPacketSize);
+		uint8_t* data = storage->data();
+
+		uint32_t packetNumber = m_nextPacketNumber++;
+		WriteValue<uint32_t>(data, packetNumber);
+
+		size_t size = PacketHeaderSize;
+
+		// acknowledgements ride along with any data going out anyway
+		if (ackOwed)
+		{
+			size += WriteAckFrame(data + size, m_maxPacketSize - size, now);
+		}
+
+		SentPacket sent;
+		sent.sentTime = now;
+
+		if (!m_spareFrameLists.empty())
+		{
+			sent.frames = std::move(m_spareFrameLists.back());
+			m_spareFrameLists.pop_back();
+		}
+
+		if (canSendData)
+		{
+			StreamFrame frame;
+
+			while (TakeNextFrame(m_maxPacketSize - size, &frame))
+			{
+				size_t length = frame.data.GetLength();
+
+				data[size] = FrameTypeStream;
+				data[size + 1] = frame.stream;
+				WriteValue<uint32_t>(data + size + 2, frame.sequence);
+				WriteValue<uint16_t>(data + size + 6, static_cast<uint16_t>(length));
+				memcpy(data + size + StreamFrameHeaderSize, frame.data.GetBuffer(), length);
+
+				size += StreamFrameHeaderSize + length;
+
+				sent.frames.push_back(std::move(frame));
+			}
+		}
+
+		sent.size = size;
+		sent.ackEliciting = !sent.frames.empty();
+		sent.lost = false;
+
+		// packets with just an acknowledgement don't get acknowledged themselves, so there's nothing to track
+		sent.acked = !sent.ackEliciting;
+
+		if (sent.ackEliciting)
+		{
+			m_bytesInFlight += size;
+			m_framesInFlight += sent.frames.size();
+			m_lastAckElicitingTime = now;
+		}
+
+		m_sentPackets.push_back(std::move(sent));
+		m_statistics.packetsSent++;
+
+		m_sink->WritePacket(Buffer(storage, 0, size));
+	}
+}
+
+bool ReliableDatagramChannel::TakeNextFrame(size_t space, StreamFrame* frame)
+{
+	if (!m_retransmitQueue.empty())
+	{
+		auto& front = m_retransmitQueue.front();
+
+		if (StreamFrameHeaderSize + front.data.GetLength() > space)
+		{
+			return false;
+		}
+
+		*frame = std::move(front);
+		m_retransmitQueue.pop_front();
+
+		return true;
+	}
+
+	if (m_queuedFrames == 0)
+	{
+		return false;
+	}
+
+	// take turns between the streams, so one stream with a lot queued doesn't hold up the others
+	auto it = m_sendStreams.lower_bound(m_nextSendStream);
+
+	for (size_t i = 0; i < m_sendStreams.size(); i++, it++)
+	{
+		if (it == m_sendStreams.end())
+		{
+			it = m_sendStreams.begin();
+		}
+
+		auto& queue = it->second.queue;
+
+		if (!queue.empty() && StreamFrameHeaderSize + queue.front().data.GetLength() <= space)
+		{
+			*frame = std::move(queue.front());
+			queue.pop_front();
+
+			m_queuedFrames--;
+			m_nextSendStream = it->first + 1;
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+size_t ReliableDatagramChannel::WriteAckFrame(uint8_t* data, size_t space, TimePoint now)
+{
+	if (space < AckFrameHeaderSize + 8 || m_receivedRanges.empty())
+	{
+		return 0;
+	}
+
+	size_t count = std::min({ m_receivedRanges.size(), MaxAckRanges, (space - AckFrameHeaderSize) / 8 });
+
+	// in units of 100 microseconds
+	auto delay = std::chrono::duration_cast<std::chrono::microseconds>(now - m_largestReceivedTime).count() / 100;
+
+	data[0] = FrameTypeAck;
+	WriteValue<uint16_t>(data + 1, static_cast<uint16_t>(std::min<int64_t>(std::max<int64_t>(delay, 0), 0xFFFF)));
+	data[3] = static_cast<uint8_t>(count);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		WriteValue<uint32_t>(data + AckFrameHeaderSize + (i * 8), m_receivedRanges[i].last);
+		WriteValue<uint32_t>(data + AckFrameHeaderSize + (i * 8) + 4, m_receivedRanges[i].first);
+	}
+
+	m_ackDeadline = TimePoint::max();
+	m_unackedPackets = 0;
+
+	return AckFrameHeaderSize + (count * 8);
+}
+
+void ReliableDatagramChannel::ProcessPacket(const Buffer& packet)
+{
+	size_t length = packet.GetLength();
+
+	if (length < PacketHeaderSize)
+	{
+		return;
+	}
+
+	auto now = m_clock();
+	const uint8_t* data = packet.GetBuffer();
+
+	uint32_t packetNumber = ReadValue<uint32_t>(data);
+
+	m_statistics.packetsReceived++;
+
+	bool inOrder = (m_receivedRanges.empty() || packetNumber == m_receivedRanges[0].last + 1);
+
+	bool ackEliciting = false;
+	bool refused = false;
+	size_t offset = PacketHeaderSize;
+
+	while (offset < length)
+	{
+		uint8_t type = data[offset];
+
+		if (type == FrameTypeAck)
+		{
+			if (!ProcessAckFrame(data, length, &offset, now))
+			{
+				break;
+			}
+		}
+		else if (type == FrameTypeStream)
+		{
+			if (length - offset < StreamFrameHeaderSize)
+			{
+				break;
+			}
+
+			uint8_t stream = data[offset + 1];
+			uint32_t sequence = ReadValue<uint32_t>(data + offset + 2);
+			size_t frameLength = ReadValue<uint16_t>(data + offset + 6);
+
+			offset += StreamFrameHeaderSize;
+
+			if (length - offset < frameLength)
+			{
+				break;
+			}
+
+			ackEliciting = true;
+
+			if (!ProcessStreamFrame(stream, sequence, packet.Slice(offset, frameLength)))
+			{
+				refused = true;
+			}
+
+			offset += frameLength;
+		}
+		else
+		{
+			// unknown frames don't say how long they are, so nothing after them can be read
+			break;
+		}
+	}
+
+	// the packet counts as not received, so the remote declares it lost and retransmits - its messages that did get
+	// accepted are duplicates by then, and get ignored
+	if (refused)
+	{
+		m_statistics.packetsRefused++;
+
+		SendPackets(now);
+		PopResolvedPackets(now);
+		return;
+	}
+
+	bool isNew = RecordReceived(packetNumber);
+
+	if (isNew && m_receivedRanges[0].last == packetNumber)
+	{
+		m_largestReceivedTime = now;
+	}
+
+	if (ackEliciting)
+	{
+		m_unackedPackets++;
+
+		// gaps and duplicates get reported right away, so the remote can retransmit sooner
+		if (m_unackedPackets >= 2 || !inOrder || !isNew)
+		{
+			m_ackDeadline = now;
+		}
+		else
+		{
+			m_ackDeadline = std::min(m_ackDeadline, now + MaxAckDelay);
+		}
+	}
+
+	SendPackets(now);
+	PopResolvedPackets(now);
+}
+
+bool ReliableDatagramChannel::RecordReceived(uint32_t packetNumber)
+{
+	auto& ranges = m_receivedRanges;
+
+	for (size_t i = 0; i < ranges.size(); i++)
+	{
+		auto& range = ranges[i];
+
+		if (!SerialLess(packetNumber, range.first) && !SerialLess(range.last, packetNumber))
+		{
+			return false;
+		}
+
+		if (packetNumber == range.last + 1)
+		{
+			range.last = packetNumber;
+			return true;
+		}
+
+		if (packetNumber + 1 == range.first)
+		{
+			range.first = packetNumber;
+
+			// this may have closed the gap to the next range
+			if (i + 1 < ranges.size() && ranges[i + 1].last + 1 == packetNumber)
+			{
+				range.first = ranges[i + 1].first;
+				ranges.erase(ranges.begin() + i + 1);
+			}
+
+			return true;
+		}
+
+		if (SerialLess(range.last, packetNumber))
+		{
+			ranges.insert(ranges.begin() + i, ReceivedRange{ packetNumber, packetNumber });
+
+			if (ranges.size() > MaxAckRanges)
+			{
+				ranges.pop_back();
+			}
+
+			return true;
+		}
+	}
+
+	// older than anything tracked - if ranges got dropped, this may well be a duplicate, but the streams catch those
+	if (ranges.size() < MaxAckRanges)
+	{
+		ranges.push_back(ReceivedRange{ packetNumber, packetNumber });
+	}
+
+	return true;
+}
+
+bool ReliableDatagramChannel::ProcessAckFrame(const uint8_t* data, size_t length, size_t* offset, TimePoint now)
+{
+	if (length - *offset < AckFrameHeaderSize)
+	{
+		return false;
+	}
+
+	auto ackDelay = std::chrono::microseconds(ReadValue<uint16_t>(data + *offset + 1) * 100);
+	size_t count = data[*offset + 3];
+
+	*offset += AckFrameHeaderSize;
+
+	if ((length - *offset) / 8 < count)
+	{
+		return false;
+	}
+
+	const uint8_t* rangeData = data + *offset;
+	*offset += count * 8;
+
+	size_t bytesInFlight = m_bytesInFlight;
+	bool ackedNew = false;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		uint32_t last = ReadValue<uint32_t>(rangeData + (i * 8));
+		uint32_t first = ReadValue<uint32_t>(rangeData + (i * 8) + 4);
+
+		// ignore anything we never sent
+		if (SerialLess(last, first) || !SerialLess(last, m_nextPacketNumber))
+		{
+			continue;
+		}
+
+		if (!m_hasLargestAcked || SerialLess(m_largestAcked, last))
+		{
+			m_hasLargestAcked = true;
+			m_largestAcked = last;
+
+			// only the newest packet gives a useful RTT sample - older ones were held up by the remote's delayed
+			// acknowledgements
+			if (!SerialLess(last, m_firstSentPacket))
+			{
+				auto& sent = m_sentPackets[last - m_firstSentPacket];
+
+				if (sent.ackEliciting && !sent.acked)
+				{
+					UpdateRtt(std::chrono::duration_cast<std::chrono::microseconds>(now - sent.sentTime), std::min(ackDelay, MaxAckDelay));
+				}
+			}
+		}
+
+		// written so it ends when `last` is the largest packet number, too
+		for (uint32_t packetNumber = (SerialLess(first, m_firstSentPacket)) ? m_firstSentPacket : first; !SerialLess(last, packetNumber); packetNumber++)
+		{
+			auto& sent = m_sentPackets[packetNumber - m_firstSentPacket];
+
+			if (sent.acked)
+			{
+				continue;
+			}
+
+			sent.acked = true;
+			ackedNew = true;
+
+			// its messages got queued again already, and the packet is out of flight - but the path reorders more than
+			// was assumed, so wait longer before calling packets lost from now on
+			if (sent.lost)
+			{
+				m_statistics.spuriousLosses++;
+				m_reorderThreshold = std::min(std::max(m_reorderThreshold, m_largestAcked - packetNumber + 1), MaxReorderThreshold);
+
+				auto ackTime = std::chrono::duration_cast<std::chrono::microseconds>(now - sent.sentTime);
+				auto lossDelay = GetLossDelay();
+
+				if (ackTime > lossDelay)
+				{
+					m_reorderDelay = std::min(m_reorderDelay + (ackTime - lossDelay), m_smoothedRtt);
+				}
+
+				continue;
+			}
+
+			m_bytesInFlight -= sent.size;
+			m_framesInFlight -= sent.frames.size();
+
+			sent.frames.clear();
+
+			// no growth during recovery, nor if the window isn't what's limiting the sender
+			if (sent.sentTime > m_recoveryStartTime && bytesInFlight * 2 >= m_congestionWindow)
+			{
+				if (m_congestionWindow < m_slowStartThreshold)
+				{
+					m_congestionWindow += sent.size;
+				}
+				else
+				{
+					m_congestionWindow += std::max<size_t>(m_maxPacketSize * sent.size / m_congestionWindow, 1);
+				}
+			}
+		}
+	}
+
+	if (ackedNew)
+	{
+		m_rtoBackoff = 0;
+
+		DetectLosses(now);
+	}
+
+	return true;
+}
+
+bool ReliableDatagramChannel::ProcessStreamFrame(uint8_t stream, uint32_t sequence, const Buffer& data)
+{
+	auto& receiveStream = m_receiveStreams[stream];
+
+	if (SerialLess(sequence, receiveStream.nextSequence))
+	{
+		return true;
+	}
+
+	if (sequence != receiveStream.nextSequence)
+	{
+		if (sequence - receiveStream.nextSequence >= ReceiveWindow)
+		{
+			return false;
+		}
+
+		// the first copy of a duplicate is kept
+		if (receiveStream.pending.find(sequence) != receiveStream.pending.end())
+		{
+			return true;
+		}
+
+		if (m_pendingBytes + data.GetLength() > MaxPendingBytes)
+		{
+			return false;
+		}
+
+		// a slice would keep the whole packet alive
+		receiveStream.pending.emplace(sequence, Buffer(data.GetBuffer(), data.GetLength()));
+		m_pendingBytes += data.GetLength();
+
+		return true;
+	}
+
+	auto deliver = [this, &receiveStream] (const Buffer& message)
+	{
+		receiveStream.nextSequence++;
+		m_statistics.messagesDelivered++;
+
+		if (receiveStream.sink.GetRef())
+		{
+			receiveStream.sink->WritePacket(message);
+		}
+	};
+
+	deliver(data);
+
+	// and anything this was holding up - the map is ordered by plain value, which isn't the order of sequences that
+	// wrapped around, so the next one gets looked up directly
+	auto& pending = receiveStream.pending;
+
+	for (auto it = pending.find(receiveStream.nextSequence); it != pending.end(); it = pending.find(receiveStream.nextSequence))
+	{
+		m_pendingBytes -= it->second.GetLength();
+
+		deliver(it->second);
+		pending.erase(it);
+	}
+
+	return true;
+}
+
+void ReliableDatagramChannel::DetectLosses(TimePoint now)
+{
+	m_lossTime = TimePoint::max();
+
+	if (!m_hasLargestAcked)
+	{
+		return;
+	}
+
+	auto lossDelay = GetLossDelay();
+
+	bool lost = false;
+	TimePoint lastLostTime;
+
+	for (uint32_t packetNumber = m_firstSentPacket; SerialLess(packetNumber, m_largestAcked) && SerialLess(packetNumber, m_nextPacketNumber); packetNumber++)
+	{
+		auto& sent = m_sentPackets[packetNumber - m_firstSentPacket];
+
+		if (sent.acked || sent.lost)
+		{
+			continue;
+		}
+
+		if (m_largestAcked - packetNumber >= m_reorderThreshold || sent.sentTime + lossDelay <= now)
+		{
+			OnPacketLost(sent);
+
+			lost = true;
+			lastLostTime = sent.sentTime;
+		}
+		else
+		{
+			m_lossTime = std::min(m_lossTime, sent.sentTime + lossDelay);
+		}
+	}
+
+	if (lost)
+	{
+		OnCongestionEvent(lastLostTime, now);
+	}
+}
+
+std::chrono::microseconds ReliableDatagramChannel::GetLossDelay()
+{
+	// allow for some reordering, as well as for the RTT growing
+	auto lossDelay = std::max(m_latestRtt, m_smoothedRtt) * 9 / 8;
+
+	// plus however much more reordering the path turned out to have - but not beyond twice the RTT, at which point
+	// waiting for acknowledgements would be slower than just retransmitting
+	lossDelay += std::min(m_reorderDelay, m_smoothedRtt);
+
+	return std::max(lossDelay, std::chrono::microseconds(1000));
+}
+
+void ReliableDatagramChannel::OnPacketLost(SentPacket& packet)
+{
+	packet.lost = true;
+
+	m_bytesInFlight -= packet.size;
+	m_framesInFlight -= packet.frames.size();
+
+	m_statistics.packetsLost++;
+	m_statistics.retransmissions += packet.frames.size();
+
+	for (auto& frame : packet.frames)
+	{
+		m_retransmitQueue.push_back(std::move(frame));
+	}
+
+	packet.frames.clear();
+}
+
+void ReliableDatagramChannel::OnCongestionEvent(TimePoint sentTime, TimePoint now)
+{
+	if (sentTime <= m_recoveryStartTime)
+	{
+		return;
+	}
+
+	m_recoveryStartTime = now;
+
+	m_congestionWindow = std::max(m_congestionWindow / 2, m_maxPacketSize * 2);
+	m_slowStartThreshold = m_congestionWindow;
+}
+
+void ReliableDatagramChannel::OnTimeout(TimePoint now)
+{
+	m_statistics.timeouts++;
+
+	// nothing got acknowledged for a while, so assume all of it is gone
+	for (auto& sent : m_sentPackets)
+	{
+		if (!sent.acked && !sent.lost)
+		{
+			OnPacketLost(sent);
+		}
+	}
+
+	m_slowStartThreshold = std::max(m_congestionWindow / 2, m_maxPacketSize * 2);
+	m_congestionWindow = m_maxPacketSize * 2;
+	m_recoveryStartTime = now;
+
+	m_rtoBackoff++;
+}
+
+void ReliableDatagramChannel::PopResolvedPackets(TimePoint now)
+{
+	auto lostExpiryTime = now - GetRetransmissionTimeout();
+
+	while (!m_sentPackets.empty())
+	{
+		auto& front = m_sentPackets.front();
+
+		if (!front.acked && (!front.lost || front.sentTime > lostExpiryTime))
+		{
+			break;
+		}
+
+		// keep the frame list's allocation around for the next packets
+		if (front.frames.capacity() > 0 && m_spareFrameLists.size() < 64)
+		{
+			front.frames.clear();
+			m_spareFrameLists.push_back(std::move(front.frames));
+		}
+
+		m_sentPackets.pop_front();
+		m_firstSentPacket++;
+	}
+}
+}
@@ -7,27 +7,76 @@
 
 #include "StdInc.h"
 #include "SequencedInputDatagramChannel.h"
+#include "PacketBufferPool.h"
+
+#include <algorithm>
 
 namespace net
 {
 SequencedInputDatagramChannel::SequencedInputDatagramChannel()
-	: SequencedDatagramChannel()
+	: SequencedDatagramChannel(), m_reorderPackets(0), m_reorderDelay(0), m_highestSequence(0), m_receivedMask(1)
+{
+
+}
+
+void SequencedInputDatagramChannel::Reset()
+{
+	SequencedDatagramChannel::Reset();
+
+	m_pending.clear();
+
+	// sequences start at 1, so 0 counts as received
+	m_highestSequence = 0;
+	m_receivedMask = 1;
+}
+
+void SequencedInputDatagramChannel::SetReorderWindow(size_t maxPackets, std::chrono::milliseconds maxDelay)
 {
+	m_reorderPackets = maxPackets;
+	m_reorderDelay = maxDelay;
 
+	// so buffering packets never allocates
+	m_pending.reserve(maxPackets + 1);
+
+	// deliver anything that doesn't fit anymore
+	while (m_pending.size() > m_reorderPackets)
+	{
+		SkipGap();
+	}
 }
 
 void SequencedInputDatagramChannel::ProcessPacket(const std::vector<uint8_t>& packet)
 {
-	if (packet.size() <= 4)
+	ProcessPacket(PacketBufferPool::Acquire(packet.data(), packet.size()));
+}
+
+void SequencedInputDatagramChannel::ProcessPacket(const Buffer& packet)
+{
+	if (packet.GetLength() <= 4)
 	{
 		return;
 	}
 
-	uint32_t thisSequence = *reinterpret_cast<const uint32_t*>(&packet[0]);
+	uint32_t thisSequence = *reinterpret_cast<const uint32_t*>(packet.GetBuffer());
 
-	if (thisSequence == 0xFFFFFFFF)
+	// the packet without its header
+	Buffer payload = packet.Slice(4, packet.GetLength() - 4);
+
+	if (thisSequence == OutOfBandSequence)
+	{
+		m_statistics.outOfBand++;
+
+		auto& sink = (m_outOfBandSink.GetRef()) ? m_outOfBandSink : GetSink();
+		sink->WritePacket(payload);
+
+		return;
+	}
+
+	bool reordered = (thisSequence < m_highestSequence);
+
+	if (!MarkReceived(thisSequence))
 	{
-		// TODO: handle OOB requests
+		m_statistics.duplicates++;
 		return;
 	}
 
@@ -35,81 +84,149 @@ void SequencedInputDatagramChannel::ProcessPacket(const std::vector<uint8_t>& pa
 
 	if (thisSequence <= lastSequence)
 	{
-		trace("out-of-order or duplicate packet (%u, %u)\n", thisSequence, lastSequence);
+		m_statistics.late++;
 		return;
 	}
 
-	if (thisSequence != (lastSequence + 1))
+	if (reordered)
 	{
-		trace("dropped packet (%u, %u)\n", thisSequence, lastSequence);
+		m_statistics.reordered++;
 	}
 
-	SetSequence(thisSequence);
+	if (thisSequence == (lastSequence + 1))
+	{
+		Deliver(thisSequence, payload);
+		DeliverPending();
+	}
+	else if (m_reorderPackets == 0)
+	{
+		m_statistics.lost += thisSequence - lastSequence - 1;
 
-	// copy packet and write it back
-	std::vector<uint8_t> nextPacket(packet.size() - 4);
-	memcpy(&nextPacket[0], &packet[4], nextPacket.size());
+		Deliver(thisSequence, payload);
+	}
+	else
+	{
+		auto it = std::lower_bound(m_pending.begin(), m_pending.end(), thisSequence, [] (const PendingPacket& pending, uint32_t sequence)
+		{
+			return pending.sequence < sequence;
+		});
+
+		// too far behind for the bitmap to have caught it
+		if (it != m_pending.end() && it->sequence == thisSequence)
+		{
+			m_statistics.duplicates++;
+			return;
+		}
+
+		PendingPacket pending;
+		pending.sequence = thisSequence;
+		pending.payload = payload;
+		pending.arrivalTime = std::chrono::steady_clock::now();
+
+		m_pending.insert(it, std::move(pending));
+
+		while (m_pending.size() > m_reorderPackets)
+		{
+			SkipGap();
+		}
+	}
 
-	GetSink()->WritePacket(nextPacket);
-}
+	if (!m_pending.empty())
+	{
+		ProcessTimeouts();
+	}
 }
 
-#ifdef fake_tests
-#include "SequencedOutputDatagramChannel.h"
-
-class StoreOutDatagramSink : public net::DatagramSink
+void SequencedInputDatagramChannel::ProcessTimeouts()
 {
-private:
-	std::vector<uint8_t> m_lastPacket;
-
-public:
-	virtual void WritePacket(const std::vector<uint8_t>& packet) override
+	if (m_pending.empty())
 	{
-		m_lastPacket = packet;
+		return;
 	}
 
-	const std::vector<uint8_t>& GetPacket()
+	auto expiryTime = std::chrono::steady_clock::now() - m_reorderDelay;
+
+	// skip gaps until no packet is left waiting for too long
+	while (!m_pending.empty())
 	{
-		return m_lastPacket;
+		bool expired = std::any_of(m_pending.begin(), m_pending.end(), [&] (const PendingPacket& pending)
+		{
+			return pending.arrivalTime <= expiryTime;
+		});
+
+		if (!expired)
+		{
+			break;
+		}
+
+		SkipGap();
 	}
-};
+}
 
-static InitFunction initFunction([] ()
+bool SequencedInputDatagramChannel::MarkReceived(uint32_t sequence)
 {
-	net::SequencedInputDatagramChannel recvChannel;
-	net::SequencedOutputDatagramChannel sendChannel;
+	if (sequence > m_highestSequence)
+	{
+		uint32_t shift = sequence - m_highestSequence;
+
+		m_receivedMask = (shift < 64) ? (m_receivedMask << shift) | 1 : 1;
+		m_highestSequence = sequence;
+
+		return true;
+	}
+
+	uint32_t distance = m_highestSequence - sequence;
+
+	// too old to tell
+	if (distance >= 64)
+	{
+		return true;
+	}
 
-	fwRefContainer<StoreOutDatagramSink> sendSink(new StoreOutDatagramSink());
-	fwRefContainer<StoreOutDatagramSink> recvSink(new StoreOutDatagramSink());
+	uint64_t bit = uint64_t(1) << distance;
 
-	recvChannel.SetSink(recvSink);
-	sendChannel.SetSink(sendSink);
+	if (m_receivedMask & bit)
+	{
+		return false;
+	}
+
+	m_receivedMask |= bit;
+
+	return true;
+}
 
-	std::vector<uint8_t> dummyPacket(4);
+void SequencedInputDatagramChannel::Deliver(uint32_t sequence, const Buffer& payload)
+{
+	SetSequence(sequence);
 
-	// sequence: 1
-	sendChannel.WritePacket(dummyPacket);
-	recvChannel.ProcessPacket(sendSink->GetPacket());
+	m_statistics.delivered++;
 
-	// sequence: 2
-	sendChannel.WritePacket(dummyPacket);
-	recvChannel.ProcessPacket(sendSink->GetPacket());
+	GetSink()->WritePacket(payload);
+}
 
-	// sequence: 2 - again? OOPS
-	recvChannel.ProcessPacket(sendSink->GetPacket());
+void SequencedInputDatagramChannel::DeliverPending()
+{
+	while (!m_pending.empty() && m_pending.front().sequence == GetSequence() + 1)
+	{
+		PendingPacket pending = std::move(m_pending.front());
+		m_pending.erase(m_pending.begin());
 
-	std::vector<uint8_t> seqTwo = sendSink->GetPacket();
+		Deliver(pending.sequence, pending.payload);
+	}
+}
 
-	// sequence: 3 - drop it
-	sendChannel.WritePacket(dummyPacket);
+void SequencedInputDatagramChannel::SkipGap()
+{
+	if (m_pending.empty())
+	{
+		return;
+	}
 
-	// sequence: 4 - send it this time
-	sendChannel.WritePacket(dummyPacket);
-	recvChannel.ProcessPacket(sendSink->GetPacket());
+	uint32_t nextSequence = m_pending.front().sequence;
 
-	// sequence: 2 - THIS GUY SURE LOVES SEQUENCE 2
-	recvChannel.ProcessPacket(seqTwo);
+	m_statistics.lost += nextSequence - GetSequence() - 1;
 
-	__debugbreak();
-});
-#endif
\ No newline at end of file
+	SetSequence(nextSequence - 1);
+	DeliverPending();
+}
+}
\ No newline at end of file
@@ -7,6 +7,8 @@
 
 #include "StdInc.h"
 #include "SequencedOutputDatagramChannel.h"
+#include "SequencedInputDatagramChannel.h"
+#include "PacketBufferPool.h"
 
 namespace net
 {
@@ -17,15 +19,33 @@ SequencedOutputDatagramChannel::SequencedOutputDatagramChannel()
 }
 
 void SequencedOutputDatagramChannel::WritePacket(const std::vector<uint8_t>& packet)
+{
+	SetSequence(GetSequence() + 1);
+
+	WriteData(GetSequence(), packet.data(), packet.size());
+}
+
+void SequencedOutputDatagramChannel::WritePacket(const Buffer& packet)
+{
+	SetSequence(GetSequence() + 1);
+
+	WriteData(GetSequence(), packet.GetBuffer(), packet.GetLength());
+}
+
+void SequencedOutputDatagramChannel::WriteOutOfBandPacket(const Buffer& packet)
+{
+	WriteData(SequencedInputDatagramChannel::OutOfBandSequence, packet.GetBuffer(), packet.GetLength());
+}
+
+void SequencedOutputDatagramChannel::WriteData(uint32_t sequence, const uint8_t* data, size_t length)
 {
 	// copy packet and write it back
-	std::vector<uint8_t> nextPacket(packet.size() + 4);
-	memcpy(&nextPacket[4], &packet[0], nextPacket.size());
+	auto nextPacket = PacketBufferPool::AcquireStorage(length + 4);
+	memcpy(nextPacket->data() + 4, data, length);
 
 	// write sequence to the packet
-	SetSequence(GetSequence() + 1);
-	*reinterpret_cast<uint32_t*>(&nextPacket[0]) = GetSequence();
+	*reinterpret_cast<uint32_t*>(nextPacket->data()) = sequence;
 
-	GetSink()->WritePacket(nextPacket);
+	GetSink()->WritePacket(Buffer(nextPacket, 0, length + 4));
 }
 }
\ No newline at end of file
@@ -0,0 +1,1134 @@
+/*
+ * This file is part of the CitizenFX project - http://citizen.re/
+ *
+ * See LICENSE and MENTIONS in the root of the source tree for information
+ * regarding licensing.
+ */
+
+// microbenchmarks for the datagram stack
+//
+//   tests_net-base --mode pipes --depth 4 --payload 1024 --duration 5
+//   tests_net-base --mode pipes --depth 4 --payload 1024 --copy 1 (payloads copied at every step, as pipes used to)
+//   tests_net-base --mode udp --senders 2 --batch 32 --payload 256
+//   tests_net-base --mode udp --senders 2 --batch 1 (ReceiveFrom/SendTo for every datagram)
+//   tests_net-base --mode udp --batch 64 --interval 200 (receiving once every 200 us, like a server draining per frame)
+//   tests_net-base --mode roundtrip --payload 1024
+//   tests_net-base --mode dispatch --types 64 --payload 32
+//   tests_net-base --mode dispatch --types 64 --payload 32 --mapped 0 (sending full type hashes, looked up by hash)
+//   tests_net-base --mode reliable --loss 5 --delay 50 --jitter 10 --bandwidth 10000 --streams 4 --messages 20000
+//   tests_net-base --mode check (runs the unit tests instead)
+
+#include "StdInc.h"
+
+#include "ConcatPipe.h"
+#include "NetPeerBase.h"
+#include "NetUdpSocket.h"
+#include "PacketBufferPool.h"
+#include "ReliableDatagramChannel.h"
+#include "SequencedInputDatagramChannel.h"
+#include "SequencedOutputDatagramChannel.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <queue>
+#include <random>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#include <unistd.h>
+#endif
+
+enum class BenchMode
+{
+	// a sequenced packet split by a chain of `depth` concat pipes, each passing an 8-byte header to a pipe of its own
+	// and the rest on to the next one - the last one getting `payload` bytes
+	Pipes,
+	// datagrams of `payload` bytes sent over loopback by `senders` threads, and received by a single one - in batches
+	// of `batch` datagrams
+	Udp,
+	// an 8-byte header and a `payload`-byte body concatenated, sequenced, and split again - which is all in-process, so
+	// the allocations and pool statistics show what each packet costs
+	Roundtrip,
+	// messages of `payload` bytes received by a PeerBase, cycling through `types` message types - they get encoded up
+	// front, so this is the receiving side only
+	Dispatch,
+	// two reliable channels each sending `messages` messages of `payload` bytes over `streams` streams to the other, on
+	// simulated time over a path with `loss` percent loss, `delay` ms latency, up to `jitter` ms extra and `bandwidth`
+	// kbit/s - failing unless every message arrives once, and in order
+	Reliable
+};
+
+struct BenchOptions
+{
+	BenchMode mode;
+
+	int duration;
+
+	size_t payload;
+
+	int depth;
+
+	// whether payloads get copied at every step, instead of being sliced
+	bool copy;
+
+	int senders;
+
+	int batch;
+
+	// microseconds the receiver sleeps after every receive call, so datagrams queue up like they would in between the
+	// frames of a server - otherwise a receiver keeping up gets woken for nearly every single datagram
+	int interval;
+
+	int types;
+
+	// whether peers send a mapping first, so messages get dispatched by index
+	bool mapped;
+
+	// percent
+	double loss;
+
+	int delay;
+
+	int jitter;
+
+	// kbit/s, or 0 for no limit
+	int bandwidth;
+
+	int streams;
+
+	int messages;
+
+	uint32_t seed;
+
+	BenchOptions()
+		: mode(BenchMode::Pipes), duration(5), payload(1024), depth(4), copy(false), senders(1), batch(32), interval(0), types(64), mapped(true),
+		  loss(0.0), delay(50), jitter(0), bandwidth(0), streams(4), messages(10000), seed(1)
+	{
+
+	}
+};
+
+struct BenchStats
+{
+	uint64_t operations;
+
+	uint64_t bytes;
+
+	uint64_t allocations;
+
+	double elapsed;
+
+	// for modes with a separate sending side
+	uint64_t sent;
+
+	// CPU time spent by the receiving and the sending threads, in seconds
+	double receiveCpu;
+
+	double sendCpu;
+
+	// for modes that verify what they did
+	bool failed;
+
+	BenchStats()
+		: operations(0), bytes(0), allocations(0), elapsed(0.0), sent(0), receiveCpu(0.0), sendCpu(0.0), failed(false)
+	{
+
+	}
+};
+
+static BenchOptions g_options;
+
+// allocations made through this executable's operator new - on platforms where components have a heap of their own,
+// only the calls made directly from here get counted
+static std::atomic<uint64_t> g_allocations;
+
+void* operator new(size_t size)
+{
+	g_allocations++;
+
+	void* pointer = malloc(size ? size : 1);
+
+	if (!pointer)
+	{
+		throw std::bad_alloc();
+	}
+
+	return pointer;
+}
+
+void operator delete(void* pointer) noexcept
+{
+	free(pointer);
+}
+
+// the end of a chain, which reads what it gets so the data actually gets touched
+class BenchLeafPipe : public net::NetPipe
+{
+private:
+	uint64_t m_bytes;
+
+	uint32_t m_checksum;
+
+public:
+	BenchLeafPipe()
+		: m_bytes(0), m_checksum(0)
+	{
+
+	}
+
+	virtual void Reset() override
+	{
+
+	}
+
+	virtual void PassPacket(net::Buffer data) override
+	{
+		const uint8_t* bytes = data.GetBuffer();
+		size_t length = data.GetLength();
+
+		for (size_t i = 0; i < length; i += 64)
+		{
+			m_checksum += bytes[i];
+		}
+
+		m_bytes += length;
+	}
+
+	inline uint64_t GetBytes()
+	{
+		return m_bytes;
+	}
+};
+
+// ConcatInputPipe as it was before buffers could be sliced, copying both halves into buffers of their own
+class BenchCopyingConcatPipe : public net::NetPipe
+{
+private:
+	fwRefContainer<net::NetPipe> m_pipe1;
+
+	fwRefContainer<net::NetPipe> m_pipe2;
+
+public:
+	BenchCopyingConcatPipe(const fwRefContainer<net::NetPipe>& p1, const fwRefContainer<net::NetPipe>& p2)
+		: m_pipe1(p1), m_pipe2(p2)
+	{
+
+	}
+
+	virtual void Reset() override
+	{
+
+	}
+
+	virtual void PassPacket(net::Buffer data) override
+	{
+		uint16_t firstLength = data.Read<uint16_t>();
+
+		if (data.GetRemainingBytes() >= firstLength)
+		{
+			net::Buffer firstData(firstLength);
+			net::Buffer secondData(data.GetRemainingBytes() - firstLength);
+
+			data.ReadTo(firstData, firstData.GetLength());
+			data.ReadTo(secondData, secondData.GetLength());
+
+			firstData.Reset();
+			secondData.Reset();
+
+			m_pipe1->PassPacket(firstData);
+			m_pipe2->PassPacket(secondData);
+		}
+	}
+};
+
+static BenchStats RunPipes()
+{
+	static const uint16_t headerLength = 8;
+
+	// build the chain back to front
+	fwRefContainer<BenchLeafPipe> payloadPipe = new BenchLeafPipe();
+	fwRefContainer<BenchLeafPipe> headerPipe = new BenchLeafPipe();
+
+	fwRefContainer<net::NetPipe> chain = payloadPipe;
+
+	for (int i = 0; i < g_options.depth; i++)
+	{
+		if (g_options.copy)
+		{
+			chain = new BenchCopyingConcatPipe(headerPipe, chain);
+		}
+		else
+		{
+			chain = new net::ConcatInputPipe(headerPipe, chain);
+		}
+	}
+
+	net::NetPipe* chainRef = chain.GetRef();
+
+	fwRefContainer<net::DatagramSink> sink;
+
+	if (g_options.copy)
+	{
+		// the vector variant, which gets the payload copied out
+		sink = new net::FunctionDatagramSink([=] (const std::vector<uint8_t>& packet)
+		{
+			chainRef->PassPacket(net::Buffer(packet));
+		});
+	}
+	else
+	{
+		sink = new net::FunctionBufferDatagramSink([=] (const net::Buffer& packet)
+		{
+			chainRef->PassPacket(packet);
+		});
+	}
+
+	fwRefContainer<net::SequencedInputDatagramChannel> channel = new net::SequencedInputDatagramChannel();
+	channel->SetSink(sink);
+
+	// the packet: a sequence, followed by a length-prefixed header for every pipe in the chain, and the payload
+	std::vector<uint8_t> packetData(4 + (2 + headerLength) * g_options.depth + g_options.payload, 'x');
+
+	for (int i = 0; i < g_options.depth; i++)
+	{
+		memcpy(&packetData[4 + (2 + headerLength) * i], &headerLength, sizeof(headerLength));
+	}
+
+	auto packetBytes = std::make_shared<std::vector<uint8_t>>(std::move(packetData));
+	uint32_t sequence = 0;
+
+	BenchStats stats;
+
+	uint64_t allocationsBefore = g_allocations;
+	auto startTime = std::chrono::high_resolution_clock::now();
+	auto endTime = startTime + std::chrono::seconds(g_options.duration);
+
+	while (std::chrono::high_resolution_clock::now() < endTime)
+	{
+		for (int i = 0; i < 1000; i++)
+		{
+			sequence++;
+			memcpy(packetBytes->data(), &sequence, sizeof(sequence));
+
+			channel->ProcessPacket(net::Buffer(packetBytes, 0, packetBytes->size()));
+		}
+
+		stats.operations += 1000;
+	}
+
+	stats.elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+	stats.allocations = g_allocations - allocationsBefore;
+	stats.bytes = payloadPipe->GetBytes();
+
+	if (stats.bytes != stats.operations * g_options.payload || headerPipe->GetBytes() != stats.operations * headerLength * g_options.depth)
+	{
+		printf("pipes passed the wrong amount of data\n");
+	}
+
+	return stats;
+}
+
+// passes packets on to a function
+class BenchFunctionPipe : public net::NetPipe
+{
+private:
+	std::function<void(const net::Buffer&)> m_function;
+
+public:
+	BenchFunctionPipe(const std::function<void(const net::Buffer&)>& function)
+		: m_function(function)
+	{
+
+	}
+
+	virtual void Reset() override
+	{
+
+	}
+
+	virtual void PassPacket(net::Buffer data) override
+	{
+		m_function(data);
+	}
+};
+
+static BenchStats RunRoundtrip()
+{
+	// the receiving side
+	fwRefContainer<BenchLeafPipe> headerPipe = new BenchLeafPipe();
+	fwRefContainer<BenchLeafPipe> payloadPipe = new BenchLeafPipe();
+	fwRefContainer<net::ConcatInputPipe> splitPipe = new net::ConcatInputPipe(headerPipe, payloadPipe);
+
+	net::ConcatInputPipe* splitPipeRef = splitPipe.GetRef();
+
+	fwRefContainer<net::SequencedInputDatagramChannel> inputChannel = new net::SequencedInputDatagramChannel();
+	inputChannel->SetSink(new net::FunctionBufferDatagramSink([=] (const net::Buffer& packet)
+	{
+		splitPipeRef->PassPacket(packet);
+	}));
+
+	net::SequencedInputDatagramChannel* inputChannelRef = inputChannel.GetRef();
+
+	// the sending side, with the 'network' in between being a direct call
+	fwRefContainer<net::SequencedOutputDatagramChannel> outputChannel = new net::SequencedOutputDatagramChannel();
+	outputChannel->SetSink(new net::FunctionBufferDatagramSink([=] (const net::Buffer& packet)
+	{
+		inputChannelRef->ProcessPacket(packet);
+	}));
+
+	net::SequencedOutputDatagramChannel* outputChannelRef = outputChannel.GetRef();
+
+	fwRefContainer<net::ConcatOutputPipe> joinPipe = new net::ConcatOutputPipe(new BenchFunctionPipe([=] (const net::Buffer& packet)
+	{
+		outputChannelRef->WritePacket(packet);
+	}));
+
+	std::vector<uint8_t> header(8, 'h');
+	std::vector<uint8_t> payload(g_options.payload, 'x');
+
+	net::Buffer headerBuffer(header);
+	net::Buffer payloadBuffer(payload);
+
+	BenchStats stats;
+
+	uint64_t allocationsBefore = g_allocations;
+	auto startTime = std::chrono::high_resolution_clock::now();
+	auto endTime = startTime + std::chrono::seconds(g_options.duration);
+
+	while (std::chrono::high_resolution_clock::now() < endTime)
+	{
+		for (int i = 0; i < 1000; i++)
+		{
+			joinPipe->PassPacket(headerBuffer);
+			joinPipe->PassPacket(payloadBuffer);
+		}
+
+		stats.operations += 1000;
+	}
+
+	stats.elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+	stats.allocations = g_allocations - allocationsBefore;
+	stats.bytes = payloadPipe->GetBytes();
+
+	if (stats.bytes != stats.operations * g_options.payload)
+	{
+		printf("pipes passed the wrong amount of data\n");
+	}
+
+	return stats;
+}
+
+static uint64_t g_dispatchedMessages;
+
+class BenchPeerHandler : public net::PeerHandler
+{
+public:
+	BenchPeerHandler()
+	{
+		for (int i = 0; i < g_options.types; i++)
+		{
+			RegisterType(("benchMessage" + std::to_string(i)).c_str(), [] (net::PeerBase* peer, net::Buffer& buffer)
+			{
+				g_dispatchedMessages++;
+			});
+		}
+	}
+};
+
+static BenchStats RunDispatch()
+{
+	// the receiving peer only sends acks for the mapping
+	net::PeerBase* sendingPeerRef = nullptr;
+
+	fwRefContainer<net::PeerBase> receivingPeer = new net::PeerBase(new net::FunctionBufferDatagramSink([&] (const net::Buffer& packet)
+	{
+		sendingPeerRef->ProcessPacket(packet);
+	}));
+
+	net::PeerBase* receivingPeerRef = receivingPeer.GetRef();
+
+	// the sending peer's packets get passed on until the mapping got through, and captured afterwards
+	std::vector<net::Buffer> packets;
+	bool capturing = false;
+
+	fwRefContainer<net::PeerBase> sendingPeer = new net::PeerBase(new net::FunctionBufferDatagramSink([&] (const net::Buffer& packet)
+	{
+		if (capturing)
+		{
+			packets.push_back(packet);
+		}
+		else
+		{
+			receivingPeerRef->ProcessPacket(packet);
+		}
+	}));
+
+	sendingPeerRef = sendingPeer.GetRef();
+
+	receivingPeer->RegisterHandler<BenchPeerHandler>();
+	sendingPeer->RegisterHandler<BenchPeerHandler>();
+
+	if (g_options.mapped)
+	{
+		sendingPeer->SendMappingPacket();
+	}
+
+	capturing = true;
+
+	std::vector<uint8_t> payloadData(g_options.payload, 'x');
+	net::Buffer payload(payloadData);
+
+	for (int i = 0; i < g_options.types; i++)
+	{
+		sendingPeer->SendNetMessage(HashRageString(("benchMessage" + std::to_string(i)).c_str()), payload);
+	}
+
+	// sequences get rewritten in place
+	uint32_t sequence = (g_options.mapped) ? 1 : 0;
+
+	BenchStats stats;
+
+	uint64_t allocationsBefore = g_allocations;
+	auto startTime = std::chrono::high_resolution_clock::now();
+	auto endTime = startTime + std::chrono::seconds(g_options.duration);
+
+	size_t packetIndex = 0;
+
+	while (std::chrono::high_resolution_clock::now() < endTime)
+	{
+		for (int i = 0; i < 1000; i++)
+		{
+			net::Buffer& packet = packets[packetIndex];
+
+			sequence++;
+			memcpy(const_cast<uint8_t*>(packet.GetBuffer()), &sequence, sizeof(sequence));
+
+			receivingPeer->ProcessPacket(packet);
+
+			packetIndex = (packetIndex + 1) % packets.size();
+		}
+
+		stats.operations += 1000;
+	}
+
+	stats.elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+	stats.allocations = g_allocations - allocationsBefore;
+	stats.bytes = stats.operations * g_options.payload;
+
+	if (g_dispatchedMessages != stats.operations)
+	{
+		printf("only %llu messages got dispatched\n", static_cast<unsigned long long>(g_dispatchedMessages));
+	}
+
+	return stats;
+}
+
+// the CPU time used by the calling thread, in seconds
+static double GetThreadCpuTime()
+{
+#ifdef _WIN32
+	FILETIME creationTime, exitTime, kernelTime, userTime;
+	GetThreadTimes(GetCurrentThread(), &creationTime, &exitTime, &kernelTime, &userTime);
+
+	auto toSeconds = [] (const FILETIME& time)
+	{
+		return ((static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime) / 1e7;
+	};
+
+	return toSeconds(kernelTime) + toSeconds(userTime);
+#else
+	timespec time;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+
+	return time.tv_sec + (time.tv_nsec / 1e9);
+#endif
+}
+
+static BenchStats RunUdp()
+{
+	static const size_t maxDatagramSize = 2048;
+
+	fwRefContainer<net::UdpSocket> receiveSocket = new net::UdpSocket();
+	receiveSocket->Bind(net::PeerAddress::FromString("127.0.0.1", 0).get());
+
+	net::PeerAddress receiveAddress = receiveSocket->GetLocalAddress();
+
+	std::atomic<bool> running(true);
+	std::atomic<bool> receiving(true);
+	std::atomic<uint64_t> sent(0);
+	std::atomic<uint64_t> sendCpuMicroseconds(0);
+
+	BenchStats stats;
+
+	std::thread receiveThread([&] ()
+	{
+		uint64_t allocationsBefore = g_allocations;
+
+		if (g_options.batch > 1)
+		{
+			// what would be pooled buffers in a server
+			std::vector<uint8_t> storage(g_options.batch * maxDatagramSize);
+			std::vector<net::UdpDatagram> datagrams(g_options.batch);
+
+			for (size_t i = 0; i < datagrams.size(); i++)
+			{
+				datagrams[i].data = &storage[i * maxDatagramSize];
+				datagrams[i].capacity = maxDatagramSize;
+			}
+
+			allocationsBefore = g_allocations;
+
+			while (running)
+			{
+				size_t count = receiveSocket->ReceiveBatch(datagrams.data(), datagrams.size());
+
+				for (size_t i = 0; i < count; i++)
+				{
+					stats.bytes += datagrams[i].length;
+				}
+
+				stats.operations += count;
+
+				if (g_options.interval)
+				{
+					std::this_thread::sleep_for(std::chrono::microseconds(g_options.interval));
+				}
+			}
+		}
+		else
+		{
+			while (running)
+			{
+				net::PeerAddress fromAddress;
+				auto datagram = receiveSocket->ReceiveFrom(maxDatagramSize, &fromAddress);
+
+				if (datagram)
+				{
+					stats.bytes += datagram->size();
+					stats.operations++;
+				}
+
+				if (g_options.interval)
+				{
+					std::this_thread::sleep_for(std::chrono::microseconds(g_options.interval));
+				}
+			}
+		}
+
+		stats.allocations = g_allocations - allocationsBefore;
+		stats.receiveCpu = GetThreadCpuTime();
+
+		receiving = false;
+	});
+
+	std::vector<std::thread> sendThreads;
+
+	for (int i = 0; i < g_options.senders; i++)
+	{
+		sendThreads.emplace_back([&] ()
+		{
+			fwRefContainer<net::UdpSocket> sendSocket = new net::UdpSocket();
+			sendSocket->Bind(net::PeerAddress::FromString("127.0.0.1", 0).get());
+
+			std::vector<uint8_t> payload(g_options.payload, 'x');
+			std::vector<net::UdpDatagram> datagrams(g_options.batch);
+
+			for (auto& datagram : datagrams)
+			{
+				datagram.data = payload.data();
+				datagram.length = payload.size();
+				datagram.address = receiveAddress;
+			}
+
+			uint64_t sentHere = 0;
+
+			while (running)
+			{
+				if (g_options.batch > 1)
+				{
+					sentHere += sendSocket->SendBatch(datagrams.data(), datagrams.size());
+				}
+				else if (sendSocket->SendTo(payload, receiveAddress))
+				{
+					sentHere++;
+				}
+			}
+
+			sent += sentHere;
+			sendCpuMicroseconds += static_cast<uint64_t>(GetThreadCpuTime() * 1e6);
+		});
+	}
+
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	std::this_thread::sleep_for(std::chrono::seconds(g_options.duration));
+	running = false;
+
+	stats.elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+	for (auto& thread : sendThreads)
+	{
+		thread.join();
+	}
+
+	// wake the receiver, which might be waiting for a datagram
+	{
+		fwRefContainer<net::UdpSocket> wakeSocket = new net::UdpSocket();
+		std::vector<uint8_t> wakeData(1);
+
+		while (receiving)
+		{
+			wakeSocket->SendTo(wakeData, receiveAddress);
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+	}
+
+	receiveThread.join();
+
+	stats.sent = sent;
+	stats.sendCpu = sendCpuMicroseconds / 1e6;
+
+	return stats;
+}
+
+// one direction of a simulated path: packets get dropped at random, queued behind each other at the path's bandwidth -
+// and tail-dropped once the queue is full - and delivered after the delay plus some jitter, which may reorder them
+class BenchLink
+{
+private:
+	struct InFlightPacket
+	{
+		std::chrono::microseconds deliveryTime;
+
+		uint64_t index;
+
+		net::Buffer packet;
+
+		inline bool operator>(const InFlightPacket& other) const
+		{
+			return (deliveryTime != other.deliveryTime) ? deliveryTime > other.deliveryTime : index > other.index;
+		}
+	};
+
+	std::priority_queue<InFlightPacket, std::vector<InFlightPacket>, std::greater<InFlightPacket>> m_packets;
+
+	std::mt19937& m_random;
+
+	// when the packets queued so far will have been put on the wire
+	std::chrono::microseconds m_queueFreeTime;
+
+	uint64_t m_nextIndex;
+
+public:
+	uint64_t dropped;
+
+	uint64_t queueDropped;
+
+public:
+	BenchLink(std::mt19937& random)
+		: m_random(random), m_queueFreeTime(0), m_nextIndex(0), dropped(0), queueDropped(0)
+	{
+
+	}
+
+	void Send(std::chrono::microseconds now, const net::Buffer& packet)
+	{
+		if (std::uniform_real_distribution<double>(0.0, 100.0)(m_random) < g_options.loss)
+		{
+			dropped++;
+			return;
+		}
+
+		auto sendTime = now;
+
+		if (g_options.bandwidth > 0)
+		{
+			// 50 ms worth of queue
+			auto queueLimit = std::chrono::milliseconds(50);
+
+			m_queueFreeTime = std::max(m_queueFreeTime, now);
+
+			if (m_queueFreeTime - now > queueLimit)
+			{
+				queueDropped++;
+				return;
+			}
+
+			m_queueFreeTime += std::chrono::microseconds(packet.GetLength() * 8 * 1000 / g_options.bandwidth);
+			sendTime = m_queueFreeTime;
+		}
+
+		InFlightPacket inFlight;
+		inFlight.deliveryTime = sendTime + std::chrono::milliseconds(g_options.delay);
+		inFlight.index = m_nextIndex++;
+		inFlight.packet = packet;
+
+		if (g_options.jitter > 0)
+		{
+			inFlight.deliveryTime += std::chrono::microseconds(std::uniform_int_distribution<int>(0, g_options.jitter * 1000)(m_random));
+		}
+
+		m_packets.push(std::move(inFlight));
+	}
+
+	template<typename TFn>
+	void Deliver(std::chrono::microseconds now, const TFn& fn)
+	{
+		while (!m_packets.empty() && m_packets.top().deliveryTime <= now)
+		{
+			// copy before popping, as the receiver may send on this link again
+			net::Buffer packet = m_packets.top().packet;
+			m_packets.pop();
+
+			fn(packet);
+		}
+	}
+};
+
+// one end of the simulation, checking that what it receives on each stream arrives in order and exactly once
+struct BenchReliableEndpoint
+{
+	fwRefContainer<net::ReliableDatagramChannel> channel;
+
+	std::vector<uint32_t> nextSequences;
+
+	uint64_t received;
+
+	uint64_t receivedBytes;
+
+	uint64_t errors;
+
+	// messages this side got to send
+	uint64_t sent;
+
+	BenchReliableEndpoint()
+		: received(0), receivedBytes(0), errors(0), sent(0)
+	{
+
+	}
+};
+
+static BenchStats RunReliable()
+{
+	std::mt19937 random(g_options.seed);
+
+	// the channels run on simulated time
+	std::chrono::microseconds simulatedTime(0);
+
+	auto clock = [&simulatedTime] ()
+	{
+		return net::ReliableDatagramChannel::TimePoint(std::chrono::duration_cast<std::chrono::steady_clock::duration>(simulatedTime));
+	};
+
+	BenchLink links[2] = { BenchLink(random), BenchLink(random) };
+	BenchReliableEndpoint endpoints[2];
+
+	for (int i = 0; i < 2; i++)
+	{
+		BenchLink* link = &links[i];
+		BenchReliableEndpoint* endpoint = &endpoints[i];
+
+		endpoint->channel = new net::ReliableDatagramChannel();
+		endpoint->channel->SetClock(clock);
+		endpoint->channel->SetSink(new net::FunctionBufferDatagramSink([link, &simulatedTime] (const net::Buffer& packet)
+		{
+			link->Send(simulatedTime, packet);
+		}));
+
+		endpoint->nextSequences.resize(g_options.streams);
+
+		for (int stream = 0; stream < g_options.streams; stream++)
+		{
+			endpoint->channel->SetStreamSink(stream, new net::FunctionBufferDatagramSink([endpoint, stream] (const net::Buffer& message)
+			{
+				uint8_t messageStream = message.GetBuffer()[0];
+
+				uint32_t sequence;
+				memcpy(&sequence, message.GetBuffer() + 1, sizeof(sequence));
+
+				if (messageStream != stream || sequence != endpoint->nextSequences[stream])
+				{
+					endpoint->errors++;
+				}
+
+				endpoint->nextSequences[stream] = sequence + 1;
+				endpoint->received++;
+				endpoint->receivedBytes += message.GetLength();
+			}));
+		}
+	}
+
+	size_t payloadSize = std::min(std::max(g_options.payload, size_t(5)), endpoints[0].channel->GetMaxMessageSize());
+	std::vector<uint8_t> payloadData(payloadSize, 'x');
+
+	std::vector<uint32_t> sendSequences[2] = { std::vector<uint32_t>(g_options.streams), std::vector<uint32_t>(g_options.streams) };
+
+	const auto step = std::chrono::microseconds(100);
+	const auto timeLimit = std::chrono::seconds(600);
+
+	BenchStats stats;
+
+	uint64_t allocationsBefore = g_allocations;
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	while (simulatedTime < timeLimit)
+	{
+		bool done = true;
+
+		for (int i = 0; i < 2; i++)
+		{
+			auto& endpoint = endpoints[i];
+
+			// keep the channel busy, without queueing everything up front
+			while (endpoint.sent < static_cast<uint64_t>(g_options.messages) && endpoint.channel->GetPendingMessages() < 256)
+			{
+				int stream = static_cast<int>(endpoint.sent % g_options.streams);
+
+				payloadData[0] = static_cast<uint8_t>(stream);
+				memcpy(&payloadData[1], &sendSequences[i][stream], sizeof(uint32_t));
+
+				sendSequences[i][stream]++;
+
+				endpoint.channel->Send(stream, net::Buffer(payloadData));
+				endpoint.sent++;
+			}
+
+			endpoint.channel->Update();
+
+			if (endpoints[i ^ 1].received < static_cast<uint64_t>(g_options.messages))
+			{
+				done = false;
+			}
+		}
+
+		if (done)
+		{
+			break;
+		}
+
+		simulatedTime += step;
+
+		for (int i = 0; i < 2; i++)
+		{
+			auto& receiver = endpoints[i ^ 1];
+
+			links[i].Deliver(simulatedTime, [&receiver] (const net::Buffer& packet)
+			{
+				receiver.channel->ProcessPacket(packet);
+			});
+		}
+	}
+
+	stats.elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+	stats.allocations = g_allocations - allocationsBefore;
+
+	double simulatedSeconds = std::chrono::duration<double>(simulatedTime).count();
+
+	for (int i = 0; i < 2; i++)
+	{
+		auto& endpoint = endpoints[i];
+		const auto& channelStatistics = endpoint.channel->GetStatistics();
+
+		stats.operations += endpoint.received;
+		stats.bytes += endpoint.receivedBytes;
+
+		printf("side %d:        %llu/%d messages received, %.1f kbit/s goodput, %llu errors\n", i, static_cast<unsigned long long>(endpoint.received),
+			g_options.messages, (endpoint.receivedBytes * 8 / 1000.0) / simulatedSeconds, static_cast<unsigned long long>(endpoint.errors));
+
+		printf("               %llu packets sent, %llu dropped (%llu by the queue), %llu lost (%llu spuriously), %llu retransmissions, %llu timeouts\n",
+			static_cast<unsigned long long>(channelStatistics.packetsSent), static_cast<unsigned long long>(links[i].dropped + links[i].queueDropped),
+			static_cast<unsigned long long>(links[i].queueDropped), static_cast<unsigned long long>(channelStatistics.packetsLost),
+			static_cast<unsigned long long>(channelStatistics.spuriousLosses),
+			static_cast<unsigned long long>(channelStatistics.retransmissions), static_cast<unsigned long long>(channelStatistics.timeouts));
+
+		printf("               srtt %.1f ms, rto %.1f ms, cwnd %llu bytes, %llu packets refused\n", channelStatistics.smoothedRtt.count() / 1000.0,
+			channelStatistics.retransmissionTimeout.count() / 1000.0, static_cast<unsigned long long>(channelStatistics.congestionWindow),
+			static_cast<unsigned long long>(channelStatistics.packetsRefused));
+
+		if (endpoint.errors > 0 || endpoint.received != static_cast<uint64_t>(g_options.messages))
+		{
+			stats.failed = true;
+		}
+	}
+
+	printf("simulated:     %.2f s\n", simulatedSeconds);
+	printf("delivery:      %s\n", (stats.failed) ? "FAILED" : "ok");
+
+	return stats;
+}
+
+static bool ParseOptions(int argc, char** argv)
+{
+	for (int i = 1; i < argc - 1; i += 2)
+	{
+		std::string option = argv[i];
+		std::string value = argv[i + 1];
+
+		if (option == "--mode")
+		{
+			if (value == "pipes")
+			{
+				g_options.mode = BenchMode::Pipes;
+			}
+			else if (value == "udp")
+			{
+				g_options.mode = BenchMode::Udp;
+			}
+			else if (value == "roundtrip")
+			{
+				g_options.mode = BenchMode::Roundtrip;
+			}
+			else if (value == "dispatch")
+			{
+				g_options.mode = BenchMode::Dispatch;
+			}
+			else if (value == "reliable")
+			{
+				g_options.mode = BenchMode::Reliable;
+			}
+			else
+			{
+				return false;
+			}
+		}
+		else if (option == "--duration")
+		{
+			g_options.duration = std::max(atoi(value.c_str()), 1);
+		}
+		else if (option == "--payload")
+		{
+			g_options.payload = std::max(atoi(value.c_str()), 1);
+		}
+		else if (option == "--depth")
+		{
+			g_options.depth = std::max(atoi(value.c_str()), 1);
+		}
+		else if (option == "--copy")
+		{
+			g_options.copy = (atoi(value.c_str()) != 0);
+		}
+		else if (option == "--senders")
+		{
+			g_options.senders = std::max(atoi(value.c_str()), 1);
+		}
+		else if (option == "--batch")
+		{
+			g_options.batch = std::max(atoi(value.c_str()), 1);
+		}
+		else if (option == "--interval")
+		{
+			g_options.interval = std::max(atoi(value.c_str()), 0);
+		}
+		else if (option == "--types")
+		{
+			g_options.types = std::max(atoi(value.c_str()), 1);
+		}
+		else if (option == "--mapped")
+		{
+			g_options.mapped = (atoi(value.c_str()) != 0);
+		}
+		else if (option == "--loss")
+		{
+			g_options.loss = std::min(std::max(atof(value.c_str()), 0.0), 100.0);
+		}
+		else if (option == "--delay")
+		{
+			g_options.delay = std::max(atoi(value.c_str()), 0);
+		}
+		else if (option == "--jitter")
+		{
+			g_options.jitter = std::max(atoi(value.c_str()), 0);
+		}
+		else if (option == "--bandwidth")
+		{
+			g_options.bandwidth = std::max(atoi(value.c_str()), 0);
+		}
+		else if (option == "--streams")
+		{
+			g_options.streams = std::min(std::max(atoi(value.c_str()), 1), 256);
+		}
+		else if (option == "--messages")
+		{
+			g_options.messages = std::max(atoi(value.c_str()), 1);
+		}
+		else if (option == "--seed")
+		{
+			g_options.seed = static_cast<uint32_t>(strtoul(value.c_str(), nullptr, 10));
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	return (argc % 2) == 1;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc >= 3 && strcmp(argv[1], "--mode") == 0 && strcmp(argv[2], "check") == 0)
+	{
+		::testing::InitGoogleTest(&argc, argv);
+		return RUN_ALL_TESTS();
+	}
+
+	if (!ParseOptions(argc, argv))
+	{
+		printf("usage: %s [--mode pipes|udp|roundtrip|dispatch|reliable|check] [--duration seconds] [--payload bytes] [--depth n] [--copy 0|1] [--senders n] [--batch n] [--interval us] [--types n] [--mapped 0|1] [--loss percent] [--delay ms] [--jitter ms] [--bandwidth kbit] [--streams n] [--messages n] [--seed n]\n", argv[0]);
+		return 1;
+	}
+
+	BenchStats stats;
+
+	switch (g_options.mode)
+	{
+		case BenchMode::Pipes:
+			stats = RunPipes();
+			break;
+		case BenchMode::Udp:
+			stats = RunUdp();
+			break;
+		case BenchMode::Roundtrip:
+			stats = RunRoundtrip();
+			break;
+		case BenchMode::Dispatch:
+			stats = RunDispatch();
+			break;
+		case BenchMode::Reliable:
+			stats = RunReliable();
+			break;
+	}
+
+	printf("%.2f s\n", stats.elapsed);
+	printf("packets/s:     %.1f\n", stats.operations / stats.elapsed);
+	printf("ns/packet:     %.1f\n", (stats.elapsed * 1e9) / stats.operations);
+	printf("bytes/s:       %.1f\n", stats.bytes / stats.elapsed);
+	printf("allocs/packet: %.2f\n", static_cast<double>(stats.allocations) / stats.operations);
+
+	if (g_options.mode == BenchMode::Udp)
+	{
+		// the rest got dropped, most likely by the receive buffer overflowing
+		printf("sent/s:        %.1f\n", stats.sent / stats.elapsed);
+		printf("received/core: %.1f packets per CPU second\n", stats.operations / stats.receiveCpu);
+		printf("sent/core:     %.1f packets per CPU second\n", stats.sent / stats.sendCpu);
+	}
+
+	net::PacketBufferPoolStatistics poolStatistics = net::PacketBufferPool::GetStatistics();
+
+	printf("pool:          %.4f hit rate (%llu acquires, %llu oversized), %llu peak in use, %llu cached (%llu bytes)\n",
+		poolStatistics.GetHitRate(), static_cast<unsigned long long>(poolStatistics.acquires), static_cast<unsigned long long>(poolStatistics.oversized),
+		static_cast<unsigned long long>(poolStatistics.peakInUse), static_cast<unsigned long long>(poolStatistics.cachedBuffers),
+		static_cast<unsigned long long>(poolStatistics.cachedBytes));
+
+	fflush(stdout);
+
+	_exit((stats.failed) ? 1 : 0);
+}
@@ -0,0 +1,183 @@
+#include "StdInc.h"
+#include <gtest/gtest.h>
+
+#include "NetBuffer.h"
+#include "SequencedOutputDatagramChannel.h"
+
+namespace
+{
+// a buffer holding the bytes 0, 1, 2 and so on
+net::Buffer MakeCountingBuffer(size_t length)
+{
+	std::vector<uint8_t> bytes(length);
+
+	for (size_t i = 0; i < length; i++)
+	{
+		bytes[i] = static_cast<uint8_t>(i);
+	}
+
+	return net::Buffer(std::move(bytes));
+}
+
+// keeps every packet written to it, as passed
+class RecordingSink : public net::DatagramSink
+{
+public:
+	std::vector<std::vector<uint8_t>> packets;
+
+	virtual void WritePacket(const std::vector<uint8_t>& packet) override
+	{
+		packets.push_back(packet);
+	}
+
+	virtual void WritePacket(const net::Buffer& packet) override
+	{
+		packets.push_back(packet.ToVector());
+	}
+};
+
+struct LargeValue
+{
+	uint8_t bytes[16];
+};
+}
+
+TEST(NetBufferTests, SliceSharesStorage)
+{
+	net::Buffer buffer = MakeCountingBuffer(16);
+	net::Buffer slice = buffer.Slice(4, 8);
+
+	EXPECT_EQ(buffer.GetBuffer() + 4, slice.GetBuffer());
+	EXPECT_EQ(8u, slice.GetLength());
+	EXPECT_EQ(0u, slice.GetCurOffset());
+	EXPECT_FALSE(slice.IsWhole());
+
+	// writes within the slice's range show in the buffer it came from
+	slice.Write<uint8_t>(0xAA);
+
+	EXPECT_EQ(0xAA, buffer.GetBuffer()[4]);
+}
+
+TEST(NetBufferTests, ReadStopsAtSliceEnd)
+{
+	net::Buffer buffer = MakeCountingBuffer(16);
+	net::Buffer slice = buffer.Slice(4, 6);
+
+	uint32_t value = 0;
+	ASSERT_TRUE(slice.Read(&value, sizeof(value)));
+
+	EXPECT_EQ(0x07060504u, value);
+	EXPECT_FALSE(slice.IsAtEnd());
+
+	// the storage has these bytes, but the slice ends two bytes in
+	EXPECT_FALSE(slice.Read(&value, sizeof(value)));
+	EXPECT_EQ(0xCECECECEu, value);
+	EXPECT_TRUE(slice.IsAtEnd());
+
+	// a failed read doesn't move the cursor, so what's left can still be read
+	EXPECT_EQ(4u, slice.GetCurOffset());
+	EXPECT_EQ(0x0908, slice.Read<uint16_t>());
+	EXPECT_EQ(0u, slice.GetRemainingBytes());
+}
+
+TEST(NetBufferTests, ReadToStopsAtSliceEnd)
+{
+	net::Buffer buffer = MakeCountingBuffer(16);
+	net::Buffer slice = buffer.Slice(2, 4);
+
+	net::Buffer out;
+	EXPECT_FALSE(slice.ReadTo(out, 5));
+	EXPECT_EQ(0u, out.GetLength());
+
+	ASSERT_TRUE(slice.ReadTo(out, 4));
+	EXPECT_EQ(std::vector<uint8_t>({ 2, 3, 4, 5 }), out.ToVector());
+}
+
+TEST(NetBufferTests, NestedSlices)
+{
+	net::Buffer buffer = MakeCountingBuffer(16);
+	net::Buffer outer = buffer.Slice(2, 10);
+	net::Buffer inner = outer.Slice(3, 4);
+
+	// offsets are relative to the slice taken from, not the storage
+	EXPECT_EQ(buffer.GetBuffer() + 5, inner.GetBuffer());
+	EXPECT_EQ(std::vector<uint8_t>({ 5, 6, 7, 8 }), inner.ToVector());
+
+	uint8_t bytes[4];
+	ASSERT_TRUE(inner.Read(bytes, 4));
+	EXPECT_FALSE(inner.Read(bytes, 1));
+	EXPECT_TRUE(inner.IsAtEnd());
+
+	// a slice of a slice doesn't reach past the outer one's end, even though the storage continues
+	EXPECT_EQ(2u, outer.Slice(8, 100).GetLength());
+	EXPECT_EQ(std::vector<uint8_t>({ 10, 11 }), outer.Slice(8, 100).ToVector());
+	EXPECT_EQ(0u, outer.Slice(20, 5).GetLength());
+	EXPECT_EQ(0u, inner.Slice(2, 4).Slice(3, 1).GetLength());
+}
+
+TEST(NetBufferTests, ShortReadFillsWholeDestination)
+{
+	net::Buffer buffer = MakeCountingBuffer(4);
+
+	LargeValue value;
+	memset(&value, 0, sizeof(value));
+
+	EXPECT_FALSE(buffer.Read(&value, sizeof(value)));
+	EXPECT_TRUE(buffer.IsAtEnd());
+
+	// all of it, not just the first sizeof(size_t) bytes
+	for (uint8_t byte : value.bytes)
+	{
+		EXPECT_EQ(0xCE, byte);
+	}
+
+	EXPECT_EQ(0u, buffer.GetCurOffset());
+}
+
+TEST(NetBufferTests, GrowingSliceDetaches)
+{
+	net::Buffer buffer = MakeCountingBuffer(16);
+	net::Buffer slice = buffer.Slice(4, 2);
+
+	slice.Write<uint32_t>(0xFFFFFFFF);
+
+	// the slice moved to storage of its own rather than writing over bytes 6 and 7
+	EXPECT_NE(buffer.GetBuffer() + 4, slice.GetBuffer());
+	EXPECT_EQ(4u, slice.GetLength());
+	EXPECT_EQ(MakeCountingBuffer(16).ToVector(), buffer.ToVector());
+}
+
+TEST(NetBufferTests, GrowingTailSliceKeepsItsStorage)
+{
+	// nothing else references the storage, and nothing follows the slice in it
+	net::Buffer slice = MakeCountingBuffer(16).Slice(12, 4);
+
+	std::vector<uint8_t> bytes(8, 0xFF);
+	slice.Write(bytes.data(), 8);
+
+	EXPECT_EQ(8u, slice.GetLength());
+	EXPECT_EQ(std::vector<uint8_t>(8, 0xFF), slice.ToVector());
+}
+
+TEST(NetBufferTests, SequencedOutputFramesSlicesExactly)
+{
+	fwRefContainer<RecordingSink> sink = new RecordingSink();
+
+	net::SequencedOutputDatagramChannel channel;
+	channel.SetSink(sink);
+
+	// the bytes after the slice must not end up in the packet, nor get read at all
+	net::Buffer buffer = MakeCountingBuffer(16);
+	channel.WritePacket(buffer.Slice(3, 5));
+
+	ASSERT_EQ(1u, sink->packets.size());
+
+	const std::vector<uint8_t>& packet = sink->packets[0];
+	ASSERT_EQ(4u + 5u, packet.size());
+
+	uint32_t sequence;
+	memcpy(&sequence, packet.data(), sizeof(sequence));
+
+	EXPECT_EQ(channel.GetSequence(), sequence);
+	EXPECT_EQ(std::vector<uint8_t>({ 3, 4, 5, 6, 7 }), std::vector<uint8_t>(packet.begin() + 4, packet.end()));
+}
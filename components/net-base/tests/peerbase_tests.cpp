@@ -0,0 +1,257 @@
+#include "StdInc.h"
+#include <gtest/gtest.h>
+
+#include "NetPeerBase.h"
+
+#include <algorithm>
+
+namespace
+{
+// messages dispatched by either peer, as "type:payload"
+std::vector<std::string> g_received;
+
+const char* const g_typeNames[] = { "a", "b", "c" };
+
+class TestHandler : public net::PeerHandler
+{
+public:
+	TestHandler()
+	{
+		for (const char* name : g_typeNames)
+		{
+			RegisterType(name, [name] (net::PeerBase* peer, net::Buffer& buffer)
+			{
+				g_received.push_back(std::string(name) + ":" + std::to_string(buffer.Read<uint8_t>()));
+			});
+		}
+	}
+};
+
+// the index a type should get - they're handed out in hash order, starting at 2
+int GetExpectedIndex(const char* name)
+{
+	std::vector<uint32_t> hashes;
+
+	for (const char* typeName : g_typeNames)
+	{
+		hashes.push_back(HashRageString(typeName));
+	}
+
+	std::sort(hashes.begin(), hashes.end());
+
+	return 2 + static_cast<int>(std::find(hashes.begin(), hashes.end(), HashRageString(name)) - hashes.begin());
+}
+
+class PeerBaseTests : public ::testing::Test
+{
+protected:
+	fwRefContainer<net::PeerBase> sender;
+
+	fwRefContainer<net::PeerBase> receiver;
+
+	// every packet the sender wrote, without the sequence - including the ones that got dropped
+	std::vector<std::vector<uint8_t>> sent;
+
+	// how many of the next packets going either way get lost
+	int dropsToReceiver;
+
+	int dropsToSender;
+
+	uint32_t injectedSequence;
+
+	virtual void SetUp() override
+	{
+		g_received.clear();
+
+		dropsToReceiver = 0;
+		dropsToSender = 0;
+		injectedSequence = 0;
+
+		sender = new net::PeerBase(new net::FunctionBufferDatagramSink([this] (const net::Buffer& packet)
+		{
+			sent.emplace_back(packet.GetBuffer() + 4, packet.GetBuffer() + packet.GetLength());
+
+			if (dropsToReceiver > 0)
+			{
+				dropsToReceiver--;
+				return;
+			}
+
+			receiver->ProcessPacket(packet);
+		}));
+
+		receiver = new net::PeerBase(new net::FunctionBufferDatagramSink([this] (const net::Buffer& packet)
+		{
+			if (dropsToSender > 0)
+			{
+				dropsToSender--;
+				return;
+			}
+
+			sender->ProcessPacket(packet);
+		}));
+
+		sender->RegisterHandler<TestHandler>();
+		receiver->RegisterHandler<TestHandler>();
+	}
+
+	void Send(const char* name, uint8_t value)
+	{
+		sender->SendNetMessage(HashRageString(name), net::Buffer(std::vector<uint8_t>{ value }));
+	}
+
+	size_t CountSent(uint8_t type)
+	{
+		return std::count_if(sent.begin(), sent.end(), [type] (const std::vector<uint8_t>& packet)
+		{
+			return packet[0] == type;
+		});
+	}
+
+	// hands the receiver a packet as if the sender wrote it, for mappings the sender wouldn't make
+	void Inject(const std::vector<uint8_t>& payload)
+	{
+		std::vector<uint8_t> packet(4);
+
+		injectedSequence++;
+		memcpy(&packet[0], &injectedSequence, sizeof(injectedSequence));
+
+		packet.insert(packet.end(), payload.begin(), payload.end());
+
+		receiver->ProcessPacket(packet);
+	}
+
+	static std::vector<uint8_t> MakeMapping(uint32_t mappingId, std::initializer_list<std::pair<uint8_t, const char*>> slots)
+	{
+		std::vector<uint8_t> packet(5);
+		packet[0] = 1;
+		memcpy(&packet[1], &mappingId, sizeof(mappingId));
+
+		for (auto& slot : slots)
+		{
+			uint32_t type = HashRageString(slot.second);
+
+			packet.push_back(slot.first);
+			packet.insert(packet.end(), reinterpret_cast<uint8_t*>(&type), reinterpret_cast<uint8_t*>(&type) + sizeof(type));
+		}
+
+		packet.push_back(0);
+
+		return packet;
+	}
+};
+}
+
+TEST_F(PeerBaseTests, AssignsIndicesInHashOrder)
+{
+	sender->SendMappingPacket();
+
+	ASSERT_EQ(1u, sent.size());
+
+	const std::vector<uint8_t>& mapping = sent[0];
+
+	// type, mapping id, three (index, hash) pairs and the end marker
+	ASSERT_EQ(1u + 4u + 3 * 5u + 1u, mapping.size());
+	EXPECT_EQ(1, mapping[0]);
+
+	uint32_t mappingId;
+	memcpy(&mappingId, &mapping[1], sizeof(mappingId));
+
+	EXPECT_EQ(1u, mappingId);
+
+	for (size_t i = 0; i < 3; i++)
+	{
+		uint32_t type;
+		memcpy(&type, &mapping[5 + (i * 5) + 1], sizeof(type));
+
+		auto name = std::find_if(std::begin(g_typeNames), std::end(g_typeNames), [type] (const char* typeName)
+		{
+			return HashRageString(typeName) == type;
+		});
+
+		ASSERT_NE(std::end(g_typeNames), name);
+		EXPECT_EQ(GetExpectedIndex(*name), mapping[5 + (i * 5)]);
+	}
+
+	EXPECT_EQ(0, mapping.back());
+
+	// every mapping gets an id of its own
+	sender->SendMappingPacket();
+
+	memcpy(&mappingId, &sent[1][1], sizeof(mappingId));
+
+	EXPECT_EQ(2u, mappingId);
+}
+
+TEST_F(PeerBaseTests, DispatchesIndicesToTheirSlots)
+{
+	sender->SendMappingPacket();
+
+	Send("c", 1);
+	Send("a", 2);
+	Send("b", 3);
+
+	ASSERT_EQ(4u, sent.size());
+	EXPECT_EQ(GetExpectedIndex("c"), sent[1][0]);
+	EXPECT_EQ(GetExpectedIndex("a"), sent[2][0]);
+	EXPECT_EQ(GetExpectedIndex("b"), sent[3][0]);
+
+	EXPECT_EQ(std::vector<std::string>({ "c:1", "a:2", "b:3" }), g_received);
+}
+
+TEST_F(PeerBaseTests, ResendsMappingAfterLostAck)
+{
+	dropsToSender = 1;
+
+	sender->SendMappingPacket();
+
+	// without the ack, the types keep going out with their hash
+	for (int i = 0; i < 31; i++)
+	{
+		Send("a", i);
+	}
+
+	EXPECT_EQ(31u, CountSent(0));
+	EXPECT_EQ(1u, CountSent(1));
+
+	// the 32nd one brings the mapping along again, which gets acknowledged this time
+	Send("a", 31);
+
+	EXPECT_EQ(2u, CountSent(1));
+
+	Send("a", 32);
+
+	EXPECT_EQ(GetExpectedIndex("a"), sent.back()[0]);
+
+	ASSERT_EQ(33u, g_received.size());
+	EXPECT_EQ("a:0", g_received.front());
+	EXPECT_EQ("a:32", g_received.back());
+}
+
+TEST_F(PeerBaseTests, KeepsHashesWhileMappingIsLost)
+{
+	dropsToReceiver = 1;
+
+	sender->SendMappingPacket();
+
+	Send("b", 1);
+
+	// the remote never heard of any index, so using one would get the message dropped
+	EXPECT_EQ(0, sent.back()[0]);
+	EXPECT_EQ(std::vector<std::string>({ "b:1" }), g_received);
+}
+
+TEST_F(PeerBaseTests, RemapDropsRemovedSlots)
+{
+	Inject(MakeMapping(1, { { 2, "a" }, { 3, "b" } }));
+	Inject({ 3, 1 });
+
+	EXPECT_EQ(std::vector<std::string>({ "b:1" }), g_received);
+
+	// a later mapping replaces the earlier one as a whole
+	Inject(MakeMapping(2, { { 2, "a" } }));
+	Inject({ 3, 2 });
+	Inject({ 2, 3 });
+
+	EXPECT_EQ(std::vector<std::string>({ "b:1", "a:3" }), g_received);
+}
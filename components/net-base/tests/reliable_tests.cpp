@@ -0,0 +1,275 @@
+#include "StdInc.h"
+#include <gtest/gtest.h>
+
+#include "NetPeerBase.h"
+#include "ReliableDatagramChannel.h"
+
+#include <queue>
+#include <random>
+
+namespace
+{
+struct PathOptions
+{
+	// in percent
+	double loss;
+
+	std::chrono::microseconds delay;
+
+	// up to this much gets added to the delay of every packet, reordering them
+	std::chrono::microseconds jitter;
+};
+
+// one direction of a simulated path, dropping packets at random and delivering the rest after the delay plus jitter
+class SimulatedLink
+{
+private:
+	struct InFlightPacket
+	{
+		std::chrono::microseconds deliveryTime;
+
+		uint64_t index;
+
+		net::Buffer packet;
+
+		inline bool operator>(const InFlightPacket& other) const
+		{
+			return (deliveryTime != other.deliveryTime) ? deliveryTime > other.deliveryTime : index > other.index;
+		}
+	};
+
+	std::priority_queue<InFlightPacket, std::vector<InFlightPacket>, std::greater<InFlightPacket>> m_packets;
+
+	std::mt19937& m_random;
+
+	PathOptions m_options;
+
+	uint64_t m_nextIndex;
+
+public:
+	SimulatedLink(std::mt19937& random, const PathOptions& options)
+		: m_random(random), m_options(options), m_nextIndex(0)
+	{
+
+	}
+
+	void Send(std::chrono::microseconds now, const net::Buffer& packet)
+	{
+		if (std::uniform_real_distribution<double>(0.0, 100.0)(m_random) < m_options.loss)
+		{
+			return;
+		}
+
+		InFlightPacket inFlight;
+		inFlight.deliveryTime = now + m_options.delay + std::chrono::microseconds(std::uniform_int_distribution<int64_t>(0, m_options.jitter.count())(m_random));
+		inFlight.index = m_nextIndex++;
+		inFlight.packet = packet;
+
+		m_packets.push(std::move(inFlight));
+	}
+
+	template<typename TFn>
+	void Deliver(std::chrono::microseconds now, const TFn& fn)
+	{
+		while (!m_packets.empty() && m_packets.top().deliveryTime <= now)
+		{
+			// copy before popping, as the receiver may send on this link again
+			net::Buffer packet = m_packets.top().packet;
+			m_packets.pop();
+
+			fn(packet);
+		}
+	}
+};
+
+// one end of the simulation - messages carry their stream and sequence, which get recorded as they arrive
+struct Endpoint
+{
+	fwRefContainer<net::ReliableDatagramChannel> channel;
+
+	std::vector<std::vector<uint32_t>> received;
+
+	std::vector<uint32_t> sendSequences;
+
+	uint32_t sent;
+};
+
+class ReliableChannelTests : public ::testing::Test
+{
+protected:
+	static const int StreamCount = 4;
+
+	std::chrono::microseconds simulatedTime;
+
+	Endpoint endpoints[2];
+
+	// runs until both sides received `messages` messages and got everything they sent acknowledged, or the time limit passes
+	void Simulate(const PathOptions& options, uint32_t messages, uint32_t initialPacketNumber = 0)
+	{
+		std::mt19937 random(1234);
+
+		simulatedTime = std::chrono::microseconds(0);
+
+		auto clock = [this] ()
+		{
+			return net::ReliableDatagramChannel::TimePoint(std::chrono::duration_cast<std::chrono::steady_clock::duration>(simulatedTime));
+		};
+
+		SimulatedLink links[2] = { SimulatedLink(random, options), SimulatedLink(random, options) };
+
+		for (int i = 0; i < 2; i++)
+		{
+			SimulatedLink* link = &links[i];
+			Endpoint* endpoint = &endpoints[i];
+
+			endpoint->channel = new net::ReliableDatagramChannel();
+			endpoint->channel->SetClock(clock);
+			endpoint->channel->SetInitialPacketNumber(initialPacketNumber);
+			endpoint->channel->SetSink(new net::FunctionBufferDatagramSink([this, link] (const net::Buffer& packet)
+			{
+				link->Send(simulatedTime, packet);
+			}));
+
+			endpoint->received.resize(StreamCount);
+			endpoint->sendSequences.resize(StreamCount);
+			endpoint->sent = 0;
+
+			for (int stream = 0; stream < StreamCount; stream++)
+			{
+				endpoint->channel->SetStreamSink(stream, new net::FunctionBufferDatagramSink([endpoint, stream] (const net::Buffer& message)
+				{
+					uint32_t sequence;
+					memcpy(&sequence, message.GetBuffer() + 1, sizeof(sequence));
+
+					// a message on the wrong stream shows up as an out of place sequence
+					endpoint->received[stream].push_back((message.GetBuffer()[0] == stream) ? sequence : UINT32_MAX);
+				}));
+			}
+		}
+
+		std::vector<uint8_t> payload(64, 'x');
+
+		const auto step = std::chrono::microseconds(100);
+		const auto timeLimit = std::chrono::seconds(600);
+
+		while (simulatedTime < timeLimit)
+		{
+			bool done = true;
+
+			for (int i = 0; i < 2; i++)
+			{
+				auto& endpoint = endpoints[i];
+
+				// keep the channel busy, without queueing everything up front
+				while (endpoint.sent < messages && endpoint.channel->GetPendingMessages() < 256)
+				{
+					int stream = endpoint.sent % StreamCount;
+
+					payload[0] = static_cast<uint8_t>(stream);
+					memcpy(&payload[1], &endpoint.sendSequences[stream], sizeof(uint32_t));
+
+					endpoint.sendSequences[stream]++;
+
+					endpoint.channel->Send(stream, net::Buffer(payload));
+					endpoint.sent++;
+				}
+
+				endpoint.channel->Update();
+
+				if (GetReceived(endpoints[i ^ 1]) < messages || endpoint.channel->GetPendingMessages() > 0)
+				{
+					done = false;
+				}
+			}
+
+			if (done)
+			{
+				break;
+			}
+
+			simulatedTime += step;
+
+			for (int i = 0; i < 2; i++)
+			{
+				auto& receiver = endpoints[i ^ 1];
+
+				links[i].Deliver(simulatedTime, [&receiver] (const net::Buffer& packet)
+				{
+					receiver.channel->ProcessPacket(packet);
+				});
+			}
+		}
+	}
+
+	static size_t GetReceived(const Endpoint& endpoint)
+	{
+		size_t count = 0;
+
+		for (auto& stream : endpoint.received)
+		{
+			count += stream.size();
+		}
+
+		return count;
+	}
+
+	// every stream has to have gotten each of its messages exactly once, in order
+	void ExpectCompleteDelivery(uint32_t messages)
+	{
+		for (int i = 0; i < 2; i++)
+		{
+			for (int stream = 0; stream < StreamCount; stream++)
+			{
+				std::vector<uint32_t> expected(messages / StreamCount);
+
+				for (uint32_t sequence = 0; sequence < expected.size(); sequence++)
+				{
+					expected[sequence] = sequence;
+				}
+
+				EXPECT_EQ(expected, endpoints[i].received[stream]) << "side " << i << ", stream " << stream;
+			}
+		}
+	}
+};
+}
+
+TEST_F(ReliableChannelTests, DeliversOverPerfectPath)
+{
+	Simulate({ 0.0, std::chrono::milliseconds(20), std::chrono::microseconds(0) }, 2000);
+
+	ExpectCompleteDelivery(2000);
+
+	for (auto& endpoint : endpoints)
+	{
+		EXPECT_EQ(0u, endpoint.channel->GetStatistics().packetsLost);
+		EXPECT_EQ(0u, endpoint.channel->GetPendingMessages());
+	}
+}
+
+TEST_F(ReliableChannelTests, DeliversOverLossyReorderingPath)
+{
+	Simulate({ 5.0, std::chrono::milliseconds(50), std::chrono::milliseconds(10) }, 8000);
+
+	ExpectCompleteDelivery(8000);
+
+	for (auto& endpoint : endpoints)
+	{
+		// the simulation has to have actually exercised recovery
+		EXPECT_GT(endpoint.channel->GetStatistics().retransmissions, 0u);
+		EXPECT_EQ(0u, endpoint.channel->GetPendingMessages());
+	}
+}
+
+TEST_F(ReliableChannelTests, SurvivesPacketNumberWraparound)
+{
+	Simulate({ 5.0, std::chrono::milliseconds(50), std::chrono::milliseconds(10) }, 8000, UINT32_MAX - 100);
+
+	ExpectCompleteDelivery(8000);
+
+	for (auto& endpoint : endpoints)
+	{
+		EXPECT_GT(endpoint.channel->GetStatistics().packetsSent, 200u);
+		EXPECT_EQ(0u, endpoint.channel->GetPendingMessages());
+	}
+}
@@ -0,0 +1,304 @@
+#include "StdInc.h"
+#include <gtest/gtest.h>
+
+#include "SequencedInputDatagramChannel.h"
+#include "SequencedOutputDatagramChannel.h"
+
+#include <thread>
+
+namespace
+{
+// keeps the sequence every delivered packet was sent with, as packets carry that as their payload
+class RecordingSink : public net::DatagramSink
+{
+public:
+	std::vector<uint32_t> received;
+
+	virtual void WritePacket(const std::vector<uint8_t>& packet) override
+	{
+		uint32_t sequence = 0;
+		memcpy(&sequence, packet.data(), std::min(packet.size(), sizeof(sequence)));
+
+		received.push_back(sequence);
+	}
+};
+
+// hands packets straight to an input channel, dropping the ones asked to
+class LossySink : public net::DatagramSink
+{
+public:
+	net::SequencedInputDatagramChannel* channel;
+
+	std::vector<bool> drops;
+
+	virtual void WritePacket(const std::vector<uint8_t>& packet) override
+	{
+		WritePacket(net::Buffer(packet));
+	}
+
+	virtual void WritePacket(const net::Buffer& packet) override
+	{
+		bool drop = !drops.empty() && drops.front();
+
+		if (!drops.empty())
+		{
+			drops.erase(drops.begin());
+		}
+
+		if (!drop)
+		{
+			channel->ProcessPacket(packet);
+		}
+	}
+};
+
+std::vector<uint8_t> MakePacket(uint32_t sequence, uint32_t payload)
+{
+	std::vector<uint8_t> packet(8);
+	memcpy(&packet[0], &sequence, sizeof(sequence));
+	memcpy(&packet[4], &payload, sizeof(payload));
+
+	return packet;
+}
+
+std::vector<uint8_t> MakePacket(uint32_t sequence)
+{
+	return MakePacket(sequence, sequence);
+}
+
+class SequencedInputTests : public ::testing::Test
+{
+protected:
+	net::SequencedInputDatagramChannel channel;
+
+	fwRefContainer<RecordingSink> sink;
+
+	virtual void SetUp() override
+	{
+		sink = new RecordingSink();
+		channel.SetSink(sink);
+	}
+
+	void Receive(std::initializer_list<uint32_t> sequences)
+	{
+		for (uint32_t sequence : sequences)
+		{
+			channel.ProcessPacket(MakePacket(sequence));
+		}
+	}
+};
+}
+
+TEST_F(SequencedInputTests, DeliversInOrder)
+{
+	Receive({ 1, 2, 3 });
+
+	EXPECT_EQ(std::vector<uint32_t>({ 1, 2, 3 }), sink->received);
+	EXPECT_EQ(3u, channel.GetSequence());
+	EXPECT_EQ(3u, channel.GetStatistics().delivered);
+	EXPECT_EQ(0u, channel.GetStatistics().lost);
+}
+
+TEST_F(SequencedInputTests, IgnoresPacketsWithoutPayload)
+{
+	channel.ProcessPacket(std::vector<uint8_t>(4));
+
+	EXPECT_TRUE(sink->received.empty());
+	EXPECT_EQ(0u, channel.GetSequence());
+}
+
+TEST_F(SequencedInputTests, SkipsGapsWithoutWindow)
+{
+	Receive({ 1, 3 });
+
+	EXPECT_EQ(std::vector<uint32_t>({ 1, 3 }), sink->received);
+	EXPECT_EQ(1u, channel.GetStatistics().lost);
+
+	// too late to be delivered now
+	Receive({ 2 });
+
+	EXPECT_EQ(2u, sink->received.size());
+	EXPECT_EQ(1u, channel.GetStatistics().late);
+}
+
+TEST_F(SequencedInputTests, ReorderWindowRestoresOrder)
+{
+	channel.SetReorderWindow(4, std::chrono::milliseconds(1000));
+
+	Receive({ 1, 3, 4 });
+
+	EXPECT_EQ(std::vector<uint32_t>({ 1 }), sink->received);
+	EXPECT_TRUE(channel.HasPendingPackets());
+
+	Receive({ 2 });
+
+	EXPECT_EQ(std::vector<uint32_t>({ 1, 2, 3, 4 }), sink->received);
+	EXPECT_FALSE(channel.HasPendingPackets());
+
+	EXPECT_EQ(4u, channel.GetStatistics().delivered);
+	EXPECT_EQ(1u, channel.GetStatistics().reordered);
+	EXPECT_EQ(0u, channel.GetStatistics().lost);
+}
+
+TEST_F(SequencedInputTests, ReorderWindowOverflowSkipsGap)
+{
+	channel.SetReorderWindow(2, std::chrono::milliseconds(1000));
+
+	Receive({ 1, 3, 4 });
+
+	EXPECT_EQ(std::vector<uint32_t>({ 1 }), sink->received);
+
+	// a third pending packet doesn't fit, so 2 is given up on
+	Receive({ 5 });
+
+	EXPECT_EQ(std::vector<uint32_t>({ 1, 3, 4, 5 }), sink->received);
+	EXPECT_FALSE(channel.HasPendingPackets());
+	EXPECT_EQ(1u, channel.GetStatistics().lost);
+
+	Receive({ 2 });
+
+	EXPECT_EQ(4u, sink->received.size());
+	EXPECT_EQ(1u, channel.GetStatistics().late);
+}
+
+TEST_F(SequencedInputTests, ReorderWindowTimesOut)
+{
+	channel.SetReorderWindow(8, std::chrono::milliseconds(10));
+
+	Receive({ 1, 3 });
+
+	EXPECT_EQ(std::vector<uint32_t>({ 1 }), sink->received);
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	channel.ProcessTimeouts();
+
+	EXPECT_EQ(std::vector<uint32_t>({ 1, 3 }), sink->received);
+	EXPECT_FALSE(channel.HasPendingPackets());
+	EXPECT_EQ(1u, channel.GetStatistics().lost);
+}
+
+TEST_F(SequencedInputTests, ShrinkingWindowDeliversPending)
+{
+	channel.SetReorderWindow(4, std::chrono::milliseconds(1000));
+
+	Receive({ 1, 3, 4 });
+
+	channel.SetReorderWindow(0, std::chrono::milliseconds(0));
+
+	EXPECT_EQ(std::vector<uint32_t>({ 1, 3, 4 }), sink->received);
+	EXPECT_FALSE(channel.HasPendingPackets());
+}
+
+TEST_F(SequencedInputTests, DropsDuplicates)
+{
+	Receive({ 1, 2, 2, 1 });
+
+	EXPECT_EQ(std::vector<uint32_t>({ 1, 2 }), sink->received);
+	EXPECT_EQ(2u, channel.GetStatistics().duplicates);
+	EXPECT_EQ(0u, channel.GetStatistics().late);
+}
+
+TEST_F(SequencedInputTests, DropsPendingDuplicates)
+{
+	channel.SetReorderWindow(4, std::chrono::milliseconds(1000));
+
+	Receive({ 1, 3, 3 });
+
+	EXPECT_EQ(1u, channel.GetStatistics().duplicates);
+
+	Receive({ 2 });
+
+	EXPECT_EQ(std::vector<uint32_t>({ 1, 2, 3 }), sink->received);
+}
+
+TEST_F(SequencedInputTests, BitmapCoversLast64Sequences)
+{
+	Receive({ 1, 3, 66 });
+
+	// 3 is still in the bitmap, so it's a duplicate - 2 is too, but never arrived, so it's late
+	Receive({ 3, 2 });
+
+	EXPECT_EQ(1u, channel.GetStatistics().duplicates);
+	EXPECT_EQ(1u, channel.GetStatistics().late);
+
+	// 1 fell out of the bitmap, so it can only be told to be late
+	Receive({ 1 });
+
+	EXPECT_EQ(1u, channel.GetStatistics().duplicates);
+	EXPECT_EQ(2u, channel.GetStatistics().late);
+}
+
+TEST_F(SequencedInputTests, DuplicatesBeyondBitmapStayPending)
+{
+	channel.SetReorderWindow(8, std::chrono::milliseconds(1000));
+
+	Receive({ 1, 100, 200 });
+
+	// 100 is too far behind 200 for the bitmap, but it's still waiting
+	Receive({ 100 });
+
+	EXPECT_EQ(1u, channel.GetStatistics().duplicates);
+	EXPECT_EQ(std::vector<uint32_t>({ 1 }), sink->received);
+}
+
+TEST_F(SequencedInputTests, PassesOutOfBandPackets)
+{
+	channel.SetReorderWindow(4, std::chrono::milliseconds(1000));
+
+	Receive({ 1, 3 });
+
+	// out-of-band packets go out right away, even while a gap is pending
+	channel.ProcessPacket(MakePacket(net::SequencedInputDatagramChannel::OutOfBandSequence, 42));
+
+	EXPECT_EQ(std::vector<uint32_t>({ 1, 42 }), sink->received);
+	EXPECT_EQ(1u, channel.GetSequence());
+	EXPECT_EQ(1u, channel.GetStatistics().outOfBand);
+
+	fwRefContainer<RecordingSink> outOfBandSink = new RecordingSink();
+	channel.SetOutOfBandSink(outOfBandSink);
+
+	channel.ProcessPacket(MakePacket(net::SequencedInputDatagramChannel::OutOfBandSequence, 43));
+
+	EXPECT_EQ(std::vector<uint32_t>({ 43 }), outOfBandSink->received);
+	EXPECT_EQ(2u, sink->received.size());
+	EXPECT_EQ(2u, channel.GetStatistics().outOfBand);
+}
+
+TEST_F(SequencedInputTests, ResetStartsOver)
+{
+	channel.SetReorderWindow(4, std::chrono::milliseconds(1000));
+
+	Receive({ 1, 2, 4 });
+
+	channel.Reset();
+
+	EXPECT_FALSE(channel.HasPendingPackets());
+
+	Receive({ 1 });
+
+	EXPECT_EQ(std::vector<uint32_t>({ 1, 2, 1 }), sink->received);
+	EXPECT_EQ(1u, channel.GetSequence());
+}
+
+TEST_F(SequencedInputTests, ReceivesFromOutputChannel)
+{
+	net::SequencedOutputDatagramChannel output;
+
+	fwRefContainer<LossySink> wire = new LossySink();
+	wire->channel = &channel;
+	wire->drops = { false, true, false, false };
+	output.SetSink(wire);
+
+	for (uint32_t i = 1; i <= 4; i++)
+	{
+		output.WritePacket(net::Buffer(reinterpret_cast<const uint8_t*>(&i), sizeof(i)));
+	}
+
+	uint32_t outOfBand = 42;
+	output.WriteOutOfBandPacket(net::Buffer(reinterpret_cast<const uint8_t*>(&outOfBand), sizeof(outOfBand)));
+
+	EXPECT_EQ(std::vector<uint32_t>({ 1, 3, 4, 42 }), sink->received);
+	EXPECT_EQ(4u, channel.GetSequence());
+	EXPECT_EQ(1u, channel.GetStatistics().lost);
+	EXPECT_EQ(1u, channel.GetStatistics().outOfBand);
+}
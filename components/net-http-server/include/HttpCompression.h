@@ -0,0 +1,86 @@
+/*
+ * This file is part of the CitizenFX project - http://citizen.re/
+ *
+ * See LICENSE and MENTIONS in the root of the source tree for information
+ * regarding licensing.
+ */
+
+#pragma once
+
+#include <boost/utility/string_ref.hpp>
+
+#include <memory>
+#include <vector>
+
+struct z_stream_s;
+
+namespace net
+{
+enum class HttpContentEncoding
+{
+	Identity,
+	Gzip,
+	Deflate
+};
+
+// response compression settings
+struct HttpCompressionOptions
+{
+	// the zlib compression level from 1 (fastest) to 9 (smallest), or 0 to not compress at all - levels out of range get
+	// clamped to these when set
+	int level;
+
+	// bodies smaller than this don't gain enough to be worth compressing
+	size_t minimumSize;
+
+	// the amount of memory static file handlers may keep precompressed bodies in
+	size_t cacheSize;
+
+	HttpCompressionOptions()
+		: level(6), minimumSize(1024), cacheSize(32 * 1024 * 1024)
+	{
+
+	}
+};
+
+// clamps the options to what zlib accepts
+HttpCompressionOptions ValidateCompressionOptions(const HttpCompressionOptions& options);
+
+// picks an encoding from an Accept-Encoding header - gzip is preferred where both are acceptable
+HttpContentEncoding NegotiateContentEncoding(const boost::string_ref& acceptEncoding);
+
+const char* GetContentEncodingName(HttpContentEncoding encoding);
+
+// text-like content types compress well, while most media formats are compressed already
+bool IsCompressibleContentType(const boost::string_ref& contentType);
+
+// a streaming deflate compressor, producing either gzip or zlib framing
+class
+#ifdef COMPILING_NET_HTTP_SERVER
+	DLL_EXPORT
+#endif
+	HttpCompressor
+{
+private:
+	std::unique_ptr<z_stream_s> m_stream;
+
+	// zlib refused to set up the stream, e.g. for an invalid level
+	bool m_failed;
+
+public:
+	HttpCompressor(HttpContentEncoding encoding, int level);
+
+	~HttpCompressor();
+
+	// whether the stream got set up - bodies should be sent uncompressed otherwise
+	inline bool IsValid() const
+	{
+		return !m_failed;
+	}
+
+	// appends the compressed data to `output` - unless `finish` ends the stream, everything is flushed, so whatever was
+	// written so far can be decompressed by the client right away. returns false, leaving `output` as it was, if zlib
+	// failed, after which the stream can't be continued
+	bool Compress(const void* data, size_t length, bool finish, std::vector<uint8_t>& output);
+};
+}
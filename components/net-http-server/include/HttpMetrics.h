@@ -0,0 +1,53 @@
+/*
+ * This file is part of the CitizenFX project - http://citizen.re/
+ *
+ * See LICENSE and MENTIONS in the root of the source tree for information
+ * regarding licensing.
+ */
+
+#pragma once
+
+#include "HttpServer.h"
+#include "MetricsCollector.h"
+
+namespace net
+{
+// what gets recorded for the requests handled by a route
+struct HttpRouteMetrics
+{
+	// responses by status class, from 1xx to 5xx
+	MetricCounter responses[5];
+
+	// the time from a request having been read until its response ended, in microseconds
+	MetricHistogram latency;
+};
+
+// what gets recorded for a server as a whole
+struct HttpServerMetrics
+{
+	// requests that have been read, but not responded to yet
+	MetricGauge requestsInFlight;
+
+	// requests not handled by any route
+	HttpRouteMetrics unrouted;
+};
+
+// adds a route's metrics to a collector, labeled with the route pattern and method
+void AddHttpRouteMetrics(MetricsCollector* collector, const std::string& method, const std::string& pattern, const std::shared_ptr<HttpRouteMetrics>& metrics);
+
+// serves a collector's metrics in the Prometheus text format - e.g. when registered for GET /metrics
+class
+#ifdef COMPILING_NET_HTTP_SERVER
+	DLL_EXPORT
+#endif
+	HttpMetricsHandler : public HttpHandler
+{
+private:
+	fwRefContainer<MetricsCollector> m_collector;
+
+public:
+	HttpMetricsHandler(const fwRefContainer<MetricsCollector>& collector);
+
+	virtual bool HandleRequest(fwRefContainer<HttpRequest> request, fwRefContainer<HttpResponse> response) override;
+};
+}
@@ -0,0 +1,85 @@
+/*
+ * This file is part of the CitizenFX project - http://citizen.re/
+ *
+ * See LICENSE and MENTIONS in the root of the source tree for information
+ * regarding licensing.
+ */
+
+#pragma once
+
+#include "HttpServer.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace net
+{
+// a trie of path segments mapping request paths to handlers
+//
+// patterns consist of literal segments, `:name` segments capturing a route parameter and an optional trailing `*`
+// matching the path and anything below it, e.g. "/info.json", "/players/:id" or "/files/*". query strings and
+// empty segments are ignored when matching.
+//
+// when multiple routes match, exact routes come before prefix routes, deeper ones before shallower ones and literal
+// segments before parameters - each matching handler is tried until one returns true or ends the response.
+class
+#ifdef COMPILING_NET_HTTP_SERVER
+	DLL_EXPORT
+#endif
+	HttpRouter
+{
+private:
+	struct Route
+	{
+		// the method to match, or empty for any
+		std::string method;
+
+		fwRefContainer<HttpHandler> handler;
+
+		std::shared_ptr<HttpRouteMetrics> metrics;
+	};
+
+	struct Node
+	{
+		// literal child segments, looked up without having to copy the request's segment
+		std::map<std::string, uint32_t, std::less<>> children;
+
+		// the node index for a parameter segment, 0 meaning there's none
+		uint32_t parameterChild;
+
+		std::string parameterName;
+
+		std::vector<Route> exactRoutes;
+
+		std::vector<Route> prefixRoutes;
+
+		Node()
+			: parameterChild(0)
+		{
+
+		}
+	};
+
+	typedef std::vector<Node> Trie;
+
+	// the current trie - registering copies it, so requests can keep matching against a snapshot without locking
+	std::shared_ptr<const Trie> m_trie;
+
+	std::mutex m_registerMutex;
+
+private:
+	bool Match(const Trie& trie, uint32_t nodeIndex, const std::vector<boost::string_ref>& segments, size_t segmentIndex, RouteParameterList& parameters, const fwRefContainer<HttpRequest>& request, const fwRefContainer<HttpResponse>& response) const;
+
+	bool TryRoutes(const std::vector<Route>& routes, const RouteParameterList& parameters, const fwRefContainer<HttpRequest>& request, const fwRefContainer<HttpResponse>& response) const;
+
+public:
+	HttpRouter();
+
+	// `metrics`, if given, get attached to the responses of requests the route handles
+	void AddRoute(const std::string& method, const std::string& pattern, const fwRefContainer<HttpHandler>& handler, const std::shared_ptr<HttpRouteMetrics>& metrics = std::shared_ptr<HttpRouteMetrics>());
+
+	// returns true if a matching handler handled the request
+	bool Dispatch(const fwRefContainer<HttpRequest>& request, const fwRefContainer<HttpResponse>& response) const;
+};
+}
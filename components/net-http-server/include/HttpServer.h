@@ -8,6 +8,13 @@
 #pragma once
 
 #include "TcpServer.h"
+#include "HttpCompression.h"
+
+#include <boost/utility/string_ref.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
 
 namespace net
 {
@@ -21,22 +28,98 @@ struct HeaderComparator : std::binary_function<std::string, std::string, bool>
 
 typedef std::map<std::string, std::string, HeaderComparator> HeaderMap;
 
-class HttpRequest : public fwRefCountable
+// request headers, as views into the request's header data
+typedef std::vector<std::pair<boost::string_ref, boost::string_ref>> HeaderViewList;
+
+// parameters captured by a route pattern, with values pointing into the request path
+typedef std::vector<std::pair<std::string, boost::string_ref>> RouteParameterList;
+
+// limits on what clients may send
+struct HttpRequestLimits
 {
+	size_t maxHeaderCount;
+
+	// the size of the request line and headers together
+	size_t maxHeaderSize;
+
+	// the body size allowed unless a handler changes it for its request - larger bodies get refused with a 413
+	uint64_t maxBodySize;
+
+	// the message size allowed on WebSockets, unless changed for a socket - this and maxHeaderSize also bound how much
+	// unprocessed data a connection buffers, e.g. for pipelined requests
+	size_t maxWebSocketMessageSize;
+
+	// how long a connection may wait for its next request, in milliseconds - while requests are being read and handled,
+	// the stream's own idle timeout applies instead. 0 leaves the stream's idle timeout in place throughout
+	uint32_t keepAliveTimeout;
+
+	// how long the request line and headers may take to arrive once a request started coming in, in milliseconds - 0
+	// lets them take forever
+	uint32_t headerTimeout;
+
+	HttpRequestLimits()
+		: maxHeaderCount(50), maxHeaderSize(64 * 1024), maxBodySize(5 * 1024 * 1024), maxWebSocketMessageSize(1024 * 1024),
+		  keepAliveTimeout(15000), headerTimeout(20000)
+	{
+
+	}
+};
+
+class HttpConnection;
+
+class HttpRouter;
+
+class HttpWebSocket;
+
+struct HttpRouteMetrics;
+
+class MetricsCollector;
+
+class
+#ifdef COMPILING_NET_HTTP_SERVER
+	DLL_EXPORT
+#endif
+	HttpRequest : public fwRefCountable
+{
+	friend class HttpConnection;
+
+public:
+	// a piece of the body, which is only valid for the duration of the call
+	typedef std::function<void(const uint8_t* data, size_t length)> TBodyChunkHandler;
+
+	typedef std::function<void()> TBodyEndHandler;
+
 private:
 	int m_httpVersionMajor;
 	int m_httpVersionMinor;
 
-	std::string m_requestMethod;
+	// the raw request line and headers - the method, path and header views all point into this
+	std::vector<char> m_headerData;
 
-	std::string m_path;
+	boost::string_ref m_requestMethod;
 
-	HeaderMap m_headerList;
+	boost::string_ref m_path;
+
+	HeaderViewList m_headerList;
+
+	RouteParameterList m_routeParameters;
 
 	std::function<void(const std::vector<uint8_t>&)> m_dataHandler;
 
+	TBodyChunkHandler m_bodyChunkHandler;
+
+	TBodyEndHandler m_bodyEndHandler;
+
+	uint64_t m_maxBodySize;
+
+	std::atomic<bool> m_bodyPaused;
+
+	// the connection the body gets read from, if any
+	std::weak_ptr<HttpConnection> m_connection;
+
 public:
-	HttpRequest(int httpVersionMajor, int httpVersionMinor, const std::string& requestMethod, const std::string& path, const HeaderMap& headerList);
+	// views have to point into `headerData` - moving the vector keeps its storage, so they stay valid
+	HttpRequest(int httpVersionMajor, int httpVersionMinor, std::vector<char>&& headerData, const boost::string_ref& requestMethod, const boost::string_ref& path, HeaderViewList&& headerList);
 
 	virtual ~HttpRequest() override;
 
@@ -45,36 +128,103 @@ public:
 		return m_dataHandler;
 	}
 
+	// sets a handler getting the whole body in one go, once it has been received - bodies are buffered for this, so
+	// large ones should rather be streamed using SetBodyHandlers
 	inline void SetDataHandler(const std::function<void(const std::vector<uint8_t>& data)>& handler)
 	{
 		m_dataHandler = handler;
 	}
 
+	// sets handlers getting the body as it arrives, with any chunked transfer encoding removed - these replace the data
+	// handler, and get called on the connection's thread. the end handler gets called once the body is complete, which
+	// for requests without a body is right after the request got handled.
+	inline void SetBodyHandlers(const TBodyChunkHandler& chunkHandler, const TBodyEndHandler& endHandler)
+	{
+		m_bodyChunkHandler = chunkHandler;
+		m_bodyEndHandler = endHandler;
+	}
+
+	inline uint64_t GetMaxBodySize() const
+	{
+		return m_maxBodySize;
+	}
+
+	// overrides the server's body size limit for this request - to apply, this has to be set while handling the request
+	inline void SetMaxBodySize(uint64_t maxBodySize)
+	{
+		m_maxBodySize = maxBodySize;
+	}
+
+	// holds off passing on body data, and stops reading from the client once more arrives - for consumers that fall
+	// behind, e.g. when writing the body elsewhere. a paused body has to be resumed for the connection to continue.
+	// both may be called from any thread.
+	inline void PauseBody()
+	{
+		m_bodyPaused = true;
+	}
+
+	void ResumeBody();
+
+	inline bool IsBodyPaused() const
+	{
+		return m_bodyPaused;
+	}
+
 	inline std::pair<int, int> GetHttpVersion() const
 	{
 		return std::make_pair(m_httpVersionMajor, m_httpVersionMinor);
 	}
 
-	inline const std::string& GetRequestMethod() const
+	inline const boost::string_ref& GetRequestMethod() const
 	{
 		return m_requestMethod;
 	}
 
-	inline const std::string& GetPath() const
+	inline const boost::string_ref& GetPath() const
 	{
 		return m_path;
 	}
 
-	inline const HeaderMap& GetHeaders() const
+	inline const HeaderViewList& GetHeaders() const
 	{
 		return m_headerList;
 	}
 
-	inline const std::string& GetHeader(const std::string& key, const std::string& default = std::string()) const
+	// header names are matched case-insensitively - a plain scan beats a map for the handful of headers a request has
+	inline boost::string_ref GetHeader(const boost::string_ref& key, const boost::string_ref& defaultValue = boost::string_ref()) const
+	{
+		for (auto& header : m_headerList)
+		{
+			if (header.first.size() == key.size() && _strnicmp(header.first.data(), key.data(), key.size()) == 0)
+			{
+				return header.second;
+			}
+		}
+
+		return defaultValue;
+	}
+
+	inline const RouteParameterList& GetRouteParameters() const
 	{
-		auto it = m_headerList.find(key);
+		return m_routeParameters;
+	}
+
+	inline void SetRouteParameters(const RouteParameterList& parameters)
+	{
+		m_routeParameters = parameters;
+	}
 
-		return (it != m_headerList.end()) ? it->second : default;
+	inline boost::string_ref GetRouteParameter(const std::string& name) const
+	{
+		for (auto& parameter : m_routeParameters)
+		{
+			if (parameter.first == name)
+			{
+				return parameter.second;
+			}
+		}
+
+		return boost::string_ref();
 	}
 };
 
@@ -84,11 +234,20 @@ class
 #endif
 	HttpResponse : public fwRefCountable
 {
+	friend class HttpConnection;
+
+	friend class HttpRouter;
+
+	friend class HttpWebSocket;
+
 private:
 	fwRefContainer<HttpRequest> m_request;
 
 	fwRefContainer<TcpServerStream> m_clientStream;
 
+	// the connection ordering pipelined responses, if any
+	std::shared_ptr<HttpConnection> m_connection;
+
 	int m_statusCode;
 
 	bool m_ended;
@@ -97,14 +256,56 @@ private:
 
 	bool m_closeConnection;
 
+	// the body is sent using chunked transfer encoding, as no Content-Length was known when sending the headers
+	bool m_chunked;
+
+	// set while an earlier response on the same connection hasn't ended yet - writes get held back until then
+	bool m_writeBlocked;
+
+	std::vector<std::function<void(const fwRefContainer<TcpServerStream>&)>> m_blockedWrites;
+
+	std::function<void()> m_drainHandler;
+
+	// set on the stream's thread once the response ended and its writes got queued - only then can the next one write
+	bool m_flushed;
+
+	// compresses the body while it's being streamed, if the headers got sent without a Content-Length
+	std::unique_ptr<HttpCompressor> m_compressor;
+
 	HeaderMap m_headerList;
 
+	// the metrics of the route handling this, if any - these live as long as the server does
+	HttpRouteMetrics* m_routeMetrics;
+
+	// set while this is counted as in flight, from when the request was read
+	bool m_inFlight;
+
+	std::chrono::steady_clock::time_point m_startTime;
+
 private:
-	static std::string GetStatusMessage(int statusCode);
+	static const char* GetStatusMessage(int statusCode);
+
+	// serializes the status line and headers, reserving room for a body of `bodyLength` bytes to be appended
+	void SerializeHead(int statusCode, const std::string& statusMessage, const HeaderMap& headers, size_t bodyLength, std::vector<uint8_t>& outData);
+
+	// picks the encoding to compress a body with - `bodyLength` being -1 if it's not known yet
+	HttpContentEncoding GetCompressionEncoding(int statusCode, const HeaderMap& headers, size_t bodyLength);
+
+	// writes body data, framed as a chunk if needed
+	void WriteBody(const uint8_t* data, size_t length);
+
+	// writes body data through the compressor - if compressing fails, the stream gets closed, returning false
+	bool WriteCompressed(const void* data, size_t length, bool finish);
+
+	void WriteOut(std::vector<uint8_t>&& data);
 
 public:
 	HttpResponse(fwRefContainer<TcpServerStream> clientStream, fwRefContainer<HttpRequest> request);
 
+	HttpResponse(fwRefContainer<TcpServerStream> clientStream, fwRefContainer<HttpRequest> request, const std::shared_ptr<HttpConnection>& connection);
+
+	virtual ~HttpResponse() override;
+
 	std::string GetHeader(const std::string& name);
 
 	void RemoveHeader(const std::string& name);
@@ -119,12 +320,34 @@ public:
 
 	void WriteHead(int statusCode, const std::string& statusMessage, const HeaderMap& headers);
 
+	// writes part of the body - without a Content-Length header having been set, HTTP/1.1 responses get streamed using
+	// chunked transfer encoding, and HTTP/1.0 responses get delimited by closing the connection. such bodies also get
+	// compressed if the client accepts it and the Content-Type is compressible, flushing the compressor on every write.
 	void Write(const std::string& data);
 
+	// runs a callback on the thread the connection invokes its callbacks on
+	void ScheduleCallback(const std::function<void()>& callback);
+
+	// whether writes go out right away - they'd otherwise pile up in memory, as the stream's write queue is above its high
+	// water mark, an earlier response on the connection is still being sent, or as the connection is closing. only
+	// meaningful on the connection's thread
+	bool IsWritable();
+
+	// called on the connection's thread whenever the response may have become writable - a handler set on a closing
+	// connection gets dropped, so whatever it references doesn't stay around
+	void SetDrainHandler(const std::function<void()>& handler);
+
 	void End();
 
+	// ends the response with a final piece of body data - if no headers have been sent yet, this sets Content-Length,
+	// compressing the data in one go if it's worth it
 	void End(const std::string& data);
 
+	// completes the handshake for a WebSocket upgrade request, selecting `protocol` if given - this has to be called while
+	// handling the request. requests that aren't valid upgrades get answered with a 400 (or 426 for unsupported
+	// versions), returning null. see HttpWebSocket.h
+	fwRefContainer<HttpWebSocket> AcceptWebSocket(const std::string& protocol = std::string());
+
 	inline int GetStatusCode()
 	{
 		return m_statusCode;
@@ -157,6 +380,19 @@ class HttpServer : public fwRefCountable
 public:
 	virtual void AttachToServer(fwRefContainer<TcpServer> server) = 0;
 
+	// registers a handler that gets to see every request not handled by a route
 	virtual void RegisterHandler(fwRefContainer<HttpHandler> handler) = 0;
+
+	// registers a handler for a route pattern (see HttpRouter), and a method to match - or an empty one for any
+	virtual void RegisterHandler(const std::string& method, const std::string& pattern, fwRefContainer<HttpHandler> handler) = 0;
+
+	// applies to connections accepted afterwards
+	virtual void SetCompressionOptions(const HttpCompressionOptions& options) = 0;
+
+	// applies to connections accepted afterwards
+	virtual void SetRequestLimits(const HttpRequestLimits& limits) = 0;
+
+	// makes requests on connections accepted from now on get recorded in the collector, per route - see HttpMetrics.h
+	virtual void SetMetricsCollector(const fwRefContainer<MetricsCollector>& collector) = 0;
 };
 };
\ No newline at end of file
@@ -8,8 +8,12 @@
 #pragma once
 
 #include "HttpServer.h"
+#include "HttpRouter.h"
+#include "HttpMetrics.h"
 
 #include <forward_list>
+#include <map>
+#include <mutex>
 
 namespace net
 {
@@ -22,8 +26,26 @@ class
 private:
 	fwRefContainer<TcpServer> m_server;
 
+	HttpRouter m_router;
+
 	std::forward_list<fwRefContainer<HttpHandler>> m_handlers;
 
+	// swapped as a whole, so connections can keep a snapshot
+	std::shared_ptr<const HttpCompressionOptions> m_compressionOptions;
+
+	std::shared_ptr<const HttpRequestLimits> m_requestLimits;
+
+	// null until a collector is set
+	std::shared_ptr<HttpServerMetrics> m_metrics;
+
+	fwRefContainer<MetricsCollector> m_metricsCollector;
+
+	// route metrics by method and pattern, which exist whether a collector is set or not - so routes can be registered
+	// before setting one
+	std::map<std::pair<std::string, std::string>, std::shared_ptr<HttpRouteMetrics>> m_routeMetrics;
+
+	std::mutex m_metricsMutex;
+
 private:
 	void OnConnection(fwRefContainer<TcpServerStream> stream);
 
@@ -35,5 +57,13 @@ public:
 	virtual void AttachToServer(fwRefContainer<TcpServer> server) override;
 
 	virtual void RegisterHandler(fwRefContainer<HttpHandler> handler) override;
+
+	virtual void RegisterHandler(const std::string& method, const std::string& pattern, fwRefContainer<HttpHandler> handler) override;
+
+	virtual void SetCompressionOptions(const HttpCompressionOptions& options) override;
+
+	virtual void SetRequestLimits(const HttpRequestLimits& limits) override;
+
+	virtual void SetMetricsCollector(const fwRefContainer<MetricsCollector>& collector) override;
 };
 }
\ No newline at end of file
@@ -0,0 +1,130 @@
+/*
+ * This file is part of the CitizenFX project - http://citizen.re/
+ *
+ * See LICENSE and MENTIONS in the root of the source tree for information
+ * regarding licensing.
+ */
+
+#pragma once
+
+#include "HttpServer.h"
+#include "WorkerPool.h"
+
+#include <VFSDevice.h>
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace net
+{
+// serves GET and HEAD requests for files below a VFS path, e.g. a handler for "/files/" and "citizen:/ui/" serves
+// "/files/app.js" from "citizen:/ui/app.js".
+//
+// responses carry a strong ETag derived from the file's SHA1 hash, honour If-None-Match with a 304, and support single
+// byte ranges (including If-Range). bodies get read through the device a chunk at a time, whenever the connection drained
+// what was sent before.
+//
+// compressible files get served gzip- or deflate-encoded to clients accepting it, unless they ask for a range. the
+// compressed bodies are cached by content hash, so they only get compressed once for as long as they're in use.
+//
+// devices may block, and hashing and compressing take a while, so requests get served on a worker pool shared by all
+// handlers - what they decide gets applied to the response through HttpResponse::ScheduleCallback, so responses only get
+// written to from the connection's thread.
+class
+#ifdef COMPILING_NET_HTTP_SERVER
+	DLL_EXPORT
+#endif
+	HttpStaticFileHandler : public HttpHandler
+{
+private:
+	struct HashEntry
+	{
+		size_t length;
+
+		std::string etag;
+	};
+
+	struct CompressedBody
+	{
+		std::string key;
+
+		std::shared_ptr<const std::string> data;
+	};
+
+	struct FileSend;
+
+private:
+	std::string m_urlPrefix;
+
+	std::string m_rootPath;
+
+	// hashes computed by reading files from devices not knowing them - keyed by path, and only trusted for the same length
+	std::unordered_map<std::string, HashEntry> m_hashCache;
+
+	std::mutex m_hashCacheMutex;
+
+	HttpCompressionOptions m_compressionOptions;
+
+	// compressed bodies by ETag of the compressed representation, the most recently used one first
+	std::list<CompressedBody> m_compressedBodies;
+
+	std::unordered_map<std::string, std::list<CompressedBody>::iterator> m_compressedBodyIndex;
+
+	size_t m_compressedBodySize;
+
+	std::mutex m_compressedBodyMutex;
+
+private:
+	static fwRefContainer<WorkerPool> GetWorkerPool();
+
+	// everything after finding the file path, on the worker pool
+	void ServeFile(const fwRefContainer<HttpRequest>& request, const fwRefContainer<HttpResponse>& response, const std::string& filePath, const std::string& relativePath);
+
+	// sets the status and headers on the connection's thread
+	static void ScheduleHead(const fwRefContainer<HttpResponse>& response, int statusCode, const HeaderMap& headers);
+
+	// ends the response on the connection's thread, with `body` if there is one
+	static void ScheduleEnd(const fwRefContainer<HttpResponse>& response, const std::shared_ptr<const std::string>& body);
+
+	std::string GetETag(const fwRefContainer<vfs::Device>& device, const std::string& path, size_t length);
+
+	// sends the body and ends the response
+	void SendBody(const fwRefContainer<vfs::Device>& device, const std::string& path, const fwRefContainer<HttpResponse>& response, uint64_t offset, uint64_t length);
+
+	// reads the next chunk on the worker pool, and writes it on the connection's thread
+	static void ReadChunk(const std::shared_ptr<FileSend>& send);
+
+	static void WriteChunk(const std::shared_ptr<FileSend>& send, std::string&& chunk);
+
+	std::shared_ptr<const std::string> GetCompressedBody(const fwRefContainer<vfs::Device>& device, const std::string& path, const std::string& etag, HttpContentEncoding encoding);
+
+public:
+	enum class RangeResult
+	{
+		// no usable range - the full file gets sent
+		Ignore,
+		Satisfiable,
+		Unsatisfiable
+	};
+
+public:
+	HttpStaticFileHandler(const std::string& urlPrefix, const std::string& rootPath);
+
+	// decodes a request path below the URL prefix into a path relative to the root, returning false if it tries to escape it
+	static bool DecodeRelativePath(const boost::string_ref& path, std::string* relativePath);
+
+	// checks an If-None-Match header for a tag - comparing weakly, as the RFC asks for this header
+	static bool MatchesETag(const boost::string_ref& header, const std::string& etag);
+
+	// parses a Range header for a file of `length` bytes, into an inclusive range - only single byte ranges are supported,
+	// as multiple ones would need a multipart response, so those get the full file instead. an If-Range header not
+	// matching `etag` makes the range get ignored.
+	static RangeResult ParseRange(boost::string_ref header, const boost::string_ref& ifRange, const std::string& etag, uint64_t length, uint64_t* start, uint64_t* end);
+
+	// has to be called before the handler gets registered
+	void SetCompressionOptions(const HttpCompressionOptions& options);
+
+	virtual bool HandleRequest(fwRefContainer<HttpRequest> request, fwRefContainer<HttpResponse> response) override;
+};
+}
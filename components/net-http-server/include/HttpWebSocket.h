@@ -0,0 +1,153 @@
+/*
+ * This file is part of the CitizenFX project - http://citizen.re/
+ *
+ * See LICENSE and MENTIONS in the root of the source tree for information
+ * regarding licensing.
+ */
+
+#pragma once
+
+#include "HttpServer.h"
+
+#include <atomic>
+#include <mutex>
+
+namespace net
+{
+enum class HttpWebSocketOpcode : uint8_t
+{
+	Continuation = 0,
+	Text = 1,
+	Binary = 2,
+	Close = 8,
+	Ping = 9,
+	Pong = 10
+};
+
+// a WebSocket (RFC 6455) connection, as returned by HttpResponse::AcceptWebSocket
+//
+// messages arrive on the connection's thread, reassembled from any fragments, and with text messages validated to be
+// UTF-8. pings get answered automatically. messages may be sent from any thread.
+class
+#ifdef COMPILING_NET_HTTP_SERVER
+	DLL_EXPORT
+#endif
+	HttpWebSocket : public fwRefCountable
+{
+	friend class HttpConnection;
+
+public:
+	// a complete message, which is only valid for the duration of the call
+	typedef std::function<void(HttpWebSocketOpcode opcode, const uint8_t* data, size_t length)> TMessageHandler;
+
+	// called once, with 1006 as the code if the connection went away without a close frame
+	typedef std::function<void(uint16_t code, const std::string& reason)> TCloseHandler;
+
+	typedef std::function<void()> TDrainHandler;
+
+private:
+	// sends go through the upgrade response, so they're ordered after it - null once the connection is gone
+	fwRefContainer<HttpResponse> m_response;
+
+	fwRefContainer<TcpServerStream> m_stream;
+
+	TMessageHandler m_messageHandler;
+
+	TCloseHandler m_closeHandler;
+
+	size_t m_maxMessageSize;
+
+	// a message being reassembled from fragments
+	std::vector<uint8_t> m_fragments;
+
+	HttpWebSocketOpcode m_fragmentOpcode;
+
+	bool m_fragmented;
+
+	// set once a close frame got received, or the connection failed - nothing gets read anymore afterwards
+	bool m_closeReceived;
+
+	bool m_closeHandled;
+
+	// guards sending, and the response reference
+	std::mutex m_sendMutex;
+
+	bool m_closeSent;
+
+private:
+	// parses (and unmasks in place) as many complete frames as there are, returning the amount of data consumed
+	size_t ProcessData(uint8_t* data, size_t length);
+
+	void HandleFrame(HttpWebSocketOpcode opcode, bool final, const uint8_t* data, size_t length);
+
+	void HandleMessage(HttpWebSocketOpcode opcode, const uint8_t* data, size_t length);
+
+	void HandleClose(const uint8_t* data, size_t length);
+
+	// fails the connection with a close code, e.g. on a protocol error
+	void Fail(uint16_t code);
+
+	void InvokeCloseHandler(uint16_t code, const std::string& reason);
+
+	// called by the connection once the stream closed
+	void OnStreamClosed();
+
+	bool WriteFrame(HttpWebSocketOpcode opcode, const uint8_t* data, size_t length, bool final);
+
+public:
+	HttpWebSocket(const fwRefContainer<HttpResponse>& response, const fwRefContainer<TcpServerStream>& stream, size_t maxMessageSize);
+
+	virtual ~HttpWebSocket() override;
+
+	// whether a request asks for a WebSocket upgrade this server supports
+	static bool IsUpgradeRequest(const fwRefContainer<HttpRequest>& request);
+
+	// the Sec-WebSocket-Accept value for a Sec-WebSocket-Key
+	static std::string GetAcceptKey(const boost::string_ref& key);
+
+	// handlers should be set before the handler accepting the socket returns - anything received before gets dropped
+	inline void SetMessageHandler(const TMessageHandler& handler)
+	{
+		m_messageHandler = handler;
+	}
+
+	inline void SetCloseHandler(const TCloseHandler& handler)
+	{
+		m_closeHandler = handler;
+	}
+
+	// called once the data queued for sending drops below the stream's low water mark, after having exceeded its high
+	// water mark (see TcpServerStream::SetWriteWaterMarks)
+	void SetDrainHandler(const TDrainHandler& handler);
+
+	inline size_t GetMaxMessageSize() const
+	{
+		return m_maxMessageSize;
+	}
+
+	// messages larger than this get refused by closing with 1009 - this also limits how much of an incomplete frame gets
+	// buffered, so it should only be changed on the connection's thread
+	inline void SetMaxMessageSize(size_t maxMessageSize)
+	{
+		m_maxMessageSize = maxMessageSize;
+	}
+
+	// the send functions queue a message as a single frame, returning false once senders should hold off until the drain
+	// handler gets called - or if the socket is closing, in which case nothing got sent
+	bool Send(const std::string& text);
+
+	bool Send(HttpWebSocketOpcode opcode, const uint8_t* data, size_t length);
+
+	// sends a message in pieces - the first frame has a Text or Binary opcode, the following ones Continuation, and the
+	// last one is marked as final. frames of other messages must not be sent in between.
+	bool SendFrame(HttpWebSocketOpcode opcode, const uint8_t* data, size_t length, bool final);
+
+	bool Ping(const std::string& payload = std::string());
+
+	// starts the closing handshake - the connection gets closed once the peer replied, or after 5 seconds
+	void Close(uint16_t code = 1000, const std::string& reason = std::string());
+
+	// the amount of data queued for sending
+	size_t GetBufferedAmount();
+};
+}
@@ -0,0 +1,204 @@
+/*
+ * This file is part of the CitizenFX project - http://citizen.re/
+ *
+ * See LICENSE and MENTIONS in the root of the source tree for information
+ * regarding licensing.
+ */
+
+#include "StdInc.h"
+#include "HttpCompression.h"
+
+#include <boost/algorithm/string.hpp>
+
+#include <zlib.h>
+
+namespace net
+{
+static boost::string_ref TrimSpaces(boost::string_ref string)
+{
+	while (!string.empty() && (string.front() == ' ' || string.front() == '\t'))
+	{
+		string.remove_prefix(1);
+	}
+
+	while (!string.empty() && (string.back() == ' ' || string.back() == '\t'))
+	{
+		string.remove_suffix(1);
+	}
+
+	return string;
+}
+
+HttpCompressionOptions ValidateCompressionOptions(const HttpCompressionOptions& options)
+{
+	HttpCompressionOptions validOptions = options;
+	validOptions.level = std::min(std::max(options.level, 0), 9);
+
+	return validOptions;
+}
+
+HttpContentEncoding NegotiateContentEncoding(const boost::string_ref& acceptEncoding)
+{
+	bool acceptsGzip = false;
+	bool acceptsDeflate = false;
+	bool refusesGzip = false;
+
+	std::vector<boost::iterator_range<const char*>> codings;
+	boost::algorithm::split(codings, acceptEncoding, boost::algorithm::is_any_of(","));
+
+	for (auto& codingRange : codings)
+	{
+		boost::string_ref coding(codingRange.begin(), codingRange.size());
+		boost::string_ref parameters;
+
+		size_t parameterStart = coding.find(';');
+
+		if (parameterStart != boost::string_ref::npos)
+		{
+			parameters = coding.substr(parameterStart + 1);
+			coding = coding.substr(0, parameterStart);
+		}
+
+		coding = TrimSpaces(coding);
+
+		// a q-value of 0 explicitly rules a coding out
+		size_t qualityStart = parameters.find("q=");
+
+		if (qualityStart != boost::string_ref::npos && atof(parameters.substr(qualityStart + 2).to_string().c_str()) <= 0.0)
+		{
+			refusesGzip = refusesGzip || boost::algorithm::iequals(coding, "gzip");
+			continue;
+		}
+
+		if (boost::algorithm::iequals(coding, "gzip") || coding == "*")
+		{
+			acceptsGzip = true;
+		}
+		else if (boost::algorithm::iequals(coding, "deflate"))
+		{
+			acceptsDeflate = true;
+		}
+	}
+
+	if (acceptsGzip && !refusesGzip)
+	{
+		return HttpContentEncoding::Gzip;
+	}
+
+	return (acceptsDeflate) ? HttpContentEncoding::Deflate : HttpContentEncoding::Identity;
+}
+
+const char* GetContentEncodingName(HttpContentEncoding encoding)
+{
+	switch (encoding)
+	{
+	case HttpContentEncoding::Gzip:
+		return "gzip";
+	case HttpContentEncoding::Deflate:
+		return "deflate";
+	default:
+		return "identity";
+	}
+}
+
+bool IsCompressibleContentType(const boost::string_ref& contentType)
+{
+	boost::string_ref mediaType = contentType.substr(0, contentType.find(';'));
+
+	if (boost::algorithm::istarts_with(mediaType, "text/"))
+	{
+		return true;
+	}
+
+	static const char* compressibleTypes[] = {
+		"application/json",
+		"application/javascript",
+		"application/xml",
+		"application/wasm",
+		"image/svg+xml",
+		"image/x-icon",
+	};
+
+	for (auto& type : compressibleTypes)
+	{
+		if (boost::algorithm::iequals(mediaType, type))
+		{
+			return true;
+		}
+	}
+
+	// structured syntax suffixes, e.g. application/ld+json
+	return (boost::algorithm::iends_with(mediaType, "+json") || boost::algorithm::iends_with(mediaType, "+xml"));
+}
+
+HttpCompressor::HttpCompressor(HttpContentEncoding encoding, int level)
+	: m_stream(std::make_unique<z_stream>()), m_failed(false)
+{
+	// 16 added to the window bits asks for a gzip header and trailer instead of zlib's
+	int windowBits = (encoding == HttpContentEncoding::Gzip) ? (MAX_WBITS + 16) : MAX_WBITS;
+
+	if (deflateInit2(m_stream.get(), level, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		trace("setting up compression at level %d failed\n", level);
+
+		m_failed = true;
+	}
+}
+
+HttpCompressor::~HttpCompressor()
+{
+	// this is fine for streams that failed to set up, too
+	deflateEnd(m_stream.get());
+}
+
+bool HttpCompressor::Compress(const void* data, size_t length, bool finish, std::vector<uint8_t>& output)
+{
+	if (m_failed)
+	{
+		return false;
+	}
+
+	m_stream->next_in = reinterpret_cast<Bytef*>(const_cast<void*>(data));
+	m_stream->avail_in = static_cast<uInt>(length);
+
+	int flush = (finish) ? Z_FINISH : Z_SYNC_FLUSH;
+
+	// reserve about what the data would take - text tends to end up a lot smaller, so this rarely has to grow
+	size_t originalSize = output.size();
+	size_t outputStart = originalSize;
+	output.resize(outputStart + deflateBound(m_stream.get(), static_cast<uLong>(length)));
+
+	while (true)
+	{
+		m_stream->next_out = &output[outputStart];
+		m_stream->avail_out = static_cast<uInt>(output.size() - outputStart);
+
+		int result = deflate(m_stream.get(), flush);
+
+		outputStart = output.size() - m_stream->avail_out;
+
+		// anything else means the stream is broken, and more room won't help
+		if (result != Z_OK && result != Z_BUF_ERROR && result != Z_STREAM_END)
+		{
+			trace("compressing failed - %d\n", result);
+
+			m_failed = true;
+			output.resize(originalSize);
+
+			return false;
+		}
+
+		// the output buffer only ever gets filled completely when there's more to come
+		if (result == Z_STREAM_END || (result == Z_OK && m_stream->avail_out != 0) || result == Z_BUF_ERROR)
+		{
+			break;
+		}
+
+		output.resize(output.size() * 2);
+	}
+
+	output.resize(outputStart);
+
+	return true;
+}
+}
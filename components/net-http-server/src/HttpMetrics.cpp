@@ -0,0 +1,48 @@
+/*
+ * This file is part of the CitizenFX project - http://citizen.re/
+ *
+ * See LICENSE and MENTIONS in the root of the source tree for information
+ * regarding licensing.
+ */
+
+#include "StdInc.h"
+#include "HttpMetrics.h"
+
+namespace net
+{
+void AddHttpRouteMetrics(MetricsCollector* collector, const std::string& method, const std::string& pattern, const std::shared_ptr<HttpRouteMetrics>& metrics)
+{
+	static const char* statusClasses[] = { "1xx", "2xx", "3xx", "4xx", "5xx" };
+
+	std::string methodLabel = (method.empty()) ? "ANY" : method;
+
+	for (size_t i = 0; i < _countof(statusClasses); i++)
+	{
+		collector->AddCounter("http_responses_total", "HTTP responses sent, by route and status class.",
+			{ { "route", pattern }, { "method", methodLabel }, { "code", statusClasses[i] } },
+			std::shared_ptr<MetricCounter>(metrics, &metrics->responses[i]));
+	}
+
+	collector->AddHistogram("http_request_duration_seconds", "Time from an HTTP request having been read until its response ended.",
+		{ { "route", pattern }, { "method", methodLabel } },
+		std::shared_ptr<MetricHistogram>(metrics, &metrics->latency));
+}
+
+HttpMetricsHandler::HttpMetricsHandler(const fwRefContainer<MetricsCollector>& collector)
+	: m_collector(collector)
+{
+
+}
+
+bool HttpMetricsHandler::HandleRequest(fwRefContainer<HttpRequest> request, fwRefContainer<HttpResponse> response)
+{
+	std::string data;
+	m_collector->Render(data);
+
+	response->SetHeader(std::string("Content-Type"), std::string("text/plain; version=0.0.4; charset=utf-8"));
+	response->SetHeader(std::string("Cache-Control"), std::string("no-cache"));
+	response->End(data);
+
+	return true;
+}
+}
@@ -0,0 +1,198 @@
+/*
+ * This file is part of the CitizenFX project - http://citizen.re/
+ *
+ * See LICENSE and MENTIONS in the root of the source tree for information
+ * regarding licensing.
+ */
+
+#include "StdInc.h"
+#include "HttpRouter.h"
+
+namespace net
+{
+// splits a path into its non-empty segments, ignoring any query string
+static void SplitPath(boost::string_ref path, std::vector<boost::string_ref>& segments)
+{
+	size_t queryStart = path.find('?');
+
+	if (queryStart != boost::string_ref::npos)
+	{
+		path = path.substr(0, queryStart);
+	}
+
+	while (!path.empty())
+	{
+		size_t separator = path.find('/');
+		boost::string_ref segment = path.substr(0, separator);
+
+		if (!segment.empty())
+		{
+			segments.push_back(segment);
+		}
+
+		if (separator == boost::string_ref::npos)
+		{
+			break;
+		}
+
+		path = path.substr(separator + 1);
+	}
+}
+
+HttpRouter::HttpRouter()
+	: m_trie(std::make_shared<Trie>(1))
+{
+
+}
+
+void HttpRouter::AddRoute(const std::string& method, const std::string& pattern, const fwRefContainer<HttpHandler>& handler, const std::shared_ptr<HttpRouteMetrics>& metrics)
+{
+	std::vector<boost::string_ref> segments;
+	SplitPath(pattern, segments);
+
+	bool isPrefix = (!segments.empty() && segments.back() == "*");
+
+	if (isPrefix)
+	{
+		segments.pop_back();
+	}
+
+	std::unique_lock<std::mutex> lock(m_registerMutex);
+
+	// copy the current trie, so requests being dispatched on other threads never see it change
+	auto trie = std::make_shared<Trie>(*std::atomic_load(&m_trie));
+	uint32_t nodeIndex = 0;
+
+	for (auto& segment : segments)
+	{
+		uint32_t nextIndex;
+
+		if (segment[0] == ':')
+		{
+			nextIndex = (*trie)[nodeIndex].parameterChild;
+
+			if (nextIndex == 0)
+			{
+				nextIndex = static_cast<uint32_t>(trie->size());
+				trie->emplace_back();
+
+				(*trie)[nodeIndex].parameterChild = nextIndex;
+				(*trie)[nextIndex].parameterName = segment.substr(1).to_string();
+			}
+			else if ((*trie)[nextIndex].parameterName != segment.substr(1))
+			{
+				trace("HTTP route %s names parameter %s, while another route already named it %s - using the latter\n",
+					pattern.c_str(), segment.substr(1).to_string().c_str(), (*trie)[nextIndex].parameterName.c_str());
+			}
+		}
+		else
+		{
+			auto& children = (*trie)[nodeIndex].children;
+			auto it = children.find(segment);
+
+			if (it == children.end())
+			{
+				nextIndex = static_cast<uint32_t>(trie->size());
+
+				// emplacing may reallocate the node vector, so don't hold on to `children`
+				children.emplace(segment.to_string(), nextIndex);
+				trie->emplace_back();
+			}
+			else
+			{
+				nextIndex = it->second;
+			}
+		}
+
+		nodeIndex = nextIndex;
+	}
+
+	Route route;
+	route.method = method;
+	route.handler = handler;
+	route.metrics = metrics;
+
+	auto& node = (*trie)[nodeIndex];
+	(isPrefix ? node.prefixRoutes : node.exactRoutes).push_back(route);
+
+	std::atomic_store(&m_trie, std::shared_ptr<const Trie>(trie));
+}
+
+bool HttpRouter::Dispatch(const fwRefContainer<HttpRequest>& request, const fwRefContainer<HttpResponse>& response) const
+{
+	std::shared_ptr<const Trie> trie = std::atomic_load(&m_trie);
+
+	std::vector<boost::string_ref> segments;
+	SplitPath(request->GetPath(), segments);
+
+	RouteParameterList parameters;
+
+	return Match(*trie, 0, segments, 0, parameters, request, response);
+}
+
+bool HttpRouter::Match(const Trie& trie, uint32_t nodeIndex, const std::vector<boost::string_ref>& segments, size_t segmentIndex, RouteParameterList& parameters, const fwRefContainer<HttpRequest>& request, const fwRefContainer<HttpResponse>& response) const
+{
+	const Node& node = trie[nodeIndex];
+
+	if (segmentIndex == segments.size())
+	{
+		if (TryRoutes(node.exactRoutes, parameters, request, response))
+		{
+			return true;
+		}
+	}
+	else
+	{
+		const boost::string_ref& segment = segments[segmentIndex];
+
+		// literal segments take precedence over parameters
+		auto it = node.children.find(segment);
+
+		if (it != node.children.end() && Match(trie, it->second, segments, segmentIndex + 1, parameters, request, response))
+		{
+			return true;
+		}
+
+		if (node.parameterChild != 0)
+		{
+			const Node& parameterNode = trie[node.parameterChild];
+			parameters.emplace_back(parameterNode.parameterName, segment);
+
+			if (Match(trie, node.parameterChild, segments, segmentIndex + 1, parameters, request, response))
+			{
+				return true;
+			}
+
+			parameters.pop_back();
+		}
+	}
+
+	// prefix routes come last, so deeper routes get to go first
+	return TryRoutes(node.prefixRoutes, parameters, request, response);
+}
+
+bool HttpRouter::TryRoutes(const std::vector<Route>& routes, const RouteParameterList& parameters, const fwRefContainer<HttpRequest>& request, const fwRefContainer<HttpResponse>& response) const
+{
+	for (auto& route : routes)
+	{
+		if (!route.method.empty() && request->GetRequestMethod() != route.method)
+		{
+			continue;
+		}
+
+		request->SetRouteParameters(parameters);
+
+		// set before handling, as the response may well end right away
+		response->m_routeMetrics = route.metrics.get();
+
+		if (route.handler->HandleRequest(request, response) || response->HasEnded())
+		{
+			return true;
+		}
+
+		response->m_routeMetrics = nullptr;
+	}
+
+	return false;
+}
+}
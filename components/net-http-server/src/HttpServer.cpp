@@ -8,13 +8,14 @@
 #include "StdInc.h"
 #include "HttpServer.h"
 #include "HttpServerImpl.h"
+#include "HttpWebSocket.h"
 #include "TLSServer.h"
 
 #include <ctime>
 #include <deque>
-#include <iomanip>
 #include <memory>
-#include <sstream>
+#include <mutex>
+#include <thread>
 
 #include <boost/algorithm/string.hpp>
 
@@ -23,6 +24,7 @@
 namespace net
 {
 HttpServerImpl::HttpServerImpl()
+	: m_compressionOptions(std::make_shared<HttpCompressionOptions>()), m_requestLimits(std::make_shared<HttpRequestLimits>())
 {
 
 }
@@ -42,449 +44,1821 @@ void HttpServerImpl::RegisterHandler(fwRefContainer<HttpHandler> handler)
 	m_handlers.push_front(handler);
 }
 
+void HttpServerImpl::RegisterHandler(const std::string& method, const std::string& pattern, fwRefContainer<HttpHandler> handler)
+{
+	std::shared_ptr<HttpRouteMetrics> metrics;
+
+	{
+		std::unique_lock<std::mutex> lock(m_metricsMutex);
+
+		// routes registered more than once share their metrics
+		auto& entry = m_routeMetrics[{ method, pattern }];
+
+		if (!entry)
+		{
+			entry = std::make_shared<HttpRouteMetrics>();
+
+			if (m_metricsCollector.GetRef())
+			{
+				AddHttpRouteMetrics(m_metricsCollector.GetRef(), method, pattern, entry);
+			}
+		}
+
+		metrics = entry;
+	}
+
+	m_router.AddRoute(method, pattern, handler, metrics);
+}
+
+void HttpServerImpl::SetCompressionOptions(const HttpCompressionOptions& options)
+{
+	std::atomic_store(&m_compressionOptions, std::shared_ptr<const HttpCompressionOptions>(std::make_shared<HttpCompressionOptions>(ValidateCompressionOptions(options))));
+}
+
+void HttpServerImpl::SetRequestLimits(const HttpRequestLimits& limits)
+{
+	std::atomic_store(&m_requestLimits, std::shared_ptr<const HttpRequestLimits>(std::make_shared<HttpRequestLimits>(limits)));
+}
+
+void HttpServerImpl::SetMetricsCollector(const fwRefContainer<MetricsCollector>& collector)
+{
+	auto metrics = std::make_shared<HttpServerMetrics>();
+
+	collector->AddGauge("http_requests_in_flight", "HTTP requests read, but not responded to yet.", {}, std::shared_ptr<MetricGauge>(metrics, &metrics->requestsInFlight));
+
+	// requests not handled by a route get an empty route label
+	AddHttpRouteMetrics(collector.GetRef(), std::string(), std::string(), std::shared_ptr<HttpRouteMetrics>(metrics, &metrics->unrouted));
+
+	{
+		std::unique_lock<std::mutex> lock(m_metricsMutex);
+
+		m_metricsCollector = collector;
+
+		for (auto& entry : m_routeMetrics)
+		{
+			AddHttpRouteMetrics(collector.GetRef(), entry.first.first, entry.first.second, entry.second);
+		}
+	}
+
+	std::atomic_store(&m_metrics, metrics);
+}
+
+// a contiguous read buffer - consumed bytes only get compacted away once more room is needed, so appending is
+// amortized O(1) and parsers can always look at the unconsumed data as a single block
+class HttpReadBuffer
+{
+private:
+	std::vector<uint8_t> m_data;
+
+	size_t m_start;
+
+	size_t m_end;
+
+public:
+	HttpReadBuffer()
+		: m_start(0), m_end(0)
+	{
+
+	}
+
+	inline char* GetData()
+	{
+		return reinterpret_cast<char*>(m_data.data() + m_start);
+	}
+
+	inline size_t GetLength() const
+	{
+		return m_end - m_start;
+	}
+
+	void Append(const uint8_t* data, size_t length)
+	{
+		if (m_data.size() - m_end < length)
+		{
+			// move unconsumed data to the front first, and only grow if that isn't enough
+			if (m_start > 0)
+			{
+				memmove(m_data.data(), m_data.data() + m_start, m_end - m_start);
+
+				m_end -= m_start;
+				m_start = 0;
+			}
+
+			if (m_data.size() - m_end < length)
+			{
+				m_data.resize(std::max(m_data.size() * 2, m_end + length));
+			}
+		}
+
+		memcpy(m_data.data() + m_end, data, length);
+		m_end += length;
+	}
+
+	void Consume(size_t length)
+	{
+		m_start += length;
+
+		if (m_start == m_end)
+		{
+			m_start = 0;
+			m_end = 0;
+		}
+	}
+
+	// drops anything past the first `length` unconsumed bytes, e.g. after decoding in place
+	void Truncate(size_t length)
+	{
+		m_end = m_start + length;
+
+		Consume(0);
+	}
+};
+
+// parses a Content-Length value, returning -1 if it's not a plain decimal number
+static int64_t ParseContentLength(const boost::string_ref& value)
+{
+	if (value.empty() || value.size() > 18)
+	{
+		return -1;
+	}
+
+	int64_t length = 0;
+
+	for (char c : value)
+	{
+		if (c < '0' || c > '9')
+		{
+			return -1;
+		}
+
+		length = (length * 10) + (c - '0');
+	}
+
+	return length;
+}
+
+// checks the transfer codings of a request, in the order they got applied - only chunked can be decoded, and it has to
+// come last for the body to be delimited at all. returns the status code to refuse the request with, or 0
+static int ParseTransferEncoding(const fwRefContainer<HttpRequest>& request, bool* chunked)
+{
+	bool present = false;
+	std::vector<boost::string_ref> codings;
+
+	// repeated headers make up a single list
+	for (auto& header : request->GetHeaders())
+	{
+		if (!boost::algorithm::iequals(header.first, "transfer-encoding"))
+		{
+			continue;
+		}
+
+		present = true;
+
+		boost::string_ref value = header.second;
+
+		while (!value.empty())
+		{
+			size_t comma = value.find(',');
+			boost::string_ref coding = value.substr(0, comma);
+
+			value = (comma == boost::string_ref::npos) ? boost::string_ref() : value.substr(comma + 1);
+
+			while (!coding.empty() && (coding.front() == ' ' || coding.front() == '\t'))
+			{
+				coding.remove_prefix(1);
+			}
+
+			while (!coding.empty() && (coding.back() == ' ' || coding.back() == '\t'))
+			{
+				coding.remove_suffix(1);
+			}
+
+			if (!coding.empty())
+			{
+				codings.push_back(coding);
+			}
+		}
+	}
+
+	*chunked = false;
+
+	if (!present)
+	{
+		return 0;
+	}
+
+	for (auto& coding : codings)
+	{
+		if (!boost::algorithm::iequals(coding, "chunked"))
+		{
+			return 501;
+		}
+	}
+
+	// chunked may only be applied once
+	if (codings.size() != 1)
+	{
+		return 400;
+	}
+
+	*chunked = true;
+
+	return 0;
+}
+
+// pipelined requests that get handled before earlier responses have ended - further requests stay in the read
+// buffer until the queue drains
+static const size_t g_maxPipelinedRequests = 16;
+
+// HTTP/1.1 connections persist unless asked not to, HTTP/1.0 ones only if asked to
+static bool IsKeepAliveRequest(const fwRefContainer<HttpRequest>& request)
+{
+	boost::string_ref connection = request->GetHeader("connection");
+
+	if (request->GetHttpVersion().second >= 1)
+	{
+		return !boost::algorithm::icontains(connection, "close");
+	}
+
+	return boost::algorithm::icontains(connection, "keep-alive");
+}
+
+class HttpConnection : public std::enable_shared_from_this<HttpConnection>
+{
+public:
+	typedef std::function<void(const fwRefContainer<HttpRequest>&, const fwRefContainer<HttpResponse>&)> THandlerCallback;
+
+private:
+	enum ReadState
+	{
+		ReadStateRequest,
+		ReadStateBody,
+		ReadStateChunked,
+
+		// a body got refused - nothing the client sends anymore is of interest
+		ReadStateDiscard,
+
+		// the connection got upgraded, and everything that follows is WebSocket frames
+		ReadStateWebSocket
+	};
+
+private:
+	fwRefContainer<TcpServerStream> m_stream;
+
+	THandlerCallback m_handler;
+
+	std::shared_ptr<const HttpCompressionOptions> m_compressionOptions;
+
+	std::shared_ptr<const HttpRequestLimits> m_limits;
+
+	// null if the server doesn't record metrics
+	std::shared_ptr<HttpServerMetrics> m_metrics;
+
+	// the thread the stream invokes its callbacks on - responses ending elsewhere get marshaled back to it
+	std::thread::id m_threadId;
+
+	ReadState m_readState;
+
+	HttpReadBuffer m_readBuffer;
+
+	// the amount of buffered request data phr_parse_request has already looked at
+	size_t m_lastLength;
+
+	std::vector<phr_header> m_headers;
+
+	phr_chunked_decoder m_decoder;
+
+	// the request whose body is being read, and its response
+	fwRefContainer<HttpRequest> m_request;
+
+	fwRefContainer<HttpResponse> m_response;
+
+	// the amount of body data left to read, if the body has a Content-Length
+	int64_t m_contentLength;
+
+	// the amount of body data received so far
+	uint64_t m_bodyLength;
+
+	// the body collected for a data handler
+	std::vector<uint8_t> m_bodyData;
+
+	// set once the connection got upgraded
+	fwRefContainer<HttpWebSocket> m_webSocket;
+
+	// set once a paused body made us stop reading from the stream
+	bool m_readPaused;
+
+	// set once the stream is closing, or is going to be closed after the current responses
+	bool m_closing;
+
+	// set once a request didn't ask for the connection to persist - any requests after it get ignored
+	bool m_lastRequest;
+
+	// set while the stream's deadline is the one for the headers of the request coming in
+	bool m_headerDeadline;
+
+	// the idle timeout the stream got configured with, which applies while requests are being read and responded to
+	uint32_t m_idleTimeout;
+
+	// responses ending from within a handler would otherwise recurse into processing the next request
+	bool m_processing;
+
+	// guards the response queue and the responses' blocked state
+	std::mutex m_responseMutex;
+
+	// responses in request order - only the first one gets to write to the stream
+	std::deque<fwRefContainer<HttpResponse>> m_responses;
+
+private:
+	void ProcessReadBuffer();
+
+	// passes on body data, returning false if the body got refused for being too large
+	bool ReceiveBody(const uint8_t* data, size_t length);
+
+	void FinishBody();
+
+	void RefuseBody();
+
+	// answers a request that can't be read with an error, and closes the connection after
+	void RejectRequest(const fwRefContainer<HttpResponse>& response, int statusCode);
+
+	// marks an ended response as done writing, on the stream's thread
+	void FlushResponse(HttpResponse* response);
+
+	void OnResponseEnded();
+
+	// lets the stream time out while waiting for the next request
+	void StartKeepAlive();
+
+	// the most data that may be left unprocessed - which is an incomplete request head, or an incomplete WebSocket frame
+	size_t GetReadBufferLimit();
+
+public:
+	HttpConnection(const fwRefContainer<TcpServerStream>& stream, const THandlerCallback& handler, const std::shared_ptr<const HttpCompressionOptions>& compressionOptions, const std::shared_ptr<const HttpRequestLimits>& limits, const std::shared_ptr<HttpServerMetrics>& metrics);
+
+	void Attach();
+
+	inline const HttpCompressionOptions& GetCompressionOptions() const
+	{
+		return *m_compressionOptions;
+	}
+
+	inline const HttpRequestLimits& GetRequestLimits() const
+	{
+		return *m_limits;
+	}
+
+	// called by a response once it ended, from any thread
+	void EndResponse(HttpResponse* response);
+
+	// called by a response with anything it wants written to the stream
+	void WriteResponse(HttpResponse* response, std::vector<uint8_t>&& data);
+
+	bool IsResponseWritable(HttpResponse* response);
+
+	void SetResponseDrainHandler(HttpResponse* response, const std::function<void()>& handler);
+
+	// calls the drain handler of the response that's being sent
+	void OnDrain();
+
+	// called by a request once its body got resumed, from any thread
+	void ResumeBody();
+
+	// records a response that was counted as in flight, once it ended or got dropped without ending
+	void RecordResponse(HttpResponse* response, bool ended);
+
+	// hands the connection over to a WebSocket, returning false if the request can't be upgraded - e.g. for having a
+	// body, or if it's not being handled right now
+	bool AttachWebSocket(HttpResponse* response, const fwRefContainer<HttpWebSocket>& webSocket);
+};
+
+HttpConnection::HttpConnection(const fwRefContainer<TcpServerStream>& stream, const THandlerCallback& handler, const std::shared_ptr<const HttpCompressionOptions>& compressionOptions, const std::shared_ptr<const HttpRequestLimits>& limits, const std::shared_ptr<HttpServerMetrics>& metrics)
+	: m_stream(stream), m_handler(handler), m_compressionOptions(compressionOptions), m_limits(limits), m_metrics(metrics), m_threadId(std::this_thread::get_id()), m_readState(ReadStateRequest), m_lastLength(0), m_headers(limits->maxHeaderCount), m_contentLength(0), m_bodyLength(0), m_readPaused(false), m_closing(false), m_lastRequest(false), m_headerDeadline(false), m_idleTimeout(0), m_processing(false)
+{
+
+}
+
+void HttpConnection::StartKeepAlive()
+{
+	if (m_limits->keepAliveTimeout > 0 && !m_closing && !m_lastRequest)
+	{
+		m_stream->SetIdleTimeout(m_limits->keepAliveTimeout);
+	}
+}
+
+size_t HttpConnection::GetReadBufferLimit()
+{
+	// a frame header takes up to 14 bytes
+	size_t messageSize = (m_webSocket.GetRef()) ? m_webSocket->GetMaxMessageSize() : m_limits->maxWebSocketMessageSize;
+
+	return std::max(m_limits->maxHeaderSize, messageSize + 14);
+}
+
+void HttpConnection::Attach()
+{
+	std::shared_ptr<HttpConnection> self = shared_from_this();
+
+	m_idleTimeout = m_stream->GetIdleTimeout();
+
+	m_stream->SetBufferReadCallback([=] (const net::BufferView& data)
+	{
+		// keep a reference to the connection locally
+		std::shared_ptr<HttpConnection> localSelf = self;
+
+		if (localSelf->m_closing)
+		{
+			return;
+		}
+
+		// copy straight from the read slab
+		localSelf->m_readBuffer.Append(data.GetData(), data.GetLength());
+
+		localSelf->ProcessReadBuffer();
+
+		// whatever is left waits for more data, or for earlier responses to end - a paused body is held back by the stream
+		// instead, so only counts for this once resumed
+		if (!localSelf->m_closing && !localSelf->m_readPaused && localSelf->m_readBuffer.GetLength() > localSelf->GetReadBufferLimit())
+		{
+			localSelf->m_stream->Close();
+		}
+	});
+
+	m_stream->SetLowWaterMarkCallback([=] ()
+	{
+		self->OnDrain();
+	});
+
+	// break the reference cycles between the stream, this and any queued responses
+	m_stream->SetCloseCallback([=] ()
+	{
+		std::shared_ptr<HttpConnection> localSelf = self;
+
+		localSelf->m_closing = true;
+
+		{
+			std::unique_lock<std::mutex> lock(localSelf->m_responseMutex);
+
+			// these tend to reference their response
+			for (auto& response : localSelf->m_responses)
+			{
+				response->m_drainHandler = std::function<void()>();
+			}
+
+			localSelf->m_responses.clear();
+		}
+
+		localSelf->m_stream->SetLowWaterMarkCallback(TcpServerStream::TWaterMarkCallback());
+
+		// body handlers that won't get called anymore tend to reference their response, which references the request
+		if (localSelf->m_request.GetRef())
+		{
+			localSelf->m_request->SetDataHandler(std::function<void(const std::vector<uint8_t>&)>());
+			localSelf->m_request->SetBodyHandlers(HttpRequest::TBodyChunkHandler(), HttpRequest::TBodyEndHandler());
+		}
+
+		localSelf->m_request = nullptr;
+		localSelf->m_response = nullptr;
+
+		if (localSelf->m_webSocket.GetRef())
+		{
+			fwRefContainer<HttpWebSocket> webSocket = localSelf->m_webSocket;
+			localSelf->m_webSocket = nullptr;
+
+			webSocket->OnStreamClosed();
+		}
+
+		localSelf->m_stream->SetBufferReadCallback(TcpServerStream::TBufferReadCallback());
+	});
+
+	// the first request is waited for like any other
+	StartKeepAlive();
+}
+
+void HttpConnection::ProcessReadBuffer()
+{
+	if (m_processing)
+	{
+		return;
+	}
+
+	m_processing = true;
+
+	// process request data until there's no need anymore
+	bool continueProcessing = (m_readBuffer.GetLength() > 0);
+
+	while (continueProcessing && !m_closing)
+	{
+		// a paused body stays in the read buffer, and the stream stops reading once more data arrives meanwhile
+		if ((m_readState == ReadStateBody || m_readState == ReadStateChunked) && m_request->IsBodyPaused())
+		{
+			if (!m_readPaused)
+			{
+				m_readPaused = true;
+				m_stream->PauseReading();
+			}
+
+			break;
+		}
+
+		// depending on the state, perform an action
+		if (m_readState == ReadStateRequest)
+		{
+			if (m_lastRequest)
+			{
+				break;
+			}
+
+			{
+				std::unique_lock<std::mutex> lock(m_responseMutex);
+
+				if (m_responses.size() >= g_maxPipelinedRequests)
+				{
+					break;
+				}
+			}
+
+			// define output variables
+			const char* requestMethod;
+			size_t requestMethodLength;
+
+			const char* path;
+			size_t pathLength;
+
+			int minorVersion;
+			size_t numHeaders = m_headers.size();
+
+			// passing the previously seen length lets the parser skip over data that didn't complete a request before
+			const char* requestStart = m_readBuffer.GetData();
+
+			int result = phr_parse_request(requestStart, m_readBuffer.GetLength(), &requestMethod, &requestMethodLength,
+										   &path, &pathLength, &minorVersion, m_headers.data(), &numHeaders, m_lastLength);
+
+			if (result > 0 && static_cast<size_t>(result) <= m_limits->maxHeaderSize)
+			{
+				// copy the header block once, and point the request's views into the copy
+				std::vector<char> headerData(requestStart, requestStart + result);
+
+				auto rebase = [&] (const char* pointer, size_t length)
+				{
+					return boost::string_ref(headerData.data() + (pointer - requestStart), length);
+				};
+
+				HeaderViewList headerList;
+				headerList.reserve(numHeaders);
+
+				for (size_t i = 0; i < numHeaders; i++)
+				{
+					auto& header = m_headers[i];
+
+					headerList.emplace_back(rebase(header.name, header.name_len), rebase(header.value, header.value_len));
+				}
+
+				boost::string_ref requestMethodRef = rebase(requestMethod, requestMethodLength);
+				boost::string_ref pathRef = rebase(path, pathLength);
+
+				// remove the original bytes from the buffer
+				m_readBuffer.Consume(result);
+				m_lastLength = 0;
+
+				// the connection isn't waiting for a request anymore, and the headers made it in time - a client stalling
+				// on the body or the response still gets reaped by the stream's own timeout
+				if (m_limits->keepAliveTimeout > 0)
+				{
+					m_stream->SetIdleTimeout(m_idleTimeout);
+				}
+
+				if (m_headerDeadline)
+				{
+					m_headerDeadline = false;
+					m_stream->SetDeadline(0);
+				}
+
+				// store the request in a request instance
+				fwRefContainer<HttpRequest> request = new HttpRequest(1, minorVersion, std::move(headerData), requestMethodRef, pathRef, std::move(headerList));
+				fwRefContainer<HttpResponse> response = new HttpResponse(m_stream, request, shared_from_this());
+
+				request->m_connection = shared_from_this();
+				request->SetMaxBodySize(m_limits->maxBodySize);
+
+				if (m_metrics)
+				{
+					response->m_inFlight = true;
+					response->m_startTime = std::chrono::steady_clock::now();
+
+					m_metrics->requestsInFlight.Add(1);
+				}
+
+				// queue the response before any handler gets to write to it
+				{
+					std::unique_lock<std::mutex> lock(m_responseMutex);
+
+					response->m_writeBlocked = !m_responses.empty();
+					m_responses.push_back(response);
+				}
+
+				if (!IsKeepAliveRequest(request))
+				{
+					m_lastRequest = true;
+				}
+
+				// figure out the body framing before calling handlers - even if they end the response right away, the body
+				// still has to be read past so it won't be taken for the next request
+				boost::string_ref contentLengthStr = request->GetHeader("content-length");
+
+				bool chunked;
+				int framingError = ParseTransferEncoding(request, &chunked);
+
+				for (auto& header : request->GetHeaders())
+				{
+					// a length next to a transfer coding, or differing lengths, would let whatever is in front of us
+					// disagree on where the body ends
+					if (boost::algorithm::iequals(header.first, "content-length") && (header.second != contentLengthStr || chunked || framingError))
+					{
+						framingError = 400;
+					}
+				}
+
+				if (framingError)
+				{
+					RejectRequest(response, framingError);
+					continue;
+				}
+
+				if (!contentLengthStr.empty())
+				{
+					int64_t contentLength = ParseContentLength(contentLengthStr);
+
+					if (contentLength < 0)
+					{
+						m_processing = false;
+
+						m_stream->Close();
+						return;
+					}
+
+					if (contentLength > 0)
+					{
+						m_request = request;
+						m_response = response;
+						m_contentLength = contentLength;
+
+						m_readState = ReadStateBody;
+					}
+				}
+				else if (chunked)
+				{
+					m_request = request;
+					m_response = response;
+					m_contentLength = -1;
+
+					m_readState = ReadStateChunked;
+
+					memset(&m_decoder, 0, sizeof(m_decoder));
+					m_decoder.consume_trailer = true;
+				}
+
+				m_handler(request, response);
+
+				if (m_closing)
+				{
+					break;
+				}
+
+				// handlers may have changed the limit, so a declared length only gets checked now
+				if (m_readState == ReadStateBody)
+				{
+					if (static_cast<uint64_t>(m_contentLength) > request->GetMaxBodySize())
+					{
+						RefuseBody();
+					}
+					else if (request->GetDataHandler() && !request->m_bodyChunkHandler)
+					{
+						m_bodyData.reserve(static_cast<size_t>(m_contentLength));
+					}
+				}
+				else if (m_readState == ReadStateRequest && request->m_bodyEndHandler)
+				{
+					auto endHandler = request->m_bodyEndHandler;
+					request->SetBodyHandlers(HttpRequest::TBodyChunkHandler(), HttpRequest::TBodyEndHandler());
+
+					endHandler();
+				}
+
+				continueProcessing = (m_readBuffer.GetLength() > 0);
+			}
+			else if (result == -1 || result > 0)
+			{
+				// should probably send 'bad request'?
+				m_processing = false;
+
+				m_stream->Close();
+				return;
+			}
+			else if (result == -2)
+			{
+				if (m_readBuffer.GetLength() > m_limits->maxHeaderSize)
+				{
+					m_processing = false;
+
+					m_stream->Close();
+					return;
+				}
+
+				m_lastLength = m_readBuffer.GetLength();
+
+				// a request started coming in - clients trickling in their headers don't get to keep it open forever
+				if (!m_headerDeadline && m_limits->headerTimeout > 0)
+				{
+					m_headerDeadline = true;
+					m_stream->SetDeadline(m_limits->headerTimeout);
+				}
+
+				continueProcessing = false;
+			}
+		}
+		else if (m_readState == ReadStateBody)
+		{
+			size_t length = static_cast<size_t>(std::min<int64_t>(m_readBuffer.GetLength(), m_contentLength));
+
+			if (!ReceiveBody(reinterpret_cast<const uint8_t*>(m_readBuffer.GetData()), length))
+			{
+				continue;
+			}
+
+			if (m_closing)
+			{
+				break;
+			}
+
+			// remove the original bytes from the buffer
+			m_readBuffer.Consume(length);
+			m_contentLength -= length;
+
+			if (m_contentLength == 0)
+			{
+				FinishBody();
+			}
+
+			continueProcessing = (m_readState != ReadStateBody && m_readBuffer.GetLength() > 0);
+		}
+		else if (m_readState == ReadStateChunked)
+		{
+			// decode in place - whatever got decoded ends up at the start of the read buffer
+			size_t chunkSize = m_readBuffer.GetLength();
+
+			auto result = phr_decode_chunked(&m_decoder, m_readBuffer.GetData(), &chunkSize);
+
+			if (result == -1)
+			{
+				m_processing = false;
+
+				m_stream->Close();
+				return;
+			}
+
+			// any data following the body (i.e. a pipelined request) gets moved to right after the decoded data, and
+			// anything the decoder only needed to update its state with is gone
+			m_readBuffer.Truncate(chunkSize + ((result >= 0) ? result : 0));
+
+			if (!ReceiveBody(reinterpret_cast<const uint8_t*>(m_readBuffer.GetData()), chunkSize))
+			{
+				continue;
+			}
+
+			if (m_closing)
+			{
+				break;
+			}
+
+			m_readBuffer.Consume(chunkSize);
+
+			if (result >= 0)
+			{
+				FinishBody();
+
+				continueProcessing = (m_readBuffer.GetLength() > 0);
+			}
+			else
+			{
+				continueProcessing = false;
+			}
+		}
+		else if (m_readState == ReadStateDiscard)
+		{
+			m_readBuffer.Consume(m_readBuffer.GetLength());
+
+			continueProcessing = false;
+		}
+		else if (m_readState == ReadStateWebSocket)
+		{
+			fwRefContainer<HttpWebSocket> webSocket = m_webSocket;
+
+			// frames get unmasked in place, and only consumed once complete
+			size_t consumed = webSocket->ProcessData(reinterpret_cast<uint8_t*>(m_readBuffer.GetData()), m_readBuffer.GetLength());
+
+			m_readBuffer.Consume(consumed);
+
+			continueProcessing = false;
+		}
+	}
+
+	m_processing = false;
+}
+
+bool HttpConnection::ReceiveBody(const uint8_t* data, size_t length)
+{
+	if (length == 0)
+	{
+		return true;
+	}
+
+	m_bodyLength += length;
+
+	if (m_bodyLength > m_request->GetMaxBodySize())
+	{
+		RefuseBody();
+		return false;
+	}
+
+	// hold on to the request, in case a handler closes the stream
+	fwRefContainer<HttpRequest> request = m_request;
+
+	if (request->m_bodyChunkHandler)
+	{
+		request->m_bodyChunkHandler(data, length);
+	}
+	else if (request->GetDataHandler())
+	{
+		m_bodyData.insert(m_bodyData.end(), data, data + length);
+	}
+
+	return true;
+}
+
+void HttpConnection::FinishBody()
+{
+	fwRefContainer<HttpRequest> request = m_request;
+
+	std::vector<uint8_t> bodyData;
+	std::swap(bodyData, m_bodyData);
+
+	m_request = nullptr;
+	m_response = nullptr;
+
+	m_bodyLength = 0;
+
+	m_readState = ReadStateRequest;
+
+	if (request->m_bodyChunkHandler || request->m_bodyEndHandler)
+	{
+		auto endHandler = request->m_bodyEndHandler;
+		request->SetBodyHandlers(HttpRequest::TBodyChunkHandler(), HttpRequest::TBodyEndHandler());
+
+		if (endHandler)
+		{
+			endHandler();
+		}
+	}
+	else if (request->GetDataHandler())
+	{
+		auto dataHandler = request->GetDataHandler();
+		request->SetDataHandler(std::function<void(const std::vector<uint8_t>&)>());
+
+		dataHandler(bodyData);
+	}
+}
+
+void HttpConnection::RefuseBody()
+{
+	fwRefContainer<HttpRequest> request = m_request;
+	fwRefContainer<HttpResponse> response = m_response;
+
+	request->SetDataHandler(std::function<void(const std::vector<uint8_t>&)>());
+	request->SetBodyHandlers(HttpRequest::TBodyChunkHandler(), HttpRequest::TBodyEndHandler());
+
+	m_request = nullptr;
+	m_response = nullptr;
+
+	m_bodyData.clear();
+	m_bodyLength = 0;
+
+	// the rest of the body is still on its way, so the connection can't be used for any further requests
+	m_readState = ReadStateDiscard;
+	m_lastRequest = true;
+
+	bool queued;
+
+	{
+		std::unique_lock<std::mutex> lock(m_responseMutex);
+
+		response->m_closeConnection = true;
+
+		queued = std::find_if(m_responses.begin(), m_responses.end(), [&] (const fwRefContainer<HttpResponse>& entry)
+		{
+			return entry.GetRef() == response.GetRef();
+		}) != m_responses.end();
+	}
+
+	if (!response->HasSentHeaders())
+	{
+		HeaderMap headers;
+		headers["Content-Length"] = "0";
+
+		response->WriteHead(413, headers);
+		response->End();
+	}
+	else if (!queued)
+	{
+		// the response is done already, so there's nobody left to close the connection once it ends
+		m_closing = true;
+		m_stream->Close();
+	}
+}
+
+void HttpConnection::RejectRequest(const fwRefContainer<HttpResponse>& response, int statusCode)
+{
+	// where the body ends isn't known, so nothing after this can be read
+	m_readState = ReadStateDiscard;
+	m_lastRequest = true;
+
+	{
+		std::unique_lock<std::mutex> lock(m_responseMutex);
+		response->m_closeConnection = true;
+	}
+
+	HeaderMap headers;
+	headers["Content-Length"] = "0";
+
+	response->WriteHead(statusCode, headers);
+	response->End();
+}
+
+void HttpConnection::ResumeBody()
+{
+	if (std::this_thread::get_id() != m_threadId)
+	{
+		std::shared_ptr<HttpConnection> self = shared_from_this();
+
+		m_stream->ScheduleCallback([=] ()
+		{
+			self->ResumeBody();
+		});
+
+		return;
+	}
+
+	if (m_closing)
+	{
+		return;
+	}
+
+	if (m_readPaused)
+	{
+		m_readPaused = false;
+		m_stream->ResumeReading();
+	}
+
+	ProcessReadBuffer();
+}
+
+void HttpConnection::WriteResponse(HttpResponse* response, std::vector<uint8_t>&& data)
+{
+	std::unique_lock<std::mutex> lock(m_responseMutex);
+
+	if (response->m_writeBlocked)
+	{
+		auto dataRef = std::make_shared<std::vector<uint8_t>>(std::move(data));
+
+		response->m_blockedWrites.push_back([=] (const fwRefContainer<TcpServerStream>& stream)
+		{
+			stream->Write(std::move(*dataRef));
+		});
+
+		return;
+	}
+
+	m_stream->Write(std::move(data));
+}
+
+bool HttpConnection::IsResponseWritable(HttpResponse* response)
+{
+	std::unique_lock<std::mutex> lock(m_responseMutex);
+
+	return !m_closing && !response->m_writeBlocked && !m_stream->IsAboveHighWaterMark();
+}
+
+void HttpConnection::SetResponseDrainHandler(HttpResponse* response, const std::function<void()>& handler)
+{
+	std::unique_lock<std::mutex> lock(m_responseMutex);
+
+	if (m_closing && handler)
+	{
+		return;
+	}
+
+	response->m_drainHandler = handler;
+}
+
+void HttpConnection::OnDrain()
+{
+	std::function<void()> drainHandler;
+
+	{
+		std::unique_lock<std::mutex> lock(m_responseMutex);
+
+		if (!m_responses.empty() && !m_responses.front()->m_writeBlocked)
+		{
+			drainHandler = m_responses.front()->m_drainHandler;
+		}
+	}
+
+	if (drainHandler)
+	{
+		drainHandler();
+	}
+}
+
+bool HttpConnection::AttachWebSocket(HttpResponse* response, const fwRefContainer<HttpWebSocket>& webSocket)
+{
+	if (std::this_thread::get_id() != m_threadId || !m_processing || m_closing || m_readState != ReadStateRequest)
+	{
+		return false;
+	}
+
+	// only the request that was read last can be upgraded
+	{
+		std::unique_lock<std::mutex> lock(m_responseMutex);
+
+		if (m_responses.empty() || m_responses.back().GetRef() != response)
+		{
+			return false;
+		}
+	}
+
+	m_webSocket = webSocket;
+
+	m_readState = ReadStateWebSocket;
+	m_lastRequest = true;
+
+	return true;
+}
+
+void HttpConnection::RecordResponse(HttpResponse* response, bool ended)
+{
+	response->m_inFlight = false;
+
+	m_metrics->requestsInFlight.Add(-1);
+
+	if (!ended)
+	{
+		return;
+	}
+
+	HttpRouteMetrics* routeMetrics = (response->m_routeMetrics) ? response->m_routeMetrics : &m_metrics->unrouted;
+
+	// status codes below 100 wrap around, and fail the bounds check just like those above 599
+	size_t statusClass = static_cast<size_t>(response->GetStatusCode() / 100) - 1;
+
+	if (statusClass < _countof(routeMetrics->responses))
+	{
+		routeMetrics->responses[statusClass].Add();
+	}
+
+	auto duration = std::chrono::steady_clock::now() - response->m_startTime;
+	routeMetrics->latency.Record(std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+}
+
+void HttpConnection::EndResponse(HttpResponse* response)
+{
+	{
+		std::unique_lock<std::mutex> lock(m_responseMutex);
+		response->m_ended = true;
+	}
+
+	if (response->m_inFlight)
+	{
+		RecordResponse(response, true);
+	}
+
+	// if the response ended on another thread, its writes may still be queued for the stream's thread - so the next
+	// response only gets to write once those went through
+	if (std::this_thread::get_id() != m_threadId)
+	{
+		std::shared_ptr<HttpConnection> self = shared_from_this();
+		fwRefContainer<HttpResponse> responseRef = response;
+
+		m_stream->ScheduleCallback([=] ()
+		{
+			self->FlushResponse(responseRef.GetRef());
+		});
+
+		return;
+	}
+
+	FlushResponse(response);
+}
+
+void HttpConnection::FlushResponse(HttpResponse* response)
+{
+	{
+		std::unique_lock<std::mutex> lock(m_responseMutex);
+		response->m_flushed = true;
+	}
+
+	OnResponseEnded();
+}
+
+void HttpConnection::OnResponseEnded()
+{
+	bool closeConnection = false;
+	bool drained = false;
+
+	// the response that got to write next, which may have been waiting for that
+	std::function<void()> drainHandler;
+
+	{
+		std::unique_lock<std::mutex> lock(m_responseMutex);
+
+		while (!m_responses.empty() && m_responses.front()->m_flushed)
+		{
+			closeConnection = m_responses.front()->m_closeConnection;
+			m_responses.pop_front();
+
+			if (closeConnection)
+			{
+				break;
+			}
+
+			// let the next response write whatever it held back
+			if (!m_responses.empty())
+			{
+				auto& nextResponse = m_responses.front();
+				nextResponse->m_writeBlocked = false;
+
+				for (auto& write : nextResponse->m_blockedWrites)
+				{
+					write(m_stream);
+				}
+
+				nextResponse->m_blockedWrites.clear();
+
+				drainHandler = nextResponse->m_drainHandler;
+			}
+		}
+
+		drained = m_responses.empty();
+	}
+
+	// closing flushes anything written before
+	if (closeConnection)
+	{
+		m_closing = true;
+		m_stream->Close();
+
+		return;
+	}
+
+	// nothing's being handled anymore, so the connection is idle until the next request comes in
+	if (drained)
+	{
+		StartKeepAlive();
+	}
+
+	if (drainHandler && !m_stream->IsAboveHighWaterMark())
+	{
+		drainHandler();
+	}
+
+	// pipelined requests may have been waiting for the queue to drain
+	ProcessReadBuffer();
+}
+
 void HttpServerImpl::OnConnection(fwRefContainer<TcpServerStream> stream)
 {
-	enum HttpConnectionReadState
-	{
-		ReadStateRequest,
-		ReadStateBody,
-		ReadStateChunked
-	};
+	std::shared_ptr<HttpConnection> connection = std::make_shared<HttpConnection>(stream, [=] (const fwRefContainer<HttpRequest>& request, const fwRefContainer<HttpResponse>& response)
+	{
+		if (m_router.Dispatch(request, response))
+		{
+			return;
+		}
+
+		for (auto& handler : m_handlers)
+		{
+			if (handler->HandleRequest(request, response) || response->HasEnded())
+			{
+				break;
+			}
+		}
+	}, std::atomic_load(&m_compressionOptions), std::atomic_load(&m_requestLimits), std::atomic_load(&m_metrics));
+
+	connection->Attach();
+}
+
+HttpRequest::HttpRequest(int httpVersionMajor, int httpVersionMinor, std::vector<char>&& headerData, const boost::string_ref& requestMethod, const boost::string_ref& path, HeaderViewList&& headerList)
+	: m_httpVersionMajor(httpVersionMajor), m_httpVersionMinor(httpVersionMinor), m_headerData(std::move(headerData)), m_requestMethod(requestMethod), m_path(path), m_headerList(std::move(headerList)), m_maxBodySize(0), m_bodyPaused(false)
+{
+}
+
+HttpRequest::~HttpRequest()
+{
+	SetDataHandler(std::function<void(const std::vector<uint8_t>&)>());
+	SetBodyHandlers(TBodyChunkHandler(), TBodyEndHandler());
+}
+
+void HttpRequest::ResumeBody()
+{
+	m_bodyPaused = false;
+
+	auto connection = m_connection.lock();
+
+	if (connection)
+	{
+		connection->ResumeBody();
+	}
+}
+
+HttpResponse::HttpResponse(fwRefContainer<TcpServerStream> clientStream, fwRefContainer<HttpRequest> request)
+	: HttpResponse(clientStream, request, std::shared_ptr<HttpConnection>())
+{
+
+}
+
+HttpResponse::HttpResponse(fwRefContainer<TcpServerStream> clientStream, fwRefContainer<HttpRequest> request, const std::shared_ptr<HttpConnection>& connection)
+	: m_clientStream(clientStream), m_connection(connection), m_ended(false), m_statusCode(200), m_sentHeaders(false), m_request(request), m_closeConnection(false), m_chunked(false), m_writeBlocked(false), m_flushed(false), m_routeMetrics(nullptr), m_inFlight(false)
+{
+
+}
+
+HttpResponse::~HttpResponse()
+{
+	// e.g. if the connection closed before a handler got to respond
+	if (m_inFlight)
+	{
+		m_connection->RecordResponse(this, false);
+	}
+}
+
+std::string HttpResponse::GetHeader(const std::string& name)
+{
+	auto it = m_headerList.find(name);
+
+	return (it == m_headerList.end()) ? std::string() : it->second;
+}
+
+void HttpResponse::SetHeader(const std::string& name, const std::string& value)
+{
+	m_headerList[name] = value;
+}
+
+void HttpResponse::RemoveHeader(const std::string& name)
+{
+	m_headerList.erase(name);
+}
 
-	struct HttpConnectionData
-	{
-		HttpConnectionReadState readState;
+void HttpResponse::WriteHead(int statusCode)
+{
+	return HttpResponse::WriteHead(statusCode, std::string(), m_headerList);
+}
+
+void HttpResponse::WriteHead(int statusCode, const HeaderMap& headers)
+{
+	return HttpResponse::WriteHead(statusCode, std::string(""), headers);
+}
 
-		std::deque<uint8_t> readBuffer;
+void HttpResponse::WriteHead(int statusCode, const std::string& statusMessage)
+{
+	return HttpResponse::WriteHead(statusCode, statusMessage, m_headerList);
+}
+
+void HttpResponse::WriteHead(int statusCode, const std::string& statusMessage, const HeaderMap& headers)
+{
+	if (m_sentHeaders)
+	{
+		return;
+	}
 
-		std::vector<uint8_t> requestData;
+	std::vector<uint8_t> outData;
+	SerializeHead(statusCode, statusMessage, (headers.size() == 0) ? m_headerList : headers, 0, outData);
 
-		size_t lastLength;
+	WriteOut(std::move(outData));
+}
 
-		phr_header headers[50];
+template<size_t Length>
+static inline void AppendLiteral(std::vector<uint8_t>& out, const char(&literal)[Length])
+{
+	out.insert(out.end(), literal, literal + Length - 1);
+}
 
-		phr_chunked_decoder decoder;
+static inline void AppendString(std::vector<uint8_t>& out, const char* data, size_t length)
+{
+	out.insert(out.end(), data, data + length);
+}
 
-		fwRefContainer<HttpRequest> request;
+static inline void AppendString(std::vector<uint8_t>& out, const std::string& string)
+{
+	out.insert(out.end(), string.begin(), string.end());
+}
 
-		fwRefContainer<HttpResponse> response;
+// the Date value for the current second - formatting it only once a second per thread saves a gmtime/strftime pair on
+// nearly every response
+static const char* GetDateHeaderValue()
+{
+	struct DateCache
+	{
+		std::time_t second;
 
-		int contentLength;
+		char value[32];
 
-		HttpConnectionData()
-			: readState(ReadStateRequest), lastLength(0), contentLength(0)
+		DateCache()
+			: second(-1)
 		{
 
 		}
 	};
 
-	std::shared_ptr<HttpConnectionData> connectionData = std::make_shared<HttpConnectionData>();
+	static thread_local DateCache cache;
+
+	std::time_t now = std::time(nullptr);
 
-	stream->SetReadCallback([=] (const std::vector<uint8_t>& data)
+	if (now != cache.second)
 	{
-		// keep a reference to the connection data locally
-		std::shared_ptr<HttpConnectionData> localConnectionData = connectionData;
+		static const char* dayNames[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+		static const char* monthNames[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
 
-		// place bytes in the read buffer
-		auto& readQueue = connectionData->readBuffer;
+		std::tm time;
 
-		size_t origSize = readQueue.size();
-		readQueue.resize(origSize + data.size());
+#ifdef _WIN32
+		gmtime_s(&time, &now);
+#else
+		gmtime_r(&now, &time);
+#endif
 
-		// close the stream if the length is too big
-		if (readQueue.size() > (1024 * 1024 * 5))
-		{
-			stream->Close();
-			return;
-		}
+		// IMF-fixdate, which is always in English and GMT, whatever the locale says
+		snprintf(cache.value, sizeof(cache.value), "%s, %02d %s %04d %02d:%02d:%02d GMT", dayNames[time.tm_wday], time.tm_mday,
+			monthNames[time.tm_mon], time.tm_year + 1900, time.tm_hour, time.tm_min, time.tm_sec);
+
+		cache.second = now;
+	}
+
+	return cache.value;
+}
+
+void HttpResponse::SerializeHead(int statusCode, const std::string& statusMessage, const HeaderMap& usedHeaders, size_t bodyLength, std::vector<uint8_t>& outData)
+{
+	bool isHttp11 = (m_request->GetHttpVersion().second >= 1);
+
+	// the connection may have decided to close already, e.g. after refusing a request body
+	m_closeConnection = m_closeConnection || !IsKeepAliveRequest(m_request);
+	m_statusCode = statusCode;
 
-		// actually copy
-		std::copy(data.begin(), data.end(), readQueue.begin() + origSize);
+	// without a known length, the body is either sent in chunks or delimited by the connection closing
+	bool hasBody = (statusCode >= 200 && statusCode != 204 && statusCode != 304);
+	HttpContentEncoding encoding = HttpContentEncoding::Identity;
 
-		// process request data until there's no need anymore
-		bool continueProcessing = true;
+	if (hasBody && usedHeaders.find("content-length") == usedHeaders.end() && usedHeaders.find("transfer-encoding") == usedHeaders.end())
+	{
+		encoding = GetCompressionEncoding(statusCode, usedHeaders, -1);
 
-		while (continueProcessing)
+		if (encoding != HttpContentEncoding::Identity)
 		{
-			// depending on the state, perform an action
-			if (localConnectionData->readState == ReadStateRequest)
-			{
-				// copy the deque into a vector for data purposes
-				std::vector<uint8_t> requestData(readQueue.begin(), readQueue.end());
+			m_compressor = std::make_unique<HttpCompressor>(encoding, m_connection->GetCompressionOptions().level);
 
-				// define output variables
-				const char* requestMethod;
-				size_t requestMethodLength;
+			if (!m_compressor->IsValid())
+			{
+				m_compressor.reset();
+				encoding = HttpContentEncoding::Identity;
+			}
+		}
 
-				const char* path;
-				size_t pathLength;
+		if (isHttp11)
+		{
+			m_chunked = true;
+		}
+		else
+		{
+			m_closeConnection = true;
+		}
+	}
 
-				int minorVersion;
-				size_t numHeaders = 50;
+	const char* message = (statusMessage.empty()) ? GetStatusMessage(statusCode) : statusMessage.c_str();
+	size_t messageLength = strlen(message);
 
-				int result = phr_parse_request(reinterpret_cast<const char*>(&requestData[0]), requestData.size(), &requestMethod, &requestMethodLength,
-											   &path, &pathLength, &minorVersion, localConnectionData->headers, &numHeaders, localConnectionData->lastLength);
+	bool needsDate = (usedHeaders.find("date") == usedHeaders.end());
 
-				if (result > 0)
-				{
-					// prepare data for a request instance
-					std::string requestMethodStr(requestMethod, requestMethodLength);
-					std::string pathStr(path, pathLength);
+	// size it all up front, so the buffer only gets allocated once - the fixed part covers the status line and any
+	// headers added here
+	size_t length = 192 + messageLength + bodyLength;
 
-					HeaderMap headerList;
+	for (auto& header : usedHeaders)
+	{
+		length += header.first.size() + header.second.size() + 4;
+	}
 
-					for (int i = 0; i < numHeaders; i++)
-					{
-						auto& header = localConnectionData->headers[i];
+	outData.reserve(outData.size() + length);
 
-						headerList.insert(std::make_pair(std::string(header.name, header.name_len), std::string(header.value, header.value_len)));
-					}
+	char statusCodeString[16];
+	int statusCodeLength = snprintf(statusCodeString, sizeof(statusCodeString), "%d ", statusCode);
 
-					// remove the original bytes from the queue
-					readQueue.erase(readQueue.begin(), readQueue.begin() + result);
-					localConnectionData->lastLength = 0;
+	AppendString(outData, (isHttp11) ? "HTTP/1.1 " : "HTTP/1.0 ", 9);
+	AppendString(outData, statusCodeString, statusCodeLength);
+	AppendString(outData, message, messageLength);
+	AppendLiteral(outData, "\r\n");
 
-					// store the request in a request instance
-					fwRefContainer<HttpRequest> request = new HttpRequest(1, minorVersion, requestMethodStr, pathStr, headerList);
-					fwRefContainer<HttpResponse> response = new HttpResponse(stream, request);
+	if (needsDate)
+	{
+		AppendLiteral(outData, "Date: ");
+		AppendString(outData, GetDateHeaderValue(), 29);
+		AppendLiteral(outData, "\r\n");
+	}
 
-					for (auto& handler : m_handlers)
-					{
-						if (handler->HandleRequest(request, response) || response->HasEnded())
-						{
-							break;
-						}
-					}
+	if (encoding != HttpContentEncoding::Identity)
+	{
+		AppendLiteral(outData, "Content-Encoding: ");
+		AppendString(outData, GetContentEncodingName(encoding), strlen(GetContentEncodingName(encoding)));
+		AppendLiteral(outData, "\r\nVary: Accept-Encoding\r\n");
+	}
 
-					continueProcessing = (readQueue.size() > 0);
+	if (m_chunked)
+	{
+		AppendLiteral(outData, "Transfer-Encoding: chunked\r\n");
+	}
 
-					if (!response->HasEnded())
-					{
-						// check to see if we'll have to read user data
-						static std::string contentLengthKey = "content-length";
-						static std::string contentLengthDefault = "0";
-
-						auto& contentLengthStr = request->GetHeader(contentLengthKey, contentLengthDefault);
-						int contentLength = atoi(contentLengthStr.c_str());
-
-						if (contentLength > 0)
-						{
-							localConnectionData->request = request;
-							localConnectionData->response = response;
-							localConnectionData->contentLength = contentLength;
-
-							localConnectionData->readState = ReadStateBody;
-						}
-						else
-						{
-							static std::string transferEncodingKey = "transfer-encoding";
-							static std::string transferEncodingDefault = "";
-							static std::string transferEncodingComparison = "chunked";
-
-							if (request->GetHeader(transferEncodingKey, transferEncodingDefault) == transferEncodingComparison)
-							{
-								localConnectionData->request = request;
-								localConnectionData->response = response;
-								localConnectionData->contentLength = -1;
-
-								localConnectionData->lastLength = 0;
-
-								localConnectionData->readState = ReadStateChunked;
-
-								memset(&localConnectionData->decoder, 0, sizeof(localConnectionData->decoder));
-								localConnectionData->decoder.consume_trailer = true;
-							}
-						}
-					}
-				}
-				else if (result == -1)
-				{
-					// should probably send 'bad request'?
-					stream->Close();
-					return;
-				}
-				else if (result == -2)
-				{
-					localConnectionData->lastLength = requestData.size();
+	// HTTP/1.1 connections persist by default, so only mention it if they won't
+	if (m_closeConnection)
+	{
+		AppendLiteral(outData, "Connection: close\r\n");
+	}
+	else if (!isHttp11)
+	{
+		AppendLiteral(outData, "Connection: keep-alive\r\n");
+	}
 
-					continueProcessing = false;
-				}
-			}
-			else if (connectionData->readState == ReadStateBody)
-			{
-				int contentLength = localConnectionData->contentLength;
+	for (auto& header : usedHeaders)
+	{
+		AppendString(outData, header.first);
+		AppendLiteral(outData, ": ");
+		AppendString(outData, header.second);
+		AppendLiteral(outData, "\r\n");
+	}
 
-				if (readQueue.size() >= contentLength)
-				{
-					// copy the deque into a vector for data purposes, again
-					std::vector<uint8_t> requestData(readQueue.begin(), readQueue.begin() + contentLength);
+	AppendLiteral(outData, "\r\n");
 
-					// remove the original bytes from the queue
-					readQueue.erase(readQueue.begin(), readQueue.begin() + contentLength);
+	m_sentHeaders = true;
+}
 
-					// call the data handler
-					auto& dataHandler = localConnectionData->request->GetDataHandler();
+void HttpResponse::Write(const std::string& data)
+{
+	if (!m_sentHeaders)
+	{
+		WriteHead(m_statusCode);
+	}
 
-					if (dataHandler)
-					{
-						dataHandler(requestData);
+	// an empty chunk would end the body
+	if (data.empty())
+	{
+		return;
+	}
 
-						localConnectionData->request->SetDataHandler(std::function<void(const std::vector<uint8_t>&)>());
-					}
+	if (m_compressor)
+	{
+		WriteCompressed(data.data(), data.size(), false);
+	}
+	else
+	{
+		WriteBody(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+	}
+}
 
-					// clean up the req/res
-					localConnectionData->request = nullptr;
-					localConnectionData->response = nullptr;
+bool HttpResponse::WriteCompressed(const void* data, size_t length, bool finish)
+{
+	std::vector<uint8_t> compressed;
 
-					localConnectionData->readState = ReadStateRequest;
+	if (!m_compressor->Compress(data, length, finish, compressed))
+	{
+		// what got sent so far can't be continued, so the client has to see the body getting cut off
+		m_clientStream->Close();
 
-					continueProcessing = (readQueue.size() > 0);
-				}
-				else
-				{
-					continueProcessing = false;
-				}
-			}
-			else if (connectionData->readState == ReadStateChunked)
-			{
-				// append the remnant of the read queue to the vector
-				auto& requestData = localConnectionData->requestData;
+		return false;
+	}
 
-				size_t addedSize = readQueue.size() - requestData.size();
-				size_t oldSize = requestData.size();
-				requestData.resize(readQueue.size());
+	WriteBody(compressed.data(), compressed.size());
 
-				// copy the appendant
-				std::copy(readQueue.begin() + oldSize, readQueue.end(), requestData.begin() + localConnectionData->lastLength);
+	return true;
+}
 
-				// decode stuff
-				size_t requestSize = addedSize;
+void HttpResponse::WriteBody(const uint8_t* data, size_t length)
+{
+	if (length == 0)
+	{
+		return;
+	}
 
-				int result = phr_decode_chunked(&localConnectionData->decoder, reinterpret_cast<char*>(&requestData[localConnectionData->lastLength]), &requestSize);
+	// this gets coalesced with the header write by the stream
+	if (m_chunked)
+	{
+		char chunkHeader[24];
+		int chunkHeaderLength = snprintf(chunkHeader, sizeof(chunkHeader), "%llx\r\n", static_cast<unsigned long long>(length));
 
-				if (result == -2)
-				{
-					localConnectionData->lastLength += requestSize;
+		std::vector<uint8_t> chunk;
+		chunk.reserve(chunkHeaderLength + length + 2);
+		chunk.insert(chunk.end(), chunkHeader, chunkHeader + chunkHeaderLength);
+		chunk.insert(chunk.end(), data, data + length);
+		chunk.push_back('\r');
+		chunk.push_back('\n');
 
-					continueProcessing = false;
-				}
-				else if (result == -1)
-				{
-					stream->Close();
-					return;
-				}
-				else
-				{
-					// call the data handler
-					auto& dataHandler = localConnectionData->request->GetDataHandler();
+		WriteOut(std::move(chunk));
+	}
+	else
+	{
+		WriteOut(std::vector<uint8_t>(data, data + length));
+	}
+}
 
-					if (dataHandler)
-					{
-						requestData.resize(localConnectionData->lastLength);
+HttpContentEncoding HttpResponse::GetCompressionEncoding(int statusCode, const HeaderMap& headers, size_t bodyLength)
+{
+	if (!m_connection)
+	{
+		return HttpContentEncoding::Identity;
+	}
 
-						dataHandler(requestData);
+	auto& options = m_connection->GetCompressionOptions();
 
-						localConnectionData->request->SetDataHandler(std::function<void(const std::vector<uint8_t>&)>());
-					}
+	if (options.level <= 0 || bodyLength < options.minimumSize)
+	{
+		return HttpContentEncoding::Identity;
+	}
 
-					// clean up the req/res
-					localConnectionData->request = nullptr;
-					localConnectionData->response = nullptr;
+	// partial content refers to the body as it is, and bodies may be encoded already
+	if (statusCode < 200 || statusCode == 204 || statusCode == 206 || statusCode == 304 || headers.find("content-encoding") != headers.end())
+	{
+		return HttpContentEncoding::Identity;
+	}
 
-					localConnectionData->requestData.clear();
+	auto contentType = headers.find("content-type");
 
-					localConnectionData->readState = ReadStateRequest;
+	if (contentType == headers.end() || !IsCompressibleContentType(contentType->second))
+	{
+		return HttpContentEncoding::Identity;
+	}
 
-					continueProcessing = (readQueue.size() > 0);
-				}
-			}
-		}
-	});
+	return NegotiateContentEncoding(m_request->GetHeader("accept-encoding"));
 }
 
-HttpRequest::HttpRequest(int httpVersionMajor, int httpVersionMinor, const std::string& requestMethod, const std::string& path, const HeaderMap& headerList)
-	: m_httpVersionMajor(httpVersionMajor), m_httpVersionMinor(httpVersionMinor), m_requestMethod(requestMethod), m_path(path), m_headerList(headerList)
+void HttpResponse::WriteOut(std::vector<uint8_t>&& data)
 {
+	if (m_connection)
+	{
+		m_connection->WriteResponse(this, std::move(data));
+	}
+	else
+	{
+		m_clientStream->Write(std::move(data));
+	}
 }
 
-HttpRequest::~HttpRequest()
+void HttpResponse::ScheduleCallback(const std::function<void()>& callback)
 {
-	SetDataHandler(std::function<void(const std::vector<uint8_t>&)>());
+	m_clientStream->ScheduleCallback(callback);
 }
 
-HttpResponse::HttpResponse(fwRefContainer<TcpServerStream> clientStream, fwRefContainer<HttpRequest> request)
-	: m_clientStream(clientStream), m_ended(false), m_statusCode(200), m_sentHeaders(false), m_request(request), m_closeConnection(false)
+bool HttpResponse::IsWritable()
 {
+	if (m_connection)
+	{
+		return m_connection->IsResponseWritable(this);
+	}
 
+	return !m_clientStream->IsAboveHighWaterMark();
 }
 
-std::string HttpResponse::GetHeader(const std::string& name)
+void HttpResponse::SetDrainHandler(const std::function<void()>& handler)
 {
-	auto it = m_headerList.find(name);
+	if (m_connection)
+	{
+		m_connection->SetResponseDrainHandler(this, handler);
+		return;
+	}
 
-	return (it == m_headerList.end()) ? std::string() : it->second;
+	m_clientStream->SetLowWaterMarkCallback(handler);
 }
 
-void HttpResponse::SetHeader(const std::string& name, const std::string& value)
+void HttpResponse::End(const std::string& data)
 {
-	m_headerList[name] = value;
-}
+	// a single-shot body doesn't need to be chunked, and can go out in the same buffer as the headers
+	if (!m_sentHeaders && m_headerList.find("content-length") == m_headerList.end())
+	{
+		HttpContentEncoding encoding = GetCompressionEncoding(m_statusCode, m_headerList, data.size());
+		std::vector<uint8_t> outData;
+		std::vector<uint8_t> compressed;
 
-void HttpResponse::RemoveHeader(const std::string& name)
-{
-	m_headerList.erase(name);
-}
+		// compressing it in one go means the compressed length is known up front, too - if that fails, it's sent as it is
+		if (encoding != HttpContentEncoding::Identity && !HttpCompressor(encoding, m_connection->GetCompressionOptions().level).Compress(data.data(), data.size(), true, compressed))
+		{
+			encoding = HttpContentEncoding::Identity;
+		}
 
-void HttpResponse::WriteHead(int statusCode)
-{
-	return HttpResponse::WriteHead(statusCode, std::string(""));
-}
+		if (encoding != HttpContentEncoding::Identity)
+		{
+			SetHeader(std::string("Content-Encoding"), std::string(GetContentEncodingName(encoding)));
+			SetHeader(std::string("Vary"), std::string("Accept-Encoding"));
+			SetHeader(std::string("Content-Length"), std::to_string(compressed.size()));
 
-void HttpResponse::WriteHead(int statusCode, const HeaderMap& headers)
-{
-	return HttpResponse::WriteHead(statusCode, std::string(""), headers);
-}
+			SerializeHead(m_statusCode, std::string(), m_headerList, compressed.size(), outData);
+			outData.insert(outData.end(), compressed.begin(), compressed.end());
+		}
+		else
+		{
+			SetHeader(std::string("Content-Length"), std::to_string(data.size()));
 
-void HttpResponse::WriteHead(int statusCode, const std::string& statusMessage)
-{
-	return HttpResponse::WriteHead(statusCode, statusMessage, HeaderMap());
+			SerializeHead(m_statusCode, std::string(), m_headerList, data.size(), outData);
+			outData.insert(outData.end(), data.begin(), data.end());
+		}
+
+		WriteOut(std::move(outData));
+
+		End();
+		return;
+	}
+
+	Write(data);
+	End();
 }
 
-void HttpResponse::WriteHead(int statusCode, const std::string& statusMessage, const HeaderMap& headers)
+void HttpResponse::End()
 {
-	if (m_sentHeaders)
+	if (m_ended)
 	{
 		return;
 	}
 
-	std::ostringstream outData;
-	outData.imbue(std::locale());
+	if (!m_sentHeaders)
+	{
+		if (m_headerList.find("content-length") == m_headerList.end())
+		{
+			SetHeader(std::string("Content-Length"), std::string("0"));
+		}
+
+		WriteHead(m_statusCode);
+	}
 
-	outData << "HTTP/1.0 " << std::to_string(statusCode) << " " << (statusMessage.empty() ? GetStatusMessage(statusCode) : statusMessage) << "\r\n";
+	bool complete = true;
 
-	auto& usedHeaders = (headers.size() == 0) ? m_headerList : headers;
-	
-	if (usedHeaders.find("date") == usedHeaders.end())
+	if (m_compressor)
 	{
-		std::time_t timeVal;
-		std::time(&timeVal);
+		complete = WriteCompressed(nullptr, 0, true);
 
-		std::tm time = *std::gmtime(&timeVal);
-		outData << "Date: " << std::put_time(&time, "%a, %d %b %Y %H:%M:%S %Z") << "\r\n";
+		m_compressor.reset();
 	}
 
-	auto requestConnection = m_request->GetHeader(std::string("connection"), std::string("close"));
-
-	if (_stricmp(requestConnection.c_str(), "keep-alive") != 0)
+	// a body that got cut off mustn't look complete
+	if (m_chunked && complete)
 	{
-		outData << "Connection: close\r\n";
+		static const char lastChunk[] = "0\r\n\r\n";
+
+		WriteOut(std::vector<uint8_t>(lastChunk, lastChunk + sizeof(lastChunk) - 1));
+	}
 
-		m_closeConnection = true;
+	if (m_connection)
+	{
+		m_connection->EndResponse(this);
 	}
 	else
 	{
-		outData << "Connection: keep-alive\r\n";
+		m_ended = true;
+
+		if (m_closeConnection)
+		{
+			m_clientStream->Close();
+		}
 	}
+}
 
-	for (auto& header : usedHeaders)
+fwRefContainer<HttpWebSocket> HttpResponse::AcceptWebSocket(const std::string& protocol)
+{
+	if (m_sentHeaders)
 	{
-		outData << header.first << ": " << header.second << "\r\n";
+		return nullptr;
 	}
 
-	outData << "\r\n";
+	fwRefContainer<HttpWebSocket> webSocket;
 
-	std::string outStr = outData.str();
+	if (HttpWebSocket::IsUpgradeRequest(m_request) && m_connection)
+	{
+		webSocket = new HttpWebSocket(this, m_clientStream, m_connection->GetRequestLimits().maxWebSocketMessageSize);
 
-	std::vector<uint8_t> dataBuffer(outStr.size());
-	memcpy(&dataBuffer[0], outStr.c_str(), outStr.size());
+		if (!m_connection->AttachWebSocket(this, webSocket))
+		{
+			webSocket = nullptr;
+		}
+	}
 
-	m_clientStream->Write(dataBuffer);
+	HeaderMap headers;
 
-	m_sentHeaders = true;
-}
+	if (!webSocket.GetRef())
+	{
+		headers["Content-Length"] = "0";
 
-void HttpResponse::Write(const std::string& data)
-{
-	SetHeader(std::string("Content-Length"), std::to_string(data.size()));
+		// clients asking for another version get told which one is supported
+		if (boost::algorithm::iequals(m_request->GetHeader("upgrade"), "websocket") && m_request->GetHeader("sec-websocket-version") != "13")
+		{
+			headers["Sec-WebSocket-Version"] = "13";
 
-	if (!m_sentHeaders)
-	{
-		WriteHead(m_statusCode);
+			WriteHead(426, headers);
+		}
+		else
+		{
+			WriteHead(400, headers);
+		}
+
+		End();
+
+		return nullptr;
 	}
 
-	std::vector<uint8_t> dataBuffer(data.size());
-	memcpy(&dataBuffer[0], data.c_str(), data.size());
+	headers["Upgrade"] = "websocket";
+	headers["Connection"] = "Upgrade";
+	headers["Sec-WebSocket-Accept"] = HttpWebSocket::GetAcceptKey(m_request->GetHeader("sec-websocket-key"));
 
-	m_clientStream->Write(dataBuffer);
-}
+	if (!protocol.empty())
+	{
+		headers["Sec-WebSocket-Protocol"] = protocol;
+	}
 
-void HttpResponse::End(const std::string& data)
-{
-	Write(data);
+	WriteHead(101, headers);
 	End();
+
+	return webSocket;
 }
 
-void HttpResponse::End()
+
+// reason phrases, indexed by status code
+struct HttpStatusTable
 {
-	if (m_closeConnection)
+	const char* messages[600];
+
+	HttpStatusTable()
 	{
-		m_clientStream->Close();
+		for (auto& message : messages)
+		{
+			message = "";
+		}
+
+		messages[100] = "Continue";
+		messages[101] = "Switching Protocols";
+		messages[200] = "OK";
+		messages[201] = "Created";
+		messages[202] = "Accepted";
+		messages[203] = "Non-Authoritative Information";
+		messages[204] = "No Content";
+		messages[205] = "Reset Content";
+		messages[206] = "Partial Content";
+		messages[300] = "Multiple Choices";
+		messages[301] = "Moved Permanently";
+		messages[302] = "Found";
+		messages[303] = "See Other";
+		messages[304] = "Not Modified";
+		messages[305] = "Use Proxy";
+		messages[307] = "Temporary Redirect";
+		messages[400] = "Bad Request";
+		messages[401] = "Unauthorized";
+		messages[402] = "Payment Required";
+		messages[403] = "Forbidden";
+		messages[404] = "Not Found";
+		messages[405] = "Method Not Allowed";
+		messages[406] = "Not Acceptable";
+		messages[407] = "Proxy Authentication Required";
+		messages[408] = "Request Time-out";
+		messages[409] = "Conflict";
+		messages[410] = "Gone";
+		messages[411] = "Length Required";
+		messages[412] = "Precondition Failed";
+		messages[413] = "Request Entity Too Large";
+		messages[414] = "Request-URI Too Large";
+		messages[415] = "Unsupported Media Type";
+		messages[416] = "Requested Range not Satisfiable";
+		messages[417] = "Expectation Failed";
+		messages[422] = "Unprocessable Entity";
+		messages[426] = "Upgrade Required";
+		messages[429] = "Too Many Requests";
+		messages[500] = "Internal Server Error";
+		messages[501] = "Not Implemented";
+		messages[502] = "Bad Gateway";
+		messages[503] = "Service Unavailable";
+		messages[504] = "Gateway Time-out";
+		messages[505] = "HTTP Version not Supported";
 	}
-}
+};
 
+static const HttpStatusTable g_statusTable;
+
+const char* HttpResponse::GetStatusMessage(int statusCode)
+{
+	if (statusCode < 0 || static_cast<size_t>(statusCode) >= _countof(g_statusTable.messages))
+	{
+		return "";
+	}
 
-std::string HttpResponse::GetStatusMessage(int statusCode)
-{
-	static std::map<int, std::string> httpStatuses;
-
-	if (httpStatuses.empty())
-	{
-		httpStatuses[100] = "Continue";
-		httpStatuses[101] = "Switching Protocols";
-		httpStatuses[200] = "OK";
-		httpStatuses[201] = "Created";
-		httpStatuses[202] = "Accepted";
-		httpStatuses[203] = "Non-Authoritative Information";
-		httpStatuses[204] = "No Content";
-		httpStatuses[205] = "Reset Content";
-		httpStatuses[206] = "Partial Content";
-		httpStatuses[300] = "Multiple Choices";
-		httpStatuses[301] = "Moved Permanently";
-		httpStatuses[302] = "Found";
-		httpStatuses[303] = "See Other";
-		httpStatuses[304] = "Not Modified";
-		httpStatuses[305] = "Use Proxy";
-		httpStatuses[307] = "Temporary Redirect";
-		httpStatuses[400] = "Bad Request";
-		httpStatuses[401] = "Unauthorized";
-		httpStatuses[402] = "Payment Required";
-		httpStatuses[403] = "Forbidden";
-		httpStatuses[404] = "Not Found";
-		httpStatuses[405] = "Method Not Allowed";
-		httpStatuses[406] = "Not Acceptable";
-		httpStatuses[407] = "Proxy Authentication Required";
-		httpStatuses[408] = "Request Time-out";
-		httpStatuses[409] = "Conflict";
-		httpStatuses[410] = "Gone";
-		httpStatuses[411] = "Length Required";
-		httpStatuses[412] = "Precondition Failed";
-		httpStatuses[413] = "Request Entity Too Large";
-		httpStatuses[414] = "Request-URI Too Large";
-		httpStatuses[415] = "Unsupported Media Type";
-		httpStatuses[416] = "Requested Range not Satisfiable";
-		httpStatuses[417] = "Expectation Failed";
-		httpStatuses[422] = "Unprocessable Entity";
-		httpStatuses[429] = "Too Many Requests";
-		httpStatuses[500] = "Internal Server Error";
-		httpStatuses[501] = "Not Implemented";
-		httpStatuses[502] = "Bad Gateway";
-		httpStatuses[503] = "Service Unavailable";
-		httpStatuses[504] = "Gateway Time-out";
-		httpStatuses[505] = "HTTP Version not Supported";
-
-	}
-
-	return httpStatuses[statusCode];
+	return g_statusTable.messages[statusCode];
 }
 }
 
@@ -500,7 +1874,7 @@ public:
 
 		if (request->GetRequestMethod() == "GET")
 		{
-			response->End(std::string(request->GetPath()));
+			response->End(request->GetPath().to_string());
 		}
 		else if (request->GetRequestMethod() == "POST")
 		{
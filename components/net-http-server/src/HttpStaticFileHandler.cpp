@@ -0,0 +1,732 @@
+/*
+ * This file is part of the CitizenFX project - http://citizen.re/
+ *
+ * See LICENSE and MENTIONS in the root of the source tree for information
+ * regarding licensing.
+ */
+
+#include "StdInc.h"
+#include "HttpStaticFileHandler.h"
+
+#include <VFSManager.h>
+
+#include <botan/hash.h>
+#include <botan/hex.h>
+
+#include <boost/algorithm/string.hpp>
+
+namespace net
+{
+// reads through the device happen in chunks of this size
+static const size_t g_readChunkSize = 64 * 1024;
+
+// most of the time is spent waiting for devices, rather than using the CPU
+static const int g_workerThreadCount = 4;
+
+static const std::pair<const char*, const char*> g_contentTypes[] = {
+	{ "html", "text/html; charset=utf-8" },
+	{ "htm", "text/html; charset=utf-8" },
+	{ "css", "text/css; charset=utf-8" },
+	{ "js", "application/javascript; charset=utf-8" },
+	{ "json", "application/json; charset=utf-8" },
+	{ "txt", "text/plain; charset=utf-8" },
+	{ "xml", "application/xml" },
+	{ "svg", "image/svg+xml" },
+	{ "png", "image/png" },
+	{ "jpg", "image/jpeg" },
+	{ "jpeg", "image/jpeg" },
+	{ "gif", "image/gif" },
+	{ "ico", "image/x-icon" },
+	{ "webp", "image/webp" },
+	{ "woff", "font/woff" },
+	{ "woff2", "font/woff2" },
+	{ "ttf", "font/ttf" },
+	{ "otf", "font/otf" },
+	{ "mp3", "audio/mpeg" },
+	{ "ogg", "audio/ogg" },
+	{ "wav", "audio/wav" },
+	{ "mp4", "video/mp4" },
+	{ "webm", "video/webm" },
+	{ "wasm", "application/wasm" },
+};
+
+static const char* GetContentType(const std::string& path)
+{
+	size_t extensionStart = path.find_last_of("./");
+
+	if (extensionStart != std::string::npos && path[extensionStart] == '.')
+	{
+		const char* extension = path.c_str() + extensionStart + 1;
+
+		for (auto& contentType : g_contentTypes)
+		{
+			if (_stricmp(extension, contentType.first) == 0)
+			{
+				return contentType.second;
+			}
+		}
+	}
+
+	return "application/octet-stream";
+}
+
+static int HexValue(char c)
+{
+	if (c >= '0' && c <= '9')
+	{
+		return c - '0';
+	}
+	else if (c >= 'a' && c <= 'f')
+	{
+		return c - 'a' + 10;
+	}
+	else if (c >= 'A' && c <= 'F')
+	{
+		return c - 'A' + 10;
+	}
+
+	return -1;
+}
+
+bool HttpStaticFileHandler::DecodeRelativePath(const boost::string_ref& path, std::string* relativePath)
+{
+	std::string decoded;
+	decoded.reserve(path.size());
+
+	for (size_t i = 0; i < path.size(); i++)
+	{
+		char c = path[i];
+
+		if (c == '%')
+		{
+			int high = (i + 2 < path.size()) ? HexValue(path[i + 1]) : -1;
+			int low = (high >= 0) ? HexValue(path[i + 2]) : -1;
+
+			if (low < 0)
+			{
+				return false;
+			}
+
+			c = static_cast<char>((high << 4) | low);
+			i += 2;
+		}
+
+		// there's no telling how a device treats these
+		if (c == '\0' || c == '\\' || c == ':')
+		{
+			return false;
+		}
+
+		decoded.push_back(c);
+	}
+
+	std::vector<std::string> segments;
+	boost::algorithm::split(segments, decoded, boost::algorithm::is_any_of("/"));
+
+	relativePath->clear();
+
+	for (auto& segment : segments)
+	{
+		if (segment == "..")
+		{
+			return false;
+		}
+
+		if (segment.empty() || segment == ".")
+		{
+			continue;
+		}
+
+		if (!relativePath->empty())
+		{
+			relativePath->push_back('/');
+		}
+
+		*relativePath += segment;
+	}
+
+	// directories get their index
+	if (relativePath->empty() || decoded.back() == '/')
+	{
+		*relativePath += (relativePath->empty()) ? "index.html" : "/index.html";
+	}
+
+	return true;
+}
+
+bool HttpStaticFileHandler::MatchesETag(const boost::string_ref& header, const std::string& etag)
+{
+	std::vector<boost::iterator_range<const char*>> tags;
+	boost::algorithm::split(tags, header, boost::algorithm::is_any_of(","));
+
+	for (auto& tagRange : tags)
+	{
+		boost::string_ref tag(tagRange.begin(), tagRange.size());
+
+		while (!tag.empty() && tag.front() == ' ')
+		{
+			tag.remove_prefix(1);
+		}
+
+		while (!tag.empty() && tag.back() == ' ')
+		{
+			tag.remove_suffix(1);
+		}
+
+		if (tag.starts_with("W/"))
+		{
+			tag.remove_prefix(2);
+		}
+
+		if (tag == "*" || tag == etag)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static bool ParseOffset(const boost::string_ref& string, uint64_t* value)
+{
+	if (string.empty() || string.size() > 18)
+	{
+		return false;
+	}
+
+	*value = 0;
+
+	for (char c : string)
+	{
+		if (c < '0' || c > '9')
+		{
+			return false;
+		}
+
+		*value = (*value * 10) + (c - '0');
+	}
+
+	return true;
+}
+
+HttpStaticFileHandler::RangeResult HttpStaticFileHandler::ParseRange(boost::string_ref header, const boost::string_ref& ifRange, const std::string& etag, uint64_t length, uint64_t* start, uint64_t* end)
+{
+	// a range only applies if the client still has the version it asks about
+	if (!ifRange.empty() && ifRange != etag)
+	{
+		return RangeResult::Ignore;
+	}
+
+	if (!header.starts_with("bytes="))
+	{
+		return RangeResult::Ignore;
+	}
+
+	header.remove_prefix(6);
+
+	size_t separator = header.find('-');
+
+	if (separator == boost::string_ref::npos || header.find(',') != boost::string_ref::npos)
+	{
+		return RangeResult::Ignore;
+	}
+
+	boost::string_ref first = header.substr(0, separator);
+	boost::string_ref last = header.substr(separator + 1);
+
+	uint64_t firstValue = 0;
+	uint64_t lastValue = 0;
+
+	// a suffix range, i.e. the last n bytes
+	if (first.empty())
+	{
+		if (!ParseOffset(last, &lastValue))
+		{
+			return RangeResult::Ignore;
+		}
+
+		if (lastValue == 0 || length == 0)
+		{
+			return RangeResult::Unsatisfiable;
+		}
+
+		*start = length - std::min(lastValue, length);
+		*end = length - 1;
+
+		return RangeResult::Satisfiable;
+	}
+
+	if (!ParseOffset(first, &firstValue) || (!last.empty() && (!ParseOffset(last, &lastValue) || lastValue < firstValue)))
+	{
+		return RangeResult::Ignore;
+	}
+
+	if (firstValue >= length)
+	{
+		return RangeResult::Unsatisfiable;
+	}
+
+	*start = firstValue;
+	*end = (last.empty()) ? length - 1 : std::min(lastValue, length - 1);
+
+	return RangeResult::Satisfiable;
+}
+
+HttpStaticFileHandler::HttpStaticFileHandler(const std::string& urlPrefix, const std::string& rootPath)
+	: m_urlPrefix(urlPrefix), m_rootPath(rootPath), m_compressedBodySize(0)
+{
+	if (m_rootPath.empty() || m_rootPath.back() != '/')
+	{
+		m_rootPath.push_back('/');
+	}
+}
+
+void HttpStaticFileHandler::SetCompressionOptions(const HttpCompressionOptions& options)
+{
+	m_compressionOptions = ValidateCompressionOptions(options);
+}
+
+bool HttpStaticFileHandler::HandleRequest(fwRefContainer<HttpRequest> request, fwRefContainer<HttpResponse> response)
+{
+	bool isHead = (request->GetRequestMethod() == "HEAD");
+
+	if (request->GetRequestMethod() != "GET" && !isHead)
+	{
+		return false;
+	}
+
+	boost::string_ref path = request->GetPath();
+	path = path.substr(0, path.find('?'));
+
+	if (!path.starts_with(m_urlPrefix))
+	{
+		return false;
+	}
+
+	path.remove_prefix(m_urlPrefix.size());
+
+	std::string relativePath;
+
+	if (!DecodeRelativePath(path, &relativePath))
+	{
+		response->SetStatusCode(400);
+		response->End("Bad request.");
+
+		return true;
+	}
+
+	std::string filePath = m_rootPath + relativePath;
+
+	// devices may block, so nothing from here on happens on the connection's thread
+	fwRefContainer<HttpStaticFileHandler> self = this;
+
+	GetWorkerPool()->Post([self, request, response, filePath, relativePath] ()
+	{
+		self->ServeFile(request, response, filePath, relativePath);
+	});
+
+	return true;
+}
+
+fwRefContainer<WorkerPool> HttpStaticFileHandler::GetWorkerPool()
+{
+	// this lives until exit, so a handler going away on a worker never ends up joining the pool from one of its threads
+	static fwRefContainer<WorkerPool> workerPool = new WorkerPool(g_workerThreadCount);
+
+	return workerPool;
+}
+
+void HttpStaticFileHandler::ServeFile(const fwRefContainer<HttpRequest>& request, const fwRefContainer<HttpResponse>& response, const std::string& filePath, const std::string& relativePath)
+{
+	bool isHead = (request->GetRequestMethod() == "HEAD");
+
+	fwRefContainer<vfs::Device> device = vfs::GetDevice(filePath);
+
+	size_t length = (device.GetRef()) ? device->GetLength(filePath) : -1;
+
+	// the response itself only gets touched on the connection's thread, so everything goes in here first
+	HeaderMap headers;
+
+	if (length == static_cast<size_t>(-1))
+	{
+		ScheduleHead(response, 404, headers);
+		ScheduleEnd(response, std::make_shared<const std::string>("Not found."));
+
+		return;
+	}
+
+	std::string etag = GetETag(device, filePath, length);
+	const char* contentType = GetContentType(relativePath);
+
+	// files too big to be worth keeping in memory are always sent as they are
+	HttpContentEncoding encoding = HttpContentEncoding::Identity;
+
+	if (m_compressionOptions.level > 0 && IsCompressibleContentType(contentType) &&
+		length >= m_compressionOptions.minimumSize && length <= m_compressionOptions.cacheSize / 4)
+	{
+		headers["Vary"] = "Accept-Encoding";
+
+		// ranges refer to the file as it is
+		if (request->GetHeader("range").empty())
+		{
+			encoding = NegotiateContentEncoding(request->GetHeader("accept-encoding"));
+		}
+	}
+
+	// a compressed body is a different representation, so it needs a tag of its own
+	std::string responseETag = etag;
+
+	if (encoding != HttpContentEncoding::Identity)
+	{
+		responseETag = etag.substr(0, etag.size() - 1) + "-" + GetContentEncodingName(encoding) + "\"";
+	}
+
+	headers["ETag"] = responseETag;
+	headers["Accept-Ranges"] = "bytes";
+
+	if (MatchesETag(request->GetHeader("if-none-match"), responseETag))
+	{
+		ScheduleHead(response, 304, headers);
+		ScheduleEnd(response, nullptr);
+
+		return;
+	}
+
+	headers["Content-Type"] = contentType;
+
+	if (encoding != HttpContentEncoding::Identity)
+	{
+		auto body = GetCompressedBody(device, filePath, responseETag, encoding);
+
+		if (body)
+		{
+			headers["Content-Encoding"] = GetContentEncodingName(encoding);
+			headers["Content-Length"] = std::to_string(body->size());
+
+			ScheduleHead(response, 200, headers);
+			ScheduleEnd(response, (isHead) ? nullptr : body);
+
+			return;
+		}
+
+		headers["ETag"] = etag;
+	}
+
+	uint64_t start = 0;
+	uint64_t end = length - 1;
+
+	RangeResult range = ParseRange(request->GetHeader("range"), request->GetHeader("if-range"), etag, length, &start, &end);
+
+	if (range == RangeResult::Unsatisfiable)
+	{
+		headers["Content-Range"] = "bytes */" + std::to_string(length);
+
+		ScheduleHead(response, 416, headers);
+		ScheduleEnd(response, nullptr);
+
+		return;
+	}
+
+	int statusCode = 200;
+
+	if (range == RangeResult::Satisfiable)
+	{
+		statusCode = 206;
+		headers["Content-Range"] = "bytes " + std::to_string(start) + "-" + std::to_string(end) + "/" + std::to_string(length);
+	}
+
+	uint64_t bodyLength = (length == 0) ? 0 : (end - start + 1);
+	headers["Content-Length"] = std::to_string(bodyLength);
+
+	ScheduleHead(response, statusCode, headers);
+
+	if (isHead)
+	{
+		ScheduleEnd(response, nullptr);
+		return;
+	}
+
+	SendBody(device, filePath, response, start, bodyLength);
+}
+
+void HttpStaticFileHandler::ScheduleHead(const fwRefContainer<HttpResponse>& response, int statusCode, const HeaderMap& headers)
+{
+	response->ScheduleCallback([response, statusCode, headers] ()
+	{
+		response->SetStatusCode(statusCode);
+
+		for (auto& header : headers)
+		{
+			response->SetHeader(header.first, header.second);
+		}
+	});
+}
+
+void HttpStaticFileHandler::ScheduleEnd(const fwRefContainer<HttpResponse>& response, const std::shared_ptr<const std::string>& body)
+{
+	response->ScheduleCallback([response, body] ()
+	{
+		if (body)
+		{
+			response->End(*body);
+		}
+		else
+		{
+			response->End();
+		}
+	});
+}
+
+std::string HttpStaticFileHandler::GetETag(const fwRefContainer<vfs::Device>& device, const std::string& path, size_t length)
+{
+	std::string hashString;
+
+	if (device->GetContentHash(path, &hashString))
+	{
+		return "\"" + hashString + "\"";
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(m_hashCacheMutex);
+
+		auto it = m_hashCache.find(path);
+
+		if (it != m_hashCache.end() && it->second.length == length)
+		{
+			return it->second.etag;
+		}
+	}
+
+	// hash the file ourselves
+	auto hashFunction = Botan::HashFunction::create("SHA-1");
+	auto handle = device->Open(path, true);
+
+	if (handle != INVALID_DEVICE_HANDLE)
+	{
+		std::vector<uint8_t> buffer(g_readChunkSize);
+		size_t readLength;
+
+		while ((readLength = device->Read(handle, &buffer[0], buffer.size())) > 0 && readLength != static_cast<size_t>(-1))
+		{
+			hashFunction->update(&buffer[0], readLength);
+		}
+
+		device->Close(handle);
+	}
+
+	std::string etag = "\"" + Botan::hex_encode(hashFunction->final(), false) + "\"";
+
+	{
+		std::unique_lock<std::mutex> lock(m_hashCacheMutex);
+
+		HashEntry& entry = m_hashCache[path];
+		entry.length = length;
+		entry.etag = etag;
+	}
+
+	return etag;
+}
+
+std::shared_ptr<const std::string> HttpStaticFileHandler::GetCompressedBody(const fwRefContainer<vfs::Device>& device, const std::string& path, const std::string& etag, HttpContentEncoding encoding)
+{
+	// the level is part of the key, in case it gets changed
+	std::string key = etag + std::to_string(m_compressionOptions.level);
+
+	{
+		std::unique_lock<std::mutex> lock(m_compressedBodyMutex);
+
+		auto it = m_compressedBodyIndex.find(key);
+
+		if (it != m_compressedBodyIndex.end())
+		{
+			m_compressedBodies.splice(m_compressedBodies.begin(), m_compressedBodies, it->second);
+
+			return it->second->data;
+		}
+	}
+
+	// concurrent requests for the same file may both end up compressing it, which is fine as long as it's rare
+	auto handle = device->Open(path, true);
+
+	if (handle == INVALID_DEVICE_HANDLE)
+	{
+		return nullptr;
+	}
+
+	HttpCompressor compressor(encoding, m_compressionOptions.level);
+
+	std::vector<uint8_t> compressed;
+	std::vector<uint8_t> buffer(g_readChunkSize);
+	size_t readLength;
+
+	bool success = compressor.IsValid();
+
+	while (success && (readLength = device->Read(handle, &buffer[0], buffer.size())) > 0 && readLength != static_cast<size_t>(-1))
+	{
+		success = compressor.Compress(&buffer[0], readLength, false, compressed);
+	}
+
+	success = success && compressor.Compress(nullptr, 0, true, compressed);
+
+	device->Close(handle);
+
+	// the file gets sent as it is instead
+	if (!success)
+	{
+		return nullptr;
+	}
+
+	auto data = std::make_shared<const std::string>(compressed.begin(), compressed.end());
+
+	std::unique_lock<std::mutex> lock(m_compressedBodyMutex);
+
+	if (m_compressedBodyIndex.find(key) == m_compressedBodyIndex.end())
+	{
+		CompressedBody body;
+		body.key = key;
+		body.data = data;
+
+		m_compressedBodies.push_front(body);
+		m_compressedBodyIndex[key] = m_compressedBodies.begin();
+		m_compressedBodySize += data->size();
+
+		while (m_compressedBodySize > m_compressionOptions.cacheSize)
+		{
+			auto& oldest = m_compressedBodies.back();
+
+			m_compressedBodySize -= oldest.data->size();
+			m_compressedBodyIndex.erase(oldest.key);
+			m_compressedBodies.pop_back();
+		}
+	}
+
+	return data;
+}
+
+// a file being read through its device
+struct HttpStaticFileHandler::FileSend
+{
+	fwRefContainer<vfs::Device> device;
+
+	vfs::Device::THandle handle;
+
+	std::string path;
+
+	fwRefContainer<HttpResponse> response;
+
+	uint64_t remaining;
+
+	void Close()
+	{
+		if (handle != INVALID_DEVICE_HANDLE)
+		{
+			device->Close(handle);
+			handle = INVALID_DEVICE_HANDLE;
+		}
+	}
+
+	// only if the connection closed halfway through - otherwise, this got closed on a worker already
+	~FileSend()
+	{
+		Close();
+	}
+};
+
+void HttpStaticFileHandler::SendBody(const fwRefContainer<vfs::Device>& device, const std::string& path, const fwRefContainer<HttpResponse>& response, uint64_t offset, uint64_t length)
+{
+	if (length == 0)
+	{
+		ScheduleEnd(response, nullptr);
+		return;
+	}
+
+	auto handle = device->Open(path, true);
+
+	if (handle == INVALID_DEVICE_HANDLE)
+	{
+		trace("opening %s for sending failed\n", path.c_str());
+
+		ScheduleEnd(response, nullptr);
+		return;
+	}
+
+	device->Seek(handle, static_cast<intptr_t>(offset), SEEK_SET);
+
+	auto send = std::make_shared<FileSend>();
+	send->device = device;
+	send->handle = handle;
+	send->path = path;
+	send->response = response;
+	send->remaining = length;
+
+	ReadChunk(send);
+}
+
+void HttpStaticFileHandler::ReadChunk(const std::shared_ptr<FileSend>& send)
+{
+	auto chunk = std::make_shared<std::string>(static_cast<size_t>(std::min<uint64_t>(send->remaining, g_readChunkSize)), '\0');
+
+	size_t readLength = send->device->Read(send->handle, &(*chunk)[0], chunk->size());
+
+	// the headers promised more than this, so the client will notice it's been cut short
+	if (readLength == 0 || readLength == static_cast<size_t>(-1))
+	{
+		trace("reading %s for sending failed - response truncated\n", send->path.c_str());
+
+		send->Close();
+		ScheduleEnd(send->response, nullptr);
+
+		return;
+	}
+
+	chunk->resize(readLength);
+
+	send->response->ScheduleCallback([send, chunk] ()
+	{
+		WriteChunk(send, std::move(*chunk));
+	});
+}
+
+void HttpStaticFileHandler::WriteChunk(const std::shared_ptr<FileSend>& send, std::string&& chunk)
+{
+	auto& response = send->response;
+
+	response->Write(chunk);
+	send->remaining -= chunk.size();
+
+	if (send->remaining == 0)
+	{
+		response->End();
+
+		GetWorkerPool()->Post([send] ()
+		{
+			send->Close();
+		});
+
+		return;
+	}
+
+	auto readNext = [send] ()
+	{
+		GetWorkerPool()->Post([send] ()
+		{
+			ReadChunk(send);
+		});
+	};
+
+	// only read ahead once the connection took what was written so far
+	if (response->IsWritable())
+	{
+		readNext();
+		return;
+	}
+
+	// handlers get called as a copy, so this may reset itself
+	response->SetDrainHandler([send, readNext] ()
+	{
+		send->response->SetDrainHandler(std::function<void()>());
+
+		readNext();
+	});
+}
+}
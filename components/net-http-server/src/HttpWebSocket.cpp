@@ -0,0 +1,524 @@
+/*
+ * This file is part of the CitizenFX project - http://citizen.re/
+ *
+ * See LICENSE and MENTIONS in the root of the source tree for information
+ * regarding licensing.
+ */
+
+#include "StdInc.h"
+#include "HttpWebSocket.h"
+
+#include <boost/algorithm/string.hpp>
+
+#include <botan/base64.h>
+#include <botan/hash.h>
+
+namespace net
+{
+// control frames can't have a longer payload
+static const size_t g_maxControlPayload = 125;
+
+// the time a peer gets to answer a close frame
+static const uint32_t g_closeTimeout = 5000;
+
+// unmasks a payload in place, 8 bytes at a time where possible
+static void UnmaskPayload(uint8_t* data, size_t length, const uint8_t mask[4])
+{
+	uint8_t wideMask[8];
+
+	for (int i = 0; i < 8; i++)
+	{
+		wideMask[i] = mask[i & 3];
+	}
+
+	uint64_t wideMaskValue;
+	memcpy(&wideMaskValue, wideMask, sizeof(wideMaskValue));
+
+	size_t i = 0;
+
+	for (; i + 8 <= length; i += 8)
+	{
+		uint64_t value;
+		memcpy(&value, data + i, sizeof(value));
+
+		value ^= wideMaskValue;
+		memcpy(data + i, &value, sizeof(value));
+	}
+
+	for (; i < length; i++)
+	{
+		data[i] ^= mask[i & 3];
+	}
+}
+
+// text messages and close reasons have to be valid UTF-8 - rejecting overlong forms, surrogates and anything past U+10FFFF
+static bool IsValidUtf8(const uint8_t* data, size_t length)
+{
+	size_t i = 0;
+
+	while (i < length)
+	{
+		// skip ASCII 8 bytes at a time
+		if (i + 8 <= length)
+		{
+			uint64_t value;
+			memcpy(&value, data + i, sizeof(value));
+
+			if ((value & 0x8080808080808080ULL) == 0)
+			{
+				i += 8;
+				continue;
+			}
+		}
+
+		uint8_t c = data[i];
+
+		if (c < 0x80)
+		{
+			i++;
+			continue;
+		}
+
+		size_t sequenceLength;
+		uint8_t low = 0x80;
+		uint8_t high = 0xBF;
+
+		if (c >= 0xC2 && c <= 0xDF)
+		{
+			sequenceLength = 2;
+		}
+		else if (c >= 0xE0 && c <= 0xEF)
+		{
+			sequenceLength = 3;
+
+			// no overlong forms, and no surrogates
+			if (c == 0xE0)
+			{
+				low = 0xA0;
+			}
+			else if (c == 0xED)
+			{
+				high = 0x9F;
+			}
+		}
+		else if (c >= 0xF0 && c <= 0xF4)
+		{
+			sequenceLength = 4;
+
+			if (c == 0xF0)
+			{
+				low = 0x90;
+			}
+			else if (c == 0xF4)
+			{
+				high = 0x8F;
+			}
+		}
+		else
+		{
+			return false;
+		}
+
+		if (i + sequenceLength > length)
+		{
+			return false;
+		}
+
+		if (data[i + 1] < low || data[i + 1] > high)
+		{
+			return false;
+		}
+
+		for (size_t j = 2; j < sequenceLength; j++)
+		{
+			if ((data[i + j] & 0xC0) != 0x80)
+			{
+				return false;
+			}
+		}
+
+		i += sequenceLength;
+	}
+
+	return true;
+}
+
+// close codes a peer may send - reserved ones, and ones that are only for reporting locally, aren't allowed
+static bool IsValidCloseCode(uint16_t code)
+{
+	if (code >= 3000 && code <= 4999)
+	{
+		return true;
+	}
+
+	return (code >= 1000 && code <= 1011 && code != 1004 && code != 1005 && code != 1006);
+}
+
+HttpWebSocket::HttpWebSocket(const fwRefContainer<HttpResponse>& response, const fwRefContainer<TcpServerStream>& stream, size_t maxMessageSize)
+	: m_response(response), m_stream(stream), m_maxMessageSize(maxMessageSize), m_fragmentOpcode(HttpWebSocketOpcode::Continuation), m_fragmented(false), m_closeReceived(false), m_closeHandled(false), m_closeSent(false)
+{
+
+}
+
+HttpWebSocket::~HttpWebSocket()
+{
+
+}
+
+bool HttpWebSocket::IsUpgradeRequest(const fwRefContainer<HttpRequest>& request)
+{
+	if (request->GetRequestMethod() != "GET" || request->GetHttpVersion().second < 1)
+	{
+		return false;
+	}
+
+	if (!boost::algorithm::iequals(request->GetHeader("upgrade"), "websocket") || !boost::algorithm::icontains(request->GetHeader("connection"), "upgrade"))
+	{
+		return false;
+	}
+
+	return (request->GetHeader("sec-websocket-version") == "13" && !request->GetHeader("sec-websocket-key").empty());
+}
+
+std::string HttpWebSocket::GetAcceptKey(const boost::string_ref& key)
+{
+	static const char guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+	auto hashFunction = Botan::HashFunction::create("SHA-1");
+	hashFunction->update(reinterpret_cast<const uint8_t*>(key.data()), key.size());
+	hashFunction->update(reinterpret_cast<const uint8_t*>(guid), sizeof(guid) - 1);
+
+	return Botan::base64_encode(hashFunction->final());
+}
+
+size_t HttpWebSocket::ProcessData(uint8_t* data, size_t length)
+{
+	// hold on to ourselves, in case a handler drops the last other reference
+	fwRefContainer<HttpWebSocket> self = this;
+
+	size_t offset = 0;
+
+	while (!m_closeReceived)
+	{
+		uint8_t* frame = data + offset;
+		size_t available = length - offset;
+
+		if (available < 2)
+		{
+			break;
+		}
+
+		bool final = (frame[0] & 0x80) != 0;
+		auto opcode = static_cast<HttpWebSocketOpcode>(frame[0] & 0x0F);
+		bool masked = (frame[1] & 0x80) != 0;
+		uint64_t payloadLength = frame[1] & 0x7F;
+
+		size_t headerLength = 2 + ((payloadLength == 126) ? 2 : (payloadLength == 127) ? 8 : 0) + 4;
+
+		// no extensions got negotiated, so reserved bits have to be clear - and clients have to mask what they send
+		if ((frame[0] & 0x70) != 0 || !masked)
+		{
+			Fail(1002);
+			return length;
+		}
+
+		bool isControl = (static_cast<uint8_t>(opcode) & 0x08) != 0;
+
+		if (opcode != HttpWebSocketOpcode::Continuation && opcode != HttpWebSocketOpcode::Text && opcode != HttpWebSocketOpcode::Binary &&
+			opcode != HttpWebSocketOpcode::Close && opcode != HttpWebSocketOpcode::Ping && opcode != HttpWebSocketOpcode::Pong)
+		{
+			Fail(1002);
+			return length;
+		}
+
+		// control frames may come between fragments, but can't be fragmented themselves
+		if (isControl && (!final || payloadLength > g_maxControlPayload))
+		{
+			Fail(1002);
+			return length;
+		}
+
+		if (!isControl && m_fragmented != (opcode == HttpWebSocketOpcode::Continuation))
+		{
+			Fail(1002);
+			return length;
+		}
+
+		if (available < headerLength)
+		{
+			break;
+		}
+
+		if (payloadLength == 126)
+		{
+			payloadLength = (uint64_t(frame[2]) << 8) | frame[3];
+		}
+		else if (payloadLength == 127)
+		{
+			payloadLength = 0;
+
+			for (int i = 0; i < 8; i++)
+			{
+				payloadLength = (payloadLength << 8) | frame[2 + i];
+			}
+		}
+
+		if (payloadLength > m_maxMessageSize || m_fragments.size() + payloadLength > m_maxMessageSize)
+		{
+			Fail(1009);
+			return length;
+		}
+
+		// only whole frames get handled, so each gets unmasked just once
+		if (available - headerLength < payloadLength)
+		{
+			break;
+		}
+
+		uint8_t* payload = frame + headerLength;
+		UnmaskPayload(payload, static_cast<size_t>(payloadLength), frame + headerLength - 4);
+
+		offset += headerLength + static_cast<size_t>(payloadLength);
+
+		HandleFrame(opcode, final, payload, static_cast<size_t>(payloadLength));
+	}
+
+	return (m_closeReceived) ? length : offset;
+}
+
+void HttpWebSocket::HandleFrame(HttpWebSocketOpcode opcode, bool final, const uint8_t* data, size_t length)
+{
+	switch (opcode)
+	{
+	case HttpWebSocketOpcode::Text:
+	case HttpWebSocketOpcode::Binary:
+		// unfragmented messages get passed on straight from the read buffer
+		if (final)
+		{
+			HandleMessage(opcode, data, length);
+			break;
+		}
+
+		m_fragmented = true;
+		m_fragmentOpcode = opcode;
+		m_fragments.assign(data, data + length);
+		break;
+	case HttpWebSocketOpcode::Continuation:
+		m_fragments.insert(m_fragments.end(), data, data + length);
+
+		if (final)
+		{
+			std::vector<uint8_t> message;
+			std::swap(message, m_fragments);
+
+			m_fragmented = false;
+
+			HandleMessage(m_fragmentOpcode, message.data(), message.size());
+		}
+
+		break;
+	case HttpWebSocketOpcode::Ping:
+		WriteFrame(HttpWebSocketOpcode::Pong, data, length, true);
+		break;
+	case HttpWebSocketOpcode::Pong:
+		break;
+	case HttpWebSocketOpcode::Close:
+		HandleClose(data, length);
+		break;
+	}
+}
+
+void HttpWebSocket::HandleMessage(HttpWebSocketOpcode opcode, const uint8_t* data, size_t length)
+{
+	if (opcode == HttpWebSocketOpcode::Text && !IsValidUtf8(data, length))
+	{
+		Fail(1007);
+		return;
+	}
+
+	if (m_messageHandler)
+	{
+		m_messageHandler(opcode, data, length);
+	}
+}
+
+void HttpWebSocket::HandleClose(const uint8_t* data, size_t length)
+{
+	uint16_t code = 1005;
+	std::string reason;
+
+	if (length == 1)
+	{
+		Fail(1002);
+		return;
+	}
+
+	if (length >= 2)
+	{
+		code = (uint16_t(data[0]) << 8) | data[1];
+
+		if (!IsValidCloseCode(code))
+		{
+			Fail(1002);
+			return;
+		}
+
+		if (!IsValidUtf8(data + 2, length - 2))
+		{
+			Fail(1007);
+			return;
+		}
+
+		reason.assign(reinterpret_cast<const char*>(data + 2), length - 2);
+	}
+
+	m_closeReceived = true;
+
+	// echo the code if we didn't start closing ourselves - the server closes the connection once both sides did
+	WriteFrame(HttpWebSocketOpcode::Close, data, std::min<size_t>(length, 2), true);
+
+	// before closing, as that reports the connection as having gone away otherwise
+	InvokeCloseHandler(code, reason);
+
+	m_stream->Close();
+}
+
+void HttpWebSocket::Fail(uint16_t code)
+{
+	uint8_t payload[2] = { uint8_t(code >> 8), uint8_t(code & 0xFF) };
+
+	m_closeReceived = true;
+
+	WriteFrame(HttpWebSocketOpcode::Close, payload, sizeof(payload), true);
+
+	InvokeCloseHandler(code, std::string());
+
+	m_stream->Close();
+}
+
+void HttpWebSocket::InvokeCloseHandler(uint16_t code, const std::string& reason)
+{
+	if (m_closeHandled)
+	{
+		return;
+	}
+
+	m_closeHandled = true;
+
+	auto closeHandler = m_closeHandler;
+
+	m_messageHandler = TMessageHandler();
+	m_closeHandler = TCloseHandler();
+
+	if (closeHandler)
+	{
+		closeHandler(code, reason);
+	}
+}
+
+void HttpWebSocket::OnStreamClosed()
+{
+	m_closeReceived = true;
+
+	{
+		std::unique_lock<std::mutex> lock(m_sendMutex);
+
+		m_closeSent = true;
+		m_response = nullptr;
+	}
+
+	m_stream->SetLowWaterMarkCallback(TcpServerStream::TWaterMarkCallback());
+
+	InvokeCloseHandler(1006, std::string());
+}
+
+bool HttpWebSocket::WriteFrame(HttpWebSocketOpcode opcode, const uint8_t* data, size_t length, bool final)
+{
+	// server frames aren't masked, so the header is at most 10 bytes
+	std::vector<uint8_t> frame;
+	frame.reserve(10 + length);
+
+	frame.push_back(uint8_t((final) ? 0x80 : 0x00) | static_cast<uint8_t>(opcode));
+
+	if (length <= 125)
+	{
+		frame.push_back(uint8_t(length));
+	}
+	else if (length <= 0xFFFF)
+	{
+		frame.push_back(126);
+		frame.push_back(uint8_t(length >> 8));
+		frame.push_back(uint8_t(length & 0xFF));
+	}
+	else
+	{
+		frame.push_back(127);
+
+		for (int i = 7; i >= 0; i--)
+		{
+			frame.push_back(uint8_t((uint64_t(length) >> (i * 8)) & 0xFF));
+		}
+	}
+
+	frame.insert(frame.end(), data, data + length);
+
+	std::unique_lock<std::mutex> lock(m_sendMutex);
+
+	// nothing may follow a close frame
+	if (m_closeSent || !m_response.GetRef())
+	{
+		return false;
+	}
+
+	if (opcode == HttpWebSocketOpcode::Close)
+	{
+		m_closeSent = true;
+	}
+
+	m_response->WriteOut(std::move(frame));
+
+	return !m_stream->IsAboveHighWaterMark();
+}
+
+void HttpWebSocket::SetDrainHandler(const TDrainHandler& handler)
+{
+	m_stream->SetLowWaterMarkCallback(handler);
+}
+
+bool HttpWebSocket::Send(const std::string& text)
+{
+	return WriteFrame(HttpWebSocketOpcode::Text, reinterpret_cast<const uint8_t*>(text.data()), text.size(), true);
+}
+
+bool HttpWebSocket::Send(HttpWebSocketOpcode opcode, const uint8_t* data, size_t length)
+{
+	return WriteFrame(opcode, data, length, true);
+}
+
+bool HttpWebSocket::SendFrame(HttpWebSocketOpcode opcode, const uint8_t* data, size_t length, bool final)
+{
+	return WriteFrame(opcode, data, length, final);
+}
+
+bool HttpWebSocket::Ping(const std::string& payload)
+{
+	return WriteFrame(HttpWebSocketOpcode::Ping, reinterpret_cast<const uint8_t*>(payload.data()), std::min(payload.size(), g_maxControlPayload), true);
+}
+
+void HttpWebSocket::Close(uint16_t code, const std::string& reason)
+{
+	std::vector<uint8_t> payload;
+	payload.push_back(uint8_t(code >> 8));
+	payload.push_back(uint8_t(code & 0xFF));
+	payload.insert(payload.end(), reason.begin(), reason.begin() + std::min(reason.size(), g_maxControlPayload - 2));
+
+	WriteFrame(HttpWebSocketOpcode::Close, payload.data(), payload.size(), true);
+
+	m_stream->SetDeadline(g_closeTimeout);
+}
+
+size_t HttpWebSocket::GetBufferedAmount()
+{
+	return m_stream->GetPendingWriteSize();
+}
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "TcpServer.h"
+
+#include <string>
+
+namespace net
+{
+// a stream the test writes requests into and reads responses from, all on the calling thread
+class TestStream : public TcpServerStream
+{
+private:
+	std::string m_output;
+
+	bool m_closed;
+
+	uint32_t m_idleTimeout;
+
+public:
+	TestStream(uint32_t idleTimeout = 0)
+		: m_closed(false), m_idleTimeout(idleTimeout)
+	{
+
+	}
+
+	virtual PeerAddress GetPeerAddress() override
+	{
+		return PeerAddress::FromString("127.0.0.1:30120").get();
+	}
+
+	using TcpServerStream::Write;
+
+	virtual void Write(const std::vector<uint8_t>& data) override
+	{
+		m_output.append(data.begin(), data.end());
+	}
+
+	virtual void SetIdleTimeout(uint32_t timeoutMs) override
+	{
+		m_idleTimeout = timeoutMs;
+	}
+
+	virtual uint32_t GetIdleTimeout() override
+	{
+		return m_idleTimeout;
+	}
+
+	virtual void Close() override
+	{
+		if (m_closed)
+		{
+			return;
+		}
+
+		m_closed = true;
+
+		SetReadCallback(TReadCallback());
+
+		// like other streams, this lets go of whatever the callbacks reference
+		auto closeCallback = GetCloseCallback();
+
+		if (closeCallback)
+		{
+			SetCloseCallback(TCloseCallback());
+
+			closeCallback();
+		}
+	}
+
+	void Receive(const std::string& data)
+	{
+		DispatchRead(BufferView(reinterpret_cast<const uint8_t*>(data.data()), data.size()));
+	}
+
+	// returns whatever got written since the last call
+	std::string TakeOutput()
+	{
+		std::string output;
+		std::swap(output, m_output);
+
+		return output;
+	}
+
+	inline bool IsClosed()
+	{
+		return m_closed;
+	}
+};
+
+class TestServer : public TcpServer
+{
+public:
+	// streams get accepted with the given idle timeout, like the manager's would
+	fwRefContainer<TestStream> Connect(uint32_t idleTimeout = 0)
+	{
+		fwRefContainer<TestStream> stream = new TestStream(idleTimeout);
+		GetConnectionCallback()(stream);
+
+		return stream;
+	}
+};
+}
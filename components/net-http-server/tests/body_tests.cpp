@@ -0,0 +1,304 @@
+#include "StdInc.h"
+#include <gtest/gtest.h>
+
+#include "HttpServerImpl.h"
+#include "TestStream.h"
+
+namespace
+{
+class BodyHandler : public net::HttpHandler
+{
+public:
+	virtual bool HandleRequest(fwRefContainer<net::HttpRequest> request, fwRefContainer<net::HttpResponse> response) override
+	{
+		std::string path = request->GetPath().to_string();
+
+		if (path == "/echo" || path == "/large")
+		{
+			if (path == "/large")
+			{
+				request->SetMaxBodySize(1024 * 1024);
+			}
+
+			request->SetDataHandler([response] (const std::vector<uint8_t>& data)
+			{
+				response->End(std::string(data.begin(), data.end()));
+			});
+		}
+		else if (path == "/stream")
+		{
+			auto body = std::make_shared<std::string>();
+
+			request->SetBodyHandlers([body] (const uint8_t* data, size_t length)
+			{
+				body->append(reinterpret_cast<const char*>(data), length);
+				body->append("|");
+			},
+			[body, response] ()
+			{
+				response->End(*body);
+			});
+		}
+		else
+		{
+			response->End("ok");
+		}
+
+		return true;
+	}
+};
+
+class HttpBodyTests : public ::testing::Test
+{
+protected:
+	fwRefContainer<net::HttpServerImpl> server;
+
+	fwRefContainer<net::TestServer> tcpServer;
+
+	fwRefContainer<net::TestStream> stream;
+
+	virtual void SetUp() override
+	{
+		net::HttpRequestLimits limits;
+		limits.maxHeaderCount = 8;
+		limits.maxHeaderSize = 1024;
+		limits.maxBodySize = 64;
+
+		server = new net::HttpServerImpl();
+		server->SetRequestLimits(limits);
+		server->RegisterHandler(new BodyHandler());
+
+		tcpServer = new net::TestServer();
+		server->AttachToServer(tcpServer);
+
+		stream = tcpServer->Connect();
+	}
+
+	virtual void TearDown() override
+	{
+		// the connection and stream hold on to each other until closed
+		stream->Close();
+	}
+
+	static std::string GetBody(const std::string& response)
+	{
+		size_t headerEnd = response.find("\r\n\r\n");
+
+		return (headerEnd == std::string::npos) ? std::string() : response.substr(headerEnd + 4);
+	}
+};
+}
+
+TEST_F(HttpBodyTests, ReadsContentLengthBodies)
+{
+	stream->Receive("POST /echo HTTP/1.1\r\nContent-Length: 11\r\n\r\nhello world");
+
+	std::string response = stream->TakeOutput();
+
+	EXPECT_EQ(0u, response.find("HTTP/1.1 200 OK\r\n"));
+	EXPECT_EQ("hello world", GetBody(response));
+}
+
+TEST_F(HttpBodyTests, DecodesChunkedBodies)
+{
+	stream->Receive("POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n");
+
+	EXPECT_EQ("hello world", GetBody(stream->TakeOutput()));
+	EXPECT_FALSE(stream->IsClosed());
+}
+
+TEST_F(HttpBodyTests, DecodesChunkedBodiesArrivingBytewise)
+{
+	std::string request = "POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\nA\r\n, world!!!\r\n0\r\n\r\n";
+
+	for (char c : request)
+	{
+		stream->Receive(std::string(1, c));
+	}
+
+	EXPECT_EQ("hello, world!!!", GetBody(stream->TakeOutput()));
+}
+
+TEST_F(HttpBodyTests, SkipsExtensionsAndTrailers)
+{
+	stream->Receive("POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+					"5;name=value\r\nhello\r\n0\r\nX-Checksum: 1234\r\n\r\n"
+					"GET /next HTTP/1.1\r\n\r\n");
+
+	std::string output = stream->TakeOutput();
+
+	// the trailer must not be taken for the next request
+	size_t second = output.find("HTTP/1.1 200 OK", 1);
+
+	ASSERT_NE(std::string::npos, second);
+	EXPECT_EQ("hello", GetBody(output.substr(0, second)));
+	EXPECT_EQ("ok", GetBody(output.substr(second)));
+}
+
+TEST_F(HttpBodyTests, StreamsChunkedBodies)
+{
+	stream->Receive("POST /stream HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n");
+	stream->Receive("2\r\nde\r\n");
+
+	EXPECT_TRUE(stream->TakeOutput().empty());
+
+	stream->Receive("0\r\n\r\n");
+
+	EXPECT_EQ("abc|de|", GetBody(stream->TakeOutput()));
+}
+
+TEST_F(HttpBodyTests, EndsBodilessStreams)
+{
+	stream->Receive("GET /stream HTTP/1.1\r\n\r\n");
+
+	std::string response = stream->TakeOutput();
+
+	EXPECT_EQ(0u, response.find("HTTP/1.1 200 OK\r\n"));
+	EXPECT_EQ("", GetBody(response));
+}
+
+TEST_F(HttpBodyTests, ClosesOnBadChunks)
+{
+	stream->Receive("POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\nhello\r\n0\r\n\r\n");
+
+	EXPECT_TRUE(stream->IsClosed());
+}
+
+TEST_F(HttpBodyTests, ClosesOnBadContentLength)
+{
+	stream->Receive("POST /echo HTTP/1.1\r\nContent-Length: -5\r\n\r\nhello");
+
+	EXPECT_TRUE(stream->IsClosed());
+}
+
+TEST_F(HttpBodyTests, RefusesLargeDeclaredBodies)
+{
+	stream->Receive("POST /echo HTTP/1.1\r\nContent-Length: 65\r\n\r\n");
+
+	EXPECT_EQ(0u, stream->TakeOutput().find("HTTP/1.1 413 Request Entity Too Large\r\n"));
+	EXPECT_TRUE(stream->IsClosed());
+}
+
+TEST_F(HttpBodyTests, RefusesLargeChunkedBodies)
+{
+	std::string chunk(40, 'x');
+
+	stream->Receive("POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n28\r\n" + chunk + "\r\n");
+
+	EXPECT_TRUE(stream->TakeOutput().empty());
+
+	stream->Receive("28\r\n" + chunk + "\r\n");
+
+	EXPECT_EQ(0u, stream->TakeOutput().find("HTTP/1.1 413 Request Entity Too Large\r\n"));
+	EXPECT_TRUE(stream->IsClosed());
+}
+
+TEST_F(HttpBodyTests, LetsHandlersRaiseTheLimit)
+{
+	std::string body(1000, 'x');
+
+	stream->Receive("POST /large HTTP/1.1\r\nContent-Length: 1000\r\n\r\n" + body);
+
+	EXPECT_EQ(body, GetBody(stream->TakeOutput()));
+	EXPECT_FALSE(stream->IsClosed());
+}
+
+TEST_F(HttpBodyTests, ClosesOnTooManyHeaders)
+{
+	std::string request = "GET / HTTP/1.1\r\n";
+
+	for (int i = 0; i < 9; i++)
+	{
+		request += "X-Header-" + std::to_string(i) + ": value\r\n";
+	}
+
+	stream->Receive(request + "\r\n");
+
+	EXPECT_TRUE(stream->TakeOutput().empty());
+	EXPECT_TRUE(stream->IsClosed());
+}
+
+TEST_F(HttpBodyTests, ClosesOnLargeHeaders)
+{
+	// this never completes, so the limit has to apply to what arrived so far
+	stream->Receive("GET / HTTP/1.1\r\nX-Large: " + std::string(1024, 'x'));
+
+	EXPECT_TRUE(stream->IsClosed());
+}
+
+TEST_F(HttpBodyTests, MatchesTransferEncodingCaseInsensitively)
+{
+	stream->Receive("POST /echo HTTP/1.1\r\nTransfer-Encoding: Chunked\r\n\r\n5\r\nhello\r\n0\r\n\r\n");
+
+	EXPECT_EQ("hello", GetBody(stream->TakeOutput()));
+	EXPECT_FALSE(stream->IsClosed());
+}
+
+TEST_F(HttpBodyTests, RejectsLengthWithTransferEncoding)
+{
+	// whatever the body turns out to be, the request after it must not get handled
+	stream->Receive("POST /echo HTTP/1.1\r\nContent-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\n"
+					"0\r\n\r\nGET /smuggled HTTP/1.1\r\n\r\n");
+
+	std::string output = stream->TakeOutput();
+
+	EXPECT_EQ(0u, output.find("HTTP/1.1 400 Bad Request\r\n"));
+	EXPECT_EQ(std::string::npos, output.find("HTTP/1.1 200 OK"));
+	EXPECT_TRUE(stream->IsClosed());
+}
+
+TEST_F(HttpBodyTests, RejectsDifferingLengths)
+{
+	stream->Receive("POST /echo HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 11\r\n\r\nhello world");
+
+	EXPECT_EQ(0u, stream->TakeOutput().find("HTTP/1.1 400 Bad Request\r\n"));
+	EXPECT_TRUE(stream->IsClosed());
+}
+
+TEST_F(HttpBodyTests, RefusesUnknownCodings)
+{
+	stream->Receive("POST /echo HTTP/1.1\r\nTransfer-Encoding: gzip, chunked\r\n\r\n"
+					"5\r\nhello\r\n0\r\n\r\nGET /smuggled HTTP/1.1\r\n\r\n");
+
+	std::string output = stream->TakeOutput();
+
+	EXPECT_EQ(0u, output.find("HTTP/1.1 501 Not Implemented\r\n"));
+	EXPECT_EQ(std::string::npos, output.find("HTTP/1.1 200 OK"));
+	EXPECT_TRUE(stream->IsClosed());
+}
+
+TEST_F(HttpBodyTests, RefusesCodingsSplitAcrossHeaders)
+{
+	stream->Receive("POST /echo HTTP/1.1\r\nTransfer-Encoding: gzip\r\nTransfer-Encoding: chunked\r\n\r\n");
+
+	EXPECT_EQ(0u, stream->TakeOutput().find("HTTP/1.1 501 Not Implemented\r\n"));
+	EXPECT_TRUE(stream->IsClosed());
+}
+
+TEST_F(HttpBodyTests, RejectsRepeatedChunked)
+{
+	stream->Receive("POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked, chunked\r\n\r\n");
+
+	EXPECT_EQ(0u, stream->TakeOutput().find("HTTP/1.1 400 Bad Request\r\n"));
+	EXPECT_TRUE(stream->IsClosed());
+}
+
+TEST_F(HttpBodyTests, KeepsStreamIdleTimeoutDuringRequests)
+{
+	fwRefContainer<net::TestStream> timedStream = tcpServer->Connect(30000);
+
+	// waiting for a request
+	EXPECT_EQ(15000u, timedStream->GetIdleTimeout());
+
+	// a client stalling on its body still gets reaped
+	timedStream->Receive("POST /echo HTTP/1.1\r\nContent-Length: 5\r\n\r\nhe");
+
+	EXPECT_EQ(30000u, timedStream->GetIdleTimeout());
+
+	timedStream->Receive("llo");
+
+	EXPECT_EQ("hello", GetBody(timedStream->TakeOutput()));
+	EXPECT_EQ(15000u, timedStream->GetIdleTimeout());
+
+	timedStream->Close();
+}
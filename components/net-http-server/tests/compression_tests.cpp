@@ -0,0 +1,127 @@
+#include "StdInc.h"
+#include <gtest/gtest.h>
+
+#include "HttpServerImpl.h"
+#include "TestStream.h"
+
+#include <zlib.h>
+
+using net::HttpCompressor;
+using net::HttpContentEncoding;
+
+namespace
+{
+// undoes gzip or zlib framing, whichever it is
+std::string Inflate(const std::string& data)
+{
+	z_stream stream = {};
+	inflateInit2(&stream, MAX_WBITS + 32);
+
+	stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+	stream.avail_in = static_cast<uInt>(data.size());
+
+	std::string output;
+	char buffer[4096];
+	int result;
+
+	do
+	{
+		stream.next_out = reinterpret_cast<Bytef*>(buffer);
+		stream.avail_out = sizeof(buffer);
+
+		result = inflate(&stream, Z_NO_FLUSH);
+
+		output.append(buffer, sizeof(buffer) - stream.avail_out);
+	} while (result == Z_OK);
+
+	inflateEnd(&stream);
+
+	return (result == Z_STREAM_END) ? output : "(invalid)";
+}
+
+std::string Compress(HttpCompressor& compressor, const std::string& data, bool finish)
+{
+	std::vector<uint8_t> output;
+	compressor.Compress(data.data(), data.size(), finish, output);
+
+	return std::string(output.begin(), output.end());
+}
+
+class TextHandler : public net::HttpHandler
+{
+public:
+	virtual bool HandleRequest(fwRefContainer<net::HttpRequest> request, fwRefContainer<net::HttpResponse> response) override
+	{
+		response->SetHeader("Content-Type", "text/plain");
+		response->End(std::string(4000, 'c'));
+
+		return true;
+	}
+};
+}
+
+TEST(HttpCompressionTests, ClampsLevels)
+{
+	net::HttpCompressionOptions options;
+
+	options.level = 42;
+	EXPECT_EQ(9, net::ValidateCompressionOptions(options).level);
+
+	options.level = -1;
+	EXPECT_EQ(0, net::ValidateCompressionOptions(options).level);
+
+	options.level = 3;
+	EXPECT_EQ(3, net::ValidateCompressionOptions(options).level);
+}
+
+TEST(HttpCompressionTests, RoundTrips)
+{
+	HttpCompressor compressor(HttpContentEncoding::Gzip, 6);
+
+	ASSERT_TRUE(compressor.IsValid());
+
+	std::string first = Compress(compressor, "hello, ", false);
+	std::string second = Compress(compressor, "world", true);
+
+	EXPECT_EQ("hello, world", Inflate(first + second));
+}
+
+TEST(HttpCompressionTests, FailsInvalidLevels)
+{
+	HttpCompressor compressor(HttpContentEncoding::Deflate, 42);
+
+	EXPECT_FALSE(compressor.IsValid());
+
+	// this used to grow the output until memory ran out
+	std::vector<uint8_t> output(3, 'x');
+	std::string data(100000, 'x');
+
+	EXPECT_FALSE(compressor.Compress(data.data(), data.size(), true, output));
+	EXPECT_EQ(3u, output.size());
+}
+
+TEST(HttpCompressionTests, CompressesResponsesWithOutOfRangeLevels)
+{
+	net::HttpCompressionOptions options;
+	options.level = 42;
+
+	fwRefContainer<net::HttpServerImpl> server = new net::HttpServerImpl();
+	server->SetCompressionOptions(options);
+	server->RegisterHandler(new TextHandler());
+
+	fwRefContainer<net::TestServer> tcpServer = new net::TestServer();
+	server->AttachToServer(tcpServer);
+
+	fwRefContainer<net::TestStream> stream = tcpServer->Connect();
+
+	stream->Receive("GET / HTTP/1.1\r\nAccept-Encoding: gzip\r\n\r\n");
+
+	std::string response = stream->TakeOutput();
+	size_t headerEnd = response.find("\r\n\r\n");
+
+	ASSERT_NE(std::string::npos, headerEnd);
+	EXPECT_NE(std::string::npos, response.find("Content-Encoding: gzip\r\n"));
+	EXPECT_EQ(std::string(4000, 'c'), Inflate(response.substr(headerEnd + 4)));
+
+	stream->Close();
+}
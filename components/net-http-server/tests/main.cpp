@@ -0,0 +1,1050 @@
+/*
+ * This file is part of the CitizenFX project - http://citizen.re/
+ *
+ * See LICENSE and MENTIONS in the root of the source tree for information
+ * regarding licensing.
+ */
+
+// loopback load generator for the server networking stack
+//
+// starts TcpServerManager + MultiplexTcpServer (+ TLSServer) + HttpServerImpl on 127.0.0.1, and drives them using a
+// number of blocking client threads, e.g.:
+//
+//   tests_net-http-server --mode get --clients 64 --duration 10 --threads 4
+//   tests_net-http-server --mode get --clients 64 --keep-alive 0
+//   tests_net-http-server --mode tls --clients 16 --cert server.crt --key server.key
+//   tests_net-http-server --mode tls --clients 16 --cert server.crt --key server.key --workers 4 (handshakes on a worker pool)
+//   tests_net-http-server --mode headers --clients 1
+//   tests_net-http-server --mode metrics --clients 4
+//   tests_net-http-server --mode get --metrics 1
+//   tests_net-http-server --mode websocket --clients 64 (compare with --mode get, which is what polling amounts to)
+//   tests_net-http-server --mode check (runs the unit tests instead)
+
+#include "StdInc.h"
+
+#include "HttpMetrics.h"
+#include "HttpServerImpl.h"
+#include "HttpWebSocket.h"
+#include "MultiplexTcpServer.h"
+#include "TcpServerManager.h"
+#include "TLSServer.h"
+#include "UvLoopManager.h"
+
+#include <botan/auto_rng.h>
+#include <botan/credentials_manager.h>
+#include <botan/tls_client.h>
+#include <botan/tls_policy.h>
+#include <botan/tls_session_manager.h>
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <thread>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#pragma comment(lib, "ws2_32.lib")
+
+typedef SOCKET socket_t;
+
+#define closesocket_ closesocket
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+typedef int socket_t;
+
+#define INVALID_SOCKET -1
+#define closesocket_ close
+#endif
+
+enum class BenchMode
+{
+	// a persistent connection per client, echoing `payload` bytes back and forth
+	Echo,
+	// a new connection for every operation, exchanging a few bytes
+	Connect,
+	// HTTP GETs, the response being `payload` bytes
+	Get,
+	// HTTP POSTs of `payload` bytes
+	Post,
+	// a full TLS handshake for every operation
+	Tls,
+	// HttpResponse header serialization for a trivial handler, in-process and without any sockets
+	Headers,
+	// the metrics recorded for every request, with all clients recording into the same route
+	Metrics,
+	// WebSocket messages of `payload` bytes, echoed back on a persistent connection
+	WebSocket
+};
+
+struct BenchOptions
+{
+	BenchMode mode;
+
+	int clients;
+
+	int duration;
+
+	int threads;
+
+	size_t payload;
+
+	int port;
+
+	// whether HTTP clients reuse their connection, or open a new one for every request
+	bool keepAlive;
+
+	// whether the server records metrics, which get served at /metrics
+	bool metrics;
+
+	std::string certificatePath;
+
+	std::string keyPath;
+
+	// the size of the worker pool TLS handshakes run on - 0 runs them on the loops
+	int workers;
+
+	BenchOptions()
+		: mode(BenchMode::Get), clients(32), duration(5), threads(0), payload(64), port(30199), keepAlive(true), metrics(false), workers(0)
+	{
+
+	}
+};
+
+// per-client results, merged after the run so the clients don't contend on anything while measuring
+struct BenchClientStats
+{
+	uint64_t connections;
+
+	uint64_t operations;
+
+	uint64_t bytes;
+
+	uint64_t errors;
+
+	// operation latencies, in microseconds
+	std::vector<uint32_t> latencies;
+
+	BenchClientStats()
+		: connections(0), operations(0), bytes(0), errors(0)
+	{
+
+	}
+};
+
+static BenchOptions g_options;
+
+static std::atomic<bool> g_running;
+
+// allocations made through this executable's operator new - on platforms where components have a heap of their own,
+// only the calls made directly from here get counted
+static std::atomic<uint64_t> g_allocations;
+
+void* operator new(size_t size)
+{
+	g_allocations++;
+
+	void* pointer = malloc(size ? size : 1);
+
+	if (!pointer)
+	{
+		throw std::bad_alloc();
+	}
+
+	return pointer;
+}
+
+void operator delete(void* pointer) noexcept
+{
+	free(pointer);
+}
+
+class BenchHttpHandler : public net::HttpHandler
+{
+private:
+	std::string m_payload;
+
+public:
+	BenchHttpHandler(size_t payloadSize)
+		: m_payload(payloadSize, 'x')
+	{
+
+	}
+
+	virtual bool HandleRequest(fwRefContainer<net::HttpRequest> request, fwRefContainer<net::HttpResponse> response) override
+	{
+		response->SetHeader(std::string("Content-Type"), std::string("text/plain"));
+
+		if (request->GetRequestMethod() == "POST")
+		{
+			request->SetDataHandler([=] (const std::vector<uint8_t>& data)
+			{
+				response->End(std::to_string(data.size()));
+			});
+		}
+		else
+		{
+			response->End(m_payload);
+		}
+
+		return true;
+	}
+};
+
+class BenchWebSocketHandler : public net::HttpHandler
+{
+public:
+	virtual bool HandleRequest(fwRefContainer<net::HttpRequest> request, fwRefContainer<net::HttpResponse> response) override
+	{
+		fwRefContainer<net::HttpWebSocket> webSocket = response->AcceptWebSocket();
+
+		if (!webSocket.GetRef())
+		{
+			return true;
+		}
+
+		net::HttpWebSocket* webSocketRef = webSocket.GetRef();
+
+		webSocket->SetMessageHandler([=] (net::HttpWebSocketOpcode opcode, const uint8_t* data, size_t length)
+		{
+			webSocketRef->Send(opcode, data, length);
+		});
+
+		return true;
+	}
+};
+
+// accepts whatever certificate the server under test uses
+class BenchCredentials : public Botan::Credentials_Manager
+{
+public:
+	virtual std::vector<Botan::Certificate_Store*> trusted_certificate_authorities(const std::string& type, const std::string& context) override
+	{
+		return std::vector<Botan::Certificate_Store*>();
+	}
+
+	virtual void verify_certificate_chain(const std::string& type, const std::string& hostname, const std::vector<Botan::X509_Certificate>& certChain) override
+	{
+
+	}
+};
+
+static socket_t ConnectClient()
+{
+	socket_t socket = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+	if (socket == INVALID_SOCKET)
+	{
+		return INVALID_SOCKET;
+	}
+
+	sockaddr_in address = { 0 };
+	address.sin_family = AF_INET;
+	address.sin_port = htons(g_options.port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (connect(socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+	{
+		closesocket_(socket);
+		return INVALID_SOCKET;
+	}
+
+	int noDelay = 1;
+	setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+
+	return socket;
+}
+
+static bool SendAll(socket_t socket, const char* data, size_t length)
+{
+	while (length > 0)
+	{
+		int sent = send(socket, data, static_cast<int>(length), 0);
+
+		if (sent <= 0)
+		{
+			return false;
+		}
+
+		data += sent;
+		length -= sent;
+	}
+
+	return true;
+}
+
+static bool ReceiveAll(socket_t socket, char* data, size_t length)
+{
+	while (length > 0)
+	{
+		int received = recv(socket, data, static_cast<int>(length), 0);
+
+		if (received <= 0)
+		{
+			return false;
+		}
+
+		data += received;
+		length -= received;
+	}
+
+	return true;
+}
+
+// reads a single response with a Content-Length from a keep-alive connection, keeping any excess data in `buffer`
+static bool ReceiveHttpResponse(socket_t socket, std::string& buffer, size_t* responseLength)
+{
+	size_t headerEnd;
+
+	while ((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos)
+	{
+		char data[16384];
+		int received = recv(socket, data, sizeof(data), 0);
+
+		if (received <= 0)
+		{
+			return false;
+		}
+
+		buffer.append(data, received);
+	}
+
+	headerEnd += 4;
+
+	if (buffer.compare(0, 12, "HTTP/1.1 200") != 0 && buffer.compare(0, 12, "HTTP/1.0 200") != 0)
+	{
+		return false;
+	}
+
+	size_t contentLength = 0;
+
+	for (size_t lineStart = buffer.find("\r\n") + 2; lineStart < headerEnd - 2; )
+	{
+		size_t lineEnd = buffer.find("\r\n", lineStart);
+
+		if (lineEnd - lineStart > 15 && _strnicmp(&buffer[lineStart], "content-length:", 15) == 0)
+		{
+			contentLength = strtoul(&buffer[lineStart + 15], nullptr, 10);
+		}
+
+		lineStart = lineEnd + 2;
+	}
+
+	while (buffer.size() < headerEnd + contentLength)
+	{
+		char data[16384];
+		int received = recv(socket, data, sizeof(data), 0);
+
+		if (received <= 0)
+		{
+			return false;
+		}
+
+		buffer.append(data, received);
+	}
+
+	*responseLength = headerEnd + contentLength;
+	buffer.erase(0, headerEnd + contentLength);
+
+	return true;
+}
+
+static void RunStreamClient(BenchClientStats& stats)
+{
+	std::string request;
+	std::string payload(g_options.payload, 'x');
+	std::string connectionHeader = (g_options.keepAlive) ? "" : "Connection: close\r\n";
+
+	switch (g_options.mode)
+	{
+		case BenchMode::Echo:
+			request = payload;
+			break;
+		case BenchMode::Get:
+			request = "GET /bench HTTP/1.1\r\nHost: localhost\r\n" + connectionHeader + "\r\n";
+			break;
+		case BenchMode::Post:
+			request = "POST /bench HTTP/1.1\r\nHost: localhost\r\n" + connectionHeader + "Content-Length: " + std::to_string(payload.size()) + "\r\n\r\n" + payload;
+			break;
+		default:
+			return;
+	}
+
+	while (g_running)
+	{
+		socket_t socket = ConnectClient();
+
+		if (socket == INVALID_SOCKET)
+		{
+			stats.errors++;
+			continue;
+		}
+
+		stats.connections++;
+
+		// the echo child server gets picked by the multiplexer using this prefix
+		if (g_options.mode == BenchMode::Echo)
+		{
+			char prefix[4];
+
+			if (!SendAll(socket, "ECHO", 4) || !ReceiveAll(socket, prefix, 4))
+			{
+				stats.errors++;
+				closesocket_(socket);
+
+				continue;
+			}
+		}
+
+		std::vector<char> echoBuffer(payload.size());
+		std::string responseBuffer;
+
+		while (g_running)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			size_t responseLength = payload.size();
+
+			if (!SendAll(socket, request.c_str(), request.size()))
+			{
+				stats.errors++;
+				break;
+			}
+
+			bool success = (g_options.mode == BenchMode::Echo) ?
+				ReceiveAll(socket, echoBuffer.data(), echoBuffer.size()) :
+				ReceiveHttpResponse(socket, responseBuffer, &responseLength);
+
+			if (!success)
+			{
+				stats.errors++;
+				break;
+			}
+
+			stats.latencies.push_back(static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count()));
+			stats.operations++;
+			stats.bytes += request.size() + responseLength;
+
+			if (!g_options.keepAlive && g_options.mode != BenchMode::Echo)
+			{
+				break;
+			}
+		}
+
+		closesocket_(socket);
+	}
+}
+
+static void RunWebSocketClient(BenchClientStats& stats)
+{
+	std::string payload(g_options.payload, 'x');
+
+	// clients have to mask what they send - the payload gets masked once, as the key stays the same
+	const uint8_t mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+	std::vector<char> frame;
+
+	frame.push_back(char(0x82));
+
+	if (payload.size() <= 125)
+	{
+		frame.push_back(char(0x80 | payload.size()));
+	}
+	else if (payload.size() <= 0xFFFF)
+	{
+		frame.push_back(char(0x80 | 126));
+		frame.push_back(char(payload.size() >> 8));
+		frame.push_back(char(payload.size() & 0xFF));
+	}
+	else
+	{
+		frame.push_back(char(0x80 | 127));
+
+		for (int i = 7; i >= 0; i--)
+		{
+			frame.push_back(char((uint64_t(payload.size()) >> (i * 8)) & 0xFF));
+		}
+	}
+
+	frame.insert(frame.end(), mask, mask + 4);
+
+	for (size_t i = 0; i < payload.size(); i++)
+	{
+		frame.push_back(char(payload[i] ^ mask[i & 3]));
+	}
+
+	static const char upgradeRequest[] = "GET /ws HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+		"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+
+	while (g_running)
+	{
+		socket_t socket = ConnectClient();
+
+		if (socket == INVALID_SOCKET)
+		{
+			stats.errors++;
+			continue;
+		}
+
+		stats.connections++;
+
+		// the 101 has no body, and the server won't send anything else before being sent a message
+		std::string responseBuffer;
+
+		if (!SendAll(socket, upgradeRequest, sizeof(upgradeRequest) - 1))
+		{
+			stats.errors++;
+			closesocket_(socket);
+
+			continue;
+		}
+
+		while (responseBuffer.find("\r\n\r\n") == std::string::npos)
+		{
+			char data[1024];
+			int received = recv(socket, data, sizeof(data), 0);
+
+			if (received <= 0)
+			{
+				break;
+			}
+
+			responseBuffer.append(data, received);
+		}
+
+		if (responseBuffer.compare(0, 12, "HTTP/1.1 101") != 0)
+		{
+			stats.errors++;
+			closesocket_(socket);
+
+			continue;
+		}
+
+		std::vector<char> echoBuffer(payload.size());
+
+		while (g_running)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+
+			if (!SendAll(socket, frame.data(), frame.size()))
+			{
+				stats.errors++;
+				break;
+			}
+
+			// server frames aren't masked, so all that's in front of the payload is the length
+			uint8_t header[10];
+			size_t headerLength = (payload.size() <= 125) ? 2 : (payload.size() <= 0xFFFF) ? 4 : 10;
+
+			if (!ReceiveAll(socket, reinterpret_cast<char*>(header), headerLength) || !ReceiveAll(socket, echoBuffer.data(), echoBuffer.size()))
+			{
+				stats.errors++;
+				break;
+			}
+
+			stats.latencies.push_back(static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count()));
+			stats.operations++;
+			stats.bytes += frame.size() + headerLength + echoBuffer.size();
+		}
+
+		closesocket_(socket);
+	}
+}
+
+static void RunConnectClient(BenchClientStats& stats)
+{
+	while (g_running)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		socket_t socket = ConnectClient();
+
+		if (socket == INVALID_SOCKET)
+		{
+			stats.errors++;
+			continue;
+		}
+
+		char data[4];
+
+		if (SendAll(socket, "ECHO", 4) && ReceiveAll(socket, data, 4))
+		{
+			stats.latencies.push_back(static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count()));
+			stats.connections++;
+			stats.operations++;
+			stats.bytes += 8;
+		}
+		else
+		{
+			stats.errors++;
+		}
+
+		closesocket_(socket);
+	}
+}
+
+static void RunTlsClient(BenchClientStats& stats)
+{
+	Botan::AutoSeeded_RNG rng;
+	BenchCredentials credentials;
+	Botan::TLS::Policy policy;
+
+	// no session caching - every operation should be a full handshake
+	Botan::TLS::Session_Manager_Noop sessionManager;
+
+	while (g_running)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		socket_t socket = ConnectClient();
+
+		if (socket == INVALID_SOCKET)
+		{
+			stats.errors++;
+			continue;
+		}
+
+		bool failed = false;
+		bool handshakeDone = false;
+		size_t bytes = 0;
+
+		try
+		{
+			Botan::TLS::Client client([&] (const uint8_t data[], size_t length)
+			{
+				bytes += length;
+
+				if (!SendAll(socket, reinterpret_cast<const char*>(data), length))
+				{
+					failed = true;
+				}
+			}, [] (const uint8_t data[], size_t length)
+			{
+
+			}, [&] (Botan::TLS::Alert alert, const uint8_t data[], size_t length)
+			{
+				if (alert.is_fatal())
+				{
+					failed = true;
+				}
+			}, [&] (const Botan::TLS::Session& session)
+			{
+				handshakeDone = true;
+
+				return false;
+			}, sessionManager, credentials, policy, rng, Botan::TLS::Server_Information("localhost", g_options.port));
+
+			while (!handshakeDone && !failed)
+			{
+				uint8_t data[16384];
+				int received = recv(socket, reinterpret_cast<char*>(data), sizeof(data), 0);
+
+				if (received <= 0)
+				{
+					failed = true;
+					break;
+				}
+
+				bytes += received;
+				client.received_data(data, received);
+			}
+
+			if (handshakeDone)
+			{
+				client.close();
+			}
+		}
+		catch (std::exception& e)
+		{
+			trace("TLS client error: %s\n", e.what());
+			failed = true;
+		}
+
+		closesocket_(socket);
+
+		if (failed)
+		{
+			stats.errors++;
+			continue;
+		}
+
+		stats.latencies.push_back(static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count()));
+		stats.connections++;
+		stats.operations++;
+		stats.bytes += bytes;
+	}
+}
+
+// discards anything written to it
+class BenchNullStream : public net::TcpServerStream
+{
+public:
+	virtual net::PeerAddress GetPeerAddress() override
+	{
+		return net::PeerAddress::FromString("127.0.0.1", 0).get();
+	}
+
+	virtual void Write(const std::vector<uint8_t>& data) override
+	{
+
+	}
+
+	virtual void Close() override
+	{
+
+	}
+};
+
+static void RunHeaderClient(BenchClientStats& stats)
+{
+	static const char requestData[] = "GET /bench HTTP/1.1\r\nHost: localhost\r\n\r\n";
+	static const int batchSize = 1000;
+
+	fwRefContainer<net::TcpServerStream> stream = new BenchNullStream();
+	std::string payload(g_options.payload, 'x');
+
+	while (g_running)
+	{
+		auto startTime = std::chrono::high_resolution_clock::now();
+
+		for (int i = 0; i < batchSize; i++)
+		{
+			std::vector<char> headerData(requestData, requestData + sizeof(requestData) - 1);
+
+			boost::string_ref method(&headerData[0], 3);
+			boost::string_ref path(&headerData[4], 6);
+
+			net::HeaderViewList headers;
+			headers.emplace_back(boost::string_ref(&headerData[21], 4), boost::string_ref(&headerData[27], 9));
+
+			fwRefContainer<net::HttpRequest> request = new net::HttpRequest(1, 1, std::move(headerData), method, path, std::move(headers));
+			fwRefContainer<net::HttpResponse> response = new net::HttpResponse(stream, request);
+
+			response->SetHeader(std::string("Content-Type"), std::string("text/plain"));
+			response->End(payload);
+		}
+
+		// latencies are per batch here
+		stats.latencies.push_back(static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - startTime).count()));
+		stats.operations += batchSize;
+	}
+}
+
+static void RunMetricsClient(BenchClientStats& stats, net::HttpServerMetrics* serverMetrics, net::HttpRouteMetrics* routeMetrics)
+{
+	static const int batchSize = 1000;
+
+	while (g_running)
+	{
+		auto startTime = std::chrono::high_resolution_clock::now();
+
+		// the same as HttpConnection does when a request gets read and when its response ends
+		for (int i = 0; i < batchSize; i++)
+		{
+			serverMetrics->requestsInFlight.Add(1);
+
+			auto requestTime = std::chrono::steady_clock::now();
+
+			routeMetrics->responses[1].Add();
+			routeMetrics->latency.Record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - requestTime).count());
+
+			serverMetrics->requestsInFlight.Add(-1);
+		}
+
+		stats.latencies.push_back(static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - startTime).count()));
+		stats.operations += batchSize;
+	}
+}
+
+static bool ParseOptions(int argc, char** argv)
+{
+	for (int i = 1; i < argc - 1; i += 2)
+	{
+		std::string option = argv[i];
+		std::string value = argv[i + 1];
+
+		if (option == "--mode")
+		{
+			if (value == "echo")
+			{
+				g_options.mode = BenchMode::Echo;
+			}
+			else if (value == "connect")
+			{
+				g_options.mode = BenchMode::Connect;
+			}
+			else if (value == "get")
+			{
+				g_options.mode = BenchMode::Get;
+			}
+			else if (value == "post")
+			{
+				g_options.mode = BenchMode::Post;
+			}
+			else if (value == "tls")
+			{
+				g_options.mode = BenchMode::Tls;
+			}
+			else if (value == "headers")
+			{
+				g_options.mode = BenchMode::Headers;
+			}
+			else if (value == "metrics")
+			{
+				g_options.mode = BenchMode::Metrics;
+			}
+			else if (value == "websocket")
+			{
+				g_options.mode = BenchMode::WebSocket;
+			}
+			else
+			{
+				return false;
+			}
+		}
+		else if (option == "--clients")
+		{
+			g_options.clients = std::max(atoi(value.c_str()), 1);
+		}
+		else if (option == "--duration")
+		{
+			g_options.duration = std::max(atoi(value.c_str()), 1);
+		}
+		else if (option == "--threads")
+		{
+			g_options.threads = std::max(atoi(value.c_str()), 0);
+		}
+		else if (option == "--payload")
+		{
+			g_options.payload = std::max(atoi(value.c_str()), 1);
+		}
+		else if (option == "--port")
+		{
+			g_options.port = atoi(value.c_str());
+		}
+		else if (option == "--keep-alive")
+		{
+			g_options.keepAlive = (atoi(value.c_str()) != 0);
+		}
+		else if (option == "--metrics")
+		{
+			g_options.metrics = (atoi(value.c_str()) != 0);
+		}
+		else if (option == "--cert")
+		{
+			g_options.certificatePath = value;
+		}
+		else if (option == "--key")
+		{
+			g_options.keyPath = value;
+		}
+		else if (option == "--workers")
+		{
+			g_options.workers = std::max(atoi(value.c_str()), 0);
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	return (argc % 2) == 1;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc >= 3 && strcmp(argv[1], "--mode") == 0 && strcmp(argv[2], "check") == 0)
+	{
+		::testing::InitGoogleTest(&argc, argv);
+		return RUN_ALL_TESTS();
+	}
+
+	if (!ParseOptions(argc, argv))
+	{
+		printf("usage: %s [--mode echo|connect|get|post|tls|headers|metrics|websocket|check] [--clients n] [--duration seconds] [--threads n] [--payload bytes] [--port n] [--keep-alive 0|1] [--metrics 0|1] [--cert path --key path] [--workers n]\n", argv[0]);
+		return 1;
+	}
+
+	if (g_options.mode == BenchMode::Tls && (g_options.certificatePath.empty() || g_options.keyPath.empty()))
+	{
+		printf("TLS mode requires --cert and --key\n");
+		return 1;
+	}
+
+#ifdef _WIN32
+	WSADATA wsaData;
+	WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+
+	// components normally get this from their InitFunctions
+	Instance<net::UvLoopManager>::Set(new net::UvLoopManager());
+
+	fwRefContainer<net::TcpServerManager> tcpStack = new net::TcpServerManager("bench", g_options.threads);
+	fwRefContainer<net::MultiplexTcpServer> multiplexServer = new net::MultiplexTcpServer(tcpStack);
+
+	fwRefContainer<net::TcpServer> echoServer = multiplexServer->CreateServer(std::vector<std::string>{ "ECHO" });
+	fwRefContainer<net::TcpServer> httpServer = multiplexServer->CreateServer(std::vector<std::string>{ "GET ", "POST " });
+
+	echoServer->SetConnectionCallback([] (fwRefContainer<net::TcpServerStream> stream)
+	{
+		net::TcpServerStream* streamRef = stream.GetRef();
+
+		stream->SetBufferReadCallback([=] (const net::BufferView& data)
+		{
+			streamRef->Write(data.ToVector());
+		});
+
+		stream->SetCloseCallback([=] ()
+		{
+			streamRef->SetBufferReadCallback(net::TcpServerStream::TBufferReadCallback());
+		});
+	});
+
+	fwRefContainer<net::HttpServerImpl> httpImpl = new net::HttpServerImpl();
+	httpImpl->AttachToServer(httpServer);
+	httpImpl->RegisterHandler("", "/bench", new BenchHttpHandler(g_options.payload));
+	httpImpl->RegisterHandler("GET", "/ws", new BenchWebSocketHandler());
+
+	fwRefContainer<net::MetricsCollector> metricsCollector = new net::MetricsCollector();
+
+	if (g_options.metrics)
+	{
+		tcpStack->SetMetricsCollector(metricsCollector);
+		httpImpl->SetMetricsCollector(metricsCollector);
+		httpImpl->RegisterHandler("GET", "/metrics", new net::HttpMetricsHandler(metricsCollector));
+	}
+
+	// for the metrics mode, which records into these directly
+	auto benchServerMetrics = std::make_shared<net::HttpServerMetrics>();
+	auto benchRouteMetrics = std::make_shared<net::HttpRouteMetrics>();
+
+	fwRefContainer<net::TLSServer> tlsServer;
+
+	if (!g_options.certificatePath.empty() && !g_options.keyPath.empty())
+	{
+		tlsServer = new net::TLSServer(multiplexServer->CreateServer(std::vector<std::string>{ std::string("\x16\x03", 2) }), g_options.certificatePath, g_options.keyPath);
+		httpImpl->AttachToServer(tlsServer);
+
+		if (g_options.workers > 0)
+		{
+			tlsServer->SetWorkerPool(new net::WorkerPool(g_options.workers));
+		}
+	}
+
+	multiplexServer->Bind(net::PeerAddress::FromString("127.0.0.1", g_options.port).get());
+
+	// give the listener loops a moment to start
+	std::this_thread::sleep_for(std::chrono::milliseconds(250));
+
+	std::vector<BenchClientStats> clientStats(g_options.clients);
+	std::vector<std::thread> clientThreads;
+
+	g_running = true;
+
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	for (auto& stats : clientStats)
+	{
+		BenchClientStats* statsRef = &stats;
+		net::HttpServerMetrics* serverMetricsRef = benchServerMetrics.get();
+		net::HttpRouteMetrics* routeMetricsRef = benchRouteMetrics.get();
+
+		clientThreads.emplace_back([=] ()
+		{
+			switch (g_options.mode)
+			{
+				case BenchMode::Connect:
+					RunConnectClient(*statsRef);
+					break;
+				case BenchMode::Tls:
+					RunTlsClient(*statsRef);
+					break;
+				case BenchMode::Headers:
+					RunHeaderClient(*statsRef);
+					break;
+				case BenchMode::Metrics:
+					RunMetricsClient(*statsRef, serverMetricsRef, routeMetricsRef);
+					break;
+				case BenchMode::WebSocket:
+					RunWebSocketClient(*statsRef);
+					break;
+				default:
+					RunStreamClient(*statsRef);
+					break;
+			}
+		});
+	}
+
+	std::this_thread::sleep_for(std::chrono::seconds(g_options.duration));
+	g_running = false;
+
+	for (auto& thread : clientThreads)
+	{
+		thread.join();
+	}
+
+	double elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+	// merge all client results
+	BenchClientStats total;
+
+	for (auto& stats : clientStats)
+	{
+		total.connections += stats.connections;
+		total.operations += stats.operations;
+		total.bytes += stats.bytes;
+		total.errors += stats.errors;
+
+		total.latencies.insert(total.latencies.end(), stats.latencies.begin(), stats.latencies.end());
+	}
+
+	std::sort(total.latencies.begin(), total.latencies.end());
+
+	auto percentile = [&] (double fraction) -> uint32_t
+	{
+		if (total.latencies.empty())
+		{
+			return 0;
+		}
+
+		return total.latencies[std::min(static_cast<size_t>(total.latencies.size() * fraction), total.latencies.size() - 1)];
+	};
+
+	printf("%d clients, %.2f s\n", g_options.clients, elapsed);
+	printf("connections/s: %.1f\n", total.connections / elapsed);
+	printf("requests/s:    %.1f\n", total.operations / elapsed);
+	printf("bytes/s:       %.1f\n", total.bytes / elapsed);
+	printf("latency (us):  p50 %u, p99 %u, p999 %u, max %u\n", percentile(0.5), percentile(0.99), percentile(0.999), total.latencies.empty() ? 0 : total.latencies.back());
+	printf("errors:        %llu\n", static_cast<unsigned long long>(total.errors));
+
+	if (g_options.mode == BenchMode::Headers && total.operations > 0)
+	{
+		printf("ns/response:   %.1f (batches of 1000 in the latencies above)\n", (elapsed * g_options.clients * 1e9) / total.operations);
+		printf("allocs/resp.:  %.2f\n", static_cast<double>(g_allocations) / total.operations);
+	}
+
+	if (g_options.mode == BenchMode::Metrics && total.operations > 0)
+	{
+		// this includes reading the clock twice, which is most of it
+		printf("ns/request:    %.1f per client (batches of 1000 in the latencies above)\n", (elapsed * g_options.clients * 1e9) / total.operations);
+		printf("p50/p99 (us):  %llu/%llu\n", static_cast<unsigned long long>(benchRouteMetrics->latency.GetPercentile(0.5)), static_cast<unsigned long long>(benchRouteMetrics->latency.GetPercentile(0.99)));
+	}
+
+	if (g_options.metrics)
+	{
+		std::string metricsData;
+		metricsCollector->Render(metricsData);
+
+		printf("\n%s", metricsData.c_str());
+	}
+
+	fflush(stdout);
+
+	// the server stack doesn't support a clean shutdown with connections still being torn down
+	_exit(0);
+}
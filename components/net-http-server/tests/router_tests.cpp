@@ -0,0 +1,172 @@
+#include "StdInc.h"
+#include <gtest/gtest.h>
+
+#include "HttpRouter.h"
+
+namespace
+{
+// records which route got a request, and the parameters it got
+class RecordingHandler : public net::HttpHandler
+{
+private:
+	std::string m_name;
+
+	bool m_handles;
+
+	std::vector<std::string>* m_calls;
+
+public:
+	RecordingHandler(const std::string& name, std::vector<std::string>* calls, bool handles = true)
+		: m_name(name), m_handles(handles), m_calls(calls)
+	{
+
+	}
+
+	virtual bool HandleRequest(fwRefContainer<net::HttpRequest> request, fwRefContainer<net::HttpResponse> response) override
+	{
+		std::string call = m_name;
+
+		for (auto& parameter : request->GetRouteParameters())
+		{
+			call += " " + parameter.first + "=" + parameter.second.to_string();
+		}
+
+		m_calls->push_back(call);
+
+		return m_handles;
+	}
+};
+
+class HttpRouterTests : public ::testing::Test
+{
+protected:
+	net::HttpRouter router;
+
+	std::vector<std::string> calls;
+
+	void AddRoute(const std::string& method, const std::string& pattern, const std::string& name, bool handles = true)
+	{
+		router.AddRoute(method, pattern, new RecordingHandler(name, &calls, handles));
+	}
+
+	// returns the routes that got tried, or "none" if none handled the request
+	std::string Dispatch(const std::string& method, const std::string& path)
+	{
+		std::string requestLine = method + " " + path;
+		std::vector<char> headerData(requestLine.begin(), requestLine.end());
+
+		boost::string_ref methodRef(headerData.data(), method.size());
+		boost::string_ref pathRef(headerData.data() + method.size() + 1, path.size());
+
+		fwRefContainer<net::HttpRequest> request = new net::HttpRequest(1, 1, std::move(headerData), methodRef, pathRef, net::HeaderViewList());
+		fwRefContainer<net::HttpResponse> response = new net::HttpResponse(nullptr, request);
+
+		calls.clear();
+		bool handled = router.Dispatch(request, response);
+
+		std::string result;
+
+		for (auto& call : calls)
+		{
+			result += (result.empty() ? "" : ", ") + call;
+		}
+
+		return (handled) ? result : result + (result.empty() ? "none" : ", none");
+	}
+};
+}
+
+TEST_F(HttpRouterTests, MatchesLiteralPaths)
+{
+	AddRoute("", "/", "root");
+	AddRoute("", "/info.json", "info");
+
+	EXPECT_EQ("root", Dispatch("GET", "/"));
+	EXPECT_EQ("info", Dispatch("GET", "/info.json"));
+	EXPECT_EQ("none", Dispatch("GET", "/players.json"));
+	EXPECT_EQ("none", Dispatch("GET", "/info.json/more"));
+}
+
+TEST_F(HttpRouterTests, IgnoresQueryAndEmptySegments)
+{
+	AddRoute("", "/players/list", "list");
+
+	EXPECT_EQ("list", Dispatch("GET", "/players/list?page=2"));
+	EXPECT_EQ("list", Dispatch("GET", "//players//list/"));
+}
+
+TEST_F(HttpRouterTests, MatchesMethods)
+{
+	AddRoute("GET", "/info.json", "get");
+	AddRoute("POST", "/info.json", "post");
+
+	EXPECT_EQ("get", Dispatch("GET", "/info.json"));
+	EXPECT_EQ("post", Dispatch("POST", "/info.json"));
+	EXPECT_EQ("none", Dispatch("PUT", "/info.json"));
+}
+
+TEST_F(HttpRouterTests, CapturesParameters)
+{
+	AddRoute("", "/players/:id", "player");
+	AddRoute("", "/players/:id/kick/:reason", "kick");
+
+	EXPECT_EQ("player id=12", Dispatch("GET", "/players/12"));
+	EXPECT_EQ("kick id=3 reason=afk", Dispatch("GET", "/players/3/kick/afk"));
+	EXPECT_EQ("none", Dispatch("GET", "/players"));
+}
+
+TEST_F(HttpRouterTests, PrefersLiteralsOverParameters)
+{
+	AddRoute("", "/players/:id", "player");
+	AddRoute("", "/players/self", "self");
+
+	EXPECT_EQ("self", Dispatch("GET", "/players/self"));
+	EXPECT_EQ("player id=4", Dispatch("GET", "/players/4"));
+}
+
+TEST_F(HttpRouterTests, PrefersExactOverPrefix)
+{
+	AddRoute("", "/files/*", "files");
+	AddRoute("", "/files", "index");
+
+	EXPECT_EQ("index", Dispatch("GET", "/files"));
+	EXPECT_EQ("files", Dispatch("GET", "/files/a/b"));
+}
+
+TEST_F(HttpRouterTests, PrefersDeeperPrefixes)
+{
+	AddRoute("", "/*", "fallback");
+	AddRoute("", "/files/*", "files");
+
+	EXPECT_EQ("files", Dispatch("GET", "/files/a"));
+	EXPECT_EQ("fallback", Dispatch("GET", "/other/a"));
+	EXPECT_EQ("fallback", Dispatch("GET", "/"));
+}
+
+TEST_F(HttpRouterTests, FallsThroughUnhandledRoutes)
+{
+	AddRoute("", "/*", "fallback");
+	AddRoute("", "/players/:id", "player");
+	AddRoute("", "/players/self", "self", false);
+
+	EXPECT_EQ("self, player id=self", Dispatch("GET", "/players/self"));
+
+	AddRoute("", "/missing", "missing", false);
+
+	EXPECT_EQ("missing, fallback", Dispatch("GET", "/missing"));
+}
+
+TEST_F(HttpRouterTests, ReportsUnhandledRequests)
+{
+	AddRoute("", "/*", "fallback", false);
+
+	EXPECT_EQ("fallback, none", Dispatch("GET", "/info.json"));
+}
+
+TEST_F(HttpRouterTests, KeepsRegistrationOrderForEqualRoutes)
+{
+	AddRoute("", "/info.json", "first", false);
+	AddRoute("", "/info.json", "second");
+
+	EXPECT_EQ("first, second", Dispatch("GET", "/info.json"));
+}
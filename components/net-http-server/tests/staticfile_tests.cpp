@@ -0,0 +1,168 @@
+#include "StdInc.h"
+#include <gtest/gtest.h>
+
+#include "HttpStaticFileHandler.h"
+
+using net::HttpStaticFileHandler;
+
+typedef HttpStaticFileHandler::RangeResult RangeResult;
+
+namespace
+{
+std::string DecodePath(const char* path)
+{
+	std::string relativePath;
+
+	if (!HttpStaticFileHandler::DecodeRelativePath(path, &relativePath))
+	{
+		return "(refused)";
+	}
+
+	return relativePath;
+}
+
+struct Range
+{
+	RangeResult result;
+
+	uint64_t start;
+
+	uint64_t end;
+};
+
+Range ParseRange(const char* header, uint64_t length, const char* ifRange = "", const std::string& etag = "\"h\"")
+{
+	Range range;
+	range.start = 0;
+	range.end = length - 1;
+	range.result = HttpStaticFileHandler::ParseRange(header, ifRange, etag, length, &range.start, &range.end);
+
+	return range;
+}
+}
+
+TEST(HttpStaticFileTests, DecodesPaths)
+{
+	EXPECT_EQ("app.js", DecodePath("app.js"));
+	EXPECT_EQ("ui/app.js", DecodePath("ui/app.js"));
+	EXPECT_EQ("ui/app.js", DecodePath("./ui//app.js"));
+	EXPECT_EQ("my file.txt", DecodePath("my%20file.txt"));
+	EXPECT_EQ("A", DecodePath("%41"));
+}
+
+TEST(HttpStaticFileTests, AppendsIndexForDirectories)
+{
+	EXPECT_EQ("index.html", DecodePath(""));
+	EXPECT_EQ("index.html", DecodePath("/"));
+	EXPECT_EQ("ui/index.html", DecodePath("ui/"));
+}
+
+TEST(HttpStaticFileTests, RefusesEscapingPaths)
+{
+	EXPECT_EQ("(refused)", DecodePath("../secret"));
+	EXPECT_EQ("(refused)", DecodePath("ui/../../secret"));
+	EXPECT_EQ("(refused)", DecodePath("ui/%2e%2e/%2E%2E/secret"));
+	EXPECT_EQ("(refused)", DecodePath("ui\\..\\secret"));
+	EXPECT_EQ("(refused)", DecodePath("ui%5csecret"));
+	EXPECT_EQ("(refused)", DecodePath("citizen:/secret"));
+	EXPECT_EQ("(refused)", DecodePath("app.js%00.png"));
+}
+
+TEST(HttpStaticFileTests, RefusesBadEscapes)
+{
+	EXPECT_EQ("(refused)", DecodePath("%"));
+	EXPECT_EQ("(refused)", DecodePath("%4"));
+	EXPECT_EQ("(refused)", DecodePath("%zz"));
+	EXPECT_EQ("(refused)", DecodePath("a%4g"));
+}
+
+TEST(HttpStaticFileTests, MatchesETags)
+{
+	std::string etag = "\"abc\"";
+
+	EXPECT_TRUE(HttpStaticFileHandler::MatchesETag("\"abc\"", etag));
+	EXPECT_TRUE(HttpStaticFileHandler::MatchesETag("W/\"abc\"", etag));
+	EXPECT_TRUE(HttpStaticFileHandler::MatchesETag("\"x\", \"abc\"", etag));
+	EXPECT_TRUE(HttpStaticFileHandler::MatchesETag("\"x\",\"abc\" ", etag));
+	EXPECT_TRUE(HttpStaticFileHandler::MatchesETag("*", etag));
+
+	EXPECT_FALSE(HttpStaticFileHandler::MatchesETag("", etag));
+	EXPECT_FALSE(HttpStaticFileHandler::MatchesETag("abc", etag));
+	EXPECT_FALSE(HttpStaticFileHandler::MatchesETag("\"abcd\", \"ab\"", etag));
+}
+
+TEST(HttpStaticFileTests, ParsesRanges)
+{
+	Range range = ParseRange("bytes=0-99", 1000);
+
+	EXPECT_EQ(RangeResult::Satisfiable, range.result);
+	EXPECT_EQ(0u, range.start);
+	EXPECT_EQ(99u, range.end);
+
+	range = ParseRange("bytes=900-", 1000);
+
+	EXPECT_EQ(RangeResult::Satisfiable, range.result);
+	EXPECT_EQ(900u, range.start);
+	EXPECT_EQ(999u, range.end);
+
+	// the end gets clamped to the file
+	range = ParseRange("bytes=500-5000", 1000);
+
+	EXPECT_EQ(RangeResult::Satisfiable, range.result);
+	EXPECT_EQ(500u, range.start);
+	EXPECT_EQ(999u, range.end);
+}
+
+TEST(HttpStaticFileTests, ParsesSuffixRanges)
+{
+	Range range = ParseRange("bytes=-100", 1000);
+
+	EXPECT_EQ(RangeResult::Satisfiable, range.result);
+	EXPECT_EQ(900u, range.start);
+	EXPECT_EQ(999u, range.end);
+
+	range = ParseRange("bytes=-2000", 1000);
+
+	EXPECT_EQ(RangeResult::Satisfiable, range.result);
+	EXPECT_EQ(0u, range.start);
+	EXPECT_EQ(999u, range.end);
+}
+
+TEST(HttpStaticFileTests, RefusesUnsatisfiableRanges)
+{
+	EXPECT_EQ(RangeResult::Unsatisfiable, ParseRange("bytes=1000-", 1000).result);
+	EXPECT_EQ(RangeResult::Unsatisfiable, ParseRange("bytes=1000-1001", 1000).result);
+	EXPECT_EQ(RangeResult::Unsatisfiable, ParseRange("bytes=-0", 1000).result);
+	EXPECT_EQ(RangeResult::Unsatisfiable, ParseRange("bytes=0-", 0).result);
+	EXPECT_EQ(RangeResult::Unsatisfiable, ParseRange("bytes=-10", 0).result);
+}
+
+TEST(HttpStaticFileTests, IgnoresUnsupportedRanges)
+{
+	EXPECT_EQ(RangeResult::Ignore, ParseRange("", 1000).result);
+	EXPECT_EQ(RangeResult::Ignore, ParseRange("items=0-99", 1000).result);
+	EXPECT_EQ(RangeResult::Ignore, ParseRange("bytes=0-1,5-6", 1000).result);
+	EXPECT_EQ(RangeResult::Ignore, ParseRange("bytes=99-0", 1000).result);
+	EXPECT_EQ(RangeResult::Ignore, ParseRange("bytes=a-b", 1000).result);
+	EXPECT_EQ(RangeResult::Ignore, ParseRange("bytes=-", 1000).result);
+	EXPECT_EQ(RangeResult::Ignore, ParseRange("bytes=0x10-", 1000).result);
+	EXPECT_EQ(RangeResult::Ignore, ParseRange("bytes=99999999999999999999-", 1000).result);
+}
+
+TEST(HttpStaticFileTests, AppliesRangesOnlyIfUnchanged)
+{
+	Range range = ParseRange("bytes=0-99", 1000, "\"h\"");
+
+	EXPECT_EQ(RangeResult::Satisfiable, range.result);
+	EXPECT_EQ(99u, range.end);
+
+	// a different version, or a date, which can't be compared against
+	EXPECT_EQ(RangeResult::Ignore, ParseRange("bytes=0-99", 1000, "\"other\"").result);
+	EXPECT_EQ(RangeResult::Ignore, ParseRange("bytes=0-99", 1000, "Wed, 21 Oct 2015 07:28:00 GMT").result);
+
+	// If-Range needs a strong match
+	EXPECT_EQ(RangeResult::Ignore, ParseRange("bytes=0-99", 1000, "W/\"h\"").result);
+
+	// and doesn't turn an unsatisfiable range into a 416 for another version
+	EXPECT_EQ(RangeResult::Ignore, ParseRange("bytes=2000-", 1000, "\"other\"").result);
+}
@@ -0,0 +1,568 @@
+#include "StdInc.h"
+#include <gtest/gtest.h>
+
+#include "HttpServerImpl.h"
+#include "HttpWebSocket.h"
+#include "TestStream.h"
+
+using net::HttpWebSocketOpcode;
+
+namespace
+{
+struct Message
+{
+	HttpWebSocketOpcode opcode;
+
+	std::string data;
+};
+
+struct Frame
+{
+	bool final;
+
+	HttpWebSocketOpcode opcode;
+
+	std::string payload;
+};
+
+// accepts sockets, recording what they receive
+class WebSocketHandler : public net::HttpHandler
+{
+public:
+	fwRefContainer<net::HttpWebSocket> webSocket;
+
+	std::vector<Message> messages;
+
+	std::vector<std::pair<uint16_t, std::string>> closes;
+
+	virtual bool HandleRequest(fwRefContainer<net::HttpRequest> request, fwRefContainer<net::HttpResponse> response) override
+	{
+		webSocket = response->AcceptWebSocket();
+
+		if (!webSocket.GetRef())
+		{
+			return true;
+		}
+
+		if (request->GetPath() == "/small")
+		{
+			webSocket->SetMaxMessageSize(100);
+		}
+		else if (request->GetPath() == "/large")
+		{
+			webSocket->SetMaxMessageSize(6 * 1024 * 1024);
+		}
+
+		webSocket->SetMessageHandler([this] (HttpWebSocketOpcode opcode, const uint8_t* data, size_t length)
+		{
+			messages.push_back({ opcode, std::string(reinterpret_cast<const char*>(data), length) });
+		});
+
+		webSocket->SetCloseHandler([this] (uint16_t code, const std::string& reason)
+		{
+			closes.emplace_back(code, reason);
+		});
+
+		return true;
+	}
+};
+
+// a frame as a client sends it - masked, unless asked otherwise
+std::string MakeFrame(uint8_t firstByte, const std::string& payload, bool masked = true)
+{
+	static const uint8_t mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+
+	std::string frame(1, char(firstByte));
+	uint8_t maskBit = (masked) ? 0x80 : 0x00;
+
+	if (payload.size() <= 125)
+	{
+		frame.push_back(char(maskBit | payload.size()));
+	}
+	else if (payload.size() <= 0xFFFF)
+	{
+		frame.push_back(char(maskBit | 126));
+		frame.push_back(char(payload.size() >> 8));
+		frame.push_back(char(payload.size() & 0xFF));
+	}
+	else
+	{
+		frame.push_back(char(maskBit | 127));
+
+		for (int i = 7; i >= 0; i--)
+		{
+			frame.push_back(char((uint64_t(payload.size()) >> (i * 8)) & 0xFF));
+		}
+	}
+
+	if (masked)
+	{
+		frame.append(reinterpret_cast<const char*>(mask), sizeof(mask));
+	}
+
+	for (size_t i = 0; i < payload.size(); i++)
+	{
+		frame.push_back((masked) ? char(payload[i] ^ mask[i & 3]) : payload[i]);
+	}
+
+	return frame;
+}
+
+std::string MakeFrame(HttpWebSocketOpcode opcode, const std::string& payload, bool final = true)
+{
+	return MakeFrame(uint8_t((final) ? 0x80 : 0x00) | uint8_t(opcode), payload);
+}
+
+std::string MakeClose(uint16_t code, const std::string& reason = std::string())
+{
+	std::string payload;
+	payload.push_back(char(code >> 8));
+	payload.push_back(char(code & 0xFF));
+
+	return MakeFrame(HttpWebSocketOpcode::Close, payload + reason);
+}
+
+// parses unmasked frames, as the server sends them
+std::vector<Frame> ParseFrames(const std::string& data)
+{
+	std::vector<Frame> frames;
+	size_t offset = 0;
+
+	while (offset + 2 <= data.size())
+	{
+		Frame frame;
+		frame.final = (uint8_t(data[offset]) & 0x80) != 0;
+		frame.opcode = HttpWebSocketOpcode(uint8_t(data[offset]) & 0x0F);
+
+		uint64_t length = uint8_t(data[offset + 1]) & 0x7F;
+		offset += 2;
+
+		int extraLength = (length == 126) ? 2 : (length == 127) ? 8 : 0;
+
+		if (extraLength)
+		{
+			length = 0;
+
+			for (int i = 0; i < extraLength; i++)
+			{
+				length = (length << 8) | uint8_t(data[offset + i]);
+			}
+
+			offset += extraLength;
+		}
+
+		frame.payload = data.substr(offset, static_cast<size_t>(length));
+		offset += static_cast<size_t>(length);
+
+		frames.push_back(frame);
+	}
+
+	return frames;
+}
+
+uint16_t GetCloseCode(const Frame& frame)
+{
+	return (frame.payload.size() >= 2) ? uint16_t((uint8_t(frame.payload[0]) << 8) | uint8_t(frame.payload[1])) : 0;
+}
+
+class HttpWebSocketTests : public ::testing::Test
+{
+protected:
+	fwRefContainer<net::HttpServerImpl> server;
+
+	fwRefContainer<WebSocketHandler> handler;
+
+	fwRefContainer<net::TestServer> tcpServer;
+
+	fwRefContainer<net::TestStream> stream;
+
+	std::string handshake;
+
+	virtual void SetUp() override
+	{
+		server = new net::HttpServerImpl();
+		handler = new WebSocketHandler();
+		server->RegisterHandler(handler);
+
+		tcpServer = new net::TestServer();
+		server->AttachToServer(tcpServer);
+
+		stream = tcpServer->Connect();
+	}
+
+	virtual void TearDown() override
+	{
+		stream->Close();
+	}
+
+	void Connect(const std::string& path = "/")
+	{
+		stream->Receive("GET " + path + " HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+						"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n");
+
+		handshake = stream->TakeOutput();
+	}
+
+	// checks the socket got failed with a close frame carrying `code`
+	void ExpectFailure(uint16_t code)
+	{
+		auto frames = ParseFrames(stream->TakeOutput());
+
+		ASSERT_EQ(1u, frames.size());
+		EXPECT_EQ(HttpWebSocketOpcode::Close, frames[0].opcode);
+		EXPECT_EQ(code, GetCloseCode(frames[0]));
+
+		ASSERT_EQ(1u, handler->closes.size());
+		EXPECT_EQ(code, handler->closes[0].first);
+
+		EXPECT_TRUE(stream->IsClosed());
+	}
+};
+}
+
+TEST_F(HttpWebSocketTests, AcceptsUpgrades)
+{
+	Connect();
+
+	ASSERT_TRUE(handler->webSocket.GetRef());
+	EXPECT_EQ(0u, handshake.find("HTTP/1.1 101 "));
+	EXPECT_NE(std::string::npos, handshake.find("Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n"));
+}
+
+TEST_F(HttpWebSocketTests, RefusesOtherVersions)
+{
+	stream->Receive("GET / HTTP/1.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+					"Sec-WebSocket-Version: 8\r\n\r\n");
+
+	std::string response = stream->TakeOutput();
+
+	EXPECT_FALSE(handler->webSocket.GetRef());
+	EXPECT_EQ(0u, response.find("HTTP/1.1 426 "));
+	EXPECT_NE(std::string::npos, response.find("Sec-WebSocket-Version: 13\r\n"));
+}
+
+TEST_F(HttpWebSocketTests, ReceivesMessages)
+{
+	Connect();
+
+	stream->Receive(MakeFrame(HttpWebSocketOpcode::Text, "hello") + MakeFrame(HttpWebSocketOpcode::Binary, std::string("\x00\xFF", 2)));
+
+	ASSERT_EQ(2u, handler->messages.size());
+	EXPECT_EQ(HttpWebSocketOpcode::Text, handler->messages[0].opcode);
+	EXPECT_EQ("hello", handler->messages[0].data);
+	EXPECT_EQ(HttpWebSocketOpcode::Binary, handler->messages[1].opcode);
+	EXPECT_EQ(std::string("\x00\xFF", 2), handler->messages[1].data);
+}
+
+TEST_F(HttpWebSocketTests, ReadsExtendedLengths)
+{
+	Connect();
+
+	std::string medium(300, 'm');
+	std::string large(70000, 'l');
+
+	stream->Receive(MakeFrame(HttpWebSocketOpcode::Text, medium) + MakeFrame(HttpWebSocketOpcode::Text, large));
+
+	ASSERT_EQ(2u, handler->messages.size());
+	EXPECT_EQ(medium, handler->messages[0].data);
+	EXPECT_EQ(large, handler->messages[1].data);
+}
+
+TEST_F(HttpWebSocketTests, ReadsFramesArrivingBytewise)
+{
+	Connect();
+
+	std::string frames = MakeFrame(HttpWebSocketOpcode::Text, std::string(200, 'x')) + MakeFrame(HttpWebSocketOpcode::Text, "two");
+
+	for (char c : frames)
+	{
+		stream->Receive(std::string(1, c));
+	}
+
+	ASSERT_EQ(2u, handler->messages.size());
+	EXPECT_EQ(std::string(200, 'x'), handler->messages[0].data);
+	EXPECT_EQ("two", handler->messages[1].data);
+}
+
+TEST_F(HttpWebSocketTests, ReassemblesFragments)
+{
+	Connect();
+
+	// a ping may come between fragments
+	stream->Receive(MakeFrame(HttpWebSocketOpcode::Text, "frag", false) + MakeFrame(HttpWebSocketOpcode::Ping, "p") +
+					MakeFrame(HttpWebSocketOpcode::Continuation, "men", false) + MakeFrame(HttpWebSocketOpcode::Continuation, "ted"));
+
+	ASSERT_EQ(1u, handler->messages.size());
+	EXPECT_EQ(HttpWebSocketOpcode::Text, handler->messages[0].opcode);
+	EXPECT_EQ("fragmented", handler->messages[0].data);
+
+	auto frames = ParseFrames(stream->TakeOutput());
+
+	ASSERT_EQ(1u, frames.size());
+	EXPECT_EQ(HttpWebSocketOpcode::Pong, frames[0].opcode);
+	EXPECT_EQ("p", frames[0].payload);
+}
+
+TEST_F(HttpWebSocketTests, SendsFrames)
+{
+	Connect();
+
+	handler->webSocket->Send("hi");
+	handler->webSocket->Send(HttpWebSocketOpcode::Binary, reinterpret_cast<const uint8_t*>(std::string(300, 'b').data()), 300);
+	handler->webSocket->SendFrame(HttpWebSocketOpcode::Text, reinterpret_cast<const uint8_t*>("ab"), 2, false);
+	handler->webSocket->SendFrame(HttpWebSocketOpcode::Continuation, reinterpret_cast<const uint8_t*>("cd"), 2, true);
+
+	auto frames = ParseFrames(stream->TakeOutput());
+
+	ASSERT_EQ(4u, frames.size());
+	EXPECT_EQ("hi", frames[0].payload);
+	EXPECT_EQ(std::string(300, 'b'), frames[1].payload);
+	EXPECT_FALSE(frames[2].final);
+	EXPECT_EQ(HttpWebSocketOpcode::Continuation, frames[3].opcode);
+	EXPECT_TRUE(frames[3].final);
+}
+
+TEST_F(HttpWebSocketTests, FailsUnmaskedFrames)
+{
+	Connect();
+
+	stream->Receive(MakeFrame(0x81, "hello", false));
+
+	ExpectFailure(1002);
+	EXPECT_TRUE(handler->messages.empty());
+}
+
+TEST_F(HttpWebSocketTests, FailsReservedBits)
+{
+	Connect();
+
+	stream->Receive(MakeFrame(0xC1, "hello"));
+
+	ExpectFailure(1002);
+}
+
+TEST_F(HttpWebSocketTests, FailsUnknownOpcodes)
+{
+	Connect();
+
+	stream->Receive(MakeFrame(0x83, "hello"));
+
+	ExpectFailure(1002);
+}
+
+TEST_F(HttpWebSocketTests, FailsUnexpectedContinuations)
+{
+	Connect();
+
+	stream->Receive(MakeFrame(HttpWebSocketOpcode::Continuation, "hello"));
+
+	ExpectFailure(1002);
+}
+
+TEST_F(HttpWebSocketTests, FailsInterleavedMessages)
+{
+	Connect();
+
+	stream->Receive(MakeFrame(HttpWebSocketOpcode::Text, "one", false) + MakeFrame(HttpWebSocketOpcode::Text, "two"));
+
+	ExpectFailure(1002);
+}
+
+TEST_F(HttpWebSocketTests, FailsFragmentedControlFrames)
+{
+	Connect();
+
+	stream->Receive(MakeFrame(HttpWebSocketOpcode::Ping, "p", false));
+
+	ExpectFailure(1002);
+}
+
+TEST_F(HttpWebSocketTests, FailsLongControlFrames)
+{
+	Connect();
+
+	stream->Receive(MakeFrame(HttpWebSocketOpcode::Ping, std::string(126, 'p')));
+
+	ExpectFailure(1002);
+}
+
+TEST_F(HttpWebSocketTests, FailsLargeMessages)
+{
+	Connect("/small");
+
+	stream->Receive(MakeFrame(HttpWebSocketOpcode::Binary, std::string(100, 'x')));
+
+	EXPECT_EQ(1u, handler->messages.size());
+
+	stream->Receive(MakeFrame(HttpWebSocketOpcode::Binary, std::string(101, 'x')));
+
+	ExpectFailure(1009);
+	EXPECT_EQ(1u, handler->messages.size());
+}
+
+TEST_F(HttpWebSocketTests, ReadsMessagesUpToTheConfiguredSize)
+{
+	Connect("/large");
+
+	std::string message(6 * 1024 * 1024, 'x');
+	std::string frame = MakeFrame(HttpWebSocketOpcode::Binary, message);
+
+	// arriving the way reads would, so the frame has to be buffered
+	for (size_t offset = 0; offset < frame.size(); offset += 64 * 1024)
+	{
+		stream->Receive(frame.substr(offset, 64 * 1024));
+	}
+
+	ASSERT_EQ(1u, handler->messages.size());
+	EXPECT_EQ(message.size(), handler->messages[0].data.size());
+	EXPECT_FALSE(stream->IsClosed());
+}
+
+TEST_F(HttpWebSocketTests, FailsLargeFragmentedMessages)
+{
+	Connect("/small");
+
+	stream->Receive(MakeFrame(HttpWebSocketOpcode::Binary, std::string(60, 'x'), false));
+	stream->Receive(MakeFrame(HttpWebSocketOpcode::Continuation, std::string(60, 'x')));
+
+	ExpectFailure(1009);
+	EXPECT_TRUE(handler->messages.empty());
+}
+
+TEST_F(HttpWebSocketTests, AcceptsValidUtf8)
+{
+	Connect();
+
+	// 2, 3 and 4 byte sequences, and the highest code point
+	std::string text = "h\xC3\xA9llo \xE2\x82\xAC \xF0\x9D\x84\x9E \xF4\x8F\xBF\xBF";
+
+	stream->Receive(MakeFrame(HttpWebSocketOpcode::Text, text));
+
+	// sequences may be split across fragments, as only whole messages get checked
+	stream->Receive(MakeFrame(HttpWebSocketOpcode::Text, "\xE2\x82", false) + MakeFrame(HttpWebSocketOpcode::Continuation, "\xAC"));
+
+	ASSERT_EQ(2u, handler->messages.size());
+	EXPECT_EQ(text, handler->messages[0].data);
+	EXPECT_EQ("\xE2\x82\xAC", handler->messages[1].data);
+	EXPECT_FALSE(stream->IsClosed());
+}
+
+TEST_F(HttpWebSocketTests, AcceptsAnyBinary)
+{
+	Connect();
+
+	stream->Receive(MakeFrame(HttpWebSocketOpcode::Binary, "\xC0\xAF\xFF"));
+
+	EXPECT_EQ(1u, handler->messages.size());
+	EXPECT_FALSE(stream->IsClosed());
+}
+
+TEST_F(HttpWebSocketTests, FailsInvalidUtf8)
+{
+	const char* invalidTexts[] = {
+		"\x80",                 // a continuation byte on its own
+		"\xC0\xAF",             // an overlong '/'
+		"\xE0\x80\xAF",         // the same, as 3 bytes
+		"\xED\xA0\x80",         // a surrogate
+		"\xF4\x90\x80\x80",     // past U+10FFFF
+		"\xF5\x80\x80\x80",
+		"\xFF",
+		"ok\xE2\x82",           // cut short
+		"\xE2\x28\xA1",         // a bad continuation byte
+	};
+
+	for (const char* text : invalidTexts)
+	{
+		SCOPED_TRACE(::testing::PrintToString(std::string(text)));
+
+		TearDown();
+		SetUp();
+		Connect();
+
+		// long enough to take the 8 byte fast path, too
+		stream->Receive(MakeFrame(HttpWebSocketOpcode::Text, std::string("abcdefgh") + text));
+
+		ExpectFailure(1007);
+		EXPECT_TRUE(handler->messages.empty());
+	}
+}
+
+TEST_F(HttpWebSocketTests, EchoesCloseFrames)
+{
+	Connect();
+
+	stream->Receive(MakeClose(1000, "bye"));
+
+	auto frames = ParseFrames(stream->TakeOutput());
+
+	ASSERT_EQ(1u, frames.size());
+	EXPECT_EQ(HttpWebSocketOpcode::Close, frames[0].opcode);
+	EXPECT_EQ(1000, GetCloseCode(frames[0]));
+
+	ASSERT_EQ(1u, handler->closes.size());
+	EXPECT_EQ(1000, handler->closes[0].first);
+	EXPECT_EQ("bye", handler->closes[0].second);
+
+	EXPECT_TRUE(stream->IsClosed());
+}
+
+TEST_F(HttpWebSocketTests, ReportsCloseFramesWithoutCode)
+{
+	Connect();
+
+	stream->Receive(MakeFrame(HttpWebSocketOpcode::Close, ""));
+
+	ASSERT_EQ(1u, handler->closes.size());
+	EXPECT_EQ(1005, handler->closes[0].first);
+}
+
+TEST_F(HttpWebSocketTests, FailsInvalidCloseFrames)
+{
+	Connect();
+
+	stream->Receive(MakeFrame(HttpWebSocketOpcode::Close, "x"));
+
+	ExpectFailure(1002);
+
+	TearDown();
+	SetUp();
+	Connect();
+
+	// only for reporting locally
+	stream->Receive(MakeClose(1006));
+
+	ExpectFailure(1002);
+
+	TearDown();
+	SetUp();
+	Connect();
+
+	stream->Receive(MakeClose(1000, "\xC0\xAF"));
+
+	ExpectFailure(1007);
+}
+
+TEST_F(HttpWebSocketTests, ReportsGoingAway)
+{
+	Connect();
+
+	stream->Close();
+
+	ASSERT_EQ(1u, handler->closes.size());
+	EXPECT_EQ(1006, handler->closes[0].first);
+}
+
+TEST_F(HttpWebSocketTests, SendsNothingAfterClosing)
+{
+	Connect();
+
+	handler->webSocket->Close(4000, "done");
+
+	EXPECT_FALSE(handler->webSocket->Send("late"));
+
+	auto frames = ParseFrames(stream->TakeOutput());
+
+	ASSERT_EQ(1u, frames.size());
+	EXPECT_EQ(4000, GetCloseCode(frames[0]));
+	EXPECT_EQ(std::string("\x0F\xA0" "done", 6), frames[0].payload);
+}
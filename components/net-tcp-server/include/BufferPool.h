@@ -0,0 +1,135 @@
+/*
+ * This file is part of the CitizenFX project - http://citizen.re/
+ *
+ * See LICENSE and MENTIONS in the root of the source tree for information
+ * regarding licensing.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#ifdef COMPILING_NET_TCP_SERVER
+#define TCP_SERVER_EXPORT DLL_EXPORT
+#else
+#define TCP_SERVER_EXPORT DLL_IMPORT
+#endif
+
+namespace net
+{
+class BufferPool;
+
+// a reference-counted slab, which returns to its pool (if any) once the last reference is released
+class TCP_SERVER_EXPORT PooledBuffer
+{
+private:
+	std::atomic<uint32_t> m_refCount;
+
+	BufferPool* m_pool;
+
+	std::unique_ptr<uint8_t[]> m_data;
+
+	size_t m_size;
+
+public:
+	PooledBuffer(BufferPool* pool, size_t size);
+
+	inline uint8_t* GetData()
+	{
+		return m_data.get();
+	}
+
+	inline size_t GetSize() const
+	{
+		return m_size;
+	}
+
+	inline uint32_t GetRefCount()
+	{
+		return m_refCount;
+	}
+
+	void AddRef();
+
+	bool Release();
+};
+
+class TCP_SERVER_EXPORT BufferPool
+{
+private:
+	size_t m_bufferSize;
+
+	size_t m_maxFreeBuffers;
+
+	std::mutex m_mutex;
+
+	std::vector<PooledBuffer*> m_freeBuffers;
+
+public:
+	BufferPool(size_t bufferSize, size_t maxFreeBuffers);
+
+	~BufferPool();
+
+	fwRefContainer<PooledBuffer> Acquire();
+
+	void Return(PooledBuffer* buffer);
+
+	inline size_t GetBufferSize() const
+	{
+		return m_bufferSize;
+	}
+
+public:
+	// the pool TCP streams read into
+	static BufferPool* GetReadPool();
+};
+
+// a view of a range of bytes, optionally keeping a pooled slab alive
+//
+// views handed to read callbacks are only guaranteed to be valid during the callback - to keep the
+// data around for longer, call Retain(), which shares the slab if possible and copies otherwise.
+class TCP_SERVER_EXPORT BufferView
+{
+private:
+	fwRefContainer<PooledBuffer> m_buffer;
+
+	const uint8_t* m_data;
+
+	size_t m_length;
+
+public:
+	BufferView();
+
+	BufferView(const uint8_t* data, size_t length);
+
+	BufferView(const fwRefContainer<PooledBuffer>& buffer, size_t offset, size_t length);
+
+	inline const uint8_t* GetData() const
+	{
+		return m_data;
+	}
+
+	inline size_t GetLength() const
+	{
+		return m_length;
+	}
+
+	inline bool IsEmpty() const
+	{
+		return (m_length == 0);
+	}
+
+	inline const uint8_t& operator[](size_t index) const
+	{
+		return m_data[index];
+	}
+
+	BufferView Slice(size_t offset, size_t length) const;
+
+	BufferView Retain() const;
+
+	std::vector<uint8_t> ToVector() const;
+};
+}
@@ -0,0 +1,194 @@
+/*
+ * This file is part of the CitizenFX project - http://citizen.re/
+ *
+ * See LICENSE and MENTIONS in the root of the source tree for information
+ * regarding licensing.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifdef COMPILING_NET_TCP_SERVER
+#define TCP_SERVER_EXPORT DLL_EXPORT
+#else
+#define TCP_SERVER_EXPORT DLL_IMPORT
+#endif
+
+namespace net
+{
+// counters are split into this many shards, so threads updating the same counter don't keep stealing its cache line
+static const size_t kMetricShardCount = 16;
+
+// the shard the calling thread updates - threads get assigned one round-robin
+inline size_t GetMetricShard()
+{
+	static std::atomic<uint32_t> nextShard;
+	static thread_local size_t shard = nextShard++ % kMetricShardCount;
+
+	return shard;
+}
+
+// a count that only ever goes up
+class TCP_SERVER_EXPORT MetricCounter
+{
+private:
+	struct alignas(64) Shard
+	{
+		std::atomic<uint64_t> value;
+	};
+
+	Shard m_shards[kMetricShardCount];
+
+public:
+	MetricCounter();
+
+	inline void Add(uint64_t value = 1)
+	{
+		m_shards[GetMetricShard()].value.fetch_add(value, std::memory_order_relaxed);
+	}
+
+	uint64_t GetValue() const;
+};
+
+// a value that goes up and down, e.g. the number of open connections - sharded like counters, as what one thread
+// adds may well get subtracted by another
+class TCP_SERVER_EXPORT MetricGauge
+{
+private:
+	struct alignas(64) Shard
+	{
+		std::atomic<int64_t> value;
+	};
+
+	Shard m_shards[kMetricShardCount];
+
+public:
+	MetricGauge();
+
+	inline void Add(int64_t value)
+	{
+		m_shards[GetMetricShard()].value.fetch_add(value, std::memory_order_relaxed);
+	}
+
+	int64_t GetValue() const;
+};
+
+// a log-linear (HDR-style) histogram - values below 32 get a bucket each, and every power of two above that gets split
+// into 16 buckets, so a bucket's width is never more than ~6% of the values in it. values from 2^32 on share the last
+// bucket. recording a value is a pair of relaxed atomic increments.
+class TCP_SERVER_EXPORT MetricHistogram
+{
+public:
+	static const size_t kBucketCount = 464;
+
+private:
+	std::atomic<uint64_t> m_buckets[kBucketCount];
+
+	std::atomic<uint64_t> m_sum;
+
+public:
+	MetricHistogram();
+
+	inline void Record(uint64_t value)
+	{
+		m_buckets[GetBucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+		m_sum.fetch_add(value, std::memory_order_relaxed);
+	}
+
+	static inline size_t GetBucketIndex(uint64_t value)
+	{
+		if (value < 32)
+		{
+			return static_cast<size_t>(value);
+		}
+
+		if (value > UINT32_MAX)
+		{
+			value = UINT32_MAX;
+		}
+
+#ifdef _MSC_VER
+		unsigned long highestBit;
+		_BitScanReverse64(&highestBit, value);
+#else
+		int highestBit = 63 - __builtin_clzll(value);
+#endif
+
+		// keep the 5 highest bits of the value - the top one is always set, so the other 4 pick the sub-bucket
+		int shift = highestBit - 4;
+
+		return (shift * 16) + static_cast<size_t>(value >> shift);
+	}
+
+	// the largest value that ends up in the given bucket
+	static uint64_t GetBucketUpperBound(size_t index);
+
+	uint64_t GetCount() const;
+
+	uint64_t GetSum() const;
+
+	// the value the given fraction (e.g. 0.99) of recorded values doesn't exceed, accurate to the bucket width
+	uint64_t GetPercentile(double fraction) const;
+
+	// the number of recorded values not exceeding each of the given ascending bounds
+	void GetCumulativeCounts(const std::vector<uint64_t>& bounds, std::vector<uint64_t>& counts) const;
+};
+
+// a set of named metrics, rendered in the Prometheus text format
+//
+// adding metrics takes a lock, but they get updated directly through the pointers passed in - so recording never does.
+// adding a metric with the same name and labels as an existing one replaces it.
+class TCP_SERVER_EXPORT MetricsCollector : public fwRefCountable
+{
+public:
+	typedef std::vector<std::pair<std::string, std::string>> LabelList;
+
+private:
+	enum class MetricType
+	{
+		Counter,
+		Gauge,
+		Histogram
+	};
+
+	struct Metric
+	{
+		std::string name;
+
+		std::string help;
+
+		MetricType type;
+
+		// the label set, formatted as it's written out
+		std::string labels;
+
+		std::shared_ptr<void> metric;
+	};
+
+	std::mutex m_mutex;
+
+	std::vector<Metric> m_metrics;
+
+private:
+	void AddMetric(const std::string& name, const std::string& help, MetricType type, const LabelList& labels, const std::shared_ptr<void>& metric);
+
+public:
+	void AddCounter(const std::string& name, const std::string& help, const LabelList& labels, const std::shared_ptr<MetricCounter>& counter);
+
+	void AddGauge(const std::string& name, const std::string& help, const LabelList& labels, const std::shared_ptr<MetricGauge>& gauge);
+
+	// histograms are expected to record latencies in microseconds - they're exposed in seconds, as is customary
+	void AddHistogram(const std::string& name, const std::string& help, const LabelList& labels, const std::shared_ptr<MetricHistogram>& histogram);
+
+	void Render(std::string& out);
+};
+}
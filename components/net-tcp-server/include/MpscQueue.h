@@ -0,0 +1,134 @@
+/*
+ * This file is part of the CitizenFX project - http://citizen.re/
+ *
+ * See LICENSE and MENTIONS in the root of the source tree for information
+ * regarding licensing.
+ */
+
+#pragma once
+
+#include <atomic>
+
+namespace net
+{
+// an intrusive multi-producer, single-consumer queue (after Dmitry Vyukov's design)
+// Push may be called from any thread, TryPop only from the single consuming thread.
+template<typename TValue>
+class MpscQueue
+{
+private:
+	struct Node
+	{
+		std::atomic<Node*> next;
+
+		TValue value;
+
+		Node()
+			: next(nullptr)
+		{
+
+		}
+	};
+
+private:
+	// producers append here
+	std::atomic<Node*> m_head;
+
+	// the consumer removes from here
+	Node* m_tail;
+
+	Node m_stub;
+
+private:
+	void PushNode(Node* node)
+	{
+		node->next.store(nullptr, std::memory_order_relaxed);
+
+		Node* previous = m_head.exchange(node, std::memory_order_acq_rel);
+		previous->next.store(node, std::memory_order_release);
+	}
+
+	inline bool PopNode(Node* tail, Node* next, TValue& outValue)
+	{
+		m_tail = next;
+		outValue = std::move(tail->value);
+
+		delete tail;
+
+		return true;
+	}
+
+public:
+	MpscQueue()
+		: m_head(&m_stub), m_tail(&m_stub)
+	{
+
+	}
+
+	~MpscQueue()
+	{
+		TValue value;
+
+		while (TryPop(value))
+		{
+			
+		}
+	}
+
+	MpscQueue(const MpscQueue&) = delete;
+
+	MpscQueue& operator=(const MpscQueue&) = delete;
+
+	void Push(TValue&& value)
+	{
+		Node* node = new Node();
+		node->value = std::move(value);
+
+		PushNode(node);
+	}
+
+	// returns false if the queue is empty, or if a producer is in the middle of pushing
+	// (in which case the producer is expected to signal the consumer afterwards)
+	bool TryPop(TValue& outValue)
+	{
+		Node* tail = m_tail;
+		Node* next = tail->next.load(std::memory_order_acquire);
+
+		// skip over the stub node
+		if (tail == &m_stub)
+		{
+			if (!next)
+			{
+				return false;
+			}
+
+			m_tail = next;
+			tail = next;
+			next = next->next.load(std::memory_order_acquire);
+		}
+
+		if (next)
+		{
+			return PopNode(tail, next, outValue);
+		}
+
+		// a producer has swapped the head, but not yet linked its node
+		if (tail != m_head.load(std::memory_order_acquire))
+		{
+			return false;
+		}
+
+		// this is the last node - push the stub back so we can take it out
+		PushNode(&m_stub);
+
+		next = tail->next.load(std::memory_order_acquire);
+
+		if (next)
+		{
+			return PopNode(tail, next, outValue);
+		}
+
+		return false;
+	}
+};
+}
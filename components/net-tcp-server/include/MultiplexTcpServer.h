@@ -10,6 +10,10 @@
 #include "TcpServer.h"
 #include "TcpServerFactory.h"
 
+#include <array>
+#include <memory>
+#include <mutex>
+
 #ifdef COMPILING_NET_TCP_SERVER
 #define TCP_SERVER_EXPORT DLL_EXPORT
 #else
@@ -25,7 +29,8 @@ class MultiplexTcpChildServerStream : public TcpServerStream
 private:
 	fwRefContainer<TcpServerStream> m_baseStream;
 
-	std::vector<uint8_t> m_initialData;
+	// data read during protocol detection, which usually shares the read slab of the base stream
+	BufferView m_initialData;
 
 	MultiplexTcpChildServer* m_server;
 
@@ -40,12 +45,32 @@ protected:
 public:
 	MultiplexTcpChildServerStream(MultiplexTcpChildServer* server, fwRefContainer<TcpServerStream> baseStream);
 
-	void SetInitialData(const std::vector<uint8_t>& initialData);
+	void SetInitialData(const BufferView& initialData);
 
 	virtual PeerAddress GetPeerAddress() override;
 
 	virtual void Write(const std::vector<uint8_t>& data) override;
 
+	virtual void Write(std::vector<uint8_t>&& data) override;
+
+	virtual void WriteV(std::vector<std::vector<uint8_t>>&& buffers) override;
+
+	virtual size_t GetPendingWriteSize() override;
+
+	virtual void SetWriteWaterMarks(size_t lowWaterMark, size_t highWaterMark) override;
+
+	virtual void SetIdleTimeout(uint32_t timeoutMs) override;
+
+	virtual uint32_t GetIdleTimeout() override;
+
+	virtual void SetDeadline(uint32_t timeoutMs) override;
+
+	virtual void ScheduleCallback(const TScheduledCallback& callback) override;
+
+	virtual void PauseReading() override;
+
+	virtual void ResumeReading() override;
+
 	virtual void Close() override;
 };
 
@@ -63,6 +88,8 @@ class MultiplexTcpChildServer : public TcpServer
 private:
 	MultiplexPatternMatchFn m_patternMatcher;
 
+	std::mutex m_connectionsMutex;
+
 	std::set<fwRefContainer<TcpServerStream>> m_connections;
 
 public:
@@ -73,25 +100,100 @@ public:
 
 	void SetPatternMatcher(const MultiplexPatternMatchFn& function);
 
-	void AttachToResult(const std::vector<uint8_t>& existingData, fwRefContainer<TcpServerStream> baseStream);
+	void AttachToResult(const BufferView& existingData, fwRefContainer<TcpServerStream> baseStream);
 
 	void CloseStream(MultiplexTcpChildServerStream* stream);
 };
 
+// a trie of byte prefixes, used to pick a child server in a single pass over the first bytes of a connection
+class MultiplexPrefixTrie
+{
+private:
+	struct Node
+	{
+		// the node index for each following byte value, 0 meaning there's none
+		std::array<uint32_t, 256> next;
+
+		MultiplexTcpChildServer* server;
+
+		Node()
+			: server(nullptr)
+		{
+			next.fill(0);
+		}
+	};
+
+	std::vector<Node> m_nodes;
+
+public:
+	MultiplexPrefixTrie();
+
+	void Insert(const std::string& prefix, MultiplexTcpChildServer* server);
+
+	// continues matching from `state` (a node index, starting at 0) with the next bytes of a connection -
+	// the shortest registered prefix wins
+	MultiplexPatternMatchResult Match(size_t& state, const uint8_t* data, size_t length, MultiplexTcpChildServer** server) const;
+
+	inline bool IsEmpty() const
+	{
+		return (m_nodes.size() == 1);
+	}
+};
+
 class TCP_SERVER_EXPORT MultiplexTcpServer : public fwRefCountable
 {
+private:
+	struct ChildServers
+	{
+		std::vector<fwRefContainer<MultiplexTcpChildServer>> servers;
+
+		// children using declarative prefixes - pattern match functions of the other children only get used if this fails
+		MultiplexPrefixTrie prefixTrie;
+
+		bool hasPatternMatchers;
+
+		ChildServers()
+			: hasPatternMatchers(false)
+		{
+
+		}
+	};
+
 private:
 	fwRefContainer<TcpServerFactory> m_factory;
 	fwRefContainer<TcpServer> m_rootServer;
 
 private:
-	std::vector<fwRefContainer<MultiplexTcpChildServer>> m_childServers;
+	// replaced as a whole when adding a child, as connections get detected on the loop threads meanwhile
+	std::shared_ptr<const ChildServers> m_childServers;
+
+	std::mutex m_registerMutex;
+
+	uint32_t m_detectionTimeout;
+
+private:
+	void AddChildServer(const fwRefContainer<MultiplexTcpChildServer>& child, const std::vector<std::string>& prefixes);
 
 public:
 	MultiplexTcpServer(const fwRefContainer<TcpServerFactory>& factory);
 
+	// sets the time a connection gets to send enough data for a child server to match
+	inline void SetDetectionTimeout(uint32_t timeoutMs)
+	{
+		m_detectionTimeout = timeoutMs;
+	}
+
 	void Bind(const PeerAddress& bindAddress);
 
+	// child servers may be created before or after binding - connections that arrived earlier won't see them, though
+	//
+	// pattern match functions get called in the order their servers were created
 	fwRefContainer<TcpServer> CreateServer(const MultiplexPatternMatchFn& patternMatchFunction);
+
+	// creates a child server matching any of a list of byte prefixes, e.g. "\x16\x03" for TLS or "GET " for HTTP
+	//
+	// prefixes get checked before any pattern match functions, so they win over these even if their server was
+	// created earlier
+	fwRefContainer<TcpServer> CreateServer(const std::vector<std::string>& prefixes);
 };
 }
\ No newline at end of file
@@ -9,6 +9,7 @@
 
 #include "TcpServer.h"
 #include "TcpServerFactory.h"
+#include "WorkerPool.h"
 
 #ifdef min
 #undef min
@@ -19,6 +20,9 @@
 #include <botan/tls_server.h>
 #include <botan/tls_session_manager.h>
 
+#include <atomic>
+#include <mutex>
+
 #ifdef COMPILING_NET_TCP_SERVER
 #define TCP_SERVER_EXPORT DLL_EXPORT
 #else
@@ -38,13 +42,22 @@ private:
 
 	TLSServer* m_parentServer;
 
-	Botan::AutoSeeded_RNG m_rng;
+	bool m_closing;
 
-	std::unique_ptr<Botan::TLS::Session_Manager> m_sessionManager;
+	// set if Botan work gets offloaded to the server's worker pool
+	fwRefContainer<WorkerStrand> m_strand;
 
-	std::unique_ptr<Botan::TLS::Policy> m_policy;
+	bool m_offloadRecords;
 
-	bool m_closing;
+	// only modified on the loop thread
+	bool m_handshakeDone;
+
+	std::atomic<int> m_pendingCryptoTasks;
+
+	// the following are owned by whichever thread is running Botan code for this stream
+	bool m_onWorker;
+
+	fwRefContainer<TcpServerStream> m_workerBaseStream;
 
 public:
 	TLSServerStream(TLSServer* server, fwRefContainer<TcpServerStream> baseStream);
@@ -53,6 +66,24 @@ public:
 
 	virtual void Write(const std::vector<uint8_t>& data) override;
 
+	using TcpServerStream::Write;
+
+	virtual size_t GetPendingWriteSize() override;
+
+	virtual void SetWriteWaterMarks(size_t lowWaterMark, size_t highWaterMark) override;
+
+	virtual void SetIdleTimeout(uint32_t timeoutMs) override;
+
+	virtual uint32_t GetIdleTimeout() override;
+
+	virtual void SetDeadline(uint32_t timeoutMs) override;
+
+	virtual void ScheduleCallback(const TScheduledCallback& callback) override;
+
+	virtual void PauseReading() override;
+
+	virtual void ResumeReading() override;
+
 	virtual void Close() override;
 
 private:
@@ -68,6 +99,18 @@ private:
 	void Initialize();
 
 	void CloseInternal();
+
+	// once the handshake is done, records only get handled on the worker if configured so - but only after the
+	// strand has finished everything queued before, to keep the record order intact
+	inline bool ShouldOffload()
+	{
+		return (m_strand.GetRef() && (m_offloadRecords || !m_handshakeDone || m_pendingCryptoTasks > 0));
+	}
+
+	// runs Botan code for this stream on the worker strand
+	void RunCrypto(const std::function<void()>& function);
+
+	void OnHandshakeComplete();
 };
 
 class TCP_SERVER_EXPORT TLSServer : public TcpServer
@@ -77,16 +120,75 @@ private:
 
 	std::shared_ptr<Botan::Credentials_Manager> m_credentials;
 
+	// shared by all streams, so sessions can be resumed on reconnecting
+	std::unique_ptr<Botan::TLS::Session_Manager> m_sessionManager;
+
+	std::unique_ptr<Botan::TLS::Policy> m_policy;
+
+	// streams on different loops use these in round-robin order, to spread out contention on the RNG locks
+	std::vector<std::unique_ptr<Botan::RandomNumberGenerator>> m_rngs;
+
+	std::atomic<size_t> m_nextRng;
+
+	std::mutex m_connectionsMutex;
+
 	std::set<fwRefContainer<TLSServerStream>> m_connections;
 
+	uint32_t m_handshakeTimeout;
+
+	fwRefContainer<WorkerPool> m_workerPool;
+
+	bool m_offloadRecords;
+
 public:
 	TLSServer(fwRefContainer<TcpServer> baseServer, const std::string& certificatePath, const std::string& keyPath);
 
+	inline uint32_t GetHandshakeTimeout()
+	{
+		return m_handshakeTimeout;
+	}
+
+	inline void SetHandshakeTimeout(uint32_t timeoutMs)
+	{
+		m_handshakeTimeout = timeoutMs;
+	}
+
+	// makes new streams run their handshakes on a worker pool - and, if `offloadRecords` is set, all record
+	// encryption/decryption after that as well
+	inline void SetWorkerPool(const fwRefContainer<WorkerPool>& workerPool, bool offloadRecords = false)
+	{
+		m_workerPool = workerPool;
+		m_offloadRecords = offloadRecords;
+	}
+
+	inline const fwRefContainer<WorkerPool>& GetWorkerPool()
+	{
+		return m_workerPool;
+	}
+
+	inline bool ShouldOffloadRecords()
+	{
+		return m_offloadRecords;
+	}
+
 	inline std::shared_ptr<Botan::Credentials_Manager> GetCredentials()
 	{
 		return m_credentials;
 	}
 
+	inline Botan::TLS::Session_Manager& GetSessionManager()
+	{
+		return *m_sessionManager;
+	}
+
+	inline const Botan::TLS::Policy& GetPolicy()
+	{
+		return *m_policy;
+	}
+
+	// gets a thread-safe RNG from the pool
+	Botan::RandomNumberGenerator& GetRandomNumberGenerator();
+
 	inline void InvokeConnectionCallback(TLSServerStream* stream)
 	{
 		if (GetConnectionCallback())
@@ -97,7 +199,11 @@ public:
 
 	inline void CloseStream(TLSServerStream* stream)
 	{
-		m_connections.erase(stream);
+		// keep the stream alive until the lock is released
+		fwRefContainer<TLSServerStream> streamRef = stream;
+
+		std::unique_lock<std::mutex> lock(m_connectionsMutex);
+		m_connections.erase(streamRef);
 	}
 };
 }
\ No newline at end of file
@@ -8,6 +8,7 @@
 #pragma once
 
 #include "NetAddress.h"
+#include "BufferPool.h"
 
 #ifdef COMPILING_NET_TCP_SERVER
 #define TCP_SERVER_EXPORT DLL_EXPORT
@@ -22,24 +23,67 @@ class TCP_SERVER_EXPORT TcpServerStream : public fwRefCountable
 public:
 	typedef std::function<void(const std::vector<uint8_t>&)> TReadCallback;
 
+	// receives a view into the read buffer, saving a copy for consumers that only inspect or forward data
+	typedef std::function<void(const BufferView&)> TBufferReadCallback;
+
 	typedef std::function<void()> TCloseCallback;
 
+	typedef std::function<void()> TWaterMarkCallback;
+
+	typedef std::function<void()> TScheduledCallback;
+
 private:
 	TReadCallback m_readCallback;
 
+	TBufferReadCallback m_bufferReadCallback;
+
 	TCloseCallback m_closeCallback;
 
+	TWaterMarkCallback m_highWaterMarkCallback;
+
+	TWaterMarkCallback m_lowWaterMarkCallback;
+
+	size_t m_lowWaterMark;
+
+	size_t m_highWaterMark;
+
+	bool m_aboveHighWaterMark;
+
+private:
+	void OnSetReadCallback(bool wasFirst);
+
 protected:
 	inline const TReadCallback& GetReadCallback()
 	{
 		return m_readCallback;
 	}
 
+	inline bool HasReadCallback()
+	{
+		return (m_readCallback || m_bufferReadCallback);
+	}
+
+	// passes received data to whichever kind of read callback is set
+	void DispatchRead(const BufferView& data);
+
 	inline const TCloseCallback& GetCloseCallback()
 	{
 		return m_closeCallback;
 	}
 
+	inline const TWaterMarkCallback& GetHighWaterMarkCallback()
+	{
+		return m_highWaterMarkCallback;
+	}
+
+	inline const TWaterMarkCallback& GetLowWaterMarkCallback()
+	{
+		return m_lowWaterMarkCallback;
+	}
+
+	// to be called by implementations whenever the amount of queued write data changes
+	void UpdatePendingWriteSize(size_t pendingSize);
+
 	virtual void OnFirstSetReadCallback() {}
 
 public:
@@ -47,14 +91,57 @@ public:
 
 	virtual void Write(const std::vector<uint8_t>& data) = 0;
 
+	// writes without copying - derived classes overriding only the copying variant should pull this in with a using declaration
+	virtual void Write(std::vector<uint8_t>&& data);
+
+	// writes a list of buffers, which implementations may send in a single operation
+	virtual void WriteV(std::vector<std::vector<uint8_t>>&& buffers);
+
+	// the amount of data written but not yet handed to the OS
+	virtual size_t GetPendingWriteSize();
+
+	// closes the stream if nothing gets received for the given time - 0 disables the timeout
+	virtual void SetIdleTimeout(uint32_t timeoutMs);
+
+	// the idle timeout last set, or the one the stream got accepted with - only meaningful on the stream's thread
+	virtual uint32_t GetIdleTimeout();
+
+	// closes the stream once the given time has passed, regardless of activity - 0 cancels the deadline
+	virtual void SetDeadline(uint32_t timeoutMs);
+
+	// runs a callback on the thread this stream invokes its callbacks on, after anything scheduled before
+	virtual void ScheduleCallback(const TScheduledCallback& callback);
+
+	// stops reading from the peer until reading gets resumed, so a slow consumer doesn't have to buffer whatever the peer
+	// keeps sending - a few reads already in progress may still arrive. the idle timeout doesn't apply while paused.
+	virtual void PauseReading();
+
+	virtual void ResumeReading();
+
 	virtual void Close() = 0;
 
 	void SetReadCallback(const TReadCallback& callback);
 
+	// sets a read callback taking buffer views - this replaces any callback set using SetReadCallback, and vice versa
+	void SetBufferReadCallback(const TBufferReadCallback& callback);
+
 	void SetCloseCallback(const TCloseCallback& callback);
 
+	// the high water mark callback gets called once the pending write size exceeds the high water mark, at
+	// which point producers should hold off writing until the low water mark callback signals it dropped below the low mark
+	virtual void SetWriteWaterMarks(size_t lowWaterMark, size_t highWaterMark);
+
+	void SetHighWaterMarkCallback(const TWaterMarkCallback& callback);
+
+	void SetLowWaterMarkCallback(const TWaterMarkCallback& callback);
+
+	inline bool IsAboveHighWaterMark()
+	{
+		return m_aboveHighWaterMark;
+	}
+
 protected:
-	TcpServerStream() { }
+	TcpServerStream();
 };
 
 class TCP_SERVER_EXPORT TcpServer : public fwRefCountable
@@ -12,6 +12,7 @@
 
 #include "UvTcpServer.h"
 #include "TcpServerFactory.h"
+#include "MetricsCollector.h"
 
 #include <memory>
 
@@ -23,16 +24,44 @@
 
 namespace net
 {
+// what the streams of a manager record, once it has a metrics collector
+struct TcpServerMetrics
+{
+	MetricCounter connectionsAccepted;
+
+	MetricGauge connectionsOpen;
+
+	MetricCounter bytesReceived;
+
+	MetricCounter bytesSent;
+};
+
 class TCP_SERVER_EXPORT TcpServerManager : public TcpServerFactory
 {
 private:
 	std::set<fwRefContainer<UvTcpServer>> m_servers;
 
-	fwRefContainer<UvLoopHolder> m_uvLoop;
+	// loops that listening sockets are sharded across - the first one is the primary loop
+	std::vector<fwRefContainer<UvLoopHolder>> m_uvLoops;
+
+	uint32_t m_firstByteTimeout;
+
+	uint32_t m_idleTimeout;
+
+	std::string m_loopTag;
+
+	std::shared_ptr<TcpServerMetrics> m_metrics;
+
+private:
+	std::unique_ptr<uv_tcp_t> CreateListener(const fwRefContainer<UvLoopHolder>& loop, const PeerAddress& bindAddress, bool reusePort);
 
 public:
 	TcpServerManager();
 
+	// creates a manager that spreads every listening address across `threadCount` loop threads
+	// (0 meaning one per hardware thread), each having its own SO_REUSEPORT listener
+	TcpServerManager(const std::string& loopTag, int threadCount);
+
 	virtual ~TcpServerManager();
 
 public:
@@ -40,7 +69,42 @@ public:
 
 	inline uv_loop_t* GetLoop()
 	{
-		return m_uvLoop->GetLoop();
+		return m_uvLoops[0]->GetLoop();
+	}
+
+	inline const std::vector<fwRefContainer<UvLoopHolder>>& GetLoops()
+	{
+		return m_uvLoops;
+	}
+
+	// the time an accepted connection gets to send its first data - 0 disables the timeout
+	inline uint32_t GetFirstByteTimeout()
+	{
+		return m_firstByteTimeout;
+	}
+
+	inline void SetFirstByteTimeout(uint32_t timeoutMs)
+	{
+		m_firstByteTimeout = timeoutMs;
+	}
+
+	// the time a connection may go without receiving data after that - 0 disables the timeout
+	inline uint32_t GetIdleTimeout()
+	{
+		return m_idleTimeout;
+	}
+
+	inline void SetIdleTimeout(uint32_t timeoutMs)
+	{
+		m_idleTimeout = timeoutMs;
+	}
+
+	// makes connections accepted from now on record their traffic, labeled with the manager's loop tag
+	void SetMetricsCollector(const fwRefContainer<MetricsCollector>& collector);
+
+	inline std::shared_ptr<TcpServerMetrics> GetMetrics()
+	{
+		return std::atomic_load(&m_metrics);
 	}
 };
 }
\ No newline at end of file
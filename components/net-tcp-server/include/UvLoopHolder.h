@@ -7,10 +7,19 @@
 
 #pragma once
 
+#include <functional>
+#include <map>
+#include <memory>
 #include <thread>
+#include <typeindex>
+#include <vector>
 
 #include <uv.h>
 
+#include "MpscQueue.h"
+#include "UvObjectPool.h"
+#include "UvTimingWheel.h"
+
 namespace net
 {
 class UvLoopHolder : public fwRefCountable
@@ -18,17 +27,91 @@ class UvLoopHolder : public fwRefCountable
 private:
 	uv_loop_t m_loop;
 
+	// persistent async handle used to wake the loop for posted tasks
+	uv_async_t m_async;
+
+	MpscQueue<std::function<void()>> m_tasks;
+
+	// check/idle handles used to run deferred callbacks at the end of the current loop iteration
+	uv_check_t m_deferCheck;
+
+	uv_idle_t m_deferIdle;
+
+	std::vector<std::function<void()>> m_deferred;
+
+	// object pools for handles/requests used on this loop, only touched from the loop thread
+	std::map<std::type_index, std::unique_ptr<UvObjectPoolBase>> m_pools;
+
+	// shared timer for connection timeouts on this loop
+	std::unique_ptr<UvTimingWheel> m_timingWheel;
+
 	std::thread m_thread;
 
-	bool m_shouldExit;
+	std::atomic<bool> m_shouldExit;
+
+	// counted here rather than by fwRefCountable, as the last release needs to know which thread it's on
+	std::atomic<uint32_t> m_refCount;
+
+	// set once the last reference got dropped, so a reference taken from a raw pointer afterwards can't delete twice
+	std::atomic<bool> m_released;
 
 	std::string m_loopTag;
 
+private:
+	void RunTasks();
+
+	void RunDeferred();
+
 public:
 	UvLoopHolder(const std::string& loopTag);
 
 	virtual ~UvLoopHolder();
 
+	virtual void AddRef() override;
+
+	// the destructor joins the loop thread, so if the last reference gets dropped on that thread (e.g. in a close
+	// callback), the holder gets deleted from another thread instead
+	virtual bool Release() override;
+
+	// schedules a task to run on the loop thread - safe to call from any thread
+	void Post(std::function<void()> task);
+
+	// runs a task on the loop thread, blocking until it has completed - returns false without running it if the loop is
+	// shutting down, or if called from another loop's thread, as blocking that one could deadlock
+	bool Invoke(const std::function<void()>& task);
+
+	// runs a callback once the current loop iteration has processed its I/O - loop thread only
+	void Defer(std::function<void()> callback);
+
+	// gets the pool for a type of handle or request - loop thread only
+	template<typename TObject>
+	UvObjectPool<TObject>* GetPool()
+	{
+		auto& pool = m_pools[std::type_index(typeid(TObject))];
+
+		if (!pool)
+		{
+			pool = std::make_unique<UvObjectPool<TObject>>();
+		}
+
+		return static_cast<UvObjectPool<TObject>*>(pool.get());
+	}
+
+	// gets the counters of all pools on this loop - safe to call from any thread, though it's empty when called from
+	// another loop's thread
+	std::vector<UvObjectPoolStats> GetPoolStats();
+
+	inline bool IsOnLoopThread() const
+	{
+		return (std::this_thread::get_id() == m_thread.get_id());
+	}
+
+	// loop thread only
+	inline UvTimingWheel* GetTimingWheel()
+	{
+		return m_timingWheel.get();
+	}
+
 	inline uv_loop_t* GetLoop()
 	{
 		return &m_loop;
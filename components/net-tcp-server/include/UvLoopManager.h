@@ -9,6 +9,7 @@
 
 #include "UvLoopHolder.h"
 
+#include <mutex>
 #include <unordered_map>
 
 namespace net
@@ -16,6 +17,8 @@ namespace net
 class UvLoopManager
 {
 private:
+	std::mutex m_loopsMutex;
+
 	std::unordered_map<std::string, fwRefContainer<UvLoopHolder>> m_uvLoops;
 
 public:
@@ -0,0 +1,122 @@
+/*
+ * This file is part of the CitizenFX project - http://citizen.re/
+ *
+ * See LICENSE and MENTIONS in the root of the source tree for information
+ * regarding licensing.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+namespace net
+{
+struct UvObjectPoolStats
+{
+	// the type name of the pooled objects
+	std::string name;
+
+	// objects that had to be allocated from the heap, as the free list was empty
+	size_t heapAllocations;
+
+	size_t acquired;
+
+	size_t returned;
+
+	// objects currently in the free list
+	size_t freeCount;
+};
+
+class UvObjectPoolBase
+{
+public:
+	virtual ~UvObjectPoolBase() = default;
+
+	virtual UvObjectPoolStats GetStats() = 0;
+};
+
+// a free list of objects belonging to a single loop - Acquire and Return may only be called from that loop's thread
+//
+// objects are allocated using plain new, so anything taken from a pool may still be deleted normally.
+template<typename TObject>
+class UvObjectPool : public UvObjectPoolBase
+{
+private:
+	std::vector<TObject*> m_freeObjects;
+
+	size_t m_maxFreeObjects;
+
+	// counters are atomic so they can be inspected from other threads
+	std::atomic<size_t> m_heapAllocations;
+
+	std::atomic<size_t> m_acquired;
+
+	std::atomic<size_t> m_returned;
+
+	std::atomic<size_t> m_freeCount;
+
+public:
+	UvObjectPool(size_t maxFreeObjects = 1024)
+		: m_maxFreeObjects(maxFreeObjects), m_heapAllocations(0), m_acquired(0), m_returned(0), m_freeCount(0)
+	{
+
+	}
+
+	virtual ~UvObjectPool() override
+	{
+		for (auto& object : m_freeObjects)
+		{
+			delete object;
+		}
+	}
+
+	TObject* Acquire()
+	{
+		m_acquired++;
+
+		if (m_freeObjects.empty())
+		{
+			m_heapAllocations++;
+
+			return new TObject();
+		}
+
+		TObject* object = m_freeObjects.back();
+		m_freeObjects.pop_back();
+
+		m_freeCount = m_freeObjects.size();
+
+		return object;
+	}
+
+	void Return(TObject* object)
+	{
+		m_returned++;
+
+		if (m_freeObjects.size() >= m_maxFreeObjects)
+		{
+			delete object;
+			return;
+		}
+
+		m_freeObjects.push_back(object);
+
+		m_freeCount = m_freeObjects.size();
+	}
+
+	virtual UvObjectPoolStats GetStats() override
+	{
+		UvObjectPoolStats stats;
+		stats.name = typeid(TObject).name();
+		stats.heapAllocations = m_heapAllocations;
+		stats.acquired = m_acquired;
+		stats.returned = m_returned;
+		stats.freeCount = m_freeCount;
+
+		return stats;
+	}
+};
+}
@@ -10,54 +10,125 @@
 #include <uv.h>
 
 #include <memory>
+#include <mutex>
 
 #include "TcpServer.h"
+#include "UvLoopHolder.h"
 
 namespace net
 {
 class UvTcpServer;
 
+struct TcpServerMetrics;
+
 class UvTcpServerStream : public TcpServerStream
 {
 private:
 	UvTcpServer* m_server;
 
+	// the loop this stream was accepted on, and which it stays pinned to
+	fwRefContainer<UvLoopHolder> m_loop;
+
 	std::unique_ptr<uv_tcp_t> m_client;
 
-	std::vector<char> m_readBuffer;
+	// the slab the current read lands in - only held from the alloc callback until the read is dispatched
+	fwRefContainer<PooledBuffer> m_readSlab;
+
+	// writes queued during the current loop iteration, which get sent as a single request once it ends
+	std::vector<std::vector<uint8_t>> m_pendingWrites;
+
+	bool m_flushScheduled;
+
+	// bytes queued or in flight in libuv
+	std::atomic<size_t> m_pendingWriteSize;
+
+	// write requests handed to libuv that haven't completed yet
+	size_t m_activeWrites;
+
+	// the stream got closed, and the handle only stays open until the writes still in flight have completed
+	bool m_closing;
+
+	// timeouts, scheduled on the loop's timing wheel
+	UvTimingWheelEntry m_idleEntry;
+
+	UvTimingWheelEntry m_deadlineEntry;
+
+	uint32_t m_idleTimeout;
+
+	bool m_readPaused;
+
+	// the manager's metrics at the time the stream got accepted, if any
+	std::shared_ptr<TcpServerMetrics> m_metrics;
+
+	// counted here rather than by fwRefCountable, as the last release needs to know which thread it's on
+	std::atomic<uint32_t> m_refCount;
 
 private:
+	void StartReading();
+
 	void HandleRead(ssize_t nread, const uv_buf_t* buf);
 
-	void CloseClient();
+	// closes the handle - gracefully once queued writes have been sent, or right away, cancelling them - loop thread only
+	void CloseClient(bool graceful);
 
-	inline std::vector<char>& GetReadBuffer()
-	{
-		return m_readBuffer;
-	}
+	void CloseHandle();
+
+	void EnqueueWrite(std::vector<uint8_t>&& data);
+
+	void FlushWrites();
+
+	// discards the coalesced writes that haven't been handed to libuv yet
+	void DropPendingWrites();
+
+	// takes bytes added to the pending write size off again, and updates the water marks - loop thread only
+	void ReleasePendingWriteSize(size_t size);
+
+	void OnWriteCompleted(size_t size, bool sent);
+
+	void AllocateRead(uv_buf_t* buf);
+
+	void OnTimeout(const char* type);
 
 public:
 	UvTcpServerStream(UvTcpServer* server);
 
 	virtual ~UvTcpServerStream();
 
-	bool Accept(std::unique_ptr<uv_tcp_t>&& client);
+	bool Accept(std::unique_ptr<uv_tcp_t>&& client, uv_stream_t* listener);
 
-	virtual void AddRef() override
+	inline const fwRefContainer<UvLoopHolder>& GetLoop()
 	{
-		TcpServerStream::AddRef();
+		return m_loop;
 	}
 
-	virtual bool Release() override
-	{
-		return TcpServerStream::Release();
-	}
+	virtual void AddRef() override;
+
+	// streams always get destroyed on their loop thread, as that's where their handle and timeouts live
+	virtual bool Release() override;
 
 public:
 	virtual PeerAddress GetPeerAddress() override;
 
 	virtual void Write(const std::vector<uint8_t>& data) override;
 
+	virtual void Write(std::vector<uint8_t>&& data) override;
+
+	virtual void WriteV(std::vector<std::vector<uint8_t>>&& buffers) override;
+
+	virtual size_t GetPendingWriteSize() override;
+
+	virtual void SetIdleTimeout(uint32_t timeoutMs) override;
+
+	virtual uint32_t GetIdleTimeout() override;
+
+	virtual void SetDeadline(uint32_t timeoutMs) override;
+
+	virtual void ScheduleCallback(const TScheduledCallback& callback) override;
+
+	virtual void PauseReading() override;
+
+	virtual void ResumeReading() override;
+
 	virtual void Close() override;
 };
 
@@ -68,12 +139,15 @@ class UvTcpServer : public TcpServer
 private:
 	TcpServerManager* m_manager;
 
-	std::unique_ptr<uv_tcp_t> m_server;
+	// one listening handle per loop the server is sharded across
+	std::vector<std::unique_ptr<uv_tcp_t>> m_listeners;
+
+	std::mutex m_clientsMutex;
 
 	std::set<fwRefContainer<UvTcpServerStream>> m_clients;
 
 private:
-	void OnConnection(int status);
+	void OnConnection(uv_stream_t* listener, int status);
 
 public:
 	UvTcpServer(TcpServerManager* manager);
@@ -82,9 +156,14 @@ public:
 
 	bool Listen(std::unique_ptr<uv_tcp_t>&& server);
 
-	inline uv_tcp_t* GetServer()
+	inline TcpServerManager* GetManager()
+	{
+		return m_manager;
+	}
+
+	inline size_t GetListenerCount()
 	{
-		return m_server.get();
+		return m_listeners.size();
 	}
 
 public:
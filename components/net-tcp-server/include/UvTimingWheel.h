@@ -0,0 +1,97 @@
+/*
+ * This file is part of the CitizenFX project - http://citizen.re/
+ *
+ * See LICENSE and MENTIONS in the root of the source tree for information
+ * regarding licensing.
+ */
+
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include <uv.h>
+
+namespace net
+{
+class UvTimingWheel;
+
+// an entry in a timing wheel, to be embedded in whatever object needs a timeout
+//
+// entries may only be used from the wheel's loop thread - which includes destroying them, as that cancels them.
+class UvTimingWheelEntry
+{
+	friend class UvTimingWheel;
+
+private:
+	// the wheel this is scheduled on, if any
+	UvTimingWheel* m_wheel;
+
+	UvTimingWheelEntry* m_prev;
+
+	UvTimingWheelEntry* m_next;
+
+	// full wheel revolutions left before this entry expires
+	uint32_t m_rounds;
+
+	std::function<void()> m_callback;
+
+private:
+	void Unlink();
+
+	void LinkAfter(UvTimingWheelEntry* entry);
+
+public:
+	UvTimingWheelEntry();
+
+	~UvTimingWheelEntry();
+
+	inline bool IsScheduled() const
+	{
+		return (m_next != nullptr);
+	}
+
+	inline void SetCallback(const std::function<void()>& callback)
+	{
+		m_callback = callback;
+	}
+};
+
+// a hashed timing wheel, for large numbers of coarse timeouts that mostly get cancelled or pushed back
+// (idle/handshake deadlines) - scheduling and cancelling are O(1), and a tick only touches a single slot.
+class UvTimingWheel
+{
+private:
+	uv_timer_t m_timer;
+
+	// sentinel entries heading each slot's list
+	std::vector<UvTimingWheelEntry> m_slots;
+
+	size_t m_currentSlot;
+
+	uint32_t m_tickMs;
+
+	size_t m_scheduledCount;
+
+private:
+	void Tick();
+
+public:
+	UvTimingWheel(uv_loop_t* loop, uint32_t tickMs = 100, size_t slotCount = 512);
+
+	~UvTimingWheel();
+
+	// (re)schedules an entry to have its callback invoked after at least `timeoutMs`, rounded up to the next tick
+	void Schedule(UvTimingWheelEntry* entry, uint32_t timeoutMs);
+
+	void Cancel(UvTimingWheelEntry* entry);
+
+	// closes the tick timer - to be called on the loop thread before the loop shuts down
+	void Close();
+
+	inline size_t GetScheduledCount() const
+	{
+		return m_scheduledCount;
+	}
+};
+}
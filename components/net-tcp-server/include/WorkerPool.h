@@ -0,0 +1,76 @@
+/*
+ * This file is part of the CitizenFX project - http://citizen.re/
+ *
+ * See LICENSE and MENTIONS in the root of the source tree for information
+ * regarding licensing.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef COMPILING_NET_TCP_SERVER
+#define TCP_SERVER_EXPORT DLL_EXPORT
+#else
+#define TCP_SERVER_EXPORT DLL_IMPORT
+#endif
+
+namespace net
+{
+// a fixed set of threads for CPU-heavy work (e.g. TLS handshakes) that shouldn't run on a loop thread
+class TCP_SERVER_EXPORT WorkerPool : public fwRefCountable
+{
+private:
+	std::vector<std::thread> m_threads;
+
+	std::mutex m_mutex;
+
+	std::condition_variable m_condition;
+
+	std::deque<std::function<void()>> m_tasks;
+
+	bool m_shouldExit;
+
+private:
+	void ThreadMain();
+
+public:
+	// a thread count of 0 means one thread per hardware thread
+	WorkerPool(int threadCount);
+
+	virtual ~WorkerPool();
+
+	void Post(std::function<void()> task);
+
+	inline size_t GetThreadCount()
+	{
+		return m_threads.size();
+	}
+};
+
+// runs tasks on a worker pool one at a time, in the order they were posted
+class TCP_SERVER_EXPORT WorkerStrand : public fwRefCountable
+{
+private:
+	fwRefContainer<WorkerPool> m_pool;
+
+	std::mutex m_mutex;
+
+	std::deque<std::function<void()>> m_tasks;
+
+	bool m_running;
+
+private:
+	void RunTasks();
+
+public:
+	WorkerStrand(const fwRefContainer<WorkerPool>& pool);
+
+	void Post(std::function<void()> task);
+};
+}
@@ -0,0 +1,155 @@
+/*
+ * This file is part of the CitizenFX project - http://citizen.re/
+ *
+ * See LICENSE and MENTIONS in the root of the source tree for information
+ * regarding licensing.
+ */
+
+#include "StdInc.h"
+#include "BufferPool.h"
+#include "memdbgon.h"
+
+namespace net
+{
+PooledBuffer::PooledBuffer(BufferPool* pool, size_t size)
+	: m_refCount(0), m_pool(pool), m_data(new uint8_t[size]), m_size(size)
+{
+
+}
+
+void PooledBuffer::AddRef()
+{
+	m_refCount++;
+}
+
+bool PooledBuffer::Release()
+{
+	uint32_t c = m_refCount.fetch_sub(1);
+
+	if (c <= 1)
+	{
+		if (m_pool)
+		{
+			m_pool->Return(this);
+		}
+		else
+		{
+			delete this;
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+BufferPool::BufferPool(size_t bufferSize, size_t maxFreeBuffers)
+	: m_bufferSize(bufferSize), m_maxFreeBuffers(maxFreeBuffers)
+{
+
+}
+
+BufferPool::~BufferPool()
+{
+	for (auto& buffer : m_freeBuffers)
+	{
+		delete buffer;
+	}
+}
+
+fwRefContainer<PooledBuffer> BufferPool::Acquire()
+{
+	PooledBuffer* buffer = nullptr;
+
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		if (!m_freeBuffers.empty())
+		{
+			buffer = m_freeBuffers.back();
+			m_freeBuffers.pop_back();
+		}
+	}
+
+	if (!buffer)
+	{
+		buffer = new PooledBuffer(this, m_bufferSize);
+	}
+
+	return buffer;
+}
+
+void BufferPool::Return(PooledBuffer* buffer)
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		if (m_freeBuffers.size() < m_maxFreeBuffers)
+		{
+			m_freeBuffers.push_back(buffer);
+			return;
+		}
+	}
+
+	delete buffer;
+}
+
+BufferPool* BufferPool::GetReadPool()
+{
+	// 64 KiB is what libuv suggests for reads
+	static BufferPool readPool(65536, 256);
+
+	return &readPool;
+}
+
+BufferView::BufferView()
+	: m_data(nullptr), m_length(0)
+{
+
+}
+
+BufferView::BufferView(const uint8_t* data, size_t length)
+	: m_data(data), m_length(length)
+{
+
+}
+
+BufferView::BufferView(const fwRefContainer<PooledBuffer>& buffer, size_t offset, size_t length)
+	: m_buffer(buffer), m_data(buffer->GetData() + offset), m_length(length)
+{
+
+}
+
+BufferView BufferView::Slice(size_t offset, size_t length) const
+{
+	BufferView view(*this);
+	view.m_data += offset;
+	view.m_length = length;
+
+	return view;
+}
+
+BufferView BufferView::Retain() const
+{
+	// pooled views can just share the slab
+	if (m_buffer.GetRef())
+	{
+		return *this;
+	}
+
+	// unowned views need a copy - this one won't return to any pool
+	fwRefContainer<PooledBuffer> buffer = new PooledBuffer(nullptr, m_length);
+
+	if (m_length > 0)
+	{
+		memcpy(buffer->GetData(), m_data, m_length);
+	}
+
+	return BufferView(buffer, 0, m_length);
+}
+
+std::vector<uint8_t> BufferView::ToVector() const
+{
+	return std::vector<uint8_t>(m_data, m_data + m_length);
+}
+}
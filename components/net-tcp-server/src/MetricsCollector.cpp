@@ -0,0 +1,326 @@
+/*
+ * This file is part of the CitizenFX project - http://citizen.re/
+ *
+ * See LICENSE and MENTIONS in the root of the source tree for information
+ * regarding licensing.
+ */
+
+#include "StdInc.h"
+#include "MetricsCollector.h"
+
+#include <map>
+
+#include "memdbgon.h"
+
+namespace net
+{
+MetricCounter::MetricCounter()
+{
+	for (auto& shard : m_shards)
+	{
+		shard.value = 0;
+	}
+}
+
+uint64_t MetricCounter::GetValue() const
+{
+	uint64_t value = 0;
+
+	for (auto& shard : m_shards)
+	{
+		value += shard.value.load(std::memory_order_relaxed);
+	}
+
+	return value;
+}
+
+MetricGauge::MetricGauge()
+{
+	for (auto& shard : m_shards)
+	{
+		shard.value = 0;
+	}
+}
+
+int64_t MetricGauge::GetValue() const
+{
+	int64_t value = 0;
+
+	for (auto& shard : m_shards)
+	{
+		value += shard.value.load(std::memory_order_relaxed);
+	}
+
+	return value;
+}
+
+MetricHistogram::MetricHistogram()
+	: m_sum(0)
+{
+	for (auto& bucket : m_buckets)
+	{
+		bucket = 0;
+	}
+}
+
+uint64_t MetricHistogram::GetBucketUpperBound(size_t index)
+{
+	if (index < 32)
+	{
+		return index;
+	}
+
+	int shift = static_cast<int>(index / 16) - 1;
+	uint64_t subBucket = index - (shift * 16);
+
+	return ((subBucket + 1) << shift) - 1;
+}
+
+uint64_t MetricHistogram::GetCount() const
+{
+	uint64_t count = 0;
+
+	for (auto& bucket : m_buckets)
+	{
+		count += bucket.load(std::memory_order_relaxed);
+	}
+
+	return count;
+}
+
+uint64_t MetricHistogram::GetSum() const
+{
+	return m_sum.load(std::memory_order_relaxed);
+}
+
+uint64_t MetricHistogram::GetPercentile(double fraction) const
+{
+	// copy the buckets first, so the total matches what gets walked
+	uint64_t buckets[kBucketCount];
+	uint64_t count = 0;
+
+	for (size_t i = 0; i < kBucketCount; i++)
+	{
+		buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+		count += buckets[i];
+	}
+
+	if (count == 0)
+	{
+		return 0;
+	}
+
+	uint64_t rank = static_cast<uint64_t>(fraction * count + 0.5);
+	uint64_t seen = 0;
+
+	for (size_t i = 0; i < kBucketCount; i++)
+	{
+		seen += buckets[i];
+
+		if (seen >= rank && seen > 0)
+		{
+			return GetBucketUpperBound(i);
+		}
+	}
+
+	return GetBucketUpperBound(kBucketCount - 1);
+}
+
+void MetricHistogram::GetCumulativeCounts(const std::vector<uint64_t>& bounds, std::vector<uint64_t>& counts) const
+{
+	counts.assign(bounds.size(), 0);
+
+	uint64_t seen = 0;
+	size_t boundIndex = 0;
+
+	for (size_t i = 0; i < kBucketCount && boundIndex < bounds.size(); i++)
+	{
+		// a bucket only counts towards a bound once all of it is below it
+		while (boundIndex < bounds.size() && GetBucketUpperBound(i) > bounds[boundIndex])
+		{
+			counts[boundIndex] = seen;
+			boundIndex++;
+		}
+
+		seen += m_buckets[i].load(std::memory_order_relaxed);
+	}
+
+	for (; boundIndex < bounds.size(); boundIndex++)
+	{
+		counts[boundIndex] = seen;
+	}
+}
+
+// label values may contain anything, apart from what the text format needs escaped
+static void AppendEscapedLabelValue(std::string& out, const std::string& value)
+{
+	for (char c : value)
+	{
+		switch (c)
+		{
+		case '\\':
+			out += "\\\\";
+			break;
+		case '"':
+			out += "\\\"";
+			break;
+		case '\n':
+			out += "\\n";
+			break;
+		default:
+			out += c;
+			break;
+		}
+	}
+}
+
+void MetricsCollector::AddMetric(const std::string& name, const std::string& help, MetricType type, const LabelList& labels, const std::shared_ptr<void>& metric)
+{
+	Metric entry;
+	entry.name = name;
+	entry.help = help;
+	entry.type = type;
+	entry.metric = metric;
+
+	for (auto& label : labels)
+	{
+		if (!entry.labels.empty())
+		{
+			entry.labels += ",";
+		}
+
+		entry.labels += label.first;
+		entry.labels += "=\"";
+		AppendEscapedLabelValue(entry.labels, label.second);
+		entry.labels += "\"";
+	}
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	for (auto& existing : m_metrics)
+	{
+		if (existing.name == entry.name && existing.labels == entry.labels)
+		{
+			existing = std::move(entry);
+			return;
+		}
+	}
+
+	m_metrics.push_back(std::move(entry));
+}
+
+void MetricsCollector::AddCounter(const std::string& name, const std::string& help, const LabelList& labels, const std::shared_ptr<MetricCounter>& counter)
+{
+	AddMetric(name, help, MetricType::Counter, labels, counter);
+}
+
+void MetricsCollector::AddGauge(const std::string& name, const std::string& help, const LabelList& labels, const std::shared_ptr<MetricGauge>& gauge)
+{
+	AddMetric(name, help, MetricType::Gauge, labels, gauge);
+}
+
+void MetricsCollector::AddHistogram(const std::string& name, const std::string& help, const LabelList& labels, const std::shared_ptr<MetricHistogram>& histogram)
+{
+	AddMetric(name, help, MetricType::Histogram, labels, histogram);
+}
+
+// writes `name{labels}` - with `extraLabel` appended to the label set, if given
+static void AppendSeries(std::string& out, const std::string& name, const char* suffix, const std::string& labels, const std::string& extraLabel = std::string())
+{
+	out += name;
+	out += suffix;
+
+	if (!labels.empty() || !extraLabel.empty())
+	{
+		out += "{";
+		out += labels;
+
+		if (!labels.empty() && !extraLabel.empty())
+		{
+			out += ",";
+		}
+
+		out += extraLabel;
+		out += "}";
+	}
+
+	out += " ";
+}
+
+void MetricsCollector::Render(std::string& out)
+{
+	// the usual latency buckets, in seconds and in the microseconds histograms record
+	static const char* bucketLabels[] = { "0.0001", "0.00025", "0.0005", "0.001", "0.0025", "0.005", "0.01", "0.025", "0.05", "0.1", "0.25", "0.5", "1", "2.5", "5", "10" };
+	static const std::vector<uint64_t> bucketBounds = { 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000 };
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	// all series of a metric have to be listed together, below a single HELP and TYPE
+	std::vector<std::string> names;
+	std::map<std::string, std::vector<const Metric*>> metricsByName;
+
+	for (auto& metric : m_metrics)
+	{
+		auto& list = metricsByName[metric.name];
+
+		if (list.empty())
+		{
+			names.push_back(metric.name);
+		}
+
+		list.push_back(&metric);
+	}
+
+	std::vector<uint64_t> counts;
+	char valueString[64];
+
+	for (auto& name : names)
+	{
+		auto& list = metricsByName[name];
+		auto type = list[0]->type;
+
+		out += "# HELP " + name + " " + list[0]->help + "\n";
+		out += "# TYPE " + name + ((type == MetricType::Counter) ? " counter\n" : (type == MetricType::Gauge) ? " gauge\n" : " histogram\n");
+
+		for (auto metric : list)
+		{
+			if (metric->type == MetricType::Counter)
+			{
+				AppendSeries(out, name, "", metric->labels);
+				out += std::to_string(static_cast<MetricCounter*>(metric->metric.get())->GetValue()) + "\n";
+			}
+			else if (metric->type == MetricType::Gauge)
+			{
+				AppendSeries(out, name, "", metric->labels);
+				out += std::to_string(static_cast<MetricGauge*>(metric->metric.get())->GetValue()) + "\n";
+			}
+			else if (metric->type == MetricType::Histogram)
+			{
+				auto histogram = static_cast<MetricHistogram*>(metric->metric.get());
+				histogram->GetCumulativeCounts(bucketBounds, counts);
+
+				// the count gets summed up from the buckets - read separately, it could disagree with the +Inf bucket
+				uint64_t count = histogram->GetCount();
+
+				for (size_t i = 0; i < bucketBounds.size(); i++)
+				{
+					AppendSeries(out, name, "_bucket", metric->labels, std::string("le=\"") + bucketLabels[i] + "\"");
+					out += std::to_string(std::min(counts[i], count)) + "\n";
+				}
+
+				AppendSeries(out, name, "_bucket", metric->labels, "le=\"+Inf\"");
+				out += std::to_string(count) + "\n";
+
+				snprintf(valueString, sizeof(valueString), "%.6f", histogram->GetSum() / 1000000.0);
+
+				AppendSeries(out, name, "_sum", metric->labels);
+				out += valueString;
+				out += "\n";
+
+				AppendSeries(out, name, "_count", metric->labels);
+				out += std::to_string(count) + "\n";
+			}
+		}
+	}
+}
+}
@@ -15,8 +15,74 @@
 
 namespace net
 {
+MultiplexPrefixTrie::MultiplexPrefixTrie()
+{
+	// the root node
+	m_nodes.resize(1);
+}
+
+void MultiplexPrefixTrie::Insert(const std::string& prefix, MultiplexTcpChildServer* server)
+{
+	if (prefix.empty())
+	{
+		return;
+	}
+
+	size_t node = 0;
+
+	for (char c : prefix)
+	{
+		uint8_t byte = static_cast<uint8_t>(c);
+
+		if (m_nodes[node].next[byte] == 0)
+		{
+			m_nodes[node].next[byte] = static_cast<uint32_t>(m_nodes.size());
+			m_nodes.emplace_back();
+		}
+
+		node = m_nodes[node].next[byte];
+	}
+
+	if (m_nodes[node].server)
+	{
+		trace("MultiplexTcpServer: prefix is already registered to another server.\n");
+		return;
+	}
+
+	m_nodes[node].server = server;
+}
+
+MultiplexPatternMatchResult MultiplexPrefixTrie::Match(size_t& state, const uint8_t* data, size_t length, MultiplexTcpChildServer** server) const
+{
+	for (size_t i = 0; i < length; i++)
+	{
+		if (m_nodes[state].server)
+		{
+			break;
+		}
+
+		uint32_t next = m_nodes[state].next[data[i]];
+
+		if (next == 0)
+		{
+			return MultiplexPatternMatchResult::NoMatch;
+		}
+
+		state = next;
+	}
+
+	if (m_nodes[state].server)
+	{
+		*server = m_nodes[state].server;
+
+		return MultiplexPatternMatchResult::Match;
+	}
+
+	return MultiplexPatternMatchResult::InsufficientData;
+}
+
 MultiplexTcpServer::MultiplexTcpServer(const fwRefContainer<TcpServerFactory>& factory)
-	: m_factory(factory)
+	: m_factory(factory), m_childServers(std::make_shared<ChildServers>()), m_detectionTimeout(10000)
 {
 	
 }
@@ -35,58 +101,135 @@ void MultiplexTcpServer::Bind(const PeerAddress& bindAddress)
 	{
 		m_rootServer->SetConnectionCallback([=] (fwRefContainer<TcpServerStream> stream)
 		{
-			// start the attachment process for the stream
-			std::shared_ptr<std::vector<uint8_t>> recvQueue = std::make_shared<std::vector<uint8_t>>();
+			// state for the attachment process of the stream
+			struct DetectionState
+			{
+				// the position in the prefix trie
+				size_t trieState;
+
+				bool trieFailed;
 
-			TcpServerStream::TReadCallback readCallback = [=] (const std::vector<uint8_t>& data)
+				// data from earlier reads - only used if detection takes more than a single read
+				std::vector<uint8_t> recvQueue;
+
+				DetectionState()
+					: trieState(0), trieFailed(false)
+				{
+
+				}
+			};
+
+			// the child servers as of now, which stay the same for the whole detection
+			std::shared_ptr<const ChildServers> children = std::atomic_load(&m_childServers);
+
+			std::shared_ptr<DetectionState> state = std::make_shared<DetectionState>();
+			state->trieFailed = children->prefixTrie.IsEmpty();
+
+			TcpServerStream::TBufferReadCallback readCallback = [=] (const BufferView& data)
 			{
-				if (data.size() > 0)
+				if (data.IsEmpty())
+				{
+					return;
+				}
+
+				// the data received so far - usually just this read
+				BufferView allData = data;
+
+				if (!state->recvQueue.empty())
+				{
+					state->recvQueue.insert(state->recvQueue.end(), data.GetData(), data.GetData() + data.GetLength());
+
+					allData = BufferView(&state->recvQueue[0], state->recvQueue.size());
+				}
+
+				MultiplexTcpChildServer* matchedServer = nullptr;
+				bool needMoreData = false;
+
+				// the trie only has to look at the bytes it hasn't seen yet
+				if (!state->trieFailed)
+				{
+					auto matchResult = children->prefixTrie.Match(state->trieState, data.GetData(), data.GetLength(), &matchedServer);
+
+					if (matchResult == MultiplexPatternMatchResult::NoMatch)
+					{
+						state->trieFailed = true;
+					}
+					else if (matchResult == MultiplexPatternMatchResult::InsufficientData)
+					{
+						needMoreData = true;
+					}
+				}
+
+				// check the remaining servers for a pattern match
+				if (!matchedServer && children->hasPatternMatchers)
 				{
-					// copy to the receive queue
-					size_t origSize = recvQueue->size();
-					recvQueue->resize(origSize + data.size());
+					std::vector<uint8_t> allDataCopy;
 
-					std::copy(data.begin(), data.end(), recvQueue->begin() + origSize);
+					if (state->recvQueue.empty())
+					{
+						allDataCopy = data.ToVector();
+					}
 
-					// check all the servers for a pattern match
-					bool needMoreData = false;
+					const std::vector<uint8_t>& matchData = (state->recvQueue.empty()) ? allDataCopy : state->recvQueue;
 
-					for (auto& server : m_childServers)
+					for (auto& server : children->servers)
 					{
 						auto& matchFunction = server->GetPatternMatcher();
-						auto matchResult = matchFunction(*recvQueue);
 
-						// if we matched on this server
-						if (matchResult == MultiplexPatternMatchResult::Match)
+						if (!matchFunction)
 						{
-							// keep a scope-local reference to the receive queue/stream (as we'll lose the stored reference soon)
-							auto localStream = stream;
-							auto localRecvQueue = recvQueue;
-
-							// unset our read callback
-							stream->SetReadCallback(TcpServerStream::TReadCallback());
+							continue;
+						}
 
-							// forward the result
-							server->AttachToResult(*localRecvQueue, localStream);
+						auto matchResult = matchFunction(matchData);
 
-							// return so that the stream doesn't end up closed
-							return;
+						// if we matched on this server
+						if (matchResult == MultiplexPatternMatchResult::Match)
+						{
+							matchedServer = server.GetRef();
+							break;
 						}
 						else if (matchResult == MultiplexPatternMatchResult::InsufficientData)
 						{
 							needMoreData = true;
 						}
 					}
+				}
 
-					if (!needMoreData)
+				if (matchedServer)
+				{
+					// keep a scope-local reference to the stream/state (as we'll lose the stored reference soon), and
+					// hand off the data - this shares the read slab if detection finished on the first read
+					auto localStream = stream;
+					auto localState = state;
+					auto initialData = allData.Retain();
+
+					// unset our read callback and detection deadline
+					stream->SetReadCallback(TcpServerStream::TReadCallback());
+					stream->SetDeadline(0);
+
+					// forward the result
+					matchedServer->AttachToResult(initialData, localStream);
+				}
+				else if (needMoreData)
+				{
+					// the view won't survive past this callback, so keep a copy
+					if (state->recvQueue.empty())
 					{
-						// nobody matched, and we don't need more data - this stream is useless to us
-						stream->Close();
+						state->recvQueue = data.ToVector();
 					}
 				}
+				else
+				{
+					// nobody matched, and we don't need more data - this stream is useless to us
+					stream->Close();
+				}
 			};
 
-			stream->SetReadCallback(readCallback);
+			stream->SetBufferReadCallback(readCallback);
+
+			// don't let clients that never send anything recognizable linger
+			stream->SetDeadline(m_detectionTimeout);
 		});
 	}
 	else
@@ -95,13 +238,16 @@ void MultiplexTcpServer::Bind(const PeerAddress& bindAddress)
 	}
 }
 
-void MultiplexTcpChildServer::AttachToResult(const std::vector<uint8_t>& existingData, fwRefContainer<TcpServerStream> baseStream)
+void MultiplexTcpChildServer::AttachToResult(const BufferView& existingData, fwRefContainer<TcpServerStream> baseStream)
 {
 	fwRefContainer<MultiplexTcpChildServerStream> stream = new MultiplexTcpChildServerStream(this, baseStream);
 	stream->SetInitialData(existingData);
 
 	// keep a local reference to the connection
-	m_connections.insert(stream);
+	{
+		std::unique_lock<std::mutex> lock(m_connectionsMutex);
+		m_connections.insert(stream);
+	}
 
 	// invoke the connection callback
 	auto connectionCallback = GetConnectionCallback();
@@ -114,7 +260,11 @@ void MultiplexTcpChildServer::AttachToResult(const std::vector<uint8_t>& existin
 
 void MultiplexTcpChildServer::CloseStream(MultiplexTcpChildServerStream* stream)
 {
-	m_connections.erase(stream);
+	// as above, streams may come from any of the loops the root server is sharded across
+	fwRefContainer<TcpServerStream> streamRef = stream;
+
+	std::unique_lock<std::mutex> lock(m_connectionsMutex);
+	m_connections.erase(streamRef);
 }
 
 void MultiplexTcpChildServer::SetPatternMatcher(const MultiplexPatternMatchFn& function)
@@ -125,15 +275,14 @@ void MultiplexTcpChildServer::SetPatternMatcher(const MultiplexPatternMatchFn& f
 MultiplexTcpChildServerStream::MultiplexTcpChildServerStream(MultiplexTcpChildServer* server, fwRefContainer<TcpServerStream> baseStream)
 	: m_baseStream(baseStream), m_server(server)
 {
-	baseStream->SetReadCallback([=] (const std::vector<uint8_t>& data)
+	// forward views as-is, so consumers of the child stream don't pay for an extra copy
+	baseStream->SetBufferReadCallback([=] (const BufferView& data)
 	{
-		auto ourReadCallback = GetReadCallback();
-
-		if (ourReadCallback)
+		if (HasReadCallback())
 		{
 			TrySendInitialData();
 
-			ourReadCallback(data);
+			DispatchRead(data);
 		}
 	});
 
@@ -141,18 +290,28 @@ MultiplexTcpChildServerStream::MultiplexTcpChildServerStream(MultiplexTcpChildSe
 	{
 		CloseInternal();
 	});
+
+	// water marks are tracked by the base stream - we just mirror its state
+	auto updateWaterMark = [=] ()
+	{
+		UpdatePendingWriteSize(GetPendingWriteSize());
+	};
+
+	baseStream->SetHighWaterMarkCallback(updateWaterMark);
+	baseStream->SetLowWaterMarkCallback(updateWaterMark);
 }
 
 void MultiplexTcpChildServerStream::TrySendInitialData()
 {
-	auto ourReadCallback = GetReadCallback();
-
-	if (ourReadCallback)
+	if (HasReadCallback())
 	{
-		if (!m_initialData.empty())
+		if (!m_initialData.IsEmpty())
 		{
-			ourReadCallback(m_initialData);
-			m_initialData.clear();
+			// move the data out first, as the read callback may end up recursing
+			BufferView initialData = m_initialData;
+			m_initialData = BufferView();
+
+			DispatchRead(initialData);
 		}
 	}
 }
@@ -177,6 +336,13 @@ void MultiplexTcpChildServerStream::CloseInternal()
 
 	SetReadCallback(TReadCallback());
 
+	// the base stream may still complete writes after we're gone
+	if (m_baseStream.GetRef())
+	{
+		m_baseStream->SetHighWaterMarkCallback(TWaterMarkCallback());
+		m_baseStream->SetLowWaterMarkCallback(TWaterMarkCallback());
+	}
+
 	m_server->CloseStream(this);
 }
 
@@ -187,6 +353,9 @@ void MultiplexTcpChildServerStream::Close()
 
 	if (m_baseStream.GetRef())
 	{
+		m_baseStream->SetHighWaterMarkCallback(TWaterMarkCallback());
+		m_baseStream->SetLowWaterMarkCallback(TWaterMarkCallback());
+
 		m_baseStream->Close();
 		m_baseStream = nullptr;
 	}
@@ -199,12 +368,82 @@ void MultiplexTcpChildServerStream::Write(const std::vector<uint8_t>& data)
 	m_baseStream->Write(data);
 }
 
+void MultiplexTcpChildServerStream::Write(std::vector<uint8_t>&& data)
+{
+	m_baseStream->Write(std::move(data));
+}
+
+void MultiplexTcpChildServerStream::WriteV(std::vector<std::vector<uint8_t>>&& buffers)
+{
+	m_baseStream->WriteV(std::move(buffers));
+}
+
+size_t MultiplexTcpChildServerStream::GetPendingWriteSize()
+{
+	return (m_baseStream.GetRef()) ? m_baseStream->GetPendingWriteSize() : 0;
+}
+
+void MultiplexTcpChildServerStream::SetIdleTimeout(uint32_t timeoutMs)
+{
+	if (m_baseStream.GetRef())
+	{
+		m_baseStream->SetIdleTimeout(timeoutMs);
+	}
+}
+
+uint32_t MultiplexTcpChildServerStream::GetIdleTimeout()
+{
+	return (m_baseStream.GetRef()) ? m_baseStream->GetIdleTimeout() : 0;
+}
+
+void MultiplexTcpChildServerStream::SetDeadline(uint32_t timeoutMs)
+{
+	if (m_baseStream.GetRef())
+	{
+		m_baseStream->SetDeadline(timeoutMs);
+	}
+}
+
+void MultiplexTcpChildServerStream::ScheduleCallback(const TScheduledCallback& callback)
+{
+	if (m_baseStream.GetRef())
+	{
+		m_baseStream->ScheduleCallback(callback);
+	}
+}
+
+void MultiplexTcpChildServerStream::PauseReading()
+{
+	if (m_baseStream.GetRef())
+	{
+		m_baseStream->PauseReading();
+	}
+}
+
+void MultiplexTcpChildServerStream::ResumeReading()
+{
+	if (m_baseStream.GetRef())
+	{
+		m_baseStream->ResumeReading();
+	}
+}
+
+void MultiplexTcpChildServerStream::SetWriteWaterMarks(size_t lowWaterMark, size_t highWaterMark)
+{
+	TcpServerStream::SetWriteWaterMarks(lowWaterMark, highWaterMark);
+
+	if (m_baseStream.GetRef())
+	{
+		m_baseStream->SetWriteWaterMarks(lowWaterMark, highWaterMark);
+	}
+}
+
 PeerAddress MultiplexTcpChildServerStream::GetPeerAddress()
 {
 	return m_baseStream->GetPeerAddress();
 }
 
-void MultiplexTcpChildServerStream::SetInitialData(const std::vector<uint8_t>& initialData)
+void MultiplexTcpChildServerStream::SetInitialData(const BufferView& initialData)
 {
 	m_initialData = initialData;
 }
@@ -214,8 +453,37 @@ fwRefContainer<TcpServer> MultiplexTcpServer::CreateServer(const MultiplexPatter
 	fwRefContainer<MultiplexTcpChildServer> child = new MultiplexTcpChildServer();
 	child->SetPatternMatcher(patternMatchFunction);
 
-	m_childServers.push_back(child);
+	AddChildServer(child, std::vector<std::string>());
+
+	return child;
+}
+
+fwRefContainer<TcpServer> MultiplexTcpServer::CreateServer(const std::vector<std::string>& prefixes)
+{
+	fwRefContainer<MultiplexTcpChildServer> child = new MultiplexTcpChildServer();
+	AddChildServer(child, prefixes);
 
 	return child;
 }
+
+void MultiplexTcpServer::AddChildServer(const fwRefContainer<MultiplexTcpChildServer>& child, const std::vector<std::string>& prefixes)
+{
+	std::unique_lock<std::mutex> lock(m_registerMutex);
+
+	// copy the current children, so connections being detected on the loop threads never see them change
+	auto children = std::make_shared<ChildServers>(*std::atomic_load(&m_childServers));
+	children->servers.push_back(child);
+
+	for (auto& prefix : prefixes)
+	{
+		children->prefixTrie.Insert(prefix, child.GetRef());
+	}
+
+	if (child->GetPatternMatcher())
+	{
+		children->hasPatternMatchers = true;
+	}
+
+	std::atomic_store(&m_childServers, std::shared_ptr<const ChildServers>(children));
+}
 }
\ No newline at end of file
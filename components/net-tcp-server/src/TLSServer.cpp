@@ -15,17 +15,36 @@
 #include <botan/pkcs8.h>
 #include <botan/tls_policy.h>
 
+#include <chrono>
 #include <fstream>
 
+// session tickets are encrypted using a key that gets replaced after this time - as Botan only supports a
+// single ticket key, tickets issued before a rotation fall back to a full handshake
+static const std::chrono::hours g_ticketKeyLifetime(12);
+
+// sessions to keep in the server-side cache, for clients not supporting tickets
+static const size_t g_maxCachedSessions = 20000;
+
 class CredentialManager : public Botan::Credentials_Manager
 {
 private:
 	std::vector<Botan::X509_Certificate> m_certificates;
 	std::shared_ptr<Botan::Private_Key> m_key;
 
+	Botan::RandomNumberGenerator& m_rng;
+
+	std::mutex m_ticketKeyMutex;
+
+	Botan::SymmetricKey m_ticketKey;
+
+	std::chrono::steady_clock::time_point m_ticketKeyCreationTime;
+
 public:
 	CredentialManager(Botan::RandomNumberGenerator& rng, const fwPlatformString& serverCert, const fwPlatformString& serverKey)
+		: m_rng(rng)
 	{
+		RotateTicketKey();
+
 		try
 		{
 			std::ifstream serverKeyStream(serverKey);
@@ -83,6 +102,24 @@ public:
 		return std::vector<Botan::X509_Certificate>();
 	}
 
+	virtual Botan::SymmetricKey psk(const std::string& type, const std::string& context, const std::string& identity) override
+	{
+		// Botan asks for the ticket key both to encrypt new tickets and to decrypt tickets clients present
+		if (type == "tls-server" && context == "session-ticket")
+		{
+			std::unique_lock<std::mutex> lock(m_ticketKeyMutex);
+
+			if ((std::chrono::steady_clock::now() - m_ticketKeyCreationTime) > g_ticketKeyLifetime)
+			{
+				RotateTicketKey();
+			}
+
+			return m_ticketKey;
+		}
+
+		return Credentials_Manager::psk(type, context, identity);
+	}
+
 	virtual Botan::Private_Key* private_key_for(const Botan::X509_Certificate& cert, const std::string& type, const std::string& context) override
 	{
 		if (m_certificates[0] == cert)
@@ -92,11 +129,24 @@ public:
 
 		return nullptr;
 	}
+
+private:
+	void RotateTicketKey()
+	{
+		m_ticketKey = Botan::SymmetricKey(m_rng, 32);
+		m_ticketKeyCreationTime = std::chrono::steady_clock::now();
+	}
 };
 
 class TLSPolicy : public Botan::TLS::Policy
 {
 public:
+	virtual Botan::u32bit session_ticket_lifetime() const override
+	{
+		// tickets don't outlive the key they're encrypted with anyway
+		return static_cast<Botan::u32bit>(std::chrono::duration_cast<std::chrono::seconds>(g_ticketKeyLifetime).count());
+	}
+
 	virtual bool acceptable_protocol_version(Botan::TLS::Protocol_Version version) const override
 	{
 		return true;
@@ -113,39 +163,55 @@ public:
 namespace net
 {
 TLSServerStream::TLSServerStream(TLSServer* server, fwRefContainer<TcpServerStream> baseStream)
-	: m_parentServer(server), m_baseStream(baseStream), m_closing(false)
+	: m_parentServer(server), m_baseStream(baseStream), m_closing(false), m_offloadRecords(false), m_handshakeDone(false), m_pendingCryptoTasks(0), m_onWorker(false)
 {
 	Initialize();
 }
 
 void TLSServerStream::Initialize()
 {
-	m_policy = std::make_unique<TLSPolicy>();
-	m_sessionManager = std::make_unique<Botan::TLS::Session_Manager_In_Memory>(m_rng);
+	if (m_parentServer->GetWorkerPool().GetRef())
+	{
+		m_strand = new WorkerStrand(m_parentServer->GetWorkerPool());
+		m_offloadRecords = m_parentServer->ShouldOffloadRecords();
+	}
 
 	m_tlsServer.reset(new Botan::TLS::Server(
 		std::bind(&TLSServerStream::WriteToClient, this, std::placeholders::_1, std::placeholders::_2),
 		std::bind(&TLSServerStream::ReceivedData, this, std::placeholders::_1, std::placeholders::_2),
 		std::bind(&TLSServerStream::ReceivedAlert, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3),
 		std::bind(&TLSServerStream::HandshakeComplete, this, std::placeholders::_1),
-		*(m_sessionManager.get()),
+		m_parentServer->GetSessionManager(),
 		*m_parentServer->GetCredentials(),
-		*(m_policy.get()),
-		m_rng,
+		m_parentServer->GetPolicy(),
+		m_parentServer->GetRandomNumberGenerator(),
 		[] (std::vector<std::string> protocols)
 		{
 			return "";
 		}
 	));
 
-	m_baseStream->SetReadCallback([=] (const std::vector<uint8_t>& data)
+	m_baseStream->SetBufferReadCallback([=] (const BufferView& data)
 	{
 		// keep a reference to the TLS server in case we close due to a TLS alert
 		fwRefContainer<TLSServerStream> self = this;
 
+		if (self->ShouldOffload())
+		{
+			// the view has to stay valid until the worker gets to it
+			BufferView dataRef = data.Retain();
+
+			self->RunCrypto([=] ()
+			{
+				m_tlsServer->received_data(dataRef.GetData(), dataRef.GetLength());
+			});
+
+			return;
+		}
+
 		try
 		{
-			self->m_tlsServer->received_data(data);
+			self->m_tlsServer->received_data(data.GetData(), data.GetLength());
 		}
 		catch (std::exception& e)
 		{
@@ -157,6 +223,18 @@ void TLSServerStream::Initialize()
 	{
 		CloseInternal();
 	});
+
+	// the handshake has to complete in time
+	m_baseStream->SetDeadline(m_parentServer->GetHandshakeTimeout());
+
+	// as the base stream carries the encrypted data, its write queue is what counts for water marks
+	auto updateWaterMark = [=] ()
+	{
+		UpdatePendingWriteSize(GetPendingWriteSize());
+	};
+
+	m_baseStream->SetHighWaterMarkCallback(updateWaterMark);
+	m_baseStream->SetLowWaterMarkCallback(updateWaterMark);
 }
 
 PeerAddress TLSServerStream::GetPeerAddress()
@@ -166,31 +244,174 @@ PeerAddress TLSServerStream::GetPeerAddress()
 
 void TLSServerStream::Write(const std::vector<uint8_t>& data)
 {
-	m_tlsServer->send(data);
+	if (!ShouldOffload())
+	{
+		m_tlsServer->send(data);
+		return;
+	}
+
+	RunCrypto([=] ()
+	{
+		m_tlsServer->send(data);
+	});
+}
+
+void TLSServerStream::RunCrypto(const std::function<void()>& function)
+{
+	TcpServerStream* baseStream = m_baseStream.GetRef();
+
+	if (!baseStream)
+	{
+		return;
+	}
+
+	// keep ourselves and the base stream alive until the loop has seen the task complete - these are manual references,
+	// and the task is only referenced by pointer, so whatever it holds, as well as the final releases, always go away
+	// on the loop rather than on a worker
+	TLSServerStream* self = this;
+	self->AddRef();
+	baseStream->AddRef();
+
+	auto task = new std::function<void()>(function);
+
+	m_pendingCryptoTasks++;
+
+	m_strand->Post([self, baseStream, task] ()
+	{
+		self->m_onWorker = true;
+		self->m_workerBaseStream = baseStream;
+
+		try
+		{
+			(*task)();
+		}
+		catch (std::exception& e)
+		{
+			trace("%s\n", e.what());
+		}
+
+		self->m_workerBaseStream = nullptr;
+		self->m_onWorker = false;
+
+		baseStream->ScheduleCallback([self, baseStream, task] ()
+		{
+			delete task;
+
+			self->m_pendingCryptoTasks--;
+			self->Release();
+			baseStream->Release();
+		});
+	});
+}
+
+size_t TLSServerStream::GetPendingWriteSize()
+{
+	return (m_baseStream.GetRef()) ? m_baseStream->GetPendingWriteSize() : 0;
+}
+
+void TLSServerStream::SetIdleTimeout(uint32_t timeoutMs)
+{
+	if (m_baseStream.GetRef())
+	{
+		m_baseStream->SetIdleTimeout(timeoutMs);
+	}
+}
+
+uint32_t TLSServerStream::GetIdleTimeout()
+{
+	return (m_baseStream.GetRef()) ? m_baseStream->GetIdleTimeout() : 0;
+}
+
+void TLSServerStream::SetDeadline(uint32_t timeoutMs)
+{
+	if (m_baseStream.GetRef())
+	{
+		m_baseStream->SetDeadline(timeoutMs);
+	}
+}
+
+void TLSServerStream::ScheduleCallback(const TScheduledCallback& callback)
+{
+	if (m_baseStream.GetRef())
+	{
+		m_baseStream->ScheduleCallback(callback);
+	}
+}
+
+void TLSServerStream::PauseReading()
+{
+	if (m_baseStream.GetRef())
+	{
+		m_baseStream->PauseReading();
+	}
+}
+
+void TLSServerStream::ResumeReading()
+{
+	if (m_baseStream.GetRef())
+	{
+		m_baseStream->ResumeReading();
+	}
+}
+
+void TLSServerStream::SetWriteWaterMarks(size_t lowWaterMark, size_t highWaterMark)
+{
+	TcpServerStream::SetWriteWaterMarks(lowWaterMark, highWaterMark);
+
+	if (m_baseStream.GetRef())
+	{
+		m_baseStream->SetWriteWaterMarks(lowWaterMark, highWaterMark);
+	}
 }
 
 void TLSServerStream::Close()
 {
-	m_tlsServer->close();
+	if (!ShouldOffload())
+	{
+		m_tlsServer->close();
+		return;
+	}
+
+	RunCrypto([=] ()
+	{
+		m_tlsServer->close();
+	});
 }
 
 void TLSServerStream::WriteToClient(const uint8_t buf[], size_t length)
 {
-	std::vector<uint8_t> data(buf, buf + length);
-	
-	if (m_baseStream.GetRef())
+	// base stream writes may happen from any thread
+	auto& baseStream = (m_onWorker) ? m_workerBaseStream : m_baseStream;
+
+	if (baseStream.GetRef())
 	{
-		m_baseStream->Write(data);
+		baseStream->Write(std::vector<uint8_t>(buf, buf + length));
 	}
 }
 
 void TLSServerStream::ReceivedData(const uint8_t buf[], size_t length)
 {
-	if (GetReadCallback())
+	// data decrypted on a worker gets handed to the read callback on the loop
+	if (m_onWorker)
 	{
-		std::vector<uint8_t> data(buf, buf + length);
+		fwRefContainer<TLSServerStream> self = this;
+		auto data = std::make_shared<std::vector<uint8_t>>(buf, buf + length);
+
+		m_workerBaseStream->ScheduleCallback([=] ()
+		{
+			if (self->HasReadCallback())
+			{
+				self->DispatchRead(BufferView(&(*data)[0], data->size()));
+			}
+		});
+
+		return;
+	}
 
-		GetReadCallback()(data);
+	// the plaintext buffer belongs to Botan, so this is only valid for the duration of the callback
+	if (HasReadCallback())
+	{
+		DispatchRead(BufferView(buf, length));
 	}
 }
 
@@ -202,8 +423,29 @@ void TLSServerStream::ReceivedAlert(Botan::TLS::Alert alert, const uint8_t[], si
 	{
 		fwRefContainer<TLSServerStream> thisRef = this;
 
+		// the base stream reference is owned by the loop thread
+		if (m_onWorker)
+		{
+			m_workerBaseStream->ScheduleCallback([=] ()
+			{
+				if (thisRef->m_baseStream.GetRef())
+				{
+					thisRef->m_baseStream->SetHighWaterMarkCallback(TWaterMarkCallback());
+					thisRef->m_baseStream->SetLowWaterMarkCallback(TWaterMarkCallback());
+
+					thisRef->m_baseStream->Close();
+					thisRef->m_baseStream = nullptr;
+				}
+			});
+
+			return;
+		}
+
 		if (m_baseStream.GetRef())
 		{
+			m_baseStream->SetHighWaterMarkCallback(TWaterMarkCallback());
+			m_baseStream->SetLowWaterMarkCallback(TWaterMarkCallback());
+
 			m_baseStream->Close();
 			m_baseStream = nullptr;
 		}
@@ -212,11 +454,36 @@ void TLSServerStream::ReceivedAlert(Botan::TLS::Alert alert, const uint8_t[], si
 
 bool TLSServerStream::HandshakeComplete(const Botan::TLS::Session& session)
 {
-	m_parentServer->InvokeConnectionCallback(this);
+	if (m_onWorker)
+	{
+		fwRefContainer<TLSServerStream> self = this;
+
+		m_workerBaseStream->ScheduleCallback([=] ()
+		{
+			self->OnHandshakeComplete();
+		});
+	}
+	else
+	{
+		OnHandshakeComplete();
+	}
 
+	// cache the session
 	return true;
 }
 
+void TLSServerStream::OnHandshakeComplete()
+{
+	m_handshakeDone = true;
+
+	if (m_baseStream.GetRef())
+	{
+		m_baseStream->SetDeadline(0);
+	}
+
+	m_parentServer->InvokeConnectionCallback(this);
+}
+
 void TLSServerStream::CloseInternal()
 {
 	// keep a reference to ourselves so we only free after returning
@@ -232,19 +499,45 @@ void TLSServerStream::CloseInternal()
 
 	SetReadCallback(TReadCallback());
 
+	// the base stream may still complete writes after we're gone
+	if (m_baseStream.GetRef())
+	{
+		m_baseStream->SetHighWaterMarkCallback(TWaterMarkCallback());
+		m_baseStream->SetLowWaterMarkCallback(TWaterMarkCallback());
+	}
+
 	m_parentServer->CloseStream(this);
 }
 
 TLSServer::TLSServer(fwRefContainer<TcpServer> baseServer, const std::string& certificatePath, const std::string& keyPath)
-	: m_baseServer(baseServer)
+	: m_baseServer(baseServer), m_nextRng(0), m_handshakeTimeout(10000), m_offloadRecords(false)
 {
+	// seed one RNG per hardware thread - they get used from multiple loops, so they have to be serialized
+	size_t rngCount = std::max(1u, std::thread::hardware_concurrency());
+
+	for (size_t i = 0; i < rngCount; i++)
+	{
+		m_rngs.push_back(std::make_unique<Botan::Serialized_RNG>());
+	}
+
 	// initialize credentials
-	Botan::AutoSeeded_RNG rng;
-	m_credentials = std::make_shared<CredentialManager>(rng, MakeRelativeCitPath(certificatePath), MakeRelativeCitPath(keyPath));
+	m_credentials = std::make_shared<CredentialManager>(GetRandomNumberGenerator(), MakeRelativeCitPath(certificatePath), MakeRelativeCitPath(keyPath));
+
+	// initialize the session cache and policy
+	m_sessionManager = std::make_unique<Botan::TLS::Session_Manager_In_Memory>(GetRandomNumberGenerator(), g_maxCachedSessions);
+	m_policy = std::make_unique<TLSPolicy>();
 	
 	m_baseServer->SetConnectionCallback([=] (fwRefContainer<TcpServerStream> stream)
 	{
-		m_connections.insert(new TLSServerStream(this, stream));
+		fwRefContainer<TLSServerStream> tlsStream = new TLSServerStream(this, stream);
+
+		std::unique_lock<std::mutex> lock(m_connectionsMutex);
+		m_connections.insert(tlsStream);
 	});
 }
+
+Botan::RandomNumberGenerator& TLSServer::GetRandomNumberGenerator()
+{
+	return *m_rngs[m_nextRng++ % m_rngs.size()];
+}
 }
\ No newline at end of file
@@ -21,6 +21,103 @@ void TcpServer::SetConnectionCallback(const TConnectionCallback& callback)
 	m_connectionCallback = callback;
 }
 
+TcpServerStream::TcpServerStream()
+	: m_lowWaterMark(64 * 1024), m_highWaterMark(1024 * 1024), m_aboveHighWaterMark(false)
+{
+
+}
+
+void TcpServerStream::Write(std::vector<uint8_t>&& data)
+{
+	Write(static_cast<const std::vector<uint8_t>&>(data));
+}
+
+void TcpServerStream::WriteV(std::vector<std::vector<uint8_t>>&& buffers)
+{
+	for (auto& buffer : buffers)
+	{
+		Write(std::move(buffer));
+	}
+}
+
+size_t TcpServerStream::GetPendingWriteSize()
+{
+	return 0;
+}
+
+void TcpServerStream::SetIdleTimeout(uint32_t timeoutMs)
+{
+
+}
+
+uint32_t TcpServerStream::GetIdleTimeout()
+{
+	return 0;
+}
+
+void TcpServerStream::SetDeadline(uint32_t timeoutMs)
+{
+
+}
+
+void TcpServerStream::ScheduleCallback(const TScheduledCallback& callback)
+{
+	callback();
+}
+
+void TcpServerStream::PauseReading()
+{
+
+}
+
+void TcpServerStream::ResumeReading()
+{
+
+}
+
+void TcpServerStream::SetWriteWaterMarks(size_t lowWaterMark, size_t highWaterMark)
+{
+	m_lowWaterMark = lowWaterMark;
+	m_highWaterMark = highWaterMark;
+}
+
+void TcpServerStream::SetHighWaterMarkCallback(const TWaterMarkCallback& callback)
+{
+	m_highWaterMarkCallback = callback;
+}
+
+void TcpServerStream::SetLowWaterMarkCallback(const TWaterMarkCallback& callback)
+{
+	m_lowWaterMarkCallback = callback;
+}
+
+void TcpServerStream::UpdatePendingWriteSize(size_t pendingSize)
+{
+	if (!m_aboveHighWaterMark && pendingSize > m_highWaterMark)
+	{
+		m_aboveHighWaterMark = true;
+
+		// copy the callback, as it may reset itself
+		auto callback = m_highWaterMarkCallback;
+
+		if (callback)
+		{
+			callback();
+		}
+	}
+	else if (m_aboveHighWaterMark && pendingSize <= m_lowWaterMark)
+	{
+		m_aboveHighWaterMark = false;
+
+		auto callback = m_lowWaterMarkCallback;
+
+		if (callback)
+		{
+			callback();
+		}
+	}
+}
+
 void TcpServerStream::SetCloseCallback(const TCloseCallback& callback)
 {
 	m_closeCallback = callback;
@@ -28,13 +125,42 @@ void TcpServerStream::SetCloseCallback(const TCloseCallback& callback)
 
 void TcpServerStream::SetReadCallback(const TReadCallback& callback)
 {
-	bool wasFirst = !static_cast<bool>(m_readCallback);
+	bool wasFirst = !HasReadCallback();
 
 	m_readCallback = callback;
+	m_bufferReadCallback = TBufferReadCallback();
+
+	OnSetReadCallback(wasFirst);
+}
+
+void TcpServerStream::SetBufferReadCallback(const TBufferReadCallback& callback)
+{
+	bool wasFirst = !HasReadCallback();
+
+	m_bufferReadCallback = callback;
+	m_readCallback = TReadCallback();
+
+	OnSetReadCallback(wasFirst);
+}
 
-	if (wasFirst)
+void TcpServerStream::OnSetReadCallback(bool wasFirst)
+{
+	if (wasFirst && HasReadCallback())
 	{
 		OnFirstSetReadCallback();
 	}
 }
+
+void TcpServerStream::DispatchRead(const BufferView& data)
+{
+	if (m_bufferReadCallback)
+	{
+		m_bufferReadCallback(data);
+	}
+	else if (m_readCallback)
+	{
+		// legacy callbacks get their own copy
+		m_readCallback(data.ToVector());
+	}
+}
 }
\ No newline at end of file
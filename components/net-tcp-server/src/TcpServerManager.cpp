@@ -8,13 +8,41 @@
 #include "StdInc.h"
 #include "TcpServerManager.h"
 #include "UvLoopManager.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
 #include "memdbgon.h"
 
 namespace net
 {
 TcpServerManager::TcpServerManager()
+	: TcpServerManager("default", 1)
+{
+	
+}
+
+TcpServerManager::TcpServerManager(const std::string& loopTag, int threadCount)
+	: m_firstByteTimeout(30000), m_idleTimeout(0), m_loopTag(loopTag)
 {
-	m_uvLoop = Instance<UvLoopManager>::Get()->GetOrCreate(std::string("default"));
+	if (threadCount <= 0)
+	{
+		threadCount = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	}
+
+#ifndef SO_REUSEPORT
+	// without SO_REUSEPORT, only a single listener can exist per address
+	threadCount = 1;
+#endif
+
+	// the first loop keeps the plain tag, so a single-threaded manager shares the loop with other users of it
+	for (int i = 0; i < threadCount; i++)
+	{
+		std::string tag = (i == 0) ? loopTag : loopTag + "_" + std::to_string(i);
+
+		m_uvLoops.push_back(Instance<UvLoopManager>::Get()->GetOrCreate(tag));
+	}
 }
 
 TcpServerManager::~TcpServerManager()
@@ -22,31 +50,140 @@ TcpServerManager::~TcpServerManager()
 	
 }
 
-fwRefContainer<TcpServer> TcpServerManager::CreateServer(const PeerAddress& bindAddress)
+void TcpServerManager::SetMetricsCollector(const fwRefContainer<MetricsCollector>& collector)
 {
-	// allocate an owning pointer for the server handle
-	std::unique_ptr<uv_tcp_t> serverHandle = std::make_unique<uv_tcp_t>();
+	auto metrics = std::make_shared<TcpServerMetrics>();
+	MetricsCollector::LabelList labels = { { "manager", m_loopTag } };
+
+	// the collector keeps the metrics alive through aliases of the shared pointer
+	collector->AddCounter("tcp_connections_accepted_total", "TCP connections accepted.", labels, std::shared_ptr<MetricCounter>(metrics, &metrics->connectionsAccepted));
+	collector->AddGauge("tcp_connections_open", "TCP connections currently open.", labels, std::shared_ptr<MetricGauge>(metrics, &metrics->connectionsOpen));
+	collector->AddCounter("tcp_received_bytes_total", "Bytes received on TCP connections.", labels, std::shared_ptr<MetricCounter>(metrics, &metrics->bytesReceived));
+	collector->AddCounter("tcp_sent_bytes_total", "Bytes sent on TCP connections.", labels, std::shared_ptr<MetricCounter>(metrics, &metrics->bytesSent));
+
+	std::atomic_store(&m_metrics, metrics);
+}
+
+// closes a listener that couldn't be set up, returning its handle to the loop's pool - loop thread only
+static void CloseFailedListener(std::unique_ptr<uv_tcp_t> handle)
+{
+	uv_close(reinterpret_cast<uv_handle_t*>(handle.release()), [] (uv_handle_t* handle)
+	{
+		UvLoopHolder* loop = reinterpret_cast<UvLoopHolder*>(handle->loop->data);
+
+		loop->GetPool<uv_tcp_t>()->Return(reinterpret_cast<uv_tcp_t*>(handle));
+	});
+}
+
+std::unique_ptr<uv_tcp_t> TcpServerManager::CreateListener(const fwRefContainer<UvLoopHolder>& loop, const PeerAddress& bindAddress, bool reusePort)
+{
+	// take a server handle from the loop's pool
+	std::unique_ptr<uv_tcp_t> serverHandle(loop->GetPool<uv_tcp_t>()->Acquire());
+
+	// clear and associate the server handle with the loop
+	uv_tcp_init(loop->GetLoop(), serverHandle.get());
+
+#ifdef SO_REUSEPORT
+	if (reusePort)
+	{
+		// libuv doesn't expose SO_REUSEPORT, so create the socket ourselves to set it before binding - the other loops'
+		// listeners would fail to bind without it, so there's no falling back to a plain socket
+		int socketHandle = socket(bindAddress.GetAddressFamily(), SOCK_STREAM, IPPROTO_TCP);
+
+		if (socketHandle < 0)
+		{
+			trace("net-tcp-server failed to create a SO_REUSEPORT socket - error code %d\n", errno);
+
+			CloseFailedListener(std::move(serverHandle));
+			return nullptr;
+		}
+
+		int reuseValue = 1;
 
-	// clear and associate the server handle with our loop
-	uv_tcp_init(m_uvLoop->GetLoop(), serverHandle.get());
+		if (setsockopt(socketHandle, SOL_SOCKET, SO_REUSEPORT, &reuseValue, sizeof(reuseValue)) != 0)
+		{
+			trace("net-tcp-server failed to set SO_REUSEPORT - error code %d\n", errno);
+
+			close(socketHandle);
+
+			CloseFailedListener(std::move(serverHandle));
+			return nullptr;
+		}
+
+		int result = uv_tcp_open(serverHandle.get(), socketHandle);
+
+		if (result != 0)
+		{
+			trace("net-tcp-server failed to open a SO_REUSEPORT socket - libuv error %s\n", uv_strerror(result));
+
+			close(socketHandle);
+
+			CloseFailedListener(std::move(serverHandle));
+			return nullptr;
+		}
+	}
+#endif
 
 	// set the socket binding to the peer address
-	uv_tcp_bind(serverHandle.get(), bindAddress.GetSocketAddress(), 0);
+	int result = uv_tcp_bind(serverHandle.get(), bindAddress.GetSocketAddress(), 0);
+
+	if (result != 0)
+	{
+		trace("net-tcp-server failed to bind to %s - libuv error %s\n", bindAddress.ToString().c_str(), uv_strerror(result));
+
+		CloseFailedListener(std::move(serverHandle));
+		return nullptr;
+	}
+
+	return serverHandle;
+}
 
-	// create a server instance and associate it with the handle
+fwRefContainer<TcpServer> TcpServerManager::CreateServer(const PeerAddress& bindAddress)
+{
+	// create a server instance
 	fwRefContainer<UvTcpServer> tcpServer = new UvTcpServer(this);
-	serverHandle->data = tcpServer.GetRef();
 
-	// attempt listening on the socket
-	if (tcpServer->Listen(std::move(serverHandle)))
+	// bind a listener on every loop - with SO_REUSEPORT the kernel will balance incoming connections between them,
+	// and every accepted stream stays on the loop that accepted it
+	bool reusePort = (m_uvLoops.size() > 1);
+
+	for (auto& loop : m_uvLoops)
+	{
+		bool listening = false;
+
+		// libuv handles may only be touched from their loop's thread
+		loop->Invoke([&] ()
+		{
+			std::unique_ptr<uv_tcp_t> serverHandle = CreateListener(loop, bindAddress, reusePort);
+
+			if (!serverHandle)
+			{
+				return;
+			}
+
+			// associate the server instance with the handle
+			serverHandle->data = tcpServer.GetRef();
+
+			// attempt listening on the socket
+			listening = tcpServer->Listen(std::move(serverHandle));
+		});
+
+		if (!listening)
+		{
+			tcpServer = nullptr;
+			break;
+		}
+	}
+
+	// listeners created on the loops before a failure get closed along with the server
+	if (tcpServer.GetRef())
 	{
 		// insert to the owned list
 		m_servers.insert(tcpServer);
 	}
 	else
 	{
-		tcpServer = nullptr;
-		trace("net-tcp-server failed to create server: couldn't listen");
+		trace("net-tcp-server failed to create server on %s: couldn't listen\n", bindAddress.ToString().c_str());
 	}
 
 	return tcpServer;
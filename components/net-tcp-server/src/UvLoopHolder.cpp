@@ -7,12 +7,53 @@
 
 #include "StdInc.h"
 #include "UvLoopHolder.h"
+
+#include <future>
+
 #include "memdbgon.h"
 
 namespace net
 {
+// the loop whose thread this is, if any
+static thread_local UvLoopHolder* t_currentLoop;
+
+// completes an Invoke - if the task gets dropped without running, e.g. as the loop shut down, this fails it instead
+class InvokeCompletion
+{
+private:
+	std::promise<bool> m_promise;
+
+	bool m_completed;
+
+public:
+	InvokeCompletion()
+		: m_completed(false)
+	{
+
+	}
+
+	~InvokeCompletion()
+	{
+		if (!m_completed)
+		{
+			m_promise.set_value(false);
+		}
+	}
+
+	inline std::future<bool> GetFuture()
+	{
+		return m_promise.get_future();
+	}
+
+	inline void Complete()
+	{
+		m_completed = true;
+		m_promise.set_value(true);
+	}
+};
+
 UvLoopHolder::UvLoopHolder(const std::string& loopTag)
-	: m_shouldExit(false), m_loopTag(loopTag)
+	: m_shouldExit(false), m_refCount(0), m_released(false), m_loopTag(loopTag)
 {
 	// initialize the libuv loop
 	uv_loop_init(&m_loop);
@@ -20,49 +61,221 @@ UvLoopHolder::UvLoopHolder(const std::string& loopTag)
 	// assign our pointer to the loop
 	m_loop.data = this;
 
+	// initialize the task async - as this handle stays referenced, uv_run won't return until we stop the loop
+	uv_async_init(&m_loop, &m_async, [] (uv_async_t* async)
+	{
+		reinterpret_cast<UvLoopHolder*>(async->data)->RunTasks();
+	});
+
+	m_async.data = this;
+
+	// deferred callbacks run from a check handle, after polling for I/O - the idle handle is only active while
+	// callbacks are pending, and stops the poll phase from blocking in that case
+	uv_check_init(&m_loop, &m_deferCheck);
+	m_deferCheck.data = this;
+
+	uv_check_start(&m_deferCheck, [] (uv_check_t* check)
+	{
+		reinterpret_cast<UvLoopHolder*>(check->data)->RunDeferred();
+	});
+
+	uv_idle_init(&m_loop, &m_deferIdle);
+
+	m_timingWheel = std::make_unique<UvTimingWheel>(&m_loop);
+
 	// start the loop's runtime thread
 	m_thread = std::thread([=] ()
 	{
-		// start running the loop
-		while (!m_shouldExit)
+		t_currentLoop = this;
+
+		// execute the loop until we're told to stop
+		uv_run(&m_loop, UV_RUN_DEFAULT);
+
+		// close any handles still open, e.g. of streams that outlived their server, as the loop can't be closed
+		// otherwise - and run until all close callbacks ran
+		uv_walk(&m_loop, [] (uv_handle_t* handle, void*)
+		{
+			if (!uv_is_closing(handle))
+			{
+				uv_close(handle, nullptr);
+			}
+		}, nullptr);
+
+		uv_run(&m_loop, UV_RUN_DEFAULT);
+
+		// tasks posted after the last run won't ever run - drop them, failing any Invoke waiting on them
+		std::function<void()> task;
+
+		while (m_tasks.TryPop(task))
 		{
-			// execute the loop - this will probably return instantly before any events are added
-			uv_run(&m_loop, UV_RUN_DEFAULT);
 
-			// wait for a bit to not cause a full-load loop
-			std::this_thread::sleep_for(std::chrono::milliseconds(100));
 		}
 
+		task = std::function<void()>();
+
 		// clean up the libuv loop
-		uv_loop_close(&m_loop);
+		int result = uv_loop_close(&m_loop);
+
+		if (result != 0)
+		{
+			trace("net-tcp-server failed to close loop %s - libuv error %s\n", m_loopTag.c_str(), uv_strerror(result));
+		}
 	});
 }
 
-UvLoopHolder::~UvLoopHolder()
+void UvLoopHolder::AddRef()
 {
-	// mark the thread as needing to exit
-	m_shouldExit = true;
+	m_refCount++;
+}
 
-	// stop the loop as soon as possible
-	uv_stop(&m_loop);
+bool UvLoopHolder::Release()
+{
+	if (m_refCount.fetch_sub(1) > 1 || m_released.exchange(true))
+	{
+		return false;
+	}
 
-	// signal the loop so it can get triggered
-	uv_async_t async;
-	
-	uv_async_init(&m_loop, &async, [] (uv_async_t*)
+	if (IsOnLoopThread())
 	{
+		// the loop keeps running until the destructor stops it, so anything further up this thread's stack may still
+		// use the holder until then
+		std::thread([this] ()
+		{
+			delete this;
+		}).detach();
+	}
+	else
+	{
+		delete this;
+	}
 
-	});
+	return true;
+}
 
-	uv_async_send(&async);
+UvLoopHolder::~UvLoopHolder()
+{
+	// mark the thread as needing to exit, and signal the loop so it notices
+	m_shouldExit = true;
+
+	uv_async_send(&m_async);
 
 	// wait for the thread to exit cleanly
 	if (m_thread.joinable())
 	{
 		m_thread.join();
 	}
+}
+
+void UvLoopHolder::RunTasks()
+{
+	std::function<void()> task;
+
+	while (m_tasks.TryPop(task))
+	{
+		task();
+	}
+
+	// release whatever the last task captured
+	task = std::function<void()>();
+
+	if (m_shouldExit)
+	{
+		uv_close(reinterpret_cast<uv_handle_t*>(&m_async), nullptr);
+		uv_close(reinterpret_cast<uv_handle_t*>(&m_deferCheck), nullptr);
+		uv_close(reinterpret_cast<uv_handle_t*>(&m_deferIdle), nullptr);
+
+		m_timingWheel->Close();
+
+		uv_stop(&m_loop);
+	}
+}
+
+void UvLoopHolder::RunDeferred()
+{
+	// callbacks may defer more work, which will run in this same pass
+	while (!m_deferred.empty())
+	{
+		std::vector<std::function<void()>> deferred;
+		deferred.swap(m_deferred);
+
+		for (auto& callback : deferred)
+		{
+			callback();
+		}
+	}
+
+	uv_idle_stop(&m_deferIdle);
+}
+
+void UvLoopHolder::Defer(std::function<void()> callback)
+{
+	if (m_deferred.empty())
+	{
+		uv_idle_start(&m_deferIdle, [] (uv_idle_t*)
+		{
+
+		});
+	}
+
+	m_deferred.push_back(std::move(callback));
+}
+
+void UvLoopHolder::Post(std::function<void()> task)
+{
+	m_tasks.Push(std::move(task));
+
+	uv_async_send(&m_async);
+}
+
+bool UvLoopHolder::Invoke(const std::function<void()>& task)
+{
+	if (IsOnLoopThread())
+	{
+		task();
+		return true;
+	}
+
+	// blocking one loop on another could deadlock, if that one ever waits for this one in turn
+	if (t_currentLoop)
+	{
+		trace("net-tcp-server can't invoke on loop %s from loop %s\n", m_loopTag.c_str(), t_currentLoop->GetLoopTag().c_str());
+		return false;
+	}
+
+	if (m_shouldExit)
+	{
+		return false;
+	}
+
+	auto completion = std::make_shared<InvokeCompletion>();
+	std::future<bool> result = completion->GetFuture();
+
+	Post([&task, completion] ()
+	{
+		task();
+
+		completion->Complete();
+	});
+
+	// the posted task holds the only reference from here on, so dropping it unrun fails the wait
+	completion.reset();
+
+	return result.get();
+}
+
+std::vector<UvObjectPoolStats> UvLoopHolder::GetPoolStats()
+{
+	std::vector<UvObjectPoolStats> stats;
+
+	// the pool list itself may only be walked on the loop thread - if that can't happen, there's nothing to report
+	Invoke([&] ()
+	{
+		for (auto& pool : m_pools)
+		{
+			stats.push_back(pool.second->GetStats());
+		}
+	});
 
-	// clean up the async
-	uv_close(reinterpret_cast<uv_handle_t*>(&async), nullptr);
+	return stats;
 }
 }
\ No newline at end of file
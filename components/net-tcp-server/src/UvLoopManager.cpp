@@ -12,6 +12,8 @@ namespace net
 {
 fwRefContainer<UvLoopHolder> UvLoopManager::GetOrCreate(const std::string& loopTag)
 {
+	std::unique_lock<std::mutex> lock(m_loopsMutex);
+
 	auto it = m_uvLoops.find(loopTag);
 
 	if (it == m_uvLoops.end())
@@ -25,6 +27,8 @@ fwRefContainer<UvLoopHolder> UvLoopManager::GetOrCreate(const std::string& loopT
 
 void UvLoopManager::Disown(const std::string& loopTag)
 {
+	std::unique_lock<std::mutex> lock(m_loopsMutex);
+
 	m_uvLoops.erase(loopTag);
 }
 }
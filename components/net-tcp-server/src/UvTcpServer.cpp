@@ -26,26 +26,59 @@ void UvCallback(Handle* handle, T1 a1, T2 a2)
 template<typename Handle>
 void UvClose(std::unique_ptr<Handle> handle)
 {
-	struct TempCloseData
+	// the owning loop, as closing has to happen on its thread
+	net::UvLoopHolder* loop = reinterpret_cast<net::UvLoopHolder*>(handle->loop->data);
+
+	// the handle goes back to the loop's pool once closed
+	Handle* rawHandle = handle.release();
+
+	auto closeHandle = [=] ()
 	{
-		std::unique_ptr<Handle> item;
-	};
+		// close the libuv handle
+		uv_close(reinterpret_cast<uv_handle_t*>(rawHandle), [] (uv_handle_t* handle)
+		{
+			net::UvLoopHolder* loop = reinterpret_cast<net::UvLoopHolder*>(handle->loop->data);
 
-	// create temporary object and give it our reference
-	TempCloseData* tempCloseData = new TempCloseData;
-	tempCloseData->item = std::move(handle);
-	tempCloseData->item->data = tempCloseData;
+			loop->GetPool<Handle>()->Return(reinterpret_cast<Handle*>(handle));
+		});
+	};
 
-	// close the libuv handle
-	uv_close(reinterpret_cast<uv_handle_t*>(tempCloseData->item.get()), [] (uv_handle_t* handle)
+	if (loop->IsOnLoopThread())
 	{
-		// delete the close holder
-		delete reinterpret_cast<TempCloseData*>(handle->data);
-	});
+		closeHandle();
+	}
+	else
+	{
+		loop->Post(closeHandle);
+	}
 }
 
 namespace net
 {
+// write request structure
+struct UvWriteReq
+{
+	std::vector<std::vector<uint8_t>> sendData;
+	std::vector<uv_buf_t> buffers;
+	size_t size;
+	uv_write_t write;
+
+	fwRefContainer<UvTcpServerStream> stream;
+};
+
+static void FreeWriteReq(UvWriteReq* req)
+{
+	// drop the data and stream reference, but keep the request around for reuse
+	fwRefContainer<UvTcpServerStream> stream = req->stream;
+	req->stream = nullptr;
+	req->sendData.clear();
+
+	stream->GetLoop()->GetPool<UvWriteReq>()->Return(req);
+}
+
+// how long a closed stream's handle stays open for writes in flight to complete
+static const uint32_t kCloseLingerTimeout = 10000;
+
 UvTcpServer::UvTcpServer(TcpServerManager* manager)
 	: m_manager(manager)
 {
@@ -56,17 +89,18 @@ UvTcpServer::~UvTcpServer()
 {
 	m_clients.clear();
 
-	if (m_server.get())
+	for (auto& listener : m_listeners)
 	{
-		UvClose(std::move(m_server));
+		UvClose(std::move(listener));
 	}
 }
 
 bool UvTcpServer::Listen(std::unique_ptr<uv_tcp_t>&& server)
 {
-	m_server = std::move(server);
-
-	int result = uv_listen(reinterpret_cast<uv_stream_t*>(m_server.get()), 0, UvCallback<uv_stream_t, UvTcpServer, int, &UvTcpServer::OnConnection>);
+	int result = uv_listen(reinterpret_cast<uv_stream_t*>(server.get()), SOMAXCONN, [] (uv_stream_t* listener, int status)
+	{
+		reinterpret_cast<UvTcpServer*>(listener->data)->OnConnection(listener, status);
+	});
 
 	bool retval = (result == 0);
 
@@ -75,10 +109,12 @@ bool UvTcpServer::Listen(std::unique_ptr<uv_tcp_t>&& server)
 		trace("Listening on socket failed - libuv error %s.\n", uv_strerror(result));
 	}
 
+	m_listeners.push_back(std::move(server));
+
 	return retval;
 }
 
-void UvTcpServer::OnConnection(int status)
+void UvTcpServer::OnConnection(uv_stream_t* listener, int status)
 {
 	// check for error conditions
 	if (status < 0)
@@ -87,18 +123,23 @@ void UvTcpServer::OnConnection(int status)
 		return;
 	}
 
-	// initialize a handle for the client
-	std::unique_ptr<uv_tcp_t> clientHandle = std::make_unique<uv_tcp_t>();
-	uv_tcp_init(m_manager->GetLoop(), clientHandle.get());
+	// initialize a handle for the client - this has to be on the loop of the accepting listener
+	UvLoopHolder* loop = reinterpret_cast<UvLoopHolder*>(listener->loop->data);
+
+	std::unique_ptr<uv_tcp_t> clientHandle(loop->GetPool<uv_tcp_t>()->Acquire());
+	uv_tcp_init(listener->loop, clientHandle.get());
 
 	// create a stream instance and associate
 	fwRefContainer<UvTcpServerStream> stream(new UvTcpServerStream(this));
 	clientHandle->data = stream.GetRef();
 
 	// attempt accepting the connection
-	if (stream->Accept(std::move(clientHandle)))
+	if (stream->Accept(std::move(clientHandle), listener))
 	{
-		m_clients.insert(stream);
+		{
+			std::unique_lock<std::mutex> lock(m_clientsMutex);
+			m_clients.insert(stream);
+		}
 		
 		// invoke the connection callback
 		if (GetConnectionCallback())
@@ -114,64 +155,259 @@ void UvTcpServer::OnConnection(int status)
 
 void UvTcpServer::RemoveStream(UvTcpServerStream* stream)
 {
-	m_clients.erase(stream);
+	// keep the stream referenced until we've left the lock, as it may be freed by erasing it
+	fwRefContainer<UvTcpServerStream> streamRef = stream;
+
+	std::unique_lock<std::mutex> lock(m_clientsMutex);
+	m_clients.erase(streamRef);
 }
 
 UvTcpServerStream::UvTcpServerStream(UvTcpServer* server)
-	: m_server(server)
+	: m_server(server), m_flushScheduled(false), m_pendingWriteSize(0), m_activeWrites(0), m_closing(false), m_idleTimeout(0),
+	  m_readPaused(false), m_refCount(0)
 {
+	m_idleEntry.SetCallback([=] ()
+	{
+		OnTimeout("idle");
+	});
+
+	m_deadlineEntry.SetCallback([=] ()
+	{
+		OnTimeout("deadline");
+	});
 
 }
 
 UvTcpServerStream::~UvTcpServerStream()
 {
-	CloseClient();
+	// writes in flight hold a reference, so there's nothing left to send by now
+	CloseClient(false);
 }
 
-void UvTcpServerStream::CloseClient()
+void UvTcpServerStream::AddRef()
 {
-	if (m_client.get())
+	m_refCount++;
+}
+
+bool UvTcpServerStream::Release()
+{
+	if (m_refCount.fetch_sub(1) > 1)
 	{
+		return false;
+	}
+
+	if (m_loop.GetRef() && !m_loop->IsOnLoopThread())
+	{
+		UvTcpServerStream* stream = this;
+
+		m_loop->Post([stream] ()
+		{
+			delete stream;
+		});
+	}
+	else
+	{
+		delete this;
+	}
+
+	return true;
+}
+
+void UvTcpServerStream::CloseClient(bool graceful)
+{
+	if (!m_client.get())
+	{
+		return;
+	}
+
+	if (!m_closing)
+	{
+		m_closing = true;
+
 		uv_read_stop(reinterpret_cast<uv_stream_t*>(m_client.get()));
 
-		UvClose(std::move(m_client));
+		// queue any coalesced writes before the handle goes away
+		if (graceful)
+		{
+			FlushWrites();
+		}
+		else
+		{
+			DropPendingWrites();
+		}
+
+		m_loop->GetTimingWheel()->Cancel(&m_idleEntry);
+		m_loop->GetTimingWheel()->Cancel(&m_deadlineEntry);
+
+		// uv_close would cancel the writes still in flight, so the handle gets closed once the last one completes - a
+		// peer that stops reading gets some time for that, and is cut off after
+		if (graceful && m_activeWrites > 0)
+		{
+			m_loop->GetTimingWheel()->Schedule(&m_deadlineEntry, kCloseLingerTimeout);
+			return;
+		}
 	}
+	else if (graceful)
+	{
+		// already waiting for the writes
+		return;
+	}
+
+	CloseHandle();
 }
 
-bool UvTcpServerStream::Accept(std::unique_ptr<uv_tcp_t>&& client)
+void UvTcpServerStream::CloseHandle()
+{
+	m_loop->GetTimingWheel()->Cancel(&m_deadlineEntry);
+
+	UvClose(std::move(m_client));
+
+	if (m_metrics)
+	{
+		m_metrics->connectionsOpen.Add(-1);
+	}
+}
+
+bool UvTcpServerStream::Accept(std::unique_ptr<uv_tcp_t>&& client, uv_stream_t* listener)
 {
 	m_client = std::move(client);
+	m_loop = reinterpret_cast<UvLoopHolder*>(listener->loop->data);
 
-	int result = uv_accept(reinterpret_cast<uv_stream_t*>(m_server->GetServer()),
-						   reinterpret_cast<uv_stream_t*>(m_client.get()));
+	int result = uv_accept(listener, reinterpret_cast<uv_stream_t*>(m_client.get()));
 
 	if (result == 0)
 	{
-		uv_read_start(reinterpret_cast<uv_stream_t*>(m_client.get()), [] (uv_handle_t* handle, size_t suggestedSize, uv_buf_t* buf)
+		StartReading();
+
+		m_metrics = m_server->GetManager()->GetMetrics();
+
+		if (m_metrics)
 		{
-			UvTcpServerStream* stream = reinterpret_cast<UvTcpServerStream*>(handle->data);
+			m_metrics->connectionsAccepted.Add();
+			m_metrics->connectionsOpen.Add(1);
+		}
 
-			auto& readBuffer = stream->GetReadBuffer();
-			readBuffer.resize(suggestedSize);
+		// until the first read, the idle timeout is the first-byte timeout
+		TcpServerManager* manager = m_server->GetManager();
+		m_idleTimeout = manager->GetIdleTimeout();
 
-			buf->base = &readBuffer[0];
-			buf->len = suggestedSize;
-		}, UvCallback<uv_stream_t, UvTcpServerStream, ssize_t, const uv_buf_t*, &UvTcpServerStream::HandleRead>);
+		if (manager->GetFirstByteTimeout() > 0)
+		{
+			m_loop->GetTimingWheel()->Schedule(&m_idleEntry, manager->GetFirstByteTimeout());
+		}
+		else if (m_idleTimeout > 0)
+		{
+			m_loop->GetTimingWheel()->Schedule(&m_idleEntry, m_idleTimeout);
+		}
 	}
 
 	return (result == 0);
 }
 
+void UvTcpServerStream::StartReading()
+{
+	uv_read_start(reinterpret_cast<uv_stream_t*>(m_client.get()), [] (uv_handle_t* handle, size_t suggestedSize, uv_buf_t* buf)
+	{
+		UvTcpServerStream* stream = reinterpret_cast<UvTcpServerStream*>(handle->data);
+
+		stream->AllocateRead(buf);
+	}, UvCallback<uv_stream_t, UvTcpServerStream, ssize_t, const uv_buf_t*, &UvTcpServerStream::HandleRead>);
+}
+
+void UvTcpServerStream::PauseReading()
+{
+	if (!m_loop->IsOnLoopThread())
+	{
+		fwRefContainer<UvTcpServerStream> thisRef = this;
+
+		m_loop->Post([=] ()
+		{
+			thisRef->PauseReading();
+		});
+
+		return;
+	}
+
+	if (m_readPaused || !m_client.get())
+	{
+		return;
+	}
+
+	m_readPaused = true;
+
+	uv_read_stop(reinterpret_cast<uv_stream_t*>(m_client.get()));
+
+	// the peer isn't idle, we're just not listening
+	m_loop->GetTimingWheel()->Cancel(&m_idleEntry);
+}
+
+void UvTcpServerStream::ResumeReading()
+{
+	if (!m_loop->IsOnLoopThread())
+	{
+		fwRefContainer<UvTcpServerStream> thisRef = this;
+
+		m_loop->Post([=] ()
+		{
+			thisRef->ResumeReading();
+		});
+
+		return;
+	}
+
+	if (!m_readPaused || !m_client.get() || m_closing)
+	{
+		return;
+	}
+
+	m_readPaused = false;
+
+	StartReading();
+
+	if (m_idleTimeout > 0)
+	{
+		m_loop->GetTimingWheel()->Schedule(&m_idleEntry, m_idleTimeout);
+	}
+}
+
+void UvTcpServerStream::AllocateRead(uv_buf_t* buf)
+{
+	// take a slab from the pool - it's released again once the read has been dispatched, so idle
+	// streams don't hold on to any read memory
+	if (!m_readSlab.GetRef())
+	{
+		m_readSlab = BufferPool::GetReadPool()->Acquire();
+	}
+
+	buf->base = reinterpret_cast<char*>(m_readSlab->GetData());
+	buf->len = m_readSlab->GetSize();
+}
+
 void UvTcpServerStream::HandleRead(ssize_t nread, const uv_buf_t* buf)
 {
+	// take ownership of the slab - if nobody retains a view of it, it goes back to the pool at the end of this scope
+	fwRefContainer<PooledBuffer> readSlab = m_readSlab;
+	m_readSlab = nullptr;
+
 	if (nread > 0)
 	{
-		std::vector<uint8_t> targetBuf(nread);
-		memcpy(&targetBuf[0], buf->base, targetBuf.size());
+		if (m_metrics)
+		{
+			m_metrics->bytesReceived.Add(nread);
+		}
+		// push back the idle timeout
+		if (m_idleTimeout > 0)
+		{
+			m_loop->GetTimingWheel()->Schedule(&m_idleEntry, m_idleTimeout);
+		}
+		else
+		{
+			m_loop->GetTimingWheel()->Cancel(&m_idleEntry);
+		}
 
-		if (GetReadCallback())
+		if (HasReadCallback() && readSlab.GetRef())
 		{
-			GetReadCallback()(targetBuf);
+			DispatchRead(BufferView(readSlab, 0, nread));
 		}
 	}
 	else if (nread < 0)
@@ -181,6 +417,8 @@ void UvTcpServerStream::HandleRead(ssize_t nread, const uv_buf_t* buf)
 
 		trace("read error: %s\n", uv_strerror(nread));
 
+		// the peer is gone, so there's no point in finishing any writes
+		CloseClient(false);
 		Close();
 	}
 }
@@ -197,37 +435,285 @@ PeerAddress UvTcpServerStream::GetPeerAddress()
 
 void UvTcpServerStream::Write(const std::vector<uint8_t>& data)
 {
-	// write request structure
-	struct UvWriteReq
+	Write(std::vector<uint8_t>(data));
+}
+
+void UvTcpServerStream::Write(std::vector<uint8_t>&& data)
+{
+	if (data.empty())
 	{
-		std::vector<uint8_t> sendData;
-		uv_buf_t buffer;
-		uv_write_t write;
+		return;
+	}
 
-		fwRefContainer<UvTcpServerStream> stream;
-	};
+	// writes from other threads get dispatched to the owning loop
+	if (!m_loop->IsOnLoopThread())
+	{
+		fwRefContainer<UvTcpServerStream> thisRef = this;
+		auto dataRef = std::make_shared<std::vector<uint8_t>>(std::move(data));
+
+		size_t size = dataRef->size();
+
+		// counted right away, so IsAboveHighWaterMark sees it - the water mark callbacks only run on the loop, though
+		m_pendingWriteSize += size;
+
+		m_loop->Post([=] ()
+		{
+			thisRef->EnqueueWrite(std::move(*dataRef));
+			thisRef->ReleasePendingWriteSize(size);
+		});
+
+		return;
+	}
+
+	EnqueueWrite(std::move(data));
+}
+
+void UvTcpServerStream::WriteV(std::vector<std::vector<uint8_t>>&& buffers)
+{
+	if (!m_loop->IsOnLoopThread())
+	{
+		fwRefContainer<UvTcpServerStream> thisRef = this;
+		auto buffersRef = std::make_shared<std::vector<std::vector<uint8_t>>>(std::move(buffers));
+
+		size_t size = 0;
+
+		for (auto& buffer : *buffersRef)
+		{
+			size += buffer.size();
+		}
+
+		m_pendingWriteSize += size;
+
+		m_loop->Post([=] ()
+		{
+			thisRef->WriteV(std::move(*buffersRef));
+			thisRef->ReleasePendingWriteSize(size);
+		});
+
+		return;
+	}
+
+	for (auto& buffer : buffers)
+	{
+		if (!buffer.empty())
+		{
+			EnqueueWrite(std::move(buffer));
+		}
+	}
+}
+
+void UvTcpServerStream::SetIdleTimeout(uint32_t timeoutMs)
+{
+	fwRefContainer<UvTcpServerStream> thisRef = this;
 
-	// prepare a write request
-	UvWriteReq* writeReq = new UvWriteReq;
-	writeReq->sendData = data;
-	writeReq->buffer.base = reinterpret_cast<char*>(&writeReq->sendData[0]);
-	writeReq->buffer.len = writeReq->sendData.size();
+	if (!m_loop->IsOnLoopThread())
+	{
+		m_loop->Post([=] ()
+		{
+			thisRef->SetIdleTimeout(timeoutMs);
+		});
+
+		return;
+	}
+
+	m_idleTimeout = timeoutMs;
+
+	// closed streams shouldn't get rescheduled, and paused ones only once they resume
+	if (timeoutMs > 0 && m_client.get() && !m_readPaused && !m_closing)
+	{
+		m_loop->GetTimingWheel()->Schedule(&m_idleEntry, timeoutMs);
+	}
+	else
+	{
+		m_loop->GetTimingWheel()->Cancel(&m_idleEntry);
+	}
+}
+
+uint32_t UvTcpServerStream::GetIdleTimeout()
+{
+	return m_idleTimeout;
+}
+
+void UvTcpServerStream::SetDeadline(uint32_t timeoutMs)
+{
+	fwRefContainer<UvTcpServerStream> thisRef = this;
+
+	if (!m_loop->IsOnLoopThread())
+	{
+		m_loop->Post([=] ()
+		{
+			thisRef->SetDeadline(timeoutMs);
+		});
+
+		return;
+	}
+
+	// a closing stream's deadline is the one limiting how long it lingers
+	if (m_closing)
+	{
+		return;
+	}
+
+	if (timeoutMs > 0 && m_client.get())
+	{
+		m_loop->GetTimingWheel()->Schedule(&m_deadlineEntry, timeoutMs);
+	}
+	else
+	{
+		m_loop->GetTimingWheel()->Cancel(&m_deadlineEntry);
+	}
+}
+
+void UvTcpServerStream::ScheduleCallback(const TScheduledCallback& callback)
+{
+	m_loop->Post(callback);
+}
+
+void UvTcpServerStream::OnTimeout(const char* type)
+{
+	trace("closing connection from %s - %s timeout expired\n", GetPeerAddress().ToString().c_str(), type);
+
+	// don't wait for any writes to finish
+	CloseClient(false);
+	Close();
+}
+
+size_t UvTcpServerStream::GetPendingWriteSize()
+{
+	return m_pendingWriteSize;
+}
+
+void UvTcpServerStream::EnqueueWrite(std::vector<uint8_t>&& data)
+{
+	// the stream may have been closed in the meantime
+	if (!m_client.get() || m_closing)
+	{
+		return;
+	}
+
+	m_pendingWriteSize += data.size();
+
+	m_pendingWrites.push_back(std::move(data));
+
+	// coalesce everything written during this loop iteration into a single write
+	if (!m_flushScheduled)
+	{
+		m_flushScheduled = true;
+
+		fwRefContainer<UvTcpServerStream> thisRef = this;
+
+		m_loop->Defer([=] ()
+		{
+			thisRef->FlushWrites();
+		});
+	}
+
+	UpdatePendingWriteSize(m_pendingWriteSize);
+}
+
+void UvTcpServerStream::FlushWrites()
+{
+	m_flushScheduled = false;
+
+	if (m_pendingWrites.empty())
+	{
+		return;
+	}
+
+	// the stream may have been closed in the meantime
+	if (!m_client.get())
+	{
+		DropPendingWrites();
+		return;
+	}
+
+	// prepare a write request - the pooled request keeps the capacity of its vectors, so swapping
+	// leaves us with a preallocated queue for the next iteration
+	UvWriteReq* writeReq = m_loop->GetPool<UvWriteReq>()->Acquire();
+	writeReq->sendData.swap(m_pendingWrites);
+	writeReq->buffers.resize(writeReq->sendData.size());
+	writeReq->size = 0;
 	writeReq->stream = this;
-	
+
+	for (size_t i = 0; i < writeReq->sendData.size(); i++)
+	{
+		auto& data = writeReq->sendData[i];
+
+		writeReq->buffers[i] = uv_buf_init(reinterpret_cast<char*>(&data[0]), data.size());
+		writeReq->size += data.size();
+	}
+
 	writeReq->write.data = writeReq;
 
+	m_activeWrites++;
+
 	// send the write request
-	uv_write(&writeReq->write, reinterpret_cast<uv_stream_t*>(m_client.get()), &writeReq->buffer, 1, [] (uv_write_t* write, int status)
+	int result = uv_write(&writeReq->write, reinterpret_cast<uv_stream_t*>(m_client.get()), &writeReq->buffers[0], writeReq->buffers.size(), [] (uv_write_t* write, int status)
 	{
 		UvWriteReq* req = reinterpret_cast<UvWriteReq*>(write->data);
 
-		if (status < 0)
+		if (status < 0 && status != UV_ECANCELED)
 		{
 			trace("write to %s failed - %s\n", req->stream->GetPeerAddress().ToString().c_str(), uv_strerror(status));
 		}
 
-		delete req;
+		req->stream->OnWriteCompleted(req->size, (status == 0));
+
+		FreeWriteReq(req);
 	});
+
+	if (result < 0)
+	{
+		OnWriteCompleted(writeReq->size, false);
+
+		FreeWriteReq(writeReq);
+	}
+}
+
+void UvTcpServerStream::DropPendingWrites()
+{
+	size_t size = 0;
+
+	for (auto& data : m_pendingWrites)
+	{
+		size += data.size();
+	}
+
+	m_pendingWrites.clear();
+
+	// writes from other threads may still be counted, so only what got dropped here gets taken off
+	ReleasePendingWriteSize(size);
+}
+
+void UvTcpServerStream::ReleasePendingWriteSize(size_t size)
+{
+	size_t pendingSize = m_pendingWriteSize;
+
+	// an accounting mistake shouldn't wrap around, leaving the stream above its high water mark for good
+	while (!m_pendingWriteSize.compare_exchange_weak(pendingSize, (pendingSize > size) ? pendingSize - size : 0))
+	{
+
+	}
+
+	UpdatePendingWriteSize(m_pendingWriteSize);
+}
+
+void UvTcpServerStream::OnWriteCompleted(size_t size, bool sent)
+{
+	m_activeWrites--;
+
+	if (sent && m_metrics)
+	{
+		m_metrics->bytesSent.Add(size);
+	}
+
+	ReleasePendingWriteSize(size);
+
+	// the stream got closed while this was in flight
+	if (m_activeWrites == 0 && m_closing && m_client.get())
+	{
+		CloseHandle();
+	}
 }
 
 void UvTcpServerStream::Close()
@@ -235,7 +721,18 @@ void UvTcpServerStream::Close()
 	// keep a reference in scope
 	fwRefContainer<UvTcpServerStream> selfRef = this;
 
-	CloseClient();
+	// closing also has to happen on the owning loop
+	if (m_loop.GetRef() && !m_loop->IsOnLoopThread())
+	{
+		m_loop->Post([=] ()
+		{
+			selfRef->Close();
+		});
+
+		return;
+	}
+
+	CloseClient(true);
 
 	SetReadCallback(TReadCallback());
 
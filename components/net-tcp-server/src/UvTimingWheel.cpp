@@ -0,0 +1,173 @@
+/*
+ * This file is part of the CitizenFX project - http://citizen.re/
+ *
+ * See LICENSE and MENTIONS in the root of the source tree for information
+ * regarding licensing.
+ */
+
+#include "StdInc.h"
+#include "UvTimingWheel.h"
+#include "memdbgon.h"
+
+namespace net
+{
+UvTimingWheelEntry::UvTimingWheelEntry()
+	: m_wheel(nullptr), m_prev(nullptr), m_next(nullptr), m_rounds(0)
+{
+
+}
+
+UvTimingWheelEntry::~UvTimingWheelEntry()
+{
+	// through the wheel, so it stops counting the entry - the wheel's own sentinels aren't scheduled on it
+	if (IsScheduled() && m_wheel)
+	{
+		m_wheel->Cancel(this);
+	}
+}
+
+void UvTimingWheelEntry::Unlink()
+{
+	if (m_next)
+	{
+		m_prev->m_next = m_next;
+		m_next->m_prev = m_prev;
+
+		m_prev = nullptr;
+		m_next = nullptr;
+	}
+}
+
+void UvTimingWheelEntry::LinkAfter(UvTimingWheelEntry* entry)
+{
+	m_prev = entry;
+	m_next = entry->m_next;
+
+	m_next->m_prev = this;
+	entry->m_next = this;
+}
+
+UvTimingWheel::UvTimingWheel(uv_loop_t* loop, uint32_t tickMs, size_t slotCount)
+	: m_slots(slotCount), m_currentSlot(0), m_tickMs(tickMs), m_scheduledCount(0)
+{
+	// every slot starts out as an empty circular list
+	for (auto& slot : m_slots)
+	{
+		slot.m_prev = &slot;
+		slot.m_next = &slot;
+	}
+
+	uv_timer_init(loop, &m_timer);
+	m_timer.data = this;
+}
+
+UvTimingWheel::~UvTimingWheel()
+{
+	// unlink any remaining entries, so they don't point into freed slots
+	for (auto& slot : m_slots)
+	{
+		while (slot.m_next != &slot)
+		{
+			slot.m_next->Unlink();
+		}
+
+		slot.m_prev = nullptr;
+		slot.m_next = nullptr;
+	}
+}
+
+void UvTimingWheel::Close()
+{
+	uv_close(reinterpret_cast<uv_handle_t*>(&m_timer), nullptr);
+}
+
+void UvTimingWheel::Schedule(UvTimingWheelEntry* entry, uint32_t timeoutMs)
+{
+	if (entry->IsScheduled())
+	{
+		entry->Unlink();
+		m_scheduledCount--;
+	}
+
+	// as the current slot has already been processed, an entry for the next tick goes into the next slot
+	size_t ticks = std::max<size_t>((timeoutMs + m_tickMs - 1) / m_tickMs, 1);
+
+	entry->m_wheel = this;
+	entry->m_rounds = static_cast<uint32_t>((ticks - 1) / m_slots.size());
+	entry->LinkAfter(&m_slots[(m_currentSlot + ticks) % m_slots.size()]);
+
+	// only keep the tick timer running while there's anything to expire
+	if (m_scheduledCount++ == 0)
+	{
+		uv_timer_start(&m_timer, [] (uv_timer_t* timer)
+		{
+			reinterpret_cast<UvTimingWheel*>(timer->data)->Tick();
+		}, m_tickMs, m_tickMs);
+	}
+}
+
+void UvTimingWheel::Cancel(UvTimingWheelEntry* entry)
+{
+	if (entry->IsScheduled())
+	{
+		entry->Unlink();
+
+		if (--m_scheduledCount == 0)
+		{
+			uv_timer_stop(&m_timer);
+		}
+	}
+}
+
+void UvTimingWheel::Tick()
+{
+	m_currentSlot = (m_currentSlot + 1) % m_slots.size();
+
+	// move the slot's entries to a local list first, as callbacks may schedule or cancel arbitrary entries
+	UvTimingWheelEntry expiring;
+	UvTimingWheelEntry* slot = &m_slots[m_currentSlot];
+
+	if (slot->m_next == slot)
+	{
+		return;
+	}
+
+	expiring.m_next = slot->m_next;
+	expiring.m_prev = slot->m_prev;
+	expiring.m_next->m_prev = &expiring;
+	expiring.m_prev->m_next = &expiring;
+
+	slot->m_next = slot;
+	slot->m_prev = slot;
+
+	while (expiring.m_next != &expiring)
+	{
+		UvTimingWheelEntry* entry = expiring.m_next;
+		entry->Unlink();
+
+		// entries further out go back for another revolution
+		if (entry->m_rounds > 0)
+		{
+			entry->m_rounds--;
+			entry->LinkAfter(slot);
+
+			continue;
+		}
+
+		m_scheduledCount--;
+
+		// copy the callback, as invoking it may well free the entry
+		auto callback = entry->m_callback;
+
+		if (callback)
+		{
+			callback();
+		}
+	}
+
+	if (m_scheduledCount == 0)
+	{
+		uv_timer_stop(&m_timer);
+	}
+}
+}
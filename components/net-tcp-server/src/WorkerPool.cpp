@@ -0,0 +1,134 @@
+/*
+ * This file is part of the CitizenFX project - http://citizen.re/
+ *
+ * See LICENSE and MENTIONS in the root of the source tree for information
+ * regarding licensing.
+ */
+
+#include "StdInc.h"
+#include "WorkerPool.h"
+#include "memdbgon.h"
+
+namespace net
+{
+WorkerPool::WorkerPool(int threadCount)
+	: m_shouldExit(false)
+{
+	if (threadCount <= 0)
+	{
+		threadCount = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	}
+
+	for (int i = 0; i < threadCount; i++)
+	{
+		m_threads.emplace_back([=] ()
+		{
+			ThreadMain();
+		});
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_shouldExit = true;
+	}
+
+	m_condition.notify_all();
+
+	for (auto& thread : m_threads)
+	{
+		thread.join();
+	}
+}
+
+void WorkerPool::ThreadMain()
+{
+	while (true)
+	{
+		std::function<void()> task;
+
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+
+			m_condition.wait(lock, [=] ()
+			{
+				return (m_shouldExit || !m_tasks.empty());
+			});
+
+			if (m_tasks.empty())
+			{
+				return;
+			}
+
+			task = std::move(m_tasks.front());
+			m_tasks.pop_front();
+		}
+
+		task();
+	}
+}
+
+void WorkerPool::Post(std::function<void()> task)
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_tasks.push_back(std::move(task));
+	}
+
+	m_condition.notify_one();
+}
+
+WorkerStrand::WorkerStrand(const fwRefContainer<WorkerPool>& pool)
+	: m_pool(pool), m_running(false)
+{
+
+}
+
+void WorkerStrand::Post(std::function<void()> task)
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_tasks.push_back(std::move(task));
+
+		// if a worker is already running our tasks, it'll pick this one up as well
+		if (m_running)
+		{
+			return;
+		}
+
+		m_running = true;
+	}
+
+	fwRefContainer<WorkerStrand> thisRef = this;
+
+	m_pool->Post([=] ()
+	{
+		thisRef->RunTasks();
+	});
+}
+
+void WorkerStrand::RunTasks()
+{
+	while (true)
+	{
+		std::function<void()> task;
+
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+
+			if (m_tasks.empty())
+			{
+				m_running = false;
+				return;
+			}
+
+			task = std::move(m_tasks.front());
+			m_tasks.pop_front();
+		}
+
+		task();
+	}
+}
+}
@@ -64,6 +64,9 @@ public:
 
 	virtual size_t GetLength(const std::string& fileName);
 
+	// gets a hex-encoded SHA1 hash of the file's contents, if the device knows it without having to read the file
+	virtual bool GetContentHash(const std::string& fileName, std::string* hashString);
+
 	virtual THandle FindFirst(const std::string& folder, FindData* findData) = 0;
 
 	virtual bool FindNext(THandle handle, FindData* findData) = 0;
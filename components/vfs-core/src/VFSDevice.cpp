@@ -84,6 +84,11 @@ size_t Device::GetLength(THandle handle)
 	return retval;
 }
 
+bool Device::GetContentHash(const std::string& fileName, std::string* hashString)
+{
+	return false;
+}
+
 void Device::SetPathPrefix(const std::string& pathPrefix)
 {
 
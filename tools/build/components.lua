@@ -348,6 +348,31 @@ local do_component = function(name, comp)
 
 	links { "Shared", "CitiCore", "gmock_main", "gtest_main", name }
 
+	-- tests may use the component's dependencies directly, too
+	for dep, data in pairs(hasDeps) do
+		configuration {}
+
+		if not data.vendor or not data.vendor.dummy then
+			links { dep }
+		end
+
+		if data.vendor then
+			if data.vendor.include then
+				data.vendor.include()
+			end
+
+			configuration {}
+
+			if data.vendor.depend then
+				data.vendor.depend()
+			end
+		else
+			includedirs { 'components/' .. dep .. '/include/' }
+		end
+	end
+
+	configuration {}
+
 	pchsource "client/common/StdInc.cpp"
 	pchheader "StdInc.h"
 end